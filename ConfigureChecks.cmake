@@ -53,6 +53,7 @@ check_include_file(shadow.h HAVE_SHADOW_H)
 check_include_file(grp.h HAVE_GRP_H)
 check_include_file(nss.h HAVE_NSS_H)
 check_include_file(nss_common.h HAVE_NSS_COMMON_H)
+check_include_file(gnu/lib-names.h HAVE_GNU_LIB_NAMES_H)
 
 # FUNCTIONS
 check_function_exists(strncpy HAVE_STRNCPY)
@@ -65,6 +66,8 @@ check_function_exists(getpwent_r HAVE_GETPWENT_R)
 
 check_function_exists(setspent HAVE_SETSPENT)
 check_function_exists(getspnam HAVE_GETSPNAM)
+check_function_exists(getspnam_r HAVE_GETSPNAM_R)
+check_function_exists(getspent_r HAVE_GETSPENT_R)
 
 check_function_exists(getgrnam_r HAVE_GETGRNAM_R)
 check_function_exists(getgrgid_r HAVE_GETGRGID_R)
@@ -77,6 +80,18 @@ check_function_exists(gethostbyname_r HAVE_GETHOSTBYNAME_R)
 
 check_function_exists(gethostbyname2 HAVE_GETHOSTBYNAME2)
 
+check_function_exists(innetgr HAVE_INNETGR)
+check_function_exists(getnetgrent_r HAVE_GETNETGRENT_R)
+
+# glibc before 2.34 has getaddrinfo_a() in libanl
+check_function_exists(getaddrinfo_a HAVE_GETADDRINFO_A)
+if (NOT HAVE_GETADDRINFO_A)
+    check_library_exists(anl getaddrinfo_a "" HAVE_LIBANL)
+    if (HAVE_LIBANL)
+        set(HAVE_GETADDRINFO_A 1)
+    endif (HAVE_LIBANL)
+endif (NOT HAVE_GETADDRINFO_A)
+
 if (WIN32)
     check_function_exists(_vsnprintf_s HAVE__VSNPRINTF_S)
     check_function_exists(_vsnprintf HAVE__VSNPRINTF)
@@ -177,6 +192,12 @@ check_prototype_definition(setgrent
     "unistd.h;grp.h"
     HAVE_BSD_SETGRENT)
 
+check_prototype_definition(setnetgrent
+    "void setnetgrent(const char *netgroup)"
+    ""
+    "unistd.h;netdb.h"
+    HAVE_BSD_SETNETGRENT)
+
 check_prototype_definition(getnameinfo
     "int getnameinfo (const struct sockaddr *sa, socklen_t salen, char *host, socklen_t __hostlen, char *serv, socklen_t servlen, int flags)"
     "-1"
@@ -191,6 +212,7 @@ check_prototype_definition(getnameinfo
 
 # STRUCT MEMBERS
 check_struct_has_member("struct sockaddr" sa_len "sys/socket.h netinet/in.h" HAVE_STRUCT_SOCKADDR_SA_LEN)
+check_struct_has_member("struct stat" st_mtim "sys/stat.h" HAVE_STRUCT_STAT_ST_MTIM)
 
 # IPV6
 check_c_source_compiles("
@@ -249,6 +271,11 @@ if (HAVE_LIBDL)
     set(CMAKE_REQUIRED_LIBRARIES ${CMAKE_REQUIRED_LIBRARIES} ${DLFCN_LIBRARY})
 endif (HAVE_LIBDL)
 
+# The call site profiler
+check_include_file(execinfo.h HAVE_EXECINFO_H)
+check_function_exists(backtrace HAVE_BACKTRACE)
+check_function_exists(dladdr HAVE_DLADDR)
+
 # ENDIAN
 if (NOT WIN32)
     test_big_endian(WORDS_BIGENDIAN)
@@ -1 +1,2 @@
 option(UNIT_TESTING "Build with unit tests" OFF)
+option(THREAD_SANITIZER "Build with the thread sanitizer to check the locking" OFF)
@@ -20,6 +20,8 @@
 #cmakedefine HAVE_GRP_H 1
 #cmakedefine HAVE_NSS_H 1
 #cmakedefine HAVE_NSS_COMMON_H 1
+#cmakedefine HAVE_GNU_LIB_NAMES_H 1
+#cmakedefine HAVE_EXECINFO_H 1
 
 /*************************** FUNCTIONS ***************************/
 
@@ -38,6 +40,12 @@
 /* Define to 1 if you have the `getspnam' function. */
 #cmakedefine HAVE_GETSPNAM 1
 
+/* Define to 1 if you have the `getspnam_r' function. */
+#cmakedefine HAVE_GETSPNAM_R 1
+
+/* Define to 1 if you have the `getspent_r' function. */
+#cmakedefine HAVE_GETSPENT_R 1
+
 /* Define to 1 if you have the `getgrnam_r' function. */
 #cmakedefine HAVE_GETGRNAM_R 1
 
@@ -59,6 +67,21 @@
 /* Define to 1 if you have the `gethostbyname2' function. */
 #cmakedefine HAVE_GETHOSTBYNAME2 1
 
+/* Define to 1 if you have the `innetgr' function. */
+#cmakedefine HAVE_INNETGR 1
+
+/* Define to 1 if you have the `getnetgrent_r' function. */
+#cmakedefine HAVE_GETNETGRENT_R 1
+
+/* Define to 1 if you have the `getaddrinfo_a' function. */
+#cmakedefine HAVE_GETADDRINFO_A 1
+
+/* Define to 1 if you have the `backtrace' function. */
+#cmakedefine HAVE_BACKTRACE 1
+
+/* Define to 1 if you have the `dladdr' function. */
+#cmakedefine HAVE_DLADDR 1
+
 #cmakedefine HAVE___POSIX_GETPWNAM_R 1
 #cmakedefine HAVE___POSIX_GETPWUID_R 1
 
@@ -69,6 +92,7 @@
 
 #cmakedefine HAVE_LIBNSL 1
 #cmakedefine HAVE_LIBSOCKET 1
+#cmakedefine HAVE_LIBANL 1
 
 /**************************** OPTIONS ****************************/
 
@@ -82,10 +106,12 @@
 #cmakedefine HAVE_SOLARIS_ENDHOSTENT 1
 #cmakedefine HAVE_SOLARIS_GETHOSTNAME 1
 #cmakedefine HAVE_BSD_SETGRENT 1
+#cmakedefine HAVE_BSD_SETNETGRENT 1
 #cmakedefine HAVE_LINUX_GETNAMEINFO 1
 #cmakedefine HAVE_LINUX_GETNAMEINFO_UNSIGNED 1
 
 #cmakedefine HAVE_STRUCT_SOCKADDR_SA_LEN 1
+#cmakedefine HAVE_STRUCT_STAT_ST_MTIM 1
 #cmakedefine HAVE_IPV6 1
 
 #cmakedefine HAVE_ATTRIBUTE_PRINTF_FORMAT 1
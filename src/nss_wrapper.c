@@ -43,20 +43,31 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <time.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <signal.h>
+#include <dirent.h>
 
 #include <netinet/in.h>
 
-#include <search.h>
 #include <assert.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 /*
  * Defining _POSIX_PTHREAD_SEMANTICS before including pwd.h and grp.h  gives us
  * the posix getpwnam_r(), getpwuid_r(), getgrnam_r and getgrgid_r calls on
@@ -77,6 +88,15 @@
 #include <netinet/in.h>
 
 #include <dlfcn.h>
+#ifdef HAVE_EXECINFO_H
+#include <execinfo.h>
+#endif
+#ifdef HAVE_GNU_LIB_NAMES_H
+/* The sonames of libc, libnsl and libanl on glibc */
+#include <gnu/lib-names.h>
+#endif
+
+#include "nss_wrapper_trace.h"
 
 #if defined(HAVE_NSS_H)
 /* Linux and some BSDs. Not OpenBSD nor OS X (Darwin) */
@@ -148,12 +168,31 @@ typedef nss_status_t NSS_STATUS;
 #define DESTRUCTOR_ATTRIBUTE
 #endif /* HAVE_DESTRUCTOR_ATTRIBUTE */
 
+#if defined(__SANITIZE_THREAD__)
+#define NWRAP_THREAD_SANITIZER 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define NWRAP_THREAD_SANITIZER 1
+#endif
+#endif
+
+/* Code which runs before the thread sanitizer runtime is initialized */
+#ifdef NWRAP_THREAD_SANITIZER
+#define NWRAP_NO_SANITIZE_THREAD __attribute__ ((no_sanitize_thread))
+#else
+#define NWRAP_NO_SANITIZE_THREAD
+#endif
+
 #define ZERO_STRUCTP(x) do { if ((x) != NULL) memset((char *)(x), 0, sizeof(*(x))); } while(0)
 
 #ifndef SAFE_FREE
 #define SAFE_FREE(x) do { if ((x) != NULL) {free(x); (x)=NULL;} } while(0)
 #endif
 
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
 #ifdef HAVE_IPV6
 #define NWRAP_INET_ADDRSTRLEN INET6_ADDRSTRLEN
 #else
@@ -168,16 +207,42 @@ typedef nss_status_t NSS_STATUS;
 	pthread_mutex_unlock(&( m ## _mutex)); \
 } while(0)
 
+/* The lookups share the databases, see nwrap_files_cache_rdlock() */
+#define NWRAP_WRLOCK(m) do { \
+	pthread_rwlock_wrlock(&( m ## _rwlock)); \
+} while(0)
+
+#define NWRAP_RWUNLOCK(m) do { \
+	pthread_rwlock_unlock(&( m ## _rwlock)); \
+} while(0)
+
+/*
+ * A write locked rwlock belongs to the thread id of its owner, which is a
+ * different one in the child. The child is the only thread, so it starts
+ * with new ones.
+ */
+#define NWRAP_RWLOCK_REINIT(m) do { \
+	pthread_rwlock_init(&( m ## _rwlock), NULL); \
+} while(0)
+
 
 static bool nwrap_initialized = false;
 static pthread_mutex_t nwrap_initialized_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Set once nwrap_init() is complete, hot wrappers check it without a lock */
+static bool nwrap_init_done = false;
 
 /* The mutex or accessing the id */
 static pthread_mutex_t nwrap_global_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t nwrap_gr_global_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t nwrap_he_global_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t nwrap_pw_global_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t nwrap_sp_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_rwlock_t nwrap_gr_global_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t nwrap_he_global_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t nwrap_pw_global_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t nwrap_sp_global_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t nwrap_ng_global_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t nwrap_gai_a_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Held by the reloader thread while it parses, before the database locks */
+static pthread_mutex_t nwrap_reload_global_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Only protects starting the reloader thread, taken last */
+static pthread_mutex_t nwrap_reload_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 /* Add new global locks here please */
 /* Also don't forget to add locks to
@@ -186,17 +251,38 @@ static pthread_mutex_t nwrap_sp_global_mutex = PTHREAD_MUTEX_INITIALIZER;
 # define NWRAP_LOCK_ALL do { \
 	NWRAP_LOCK(nwrap_initialized); \
 	NWRAP_LOCK(nwrap_global); \
-	NWRAP_LOCK(nwrap_gr_global); \
-	NWRAP_LOCK(nwrap_he_global); \
-	NWRAP_LOCK(nwrap_pw_global); \
-	NWRAP_LOCK(nwrap_sp_global); \
+	NWRAP_LOCK(nwrap_reload_global); \
+	NWRAP_WRLOCK(nwrap_gr_global); \
+	NWRAP_WRLOCK(nwrap_he_global); \
+	NWRAP_WRLOCK(nwrap_pw_global); \
+	NWRAP_WRLOCK(nwrap_sp_global); \
+	NWRAP_WRLOCK(nwrap_ng_global); \
+	NWRAP_LOCK(nwrap_gai_a_global); \
+	NWRAP_LOCK(nwrap_reload_thread); \
 } while (0);
 
 # define NWRAP_UNLOCK_ALL do {\
-	NWRAP_UNLOCK(nwrap_sp_global); \
-	NWRAP_UNLOCK(nwrap_pw_global); \
-	NWRAP_UNLOCK(nwrap_he_global); \
-	NWRAP_UNLOCK(nwrap_gr_global); \
+	NWRAP_UNLOCK(nwrap_reload_thread); \
+	NWRAP_UNLOCK(nwrap_gai_a_global); \
+	NWRAP_RWUNLOCK(nwrap_ng_global); \
+	NWRAP_RWUNLOCK(nwrap_sp_global); \
+	NWRAP_RWUNLOCK(nwrap_pw_global); \
+	NWRAP_RWUNLOCK(nwrap_he_global); \
+	NWRAP_RWUNLOCK(nwrap_gr_global); \
+	NWRAP_UNLOCK(nwrap_reload_global); \
+	NWRAP_UNLOCK(nwrap_global); \
+	NWRAP_UNLOCK(nwrap_initialized); \
+} while (0);
+
+# define NWRAP_UNLOCK_ALL_CHILD do {\
+	NWRAP_UNLOCK(nwrap_reload_thread); \
+	NWRAP_UNLOCK(nwrap_gai_a_global); \
+	NWRAP_RWLOCK_REINIT(nwrap_ng_global); \
+	NWRAP_RWLOCK_REINIT(nwrap_sp_global); \
+	NWRAP_RWLOCK_REINIT(nwrap_pw_global); \
+	NWRAP_RWLOCK_REINIT(nwrap_he_global); \
+	NWRAP_RWLOCK_REINIT(nwrap_gr_global); \
+	NWRAP_UNLOCK(nwrap_reload_global); \
 	NWRAP_UNLOCK(nwrap_global); \
 	NWRAP_UNLOCK(nwrap_initialized); \
 } while (0);
@@ -211,9 +297,16 @@ static void nwrap_thread_parent(void)
 	NWRAP_UNLOCK_ALL;
 }
 
+static void nwrap_gai_a_thread_child(void);
+static void nwrap_trace_thread_child(void);
+static void nwrap_reload_thread_child(void);
+
 static void nwrap_thread_child(void)
 {
-	NWRAP_UNLOCK_ALL;
+	nwrap_gai_a_thread_child();
+	nwrap_trace_thread_child();
+	nwrap_reload_thread_child();
+	NWRAP_UNLOCK_ALL_CHILD;
 }
 
 enum nwrap_dbglvl_e {
@@ -238,40 +331,45 @@ static void nwrap_log(enum nwrap_dbglvl_e dbglvl,
 	va_list va;
 	const char *d;
 	unsigned int lvl = 0;
-	int pid = getpid();
+	int pid;
 
 	d = getenv("NSS_WRAPPER_DEBUGLEVEL");
 	if (d != NULL) {
 		lvl = atoi(d);
 	}
 
+	/* The parsers log every line, don't format what isn't printed */
+	if (lvl < dbglvl) {
+		return;
+	}
+
+	pid = getpid();
+
 	va_start(va, format);
 	vsnprintf(buffer, sizeof(buffer), format, va);
 	va_end(va);
 
-	if (lvl >= dbglvl) {
-		switch (dbglvl) {
-			case NWRAP_LOG_ERROR:
-				fprintf(stderr,
-					"NWRAP_ERROR(%d) - %s: %s\n",
-					pid, func, buffer);
-				break;
-			case NWRAP_LOG_WARN:
-				fprintf(stderr,
-					"NWRAP_WARN(%d) - %s: %s\n",
-					pid, func, buffer);
-				break;
-			case NWRAP_LOG_DEBUG:
-				fprintf(stderr,
-					"NWRAP_DEBUG(%d) - %s: %s\n",
-					pid, func, buffer);
-				break;
-			case NWRAP_LOG_TRACE:
-				fprintf(stderr,
-					"NWRAP_TRACE(%d) - %s: %s\n",
-					pid, func, buffer);
-				break;
-		}
+	switch (dbglvl) {
+		case NWRAP_LOG_ERROR:
+			fprintf(stderr,
+				"NWRAP_ERROR(%d) - %s: %s\n",
+				pid, func, buffer);
+			break;
+		case NWRAP_LOG_WARN:
+			fprintf(stderr,
+				"NWRAP_WARN(%d) - %s: %s\n",
+				pid, func, buffer);
+			break;
+		case NWRAP_LOG_DEBUG:
+			fprintf(stderr,
+				"NWRAP_DEBUG(%d) - %s: %s\n",
+				pid, func, buffer);
+			break;
+		case NWRAP_LOG_TRACE:
+			fprintf(stderr,
+				"NWRAP_TRACE(%d) - %s: %s\n",
+				pid, func, buffer);
+			break;
 	}
 }
 #endif /* NDEBUG NWRAP_LOG */
@@ -357,6 +455,45 @@ typedef	int (*__libc_gethostbyaddr_r)(const void *addr, socklen_t len, int type,
 				      char *buf, size_t buflen,
 				      struct hostent **result, int *h_errnop);
 #endif
+#ifdef HAVE_GETADDRINFO_A
+typedef int (*__libc_getaddrinfo_a)(int mode,
+				    struct gaicb *list[],
+				    int nitems,
+				    struct sigevent *sevp);
+typedef int (*__libc_gai_suspend)(const struct gaicb * const list[],
+				  int nitems,
+				  const struct timespec *timeout);
+typedef int (*__libc_gai_error)(struct gaicb *req);
+typedef int (*__libc_gai_cancel)(struct gaicb *req);
+#endif
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+typedef int (*__libc_getspnam_r)(const char *name, struct spwd *spdst,
+				 char *buf, size_t buflen,
+				 struct spwd **spdstp);
+#endif
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPENT_R)
+typedef int (*__libc_getspent_r)(struct spwd *spdst,
+				 char *buf, size_t buflen,
+				 struct spwd **spdstp);
+#endif
+#ifdef HAVE_INNETGR
+#ifdef HAVE_BSD_SETNETGRENT
+typedef void (*__libc_setnetgrent)(const char *netgroup);
+#else
+typedef int (*__libc_setnetgrent)(const char *netgroup);
+#endif
+typedef int (*__libc_getnetgrent)(char **host, char **user, char **domain);
+#ifdef HAVE_GETNETGRENT_R
+typedef int (*__libc_getnetgrent_r)(char **host, char **user, char **domain,
+				    char *buf, size_t buflen);
+#endif
+typedef void (*__libc_endnetgrent)(void);
+typedef int (*__libc_innetgr)(const char *netgroup,
+			      const char *host,
+			      const char *user,
+			      const char *domain);
+#endif
+typedef long (*__libc_sysconf)(int name);
 
 #define NWRAP_SYMBOL_ENTRY(i) \
         union { \
@@ -415,6 +552,28 @@ struct nwrap_libc_symbols {
 #ifdef HAVE_GETHOSTBYADDR_R
 	NWRAP_SYMBOL_ENTRY(gethostbyaddr_r);
 #endif
+#ifdef HAVE_GETADDRINFO_A
+	NWRAP_SYMBOL_ENTRY(getaddrinfo_a);
+	NWRAP_SYMBOL_ENTRY(gai_suspend);
+	NWRAP_SYMBOL_ENTRY(gai_error);
+	NWRAP_SYMBOL_ENTRY(gai_cancel);
+#endif
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+	NWRAP_SYMBOL_ENTRY(getspnam_r);
+#endif
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPENT_R)
+	NWRAP_SYMBOL_ENTRY(getspent_r);
+#endif
+#ifdef HAVE_INNETGR
+	NWRAP_SYMBOL_ENTRY(setnetgrent);
+	NWRAP_SYMBOL_ENTRY(getnetgrent);
+#ifdef HAVE_GETNETGRENT_R
+	NWRAP_SYMBOL_ENTRY(getnetgrent_r);
+#endif
+	NWRAP_SYMBOL_ENTRY(endnetgrent);
+	NWRAP_SYMBOL_ENTRY(innetgr);
+#endif
+	NWRAP_SYMBOL_ENTRY(sysconf);
 };
 
 #ifndef NO_NSS_SUPPORT 
@@ -440,12 +599,37 @@ struct nwrap_module_nss_fns {
 };
 #endif
 
+/*
+ * Enumerating a module costs a call per entry. The entries are read ahead in
+ * batches of up to NWRAP_MODULE_ENUM_ENTRIES entries, which the module writes
+ * one after the other into buf. The buffer grows if a single entry doesn't
+ * fit into it. The next batch is read when the last entry was handed out.
+ */
+#define NWRAP_MODULE_ENUM_ENTRIES 256
+#define NWRAP_MODULE_ENUM_BUFLEN (64 * 1024)
+#define NWRAP_MODULE_ENUM_MAX_BUFLEN (16 * 1024 * 1024)
+
+struct nwrap_module_enum {
+	char *buf;
+	size_t buflen;
+	struct passwd *pw;
+	struct group *gr;
+	size_t num;
+	size_t idx;
+	/* The module returned its last entry */
+	bool done;
+};
+
 struct nwrap_backend {
 	const char *name;
 	const char *so_path;
 	void *so_handle;
 	struct nwrap_ops *ops;
 	struct nwrap_module_nss_fns *fns;
+	/* The module is opened on first use, protected by nwrap_global_mutex */
+	bool loaded;
+	struct nwrap_module_enum pw_enum;
+	struct nwrap_module_enum gr_enum;
 };
 
 struct nwrap_ops {
@@ -483,6 +667,27 @@ struct nwrap_ops {
 					 struct group *grdst, char *buf,
 					 size_t buflen, struct group **grdstp);
 	void		(*nw_endgrent)(struct nwrap_backend *b);
+	/*
+	 * Optional batch lookups. Only the entries of errors[] which are set
+	 * to ENOENT get resolved, the results are packed into *buf which is
+	 * advanced accordingly. Returns the number of resolved entries.
+	 */
+	int		(*nw_getpwnam_batch)(struct nwrap_backend *b,
+					     const char * const *names, size_t num,
+					     struct passwd *pwdst, int *errors,
+					     char **buf, size_t *buflen);
+	int		(*nw_getpwuid_batch)(struct nwrap_backend *b,
+					     const uid_t *uids, size_t num,
+					     struct passwd *pwdst, int *errors,
+					     char **buf, size_t *buflen);
+	int		(*nw_getgrnam_batch)(struct nwrap_backend *b,
+					     const char * const *names, size_t num,
+					     struct group *grdst, int *errors,
+					     char **buf, size_t *buflen);
+	int		(*nw_getgrgid_batch)(struct nwrap_backend *b,
+					     const gid_t *gids, size_t num,
+					     struct group *grdst, int *errors,
+					     char **buf, size_t *buflen);
 };
 
 /* Public prototypes */
@@ -490,6 +695,31 @@ struct nwrap_ops {
 bool nss_wrapper_enabled(void);
 bool nss_wrapper_shadow_enabled(void);
 bool nss_wrapper_hosts_enabled(void);
+#ifdef HAVE_INNETGR
+bool nss_wrapper_netgroup_enabled(void);
+#endif
+int nss_wrapper_getpwnam_batch(const char * const *names, size_t num,
+			       struct passwd *pwds, int *errors,
+			       char *buf, size_t buflen);
+int nss_wrapper_getpwuid_batch(const uid_t *uids, size_t num,
+			       struct passwd *pwds, int *errors,
+			       char *buf, size_t buflen);
+int nss_wrapper_getgrnam_batch(const char * const *names, size_t num,
+			       struct group *grps, int *errors,
+			       char *buf, size_t buflen);
+int nss_wrapper_getgrgid_batch(const gid_t *gids, size_t num,
+			       struct group *grps, int *errors,
+			       char *buf, size_t buflen);
+unsigned long nss_wrapper_erange_retries(void);
+unsigned long nss_wrapper_reload_swaps(void);
+unsigned long nss_wrapper_gai_cache_hits(void);
+unsigned long nss_wrapper_hosts_fallbacks(void);
+int nss_wrapper_add_user(const struct passwd *pwd);
+int nss_wrapper_del_user(const char *name);
+int nss_wrapper_add_group(const struct group *grp);
+int nss_wrapper_del_group(const char *name);
+int nss_wrapper_add_host(const char *name, const char *addr);
+int nss_wrapper_del_host(const char *name);
 
 /* prototypes for files backend */
 
@@ -528,6 +758,24 @@ static int nwrap_files_getgrent_r(struct nwrap_backend *b,
 				  struct group *grdst, char *buf,
 				  size_t buflen, struct group **grdstp);
 static void nwrap_files_endgrent(struct nwrap_backend *b);
+static void nwrap_files_rewind_gr(void);
+static struct group *nwrap_files_next_gr(void);
+static int nwrap_files_getpwnam_batch(struct nwrap_backend *b,
+				      const char * const *names, size_t num,
+				      struct passwd *pwdst, int *errors,
+				      char **buf, size_t *buflen);
+static int nwrap_files_getpwuid_batch(struct nwrap_backend *b,
+				      const uid_t *uids, size_t num,
+				      struct passwd *pwdst, int *errors,
+				      char **buf, size_t *buflen);
+static int nwrap_files_getgrnam_batch(struct nwrap_backend *b,
+				      const char * const *names, size_t num,
+				      struct group *grdst, int *errors,
+				      char **buf, size_t *buflen);
+static int nwrap_files_getgrgid_batch(struct nwrap_backend *b,
+				      const gid_t *gids, size_t num,
+				      struct group *grdst, int *errors,
+				      char **buf, size_t *buflen);
 
 /* prototypes for module backend */
 
@@ -586,6 +834,10 @@ struct nwrap_ops nwrap_files_ops = {
 	.nw_getgrent	= nwrap_files_getgrent,
 	.nw_getgrent_r	= nwrap_files_getgrent_r,
 	.nw_endgrent	= nwrap_files_endgrent,
+	.nw_getpwnam_batch	= nwrap_files_getpwnam_batch,
+	.nw_getpwuid_batch	= nwrap_files_getpwuid_batch,
+	.nw_getgrnam_batch	= nwrap_files_getgrnam_batch,
+	.nw_getgrgid_batch	= nwrap_files_getgrgid_batch,
 };
 
 #ifndef NO_NSS_SUPPORT
@@ -614,6 +866,7 @@ struct nwrap_libc {
 	void *handle;
 	void *nsl_handle;
 	void *sock_handle;
+	void *anl_handle;
 	struct nwrap_libc_symbols symbols;
 };
 
@@ -621,6 +874,9 @@ struct nwrap_main {
 	int num_backends;
 	struct nwrap_backend *backends;
 	struct nwrap_libc libc;
+
+	/* _r calls which failed with ERANGE, protected by nwrap_global_mutex */
+	unsigned long erange_retries;
 };
 
 static struct nwrap_main *nwrap_main_global;
@@ -742,7 +998,7 @@ static bool nwrap_vector_add_item(struct nwrap_vector *vector, void *const item)
 	return true;
 }
 
-static bool nwrap_vector_merge(struct nwrap_vector *dst,
+static inline bool nwrap_vector_merge(struct nwrap_vector *dst,
 			       struct nwrap_vector *src)
 {
 	void **dst_items = NULL;
@@ -772,33 +1028,152 @@ static bool nwrap_vector_merge(struct nwrap_vector *dst,
 	return true;
 }
 
-struct nwrap_cache {
-	const char *path;
-	int fd;
+/* The size of a database before a layer of its file list was parsed */
+struct nwrap_mark {
+	int num;
+	int num_ranges;
+	size_t pool_used;
+	size_t num_rels;
+	size_t max_size;
+	size_t num_lines;
+};
+
+/*
+ * One file of the list in NSS_WRAPPER_PASSWD and friends. The files are
+ * parsed in order, an entry of a later file overrides the entries of the
+ * same name in earlier ones. Every layer is checked for changes on its own,
+ * so a small overlay can be reparsed while a large base file stays loaded.
+ */
+struct nwrap_layer {
+	/* NULL for the memory layer, which is always the last one */
+	char *path;
 	FILE *fp;
+	int fd;
+	struct stat st;
+	struct nwrap_mark mark;
+	/* Parse the layer again on the next reload */
+	bool dirty;
+};
+
+/* A drop-in directory of the file list, rescanned when it changes */
+struct nwrap_layer_dir {
+	char *path;
 	struct stat st;
+	/* A listed path which doesn't exist yet */
+	bool missing;
+};
+
+struct nwrap_cache {
+	/* A colon separated list of files and directories */
+	const char *path;
 	void *private_data;
 
+	struct nwrap_layer *layers;
+	size_t num_layers;
+	struct nwrap_layer_dir *dirs;
+	size_t num_dirs;
+	bool scanned;
+
 	struct nwrap_vector lines;
+	/* The parser copies what it needs, so the lines don't need to be kept */
+	bool discard_lines;
+
+	/*
+	 * Lines added by nss_wrapper_add_user() and friends. They make up the
+	 * memory layer and survive reloads of the files.
+	 */
+	struct nwrap_vector mem_lines;
+	/* Counts the changes of mem_lines */
+	unsigned long mem_generation;
+
+	/* A version of the files was loaded */
+	bool loaded;
+	/* The files are checked by the reloader thread, see nwrap_reload_db() */
+	bool background;
 
 	bool (*parse_line)(struct nwrap_cache *, char *line);
 	void (*unload)(struct nwrap_cache *);
+	/*
+	 * Optional. With them only the layers from a changed one on are
+	 * reparsed, the database is truncated to its size before that layer.
+	 */
+	void (*mark)(struct nwrap_cache *, struct nwrap_mark *);
+	void (*truncate)(struct nwrap_cache *, const struct nwrap_mark *);
+	/*
+	 * Optional. Swaps the entries with the ones of the second cache, which
+	 * the reloader thread parsed. Without it the lookups reload the files.
+	 */
+	void (*swap)(struct nwrap_cache *, struct nwrap_cache *);
+};
+
+/*
+ * String pool for the passwd and group databases. The entries only keep
+ * 32-bit offsets into it, so it can be grown while the file gets parsed.
+ */
+struct nwrap_strpool {
+	char *buf;
+	size_t size;
+	size_t used;
+};
+
+/*
+ * A passwd line with a range of uids instead of a single one, like
+ * "user%d:x:100000-199999:100:User %d:/home/user%d:/bin/sh". The entries are
+ * computed on demand, %d is replaced by the offset in the range. The gid can
+ * be a range of the same size too.
+ */
+struct nwrap_pw_range {
+	uid_t uid;
+	gid_t gid;
+	uint32_t count;
+	bool gid_range;
+	/* Offset of the templates in the pool, stored like an entry */
+	uint32_t offset;
 };
 
 /* passwd */
 struct nwrap_pw {
 	struct nwrap_cache *cache;
 
-	struct passwd *list;
+	/*
+	 * The entries are stored column wise. The strings of an entry are
+	 * stored NUL separated in the pool: name, passwd, gecos, dir and shell.
+	 */
+	uid_t *uids;
+	gid_t *gids;
+	uint32_t *hashes;
+	uint32_t *offsets;
+	/* A "-name" line, which removes the name of the earlier layers */
+	bool *deleted;
+	struct nwrap_strpool pool;
 	int num;
+	int capacity;
 	int idx;
+
+	struct nwrap_pw_range *ranges;
+	int num_ranges;
+	/* Enumeration position once idx reached num */
+	int range_idx;
+	uint32_t range_off;
+
+	/* The buffer size getpwnam_r() needs for the largest entry */
+	size_t max_size;
+	/* The size of the strings of the largest computed entry */
+	size_t range_size;
 };
 
 struct nwrap_cache __nwrap_cache_pw;
 struct nwrap_pw nwrap_pw_global;
+/* Parsed by the reloader thread, see nwrap_reload */
+static struct nwrap_cache __nwrap_cache_pw_next;
+static struct nwrap_pw nwrap_pw_next;
 
 static bool nwrap_pw_parse_line(struct nwrap_cache *nwrap, char *line);
 static void nwrap_pw_unload(struct nwrap_cache *nwrap);
+static void nwrap_pw_mark(struct nwrap_cache *nwrap, struct nwrap_mark *mark);
+static void nwrap_pw_truncate(struct nwrap_cache *nwrap,
+			      const struct nwrap_mark *mark);
+static void nwrap_pw_swap(struct nwrap_cache *live, struct nwrap_cache *next);
 
 /* shadow */
 #if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
@@ -806,28 +1181,170 @@ struct nwrap_sp {
 	struct nwrap_cache *cache;
 
 	struct spwd *list;
+	uint32_t *hashes;
 	int num;
+	int capacity;
 	int idx;
+
+	/* Index of the names, entry index + 1 or 0 for a free slot */
+	uint32_t *slots;
+	size_t num_slots;
+	/* The first entry of the layer being parsed */
+	int layer_first;
 };
 
 struct nwrap_cache __nwrap_cache_sp;
 struct nwrap_sp nwrap_sp_global;
+static struct nwrap_cache __nwrap_cache_sp_next;
+static struct nwrap_sp nwrap_sp_next;
 
 static bool nwrap_sp_parse_line(struct nwrap_cache *nwrap, char *line);
 static void nwrap_sp_unload(struct nwrap_cache *nwrap);
+static void nwrap_sp_mark(struct nwrap_cache *nwrap, struct nwrap_mark *mark);
+static void nwrap_sp_truncate(struct nwrap_cache *nwrap,
+			      const struct nwrap_mark *mark);
+static void nwrap_sp_swap(struct nwrap_cache *live, struct nwrap_cache *next);
 #endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
+/* netgroup */
+#ifdef HAVE_INNETGR
+/* An empty field of a triple, it matches everything */
+#define NWRAP_NG_EMPTY UINT32_MAX
+/* A field innetgr() was called with NULL for */
+#define NWRAP_NG_ANY (UINT32_MAX - 1)
+
+/* Either a (host,user,domain) triple or a nested netgroup */
+struct nwrap_ng_member {
+	/* Offsets into the pool or NWRAP_NG_EMPTY */
+	uint32_t host;
+	uint32_t user;
+	uint32_t domain;
+	/* Name of the nested netgroup, NWRAP_NG_EMPTY for a triple */
+	uint32_t nested;
+};
+
+struct nwrap_ng_group {
+	uint32_t name;
+	uint32_t hash;
+	int first_member;
+	int num_members;
+	/* The triples of the group and all nested groups in flat */
+	size_t first_triple;
+	size_t num_triples;
+};
+
+/*
+ * Slot of the innetgr() index. Each triple of a flattened netgroup is
+ * inserted for every combination of its fields and NWRAP_NG_ANY, so a query
+ * takes at most 8 lookups, however deep the netgroups are nested.
+ */
+struct nwrap_ng_key {
+	/* Group index + 1, 0 for a free slot */
+	uint32_t group;
+	uint32_t host;
+	uint32_t user;
+	uint32_t domain;
+	uint32_t hash;
+};
+
+struct nwrap_ng {
+	struct nwrap_cache *cache;
+
+	struct nwrap_strpool pool;
+	struct nwrap_ng_group *groups;
+	int num_groups;
+	int groups_capacity;
+	struct nwrap_ng_member *members;
+	int num_members;
+	int members_capacity;
+	/* The last line ended with a backslash */
+	bool continued;
+
+	/* Built by the first lookup after a reload */
+	bool indexed;
+	uint32_t *flat;
+	size_t num_flat;
+	size_t flat_capacity;
+	/* Group index + 1 by name, 0 for a free slot */
+	uint32_t *names;
+	size_t num_name_slots;
+	struct nwrap_ng_key *keys;
+	size_t num_keys;
+	size_t num_key_slots;
+
+	/* The netgroup selected by setnetgrent() */
+	int cur_group;
+	size_t cur_idx;
+};
+
+static struct nwrap_cache __nwrap_cache_ng;
+static struct nwrap_ng nwrap_ng_global = {
+	.cur_group = -1,
+};
+static struct nwrap_cache __nwrap_cache_ng_next;
+static struct nwrap_ng nwrap_ng_next = {
+	.cur_group = -1,
+};
+
+static bool nwrap_ng_parse_line(struct nwrap_cache *nwrap, char *line);
+static void nwrap_ng_unload(struct nwrap_cache *nwrap);
+static void nwrap_ng_swap(struct nwrap_cache *live, struct nwrap_cache *next);
+#endif /* HAVE_INNETGR */
+
+/* Like nwrap_pw_range, the members can be templates as well */
+struct nwrap_gr_range {
+	gid_t gid;
+	uint32_t count;
+	uint32_t nummem;
+	uint32_t offset;
+};
+
 /* group */
 struct nwrap_gr {
 	struct nwrap_cache *cache;
 
-	struct group *list;
+	/*
+	 * Same as for passwd, the pool holds the name, the passwd and the
+	 * members of an entry. Together they are a blob of sizes[i] bytes,
+	 * the offsets of the passwd and the members in it start at
+	 * rels[first_rel[i]], so the _r functions don't need to measure the
+	 * strings.
+	 */
+	gid_t *gids;
+	uint32_t *hashes;
+	uint32_t *offsets;
+	uint32_t *nummem;
+	uint32_t *sizes;
+	uint32_t *first_rel;
+	/* Same as for passwd */
+	bool *deleted;
+	struct nwrap_strpool pool;
 	int num;
+	int capacity;
 	int idx;
+
+	uint32_t *rels;
+	size_t num_rels;
+	size_t rels_capacity;
+
+	struct nwrap_gr_range *ranges;
+	int num_ranges;
+	int range_idx;
+	uint32_t range_off;
+	/* The buffer size getgrnam_r() needs for the largest entry */
+	size_t max_size;
+	/* The member array of the largest entry, in pointers */
+	size_t mem_size;
+	/* The size of the strings of the largest computed entry */
+	size_t range_size;
 };
 
 struct nwrap_cache __nwrap_cache_gr;
 struct nwrap_gr nwrap_gr_global;
+static struct nwrap_cache __nwrap_cache_gr_next;
+static struct nwrap_gr nwrap_gr_next;
+
+static void nwrap_gr_swap(struct nwrap_cache *live, struct nwrap_cache *next);
 
 /* hosts */
 static bool nwrap_he_parse_line(struct nwrap_cache *nwrap, char *line);
@@ -853,11 +1370,92 @@ struct nwrap_entlist {
 	struct nwrap_entdata *ed;
 };
 
+/* The result of gethostbyname() for one address family */
+struct nwrap_he_result {
+	struct hostent ht;
+	struct nwrap_vector addrs;
+
+	/*
+	 * The result packed for gethostbyname_r() while loading, so a lookup
+	 * only copies it: the address and alias arrays followed by the data,
+	 * the pointers are offsets into the blob.
+	 */
+	char *blob;
+	size_t blob_size;
+	size_t num_addrs;
+	size_t num_aliases;
+	size_t name_offset;
+};
+
+/*
+ * Everything known about a name or address of the hosts file. The results
+ * are built while parsing, so a lookup doesn't need to merge the entries.
+ */
+struct nwrap_he_name {
+	struct nwrap_entlist *list;
+	struct nwrap_entlist *tail;
+
+	/* AF_UNSPEC only returns the IPv4 addresses like glibc */
+	struct nwrap_he_result inet;
+	struct nwrap_he_result inet6;
+};
+
+/*
+ * Slot of the hosts hash table. The name points into the entry and is stored
+ * in lower case without a trailing dot.
+ */
+struct nwrap_he_slot {
+	const char *name;
+	size_t len;
+	uint32_t hash;
+	struct nwrap_he_name *hn;
+};
+
+/*
+ * A rule of the hosts file like "10.1.0.0/16 node%d.cluster.test". The names
+ * and addresses of the block are computed on demand, the number in the name
+ * is the offset of the address in the block.
+ */
+struct nwrap_he_rule {
+	int af;
+	int length;
+	unsigned char net[16];
+	uint64_t count;
+
+	/* The template around the %d, pointing into the line */
+	const char *prefix;
+	size_t prefix_len;
+	const char *suffix;
+	size_t suffix_len;
+};
+
+#define NWRAP_HE_RULE_NAME_MAX 256
+
+/* The result of a rule lookup, every thread has its own */
+struct nwrap_he_synth {
+	struct hostent ht;
+	char name[NWRAP_HE_RULE_NAME_MAX];
+	char *aliases[1];
+	char *addr_list[2];
+	unsigned char addr[16];
+};
+
 struct nwrap_he {
 	struct nwrap_cache *cache;
 
 	struct nwrap_vector entries;
-	struct nwrap_vector lists;
+	struct nwrap_vector names;
+	struct nwrap_vector rules;
+
+	/* Open addressing hash table, the size is a power of two */
+	struct nwrap_he_slot *slots;
+	size_t num_slots;
+	size_t num_used;
+
+	/* Never ask libc for names missing in the hosts file */
+	bool strict;
+	/* Lookups passed on to libc, protected by nwrap_he_global_rwlock */
+	unsigned long fallbacks;
 
 	int num;
 	int idx;
@@ -865,6 +1463,144 @@ struct nwrap_he {
 
 static struct nwrap_cache __nwrap_cache_he;
 static struct nwrap_he nwrap_he_global;
+static struct nwrap_cache __nwrap_cache_he_next;
+static struct nwrap_he nwrap_he_next;
+
+static void nwrap_he_swap(struct nwrap_cache *live, struct nwrap_cache *next);
+
+/*
+ * With NSS_WRAPPER_RELOAD_INTERVAL a thread checks the files of the
+ * databases in the background. It parses a changed file into the next cache
+ * of the database and swaps it with the live one, so the lookups only wait
+ * for the parser until the first version was loaded.
+ */
+struct nwrap_reload_db {
+	struct nwrap_cache *live;
+	struct nwrap_cache *next;
+	pthread_rwlock_t *lock;
+};
+
+struct nwrap_reload {
+	/* 0 if the lookups check the files themselves */
+	unsigned long interval_ms;
+	struct nwrap_reload_db dbs[5];
+	size_t num_dbs;
+
+	/* Protected by nwrap_reload_global_mutex */
+	pthread_cond_t cond;
+	bool stop;
+	unsigned long swaps;
+
+	/* Set under nwrap_reload_thread_mutex, the lookups read it without */
+	bool running;
+};
+
+static struct nwrap_reload nwrap_reload = {
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+
+static void nwrap_reload_init(const char *env);
+static void nwrap_reload_start(void);
+
+/*
+ * Cache for the results of getaddrinfo() calls passed on to libc, so retry
+ * loops don't hit the resolver every time. It is protected by
+ * nwrap_he_global_rwlock.
+ */
+#define NWRAP_GAI_CACHE_SIZE 64
+
+struct nwrap_gai_cache_entry {
+	char *node;
+	char *service;
+	uint32_t hash;
+	int flags;
+	int family;
+	int socktype;
+	int protocol;
+
+	int rc;
+	struct addrinfo *ai;
+	time_t expires;
+};
+
+struct nwrap_gai_cache {
+	/* in seconds, 0 disables the cache */
+	time_t ttl;
+	/* Also cache successful lookups */
+	bool positive;
+	/* The lookups answered from the cache */
+	unsigned long hits;
+
+	struct nwrap_gai_cache_entry entries[NWRAP_GAI_CACHE_SIZE];
+};
+
+static struct nwrap_gai_cache nwrap_gai_cache;
+
+/*
+ * With NSS_WRAPPER_TRACE_FILE every wrapped call appends a record to the
+ * file, see nss_wrapper_trace.h. The records are collected in a buffer per
+ * thread, which is written with a single write() when it is full, when the
+ * thread exits and when the library gets unloaded. The file is opened with
+ * O_APPEND, so all processes of a test can trace to the same file.
+ */
+#define NWRAP_TRACE_BUF_SIZE 8192
+#define NWRAP_TRACE_KEY_MAX 1024
+
+struct nwrap_trace {
+	int fd;
+	uint32_t pid;
+	uint32_t num_threads;
+};
+
+static struct nwrap_trace nwrap_trace = {
+	.fd = -1,
+};
+
+struct nwrap_trace_tls {
+	char *buf;
+	size_t used;
+	uint32_t thread;
+
+	unsigned int profile_calls;
+	bool profile_sampled;
+};
+
+static __thread struct nwrap_trace_tls nwrap_trace_tls;
+static pthread_key_t nwrap_trace_tls_key;
+static pthread_once_t nwrap_trace_tls_once = PTHREAD_ONCE_INIT;
+
+/*
+ * With NSS_WRAPPER_PROFILE_RATE=N every Nth wrapped call of a thread takes a
+ * short backtrace. The calls and their time are summed up per function and
+ * call site, the report is written to NSS_WRAPPER_PROFILE_FILE or stderr
+ * when the library gets unloaded. The counts are samples, the report scales
+ * them by the rate.
+ */
+#define NWRAP_PROFILE_FRAMES 32
+#define NWRAP_PROFILE_DEPTH 4
+#define NWRAP_PROFILE_SITES 1024
+
+struct nwrap_profile_site {
+	uint16_t fn;
+	int num_frames;
+	void *frames[NWRAP_PROFILE_DEPTH];
+
+	unsigned long count;
+	uint64_t total_ns;
+};
+
+struct nwrap_profile {
+	unsigned int rate;
+	const char *path;
+	/* The base address of nss_wrapper, its frames are skipped */
+	void *own_base;
+
+	size_t num_sites;
+	unsigned long dropped;
+	struct nwrap_profile_site sites[NWRAP_PROFILE_SITES];
+};
+
+static struct nwrap_profile nwrap_profile;
 
 
 /*********************************************************
@@ -874,6 +1610,9 @@ static struct nwrap_he nwrap_he_global;
 static void nwrap_init(void);
 static bool nwrap_gr_parse_line(struct nwrap_cache *nwrap, char *line);
 static void nwrap_gr_unload(struct nwrap_cache *nwrap);
+static void nwrap_gr_mark(struct nwrap_cache *nwrap, struct nwrap_mark *mark);
+static void nwrap_gr_truncate(struct nwrap_cache *nwrap,
+			      const struct nwrap_mark *mark);
 void nwrap_destructor(void) DESTRUCTOR_ATTRIBUTE;
 
 /*********************************************************
@@ -884,6 +1623,7 @@ enum nwrap_lib {
     NWRAP_LIBC,
     NWRAP_LIBNSL,
     NWRAP_LIBSOCKET,
+    NWRAP_LIBANL,
     NWRAP_LIBSYSTEM,
 };
 
@@ -898,6 +1638,8 @@ static const char *nwrap_str_lib(enum nwrap_lib lib)
 		return "libnsl";
 	case NWRAP_LIBSOCKET:
 		return "libsocket";
+	case NWRAP_LIBANL:
+		return "libanl";
 	case NWRAP_LIBSYSTEM:
 		return "libSystem";
 #else /* OSX specific */
@@ -905,6 +1647,7 @@ static const char *nwrap_str_lib(enum nwrap_lib lib)
 	case NWRAP_LIBC:
 	case NWRAP_LIBNSL:
 	case NWRAP_LIBSOCKET:
+	case NWRAP_LIBANL:
 	case NWRAP_LIBSYSTEM:
 		return "libSystem";
 #endif /* OSX */
@@ -918,19 +1661,37 @@ static void *nwrap_load_lib_handle(enum nwrap_lib lib)
 {
 	int flags = RTLD_LAZY;
 	void *handle = NULL;
-#ifndef OSX
-	int i;
-#endif /* OSX */
 
-#ifdef RTLD_DEEPBIND
+	/* The thread sanitizer refuses to load libc with RTLD_DEEPBIND */
+#if defined(RTLD_DEEPBIND) && !defined(NWRAP_THREAD_SANITIZER)
 	flags |= RTLD_DEEPBIND;
 #endif
 
 	switch (lib) {
+	case NWRAP_LIBANL:
+#ifdef HAVE_LIBANL
+		handle = nwrap_main_global->libc.anl_handle;
+		if (handle == NULL) {
+#ifdef LIBANL_SO
+			handle = dlopen(LIBANL_SO, flags);
+#else
+			handle = dlopen("libanl.so.1", flags);
+#endif
+
+			nwrap_main_global->libc.anl_handle = handle;
+		}
+		break;
+#endif
+		/* FALL TROUGH */
 	case NWRAP_LIBNSL:
 #ifdef HAVE_LIBNSL
 		handle = nwrap_main_global->libc.nsl_handle;
 		if (handle == NULL) {
+#ifdef LIBNSL_SO
+			handle = dlopen(LIBNSL_SO, flags);
+#else
+			int i;
+
 			for (i = 10; i >= 0; i--) {
 				char soname[256] = {0};
 
@@ -940,6 +1701,7 @@ static void *nwrap_load_lib_handle(enum nwrap_lib lib)
 					break;
 				}
 			}
+#endif
 
 			nwrap_main_global->libc.nsl_handle = handle;
 		}
@@ -950,6 +1712,8 @@ static void *nwrap_load_lib_handle(enum nwrap_lib lib)
 #ifdef HAVE_LIBSOCKET
 		handle = nwrap_main_global->libc.sock_handle;
 		if (handle == NULL) {
+			int i;
+
 			for (i = 10; i >= 0; i--) {
 				char soname[256] = {0};
 
@@ -970,6 +1734,18 @@ static void *nwrap_load_lib_handle(enum nwrap_lib lib)
 	case NWRAP_LIBC:
 		handle = nwrap_main_global->libc.handle;
 		if (handle == NULL) {
+			/*
+			 * libc is always loaded already. Don't probe all the
+			 * sonames with dlopen(), every miss searches the
+			 * library path.
+			 */
+#if defined(LIBC_SO)
+			handle = dlopen(LIBC_SO, flags);
+#elif defined(RTLD_NEXT)
+			handle = RTLD_NEXT;
+#else
+			int i;
+
 			for (i = 10; i >= 0; i--) {
 				char soname[256] = {0};
 
@@ -979,6 +1755,7 @@ static void *nwrap_load_lib_handle(enum nwrap_lib lib)
 					break;
 				}
 			}
+#endif
 
 			nwrap_main_global->libc.handle = handle;
 		}
@@ -999,6 +1776,7 @@ static void *nwrap_load_lib_handle(enum nwrap_lib lib)
 		handle = nwrap_main_global->libc.handle
 		       = nwrap_main_global->libc.sock_handle
 		       = nwrap_main_global->libc.nsl_handle
+		       = nwrap_main_global->libc.anl_handle
 		       = RTLD_NEXT;
 #else
 		NWRAP_LOG(NWRAP_LOG_ERROR,
@@ -1120,34 +1898,98 @@ static int libc_getpwuid_r(uid_t uid,
 }
 #endif
 
+/*
+ * Host names are compared case insensitive. Only ASCII is folded, which is
+ * what DNS does too.
+ */
+static inline char nwrap_ascii_tolower(char c)
+{
+	if (c >= 'A' && c <= 'Z') {
+		return c | 0x20;
+	}
+
+	return c;
+}
+
+#ifdef __SSE2__
+static inline __m128i nwrap_sse2_tolower(__m128i v)
+{
+	/* Bytes >= 0x80 are negative, so they are never in the range */
+	__m128i ge_a = _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1));
+	__m128i le_z = _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1));
+	__m128i upper = _mm_and_si128(ge_a, le_z);
+
+	return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
 static inline void str_tolower(char *dst, char *src)
 {
-	register char *src_tmp = src;
-	register char *dst_tmp = dst;
+	size_t len = strlen(src);
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
 
-	while (*src_tmp != '\0') {
-		*dst_tmp = tolower(*src_tmp);
-		++src_tmp;
-		++dst_tmp;
+		_mm_storeu_si128((__m128i *)(dst + i), nwrap_sse2_tolower(v));
+	}
+#endif
+	for (; i < len; i++) {
+		dst[i] = nwrap_ascii_tolower(src[i]);
 	}
 }
 
-static bool str_tolower_copy(char **dst_name, const char *const src_name)
+/* The length of a host name, ignoring a trailing dot */
+static size_t nwrap_hostname_len(const char *name)
 {
-	char *h_name_lower;
+	size_t len = strlen(name);
 
-	if ((dst_name == NULL) || (src_name == NULL)) {
-		return false;
+	if (len > 1 && name[len - 1] == '.') {
+		len--;
 	}
 
-	h_name_lower = strdup(src_name);
-	if (h_name_lower == NULL) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Out of memory while strdup");
-		return false;
+	return len;
+}
+
+/* FNV-1a over the lower case name */
+static uint32_t nwrap_hostname_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (unsigned char)nwrap_ascii_tolower(name[i]);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+/* key has to be lower case already */
+static bool nwrap_hostname_equal(const char *key,
+				 const char *name,
+				 size_t len)
+{
+	size_t i = 0;
+
+#ifdef __SSE2__
+	for (; i + 16 <= len; i += 16) {
+		__m128i k = _mm_loadu_si128((const __m128i *)(key + i));
+		__m128i n = _mm_loadu_si128((const __m128i *)(name + i));
+		__m128i eq = _mm_cmpeq_epi8(k, nwrap_sse2_tolower(n));
+
+		if (_mm_movemask_epi8(eq) != 0xFFFF) {
+			return false;
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		if (key[i] != nwrap_ascii_tolower(name[i])) {
+			return false;
+		}
 	}
 
-	str_tolower(h_name_lower, h_name_lower);
-	*dst_name = h_name_lower;
 	return true;
 }
 
@@ -1406,8 +2248,126 @@ static int libc_gethostbyaddr_r(const void *addr,
 }
 #endif
 
-static int libc_getaddrinfo(const char *node,
-			    const char *service,
+#ifdef HAVE_GETADDRINFO_A
+static int libc_getaddrinfo_a(int mode,
+			      struct gaicb *list[],
+			      int nitems,
+			      struct sigevent *sevp)
+{
+	nwrap_bind_symbol(NWRAP_LIBANL, getaddrinfo_a);
+
+	return nwrap_symbol_libc(getaddrinfo_a).f(mode, list, nitems, sevp);
+}
+
+static int libc_gai_suspend(const struct gaicb * const list[],
+			    int nitems,
+			    const struct timespec *timeout)
+{
+	nwrap_bind_symbol(NWRAP_LIBANL, gai_suspend);
+
+	return nwrap_symbol_libc(gai_suspend).f(list, nitems, timeout);
+}
+
+static int libc_gai_error(struct gaicb *req)
+{
+	nwrap_bind_symbol(NWRAP_LIBANL, gai_error);
+
+	return nwrap_symbol_libc(gai_error).f(req);
+}
+
+static int libc_gai_cancel(struct gaicb *req)
+{
+	nwrap_bind_symbol(NWRAP_LIBANL, gai_cancel);
+
+	return nwrap_symbol_libc(gai_cancel).f(req);
+}
+#endif /* HAVE_GETADDRINFO_A */
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+static int libc_getspnam_r(const char *name, struct spwd *spdst,
+			   char *buf, size_t buflen,
+			   struct spwd **spdstp)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, getspnam_r);
+
+	return nwrap_symbol_libc(getspnam_r).f(name, spdst, buf, buflen,
+					       spdstp);
+}
+#endif
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPENT_R)
+static int libc_getspent_r(struct spwd *spdst,
+			   char *buf, size_t buflen,
+			   struct spwd **spdstp)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, getspent_r);
+
+	return nwrap_symbol_libc(getspent_r).f(spdst, buf, buflen, spdstp);
+}
+#endif
+
+#ifdef HAVE_INNETGR
+#ifdef HAVE_BSD_SETNETGRENT
+static void libc_setnetgrent(const char *netgroup)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, setnetgrent);
+
+	nwrap_symbol_libc(setnetgrent).f(netgroup);
+}
+#else
+static int libc_setnetgrent(const char *netgroup)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, setnetgrent);
+
+	return nwrap_symbol_libc(setnetgrent).f(netgroup);
+}
+#endif /* HAVE_BSD_SETNETGRENT */
+
+static int libc_getnetgrent(char **host, char **user, char **domain)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, getnetgrent);
+
+	return nwrap_symbol_libc(getnetgrent).f(host, user, domain);
+}
+
+#ifdef HAVE_GETNETGRENT_R
+static int libc_getnetgrent_r(char **host, char **user, char **domain,
+			      char *buf, size_t buflen)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, getnetgrent_r);
+
+	return nwrap_symbol_libc(getnetgrent_r).f(host, user, domain,
+						  buf, buflen);
+}
+#endif /* HAVE_GETNETGRENT_R */
+
+static void libc_endnetgrent(void)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, endnetgrent);
+
+	nwrap_symbol_libc(endnetgrent).f();
+}
+
+static int libc_innetgr(const char *netgroup,
+			const char *host,
+			const char *user,
+			const char *domain)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, innetgr);
+
+	return nwrap_symbol_libc(innetgr).f(netgroup, host, user, domain);
+}
+#endif /* HAVE_INNETGR */
+
+static long libc_sysconf(int name)
+{
+	nwrap_bind_symbol(NWRAP_LIBC, sysconf);
+
+	return nwrap_symbol_libc(sysconf).f(name);
+}
+
+static int libc_getaddrinfo(const char *node,
+			    const char *service,
 			    const struct addrinfo *hints,
 			    struct addrinfo **res)
 {
@@ -1540,21 +2500,50 @@ static bool nwrap_module_init(const char *name,
 	b->name = name;
 	b->ops = ops;
 	b->so_path = so_path;
+	b->so_handle = NULL;
+	b->fns = NULL;
+	/* The module is only opened when it is used the first time */
+	b->loaded = (so_path == NULL);
+	ZERO_STRUCTP(&b->pw_enum);
+	ZERO_STRUCTP(&b->gr_enum);
+
+	(*num_backends)++;
+
+	return true;
+}
+
+static void nwrap_module_enum_free(struct nwrap_module_enum *e)
+{
+	SAFE_FREE(e->buf);
+	SAFE_FREE(e->pw);
+	SAFE_FREE(e->gr);
+	ZERO_STRUCTP(e);
+}
 
-	if (so_path != NULL) {
-		b->so_handle = nwrap_load_module(so_path);
+/*
+ * Open the module of the backend if this didn't happen yet. Processes which
+ * only resolve hosts or are done before the first user lookup never pay for
+ * the dlopen() and the symbol lookups.
+ */
+static bool nwrap_module_load(struct nwrap_backend *b)
+{
+	bool ok;
+
+	NWRAP_LOCK(nwrap_global);
+	if (!b->loaded) {
+		b->loaded = true;
+		b->so_handle = nwrap_load_module(b->so_path);
 		b->fns = nwrap_load_module_fns(b);
 		if (b->fns == NULL) {
-			return false;
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Failed to initialize '%s' backend",
+				  b->name);
 		}
-	} else {
-		b->so_handle = NULL;
-		b->fns = NULL;
 	}
+	ok = (b->fns != NULL);
+	NWRAP_UNLOCK(nwrap_global);
 
-	(*num_backends)++;
-
-	return true;
+	return ok;
 }
 
 static void nwrap_backend_init(struct nwrap_main *r)
@@ -1591,3884 +2580,11563 @@ static void nwrap_backend_init(struct nwrap_main *r)
 }
 #endif
 
-static void nwrap_init(void)
-{
-	const char *env;
-	char *endptr;
-	size_t max_hostents_tmp;
+/*********************************************************
+ * NWRAP TRACE
+ *********************************************************/
 
-	NWRAP_LOCK(nwrap_initialized);
-	if (nwrap_initialized) {
-		NWRAP_UNLOCK(nwrap_initialized);
-		return;
-	}
+static uint64_t nwrap_trace_clock(clockid_t clock)
+{
+	struct timespec ts;
 
-	/*
-	 * Still holding nwrap_initialized lock here.
-	 * We don't use NWRAP_(UN)LOCK_ALL macros here because we
-	 * want to avoid overhead when other threads do their job.
-	 */
-	NWRAP_LOCK(nwrap_global);
-	NWRAP_LOCK(nwrap_gr_global);
-	NWRAP_LOCK(nwrap_he_global);
-	NWRAP_LOCK(nwrap_pw_global);
-	NWRAP_LOCK(nwrap_sp_global);
+	clock_gettime(clock, &ts);
 
-	nwrap_initialized = true;
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
 
-	/* Initialize pthread_atfork handlers */
-	pthread_atfork(&nwrap_thread_prepare, &nwrap_thread_parent,
-		       &nwrap_thread_child);
+static void nwrap_trace_open(const char *path)
+{
+	struct nwrap_trace_header hdr;
+	ssize_t n;
+	int fd;
 
-	env = getenv("NSS_WRAPPER_MAX_HOSTENTS");
-	if (env != NULL) {
-		max_hostents_tmp = (size_t)strtol(env, &endptr, 10);
-		if (((env != '\0') && (endptr == '\0')) ||
-		    (max_hostents_tmp == 0)) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG,
-				  "Error parsing NSS_WRAPPER_MAX_HOSTENTS "
-				  "value or value is too small. "
-				  "Using default value: %lu.",
-				  (unsigned long)max_hostents);
-		} else {
-			max_hostents = max_hostents_tmp;
+	/* Only the process which creates the file writes the header */
+	fd = open(path, O_WRONLY|O_CREAT|O_EXCL|O_APPEND|O_CLOEXEC, 0644);
+	if (fd != -1) {
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(hdr.magic, NWRAP_TRACE_MAGIC, sizeof(hdr.magic));
+		hdr.version = NWRAP_TRACE_VERSION;
+		hdr.record_size = sizeof(struct nwrap_trace_record);
+		hdr.realtime_ns = nwrap_trace_clock(CLOCK_REALTIME);
+		hdr.monotonic_ns = nwrap_trace_clock(CLOCK_MONOTONIC);
+
+		n = write(fd, &hdr, sizeof(hdr));
+		if (n != (ssize_t)sizeof(hdr)) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Unable to write trace header to %s",
+				  path);
+			close(fd);
+			return;
 		}
+	} else if (errno == EEXIST) {
+		fd = open(path, O_WRONLY|O_APPEND|O_CLOEXEC);
 	}
-	/* Initialize hash table */
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "Initializing hash table of size %lu items.",
-		  (unsigned long)max_hostents);
-	if (hcreate(max_hostents) == 0) {
+	if (fd == -1) {
 		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Failed to initialize hash table");
-		goto done;
+			  "Unable to open trace file %s: %s",
+			  path, strerror(errno));
+		return;
 	}
 
-	nwrap_main_global = &__nwrap_main_global;
-
-#ifndef NO_NSS_SUPPORT
-	nwrap_backend_init(nwrap_main_global);
-#endif
+	nwrap_trace.fd = fd;
+	nwrap_trace.pid = (uint32_t)getpid();
+}
 
-	/* passwd */
-	nwrap_pw_global.cache = &__nwrap_cache_pw;
+static void nwrap_trace_flush(struct nwrap_trace_tls *tls)
+{
+	size_t done = 0;
 
-	nwrap_pw_global.cache->path = getenv("NSS_WRAPPER_PASSWD");
-	nwrap_pw_global.cache->fp = NULL;
-	nwrap_pw_global.cache->fd = -1;
-	nwrap_pw_global.cache->private_data = &nwrap_pw_global;
-	nwrap_pw_global.cache->parse_line = nwrap_pw_parse_line;
-	nwrap_pw_global.cache->unload = nwrap_pw_unload;
+	while (done < tls->used) {
+		ssize_t n;
 
-	/* shadow */
-#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
-	nwrap_sp_global.cache = &__nwrap_cache_sp;
+		n = write(nwrap_trace.fd, tls->buf + done, tls->used - done);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Unable to write trace: %s",
+				  strerror(errno));
+			break;
+		}
+		done += (size_t)n;
+	}
 
-	nwrap_sp_global.cache->path = getenv("NSS_WRAPPER_SHADOW");
-	nwrap_sp_global.cache->fp = NULL;
-	nwrap_sp_global.cache->fd = -1;
-	nwrap_sp_global.cache->private_data = &nwrap_sp_global;
-	nwrap_sp_global.cache->parse_line = nwrap_sp_parse_line;
-	nwrap_sp_global.cache->unload = nwrap_sp_unload;
-#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+	tls->used = 0;
+}
 
-	/* group */
-	nwrap_gr_global.cache = &__nwrap_cache_gr;
+static void nwrap_trace_tls_free(void *p)
+{
+	struct nwrap_trace_tls *tls = (struct nwrap_trace_tls *)p;
 
-	nwrap_gr_global.cache->path = getenv("NSS_WRAPPER_GROUP");
-	nwrap_gr_global.cache->fp = NULL;
-	nwrap_gr_global.cache->fd = -1;
-	nwrap_gr_global.cache->private_data = &nwrap_gr_global;
-	nwrap_gr_global.cache->parse_line = nwrap_gr_parse_line;
-	nwrap_gr_global.cache->unload = nwrap_gr_unload;
+	if (tls->used > 0 && nwrap_trace.fd != -1) {
+		nwrap_trace_flush(tls);
+	}
+	SAFE_FREE(tls->buf);
+}
 
-	/* hosts */
-	nwrap_he_global.cache = &__nwrap_cache_he;
+/* The key writes the records of a thread when it exits */
+static void nwrap_trace_tls_key_create(void)
+{
+	int ret;
 
-	nwrap_he_global.cache->path = getenv("NSS_WRAPPER_HOSTS");
-	nwrap_he_global.cache->fp = NULL;
-	nwrap_he_global.cache->fd = -1;
-	nwrap_he_global.cache->private_data = &nwrap_he_global;
-	nwrap_he_global.cache->parse_line = nwrap_he_parse_line;
-	nwrap_he_global.cache->unload = nwrap_he_unload;
+	ret = pthread_key_create(&nwrap_trace_tls_key, nwrap_trace_tls_free);
+	if (ret != 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to create thread key: %s",
+			  strerror(ret));
+	}
+}
 
-done:
-	/* We hold all locks here so we can use NWRAP_UNLOCK_ALL. */
-	NWRAP_UNLOCK_ALL;
+/* The records of the parent are written by the parent */
+static void nwrap_trace_thread_child(void)
+{
+	nwrap_trace_tls.used = 0;
+	nwrap_trace.pid = (uint32_t)getpid();
 }
 
-bool nss_wrapper_enabled(void)
+#if defined(HAVE_BACKTRACE) && defined(HAVE_DLADDR)
+static void nwrap_profile_init(const char *rate)
 {
-	nwrap_init();
+	Dl_info info;
+	char *endptr;
+	unsigned long r;
 
-	if (nwrap_pw_global.cache->path == NULL ||
-	    nwrap_pw_global.cache->path[0] == '\0') {
-		return false;
+	r = strtoul(rate, &endptr, 10);
+	if (endptr[0] != '\0' || r == 0 || r > UINT_MAX) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid NSS_WRAPPER_PROFILE_RATE: %s",
+			  rate);
+		return;
 	}
-	if (nwrap_gr_global.cache->path == NULL ||
-	    nwrap_gr_global.cache->path[0] == '\0') {
-		return false;
+
+	if (dladdr(&nwrap_profile, &info) == 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to find nss_wrapper, profiling disabled");
+		return;
 	}
 
-	return true;
+	nwrap_profile.own_base = info.dli_fbase;
+	nwrap_profile.path = getenv("NSS_WRAPPER_PROFILE_FILE");
+	nwrap_profile.rate = (unsigned int)r;
 }
 
-#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
-bool nss_wrapper_shadow_enabled(void)
+static bool nwrap_profile_own_frame(void *addr)
 {
-	nwrap_init();
+	Dl_info info;
 
-	if (nwrap_sp_global.cache->path == NULL ||
-	    nwrap_sp_global.cache->path[0] == '\0') {
+	if (dladdr(addr, &info) == 0) {
 		return false;
 	}
 
-	return true;
+	return info.dli_fbase == nwrap_profile.own_base;
 }
-#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
-bool nss_wrapper_hosts_enabled(void)
+static void nwrap_profile_add(enum nwrap_trace_fn fn, uint64_t ns)
 {
-	nwrap_init();
+	void *frames[NWRAP_PROFILE_FRAMES];
+	void *site[NWRAP_PROFILE_DEPTH];
+	uint32_t h = (uint32_t)fn;
+	int num_frames;
+	int num = 0;
+	size_t idx;
+	size_t i;
+	int j;
 
-	if (nwrap_he_global.cache->path == NULL ||
-	    nwrap_he_global.cache->path[0] == '\0') {
-		return false;
+	num_frames = backtrace(frames, NWRAP_PROFILE_FRAMES);
+
+	/* A sanitizer which intercepts backtrace() adds frames before ours */
+	for (j = 0; j < num_frames; j++) {
+		if (nwrap_profile_own_frame(frames[j])) {
+			break;
+		}
+	}
+	if (j == num_frames) {
+		j = 0;
 	}
 
-	return true;
+	/* The call site is the first frame outside of nss_wrapper */
+	for (; j < num_frames && num < NWRAP_PROFILE_DEPTH; j++) {
+		if (num == 0 && nwrap_profile_own_frame(frames[j])) {
+			continue;
+		}
+		site[num++] = frames[j];
+		h = h * 31 + (uint32_t)((uintptr_t)frames[j] >> 2);
+	}
+
+	NWRAP_LOCK(nwrap_global);
+
+	idx = h % NWRAP_PROFILE_SITES;
+	for (i = 0; i < NWRAP_PROFILE_SITES; i++) {
+		struct nwrap_profile_site *s = &nwrap_profile.sites[idx];
+
+		if (s->count == 0) {
+			/* Keep a free slot, so the search always ends */
+			if (nwrap_profile.num_sites + 1 >= NWRAP_PROFILE_SITES) {
+				break;
+			}
+			s->fn = (uint16_t)fn;
+			s->num_frames = num;
+			memcpy(s->frames, site, num * sizeof(void *));
+			nwrap_profile.num_sites++;
+		}
+		if (s->fn == fn &&
+		    s->num_frames == num &&
+		    memcmp(s->frames, site, num * sizeof(void *)) == 0) {
+			s->count++;
+			s->total_ns += ns;
+			NWRAP_UNLOCK(nwrap_global);
+			return;
+		}
+
+		idx = (idx + 1) % NWRAP_PROFILE_SITES;
+	}
+
+	nwrap_profile.dropped++;
+
+	NWRAP_UNLOCK(nwrap_global);
 }
 
-static bool nwrap_hostname_enabled(void)
+static int nwrap_profile_site_cmp(const void *p1, const void *p2)
 {
-	nwrap_init();
+	const struct nwrap_profile_site *s1 = p1;
+	const struct nwrap_profile_site *s2 = p2;
 
-	if (getenv("NSS_WRAPPER_HOSTNAME") == NULL) {
-		return false;
+	if (s1->count != s2->count) {
+		return s1->count > s2->count ? -1 : 1;
+	}
+	if (s1->total_ns != s2->total_ns) {
+		return s1->total_ns > s2->total_ns ? -1 : 1;
 	}
 
-	return true;
+	return 0;
 }
 
-static bool nwrap_parse_file(struct nwrap_cache *nwrap)
+/* Called by the destructor, which holds all locks */
+static void nwrap_profile_report(void)
 {
-	char *line = NULL;
-	ssize_t n;
-	/* Unused but getline needs it */
-	size_t len;
-	bool ok;
+	struct nwrap_profile *p = &nwrap_profile;
+	FILE *fp = stderr;
+	size_t i;
 
-	if (nwrap->st.st_size == 0) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "size == 0");
-		return true;
+	if (p->rate == 0 || p->num_sites == 0) {
+		return;
 	}
 
-	/* Support for 32-bit system I guess */
-	if (nwrap->st.st_size > INT32_MAX) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Size[%u] larger than INT32_MAX",
-			  (unsigned)nwrap->st.st_size);
-		return false;
+	if (p->path != NULL && p->path[0] != '\0') {
+		fp = fopen(p->path, "a");
+		if (fp == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Unable to open %s: %s",
+				  p->path, strerror(errno));
+			fp = stderr;
+		}
 	}
 
-	rewind(nwrap->fp);
+	/* The sites are only looked up by hash while profiling */
+	qsort(p->sites, NWRAP_PROFILE_SITES,
+	      sizeof(struct nwrap_profile_site),
+	      nwrap_profile_site_cmp);
 
-	do {
-		n = getline(&line, &len, nwrap->fp);
-		if (n < 0) {
-			SAFE_FREE(line);
-			if (feof(nwrap->fp)) {
-				break;
-			}
+	fprintf(fp,
+		"nss_wrapper profile of process %d, every %u. call sampled\n",
+		(int)getpid(), p->rate);
+	fprintf(fp, "%10s %12s %10s  %s\n",
+		"calls", "total_us", "avg_us", "function and call site");
 
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Unable to read line from file: %s",
-				  nwrap->path);
-			return false;
+	for (i = 0; i < p->num_sites; i++) {
+		struct nwrap_profile_site *s = &p->sites[i];
+		char **syms;
+		int j;
+
+		if (s->count == 0) {
+			break;
 		}
 
-		if (line[n - 1] == '\n') {
-			line[n - 1] = '\0';
-		}
-
-		if (line[0] == '\0') {
-			SAFE_FREE(line);
-			continue;
-		}
+		fprintf(fp, "%10lu %12.1f %10.2f  %s\n",
+			s->count * p->rate,
+			(double)s->total_ns * p->rate / 1000,
+			(double)s->total_ns / s->count / 1000,
+			s->fn < NWRAP_TRACE_FN_MAX ?
+			nwrap_trace_fn_names[s->fn] : "unknown");
 
-		ok = nwrap->parse_line(nwrap, line);
-		if (!ok) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Unable to parse line file: %s",
-				  line);
-			SAFE_FREE(line);
-			return false;
+		syms = backtrace_symbols(s->frames, s->num_frames);
+		for (j = 0; j < s->num_frames; j++) {
+			if (syms != NULL) {
+				fprintf(fp, "%36s %s\n", "", syms[j]);
+			} else {
+				fprintf(fp, "%36s %p\n", "", s->frames[j]);
+			}
 		}
+		free(syms);
+	}
 
-		/* Line is parsed without issues so add it to list */
-		ok = nwrap_vector_add_item(&(nwrap->lines), (void *const) line);
-		if (!ok) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Unable to add line to vector");
-			return false;
-		}
+	if (p->dropped > 0) {
+		fprintf(fp, "%lu samples of more call sites dropped\n",
+			p->dropped);
+	}
 
-		/* This forces getline to allocate new memory for line. */
-		line = NULL;
-	} while (!feof(nwrap->fp));
+	if (fp != stderr) {
+		fclose(fp);
+	}
+}
+#else /* HAVE_BACKTRACE && HAVE_DLADDR */
+static void nwrap_profile_init(const char *rate)
+{
+	(void) rate; /* unused */
 
-	return true;
+	NWRAP_LOG(NWRAP_LOG_ERROR,
+		  "NSS_WRAPPER_PROFILE_RATE needs backtrace() and dladdr()");
 }
 
-static void nwrap_files_cache_unload(struct nwrap_cache *nwrap)
+static void nwrap_profile_add(enum nwrap_trace_fn fn, uint64_t ns)
 {
-	nwrap->unload(nwrap);
+	(void) fn; /* unused */
+	(void) ns; /* unused */
+}
 
-	nwrap_lines_unload(nwrap);
+static void nwrap_profile_report(void)
+{
 }
+#endif /* HAVE_BACKTRACE && HAVE_DLADDR */
 
-static bool nwrap_files_cache_reload(struct nwrap_cache *nwrap)
+/* The wall clock can jump, the header maps the times to it */
+static uint64_t nwrap_trace_now(void)
 {
-	struct stat st;
-	int ret;
-	bool ok;
-	bool retried = false;
+	return nwrap_trace_clock(CLOCK_MONOTONIC);
+}
 
-	assert(nwrap != NULL);
+/*
+ * Returns the start time of a call, which is passed to nwrap_trace_end().
+ * It also decides if the profiler samples the call.
+ */
+static uint64_t nwrap_trace_begin(void)
+{
+	if (nwrap_trace.fd == -1 && nwrap_profile.rate == 0) {
+		return 0;
+	}
 
-reopen:
-	if (nwrap->fd < 0) {
-		nwrap->fp = fopen(nwrap->path, "re");
-		if (nwrap->fp == NULL) {
-			nwrap->fd = -1;
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Unable to open '%s' readonly %d:%s",
-				  nwrap->path, nwrap->fd,
-				  strerror(errno));
-			return false;
+	if (nwrap_profile.rate > 0) {
+		struct nwrap_trace_tls *tls = &nwrap_trace_tls;
 
-		}
-		nwrap->fd = fileno(nwrap->fp);
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Open '%s'", nwrap->path);
+		tls->profile_calls++;
+		tls->profile_sampled =
+			(tls->profile_calls % nwrap_profile.rate) == 0;
 	}
 
-	ret = fstat(nwrap->fd, &st);
-	if (ret != 0) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "fstat(%s) - %d:%s",
-			  nwrap->path,
-			  ret,
-			  strerror(errno));
-		fclose(nwrap->fp);
-		nwrap->fp = NULL;
-		nwrap->fd = -1;
-		return false;
+	return nwrap_trace_now();
+}
+
+static void nwrap_trace_end(uint64_t start,
+			    enum nwrap_trace_fn fn,
+			    const void *key,
+			    size_t key_len,
+			    int32_t arg,
+			    int32_t result)
+{
+	struct nwrap_trace_tls *tls = &nwrap_trace_tls;
+	struct nwrap_trace_record rec;
+	uint64_t now;
+	int saved_errno;
+
+	if (nwrap_trace.fd == -1 && nwrap_profile.rate == 0) {
+		return;
 	}
 
-	if (retried == false && st.st_nlink == 0) {
-		/* maybe someone has replaced the file... */
-		NWRAP_LOG(NWRAP_LOG_TRACE,
-			  "st_nlink == 0, reopen %s",
-			  nwrap->path);
-		retried = true;
-		memset(&nwrap->st, 0, sizeof(nwrap->st));
-		fclose(nwrap->fp);
-		nwrap->fp = NULL;
-		nwrap->fd = -1;
-		goto reopen;
+	/* The caller looks at errno after the call */
+	saved_errno = errno;
+
+	now = nwrap_trace_now();
+
+	if (tls->profile_sampled) {
+		tls->profile_sampled = false;
+		nwrap_profile_add(fn, now > start ? now - start : 0);
+	}
+	if (nwrap_trace.fd == -1) {
+		errno = saved_errno;
+		return;
 	}
 
-	if (st.st_mtime == nwrap->st.st_mtime) {
-		NWRAP_LOG(NWRAP_LOG_TRACE,
-			  "st_mtime[%u] hasn't changed, skip reload",
-			  (unsigned)st.st_mtime);
-		return true;
+	if (tls->buf == NULL) {
+		tls->buf = (char *)malloc(NWRAP_TRACE_BUF_SIZE);
+		if (tls->buf == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			errno = saved_errno;
+			return;
+		}
+		pthread_once(&nwrap_trace_tls_once, nwrap_trace_tls_key_create);
+		pthread_setspecific(nwrap_trace_tls_key, tls);
+
+		NWRAP_LOCK(nwrap_global);
+		tls->thread = ++nwrap_trace.num_threads;
+		NWRAP_UNLOCK(nwrap_global);
 	}
 
-	NWRAP_LOG(NWRAP_LOG_TRACE,
-		  "st_mtime has changed [%u] => [%u], start reload",
-		  (unsigned)st.st_mtime,
-		  (unsigned)nwrap->st.st_mtime);
+	if (key == NULL) {
+		key_len = 0;
+	}
+	if (key_len > NWRAP_TRACE_KEY_MAX) {
+		key_len = NWRAP_TRACE_KEY_MAX;
+	}
+	if (tls->used + sizeof(rec) + key_len > NWRAP_TRACE_BUF_SIZE) {
+		nwrap_trace_flush(tls);
+	}
 
-	nwrap->st = st;
+	rec.time_ns = start;
+	rec.latency_ns = 0;
+	if (now > start) {
+		uint64_t latency = now - start;
 
-	nwrap_files_cache_unload(nwrap);
+		rec.latency_ns = latency > UINT32_MAX ?
+				 UINT32_MAX : (uint32_t)latency;
+	}
+	rec.pid = nwrap_trace.pid;
+	rec.thread = tls->thread;
+	rec.result = result;
+	rec.arg = arg;
+	rec.fn = (uint16_t)fn;
+	rec.key_len = (uint16_t)key_len;
 
-	ok = nwrap_parse_file(nwrap);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Failed to reload %s", nwrap->path);
-		nwrap_files_cache_unload(nwrap);
-		return false;
+	memcpy(tls->buf + tls->used, &rec, sizeof(rec));
+	tls->used += sizeof(rec);
+	if (key_len > 0) {
+		memcpy(tls->buf + tls->used, key, key_len);
+		tls->used += key_len;
 	}
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "Reloaded %s", nwrap->path);
-	return true;
+	errno = saved_errno;
 }
 
-/*
- * the caller has to call nwrap_unload() on failure
- */
-static bool nwrap_pw_parse_line(struct nwrap_cache *nwrap, char *line)
+static void nwrap_trace_name(uint64_t start,
+			     enum nwrap_trace_fn fn,
+			     const char *name,
+			     int32_t arg,
+			     int32_t result)
 {
-	struct nwrap_pw *nwrap_pw;
-	char *c;
-	char *p;
-	char *e;
-	struct passwd *pw;
-	size_t list_size;
+	nwrap_trace_end(start, fn,
+			name, name != NULL ? strlen(name) : 0,
+			arg, result);
+}
 
-	nwrap_pw = (struct nwrap_pw *)nwrap->private_data;
+static void nwrap_trace_id(uint64_t start,
+			   enum nwrap_trace_fn fn,
+			   uint32_t id,
+			   int32_t arg,
+			   int32_t result)
+{
+	nwrap_trace_end(start, fn, &id, sizeof(id), arg, result);
+}
 
-	list_size = sizeof(*nwrap_pw->list) * (nwrap_pw->num+1);
-	pw = (struct passwd *)realloc(nwrap_pw->list, list_size);
-	if (!pw) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "realloc(%u) failed",
-			  (unsigned)list_size);
-		return false;
+static void nwrap_init(void)
+{
+	const char *env;
+	char *endptr;
+	size_t max_hostents_tmp;
+
+	NWRAP_LOCK(nwrap_initialized);
+	if (nwrap_initialized) {
+		NWRAP_UNLOCK(nwrap_initialized);
+		return;
 	}
-	nwrap_pw->list = pw;
 
-	pw = &nwrap_pw->list[nwrap_pw->num];
+	/*
+	 * Still holding nwrap_initialized lock here.
+	 * We don't use NWRAP_(UN)LOCK_ALL macros here because we
+	 * want to avoid overhead when other threads do their job.
+	 */
+	NWRAP_LOCK(nwrap_global);
+	NWRAP_WRLOCK(nwrap_gr_global);
+	NWRAP_WRLOCK(nwrap_he_global);
+	NWRAP_WRLOCK(nwrap_pw_global);
+	NWRAP_WRLOCK(nwrap_sp_global);
+	NWRAP_WRLOCK(nwrap_ng_global);
 
-	c = line;
+	nwrap_initialized = true;
 
-	/* name */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s'",
-			  line,
-			  c);
-		return false;
+	/* Initialize pthread_atfork handlers */
+	pthread_atfork(&nwrap_thread_prepare, &nwrap_thread_parent,
+		       &nwrap_thread_child);
+
+	env = getenv("NSS_WRAPPER_MAX_HOSTENTS");
+	if (env != NULL) {
+		max_hostents_tmp = (size_t)strtol(env, &endptr, 10);
+		if (((env != '\0') && (endptr == '\0')) ||
+		    (max_hostents_tmp == 0)) {
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "Error parsing NSS_WRAPPER_MAX_HOSTENTS "
+				  "value or value is too small. "
+				  "Using default value: %lu.",
+				  (unsigned long)max_hostents);
+		} else {
+			max_hostents = max_hostents_tmp;
+		}
 	}
-	*p = '\0';
-	p++;
-	pw->pw_name = c;
-	c = p;
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Hosts hash table will be sized for %lu items.",
+		  (unsigned long)max_hostents);
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "name[%s]\n", pw->pw_name);
+	nwrap_main_global = &__nwrap_main_global;
 
-	/* password */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid line[%s]: '%s'", line, c);
-		return false;
-	}
-	*p = '\0';
-	p++;
-	pw->pw_passwd = c;
-	c = p;
+#ifndef NO_NSS_SUPPORT
+	nwrap_backend_init(nwrap_main_global);
+#endif
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "password[%s]\n", pw->pw_passwd);
+	/* passwd */
+	nwrap_pw_global.cache = &__nwrap_cache_pw;
 
-	/* uid */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid line[%s]: '%s'", line, c);
-		return false;
-	}
-	*p = '\0';
-	p++;
-	e = NULL;
-	pw->pw_uid = (uid_t)strtoul(c, &e, 10);
-	if (c == e) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
-		return false;
+	nwrap_pw_global.cache->path = getenv("NSS_WRAPPER_PASSWD");
+	nwrap_pw_global.cache->private_data = &nwrap_pw_global;
+	nwrap_pw_global.cache->parse_line = nwrap_pw_parse_line;
+	nwrap_pw_global.cache->unload = nwrap_pw_unload;
+	nwrap_pw_global.cache->mark = nwrap_pw_mark;
+	nwrap_pw_global.cache->truncate = nwrap_pw_truncate;
+	nwrap_pw_global.cache->swap = nwrap_pw_swap;
+	nwrap_pw_global.cache->discard_lines = true;
+
+	/* shadow */
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+	nwrap_sp_global.cache = &__nwrap_cache_sp;
+
+	nwrap_sp_global.cache->path = getenv("NSS_WRAPPER_SHADOW");
+	nwrap_sp_global.cache->private_data = &nwrap_sp_global;
+	nwrap_sp_global.cache->parse_line = nwrap_sp_parse_line;
+	nwrap_sp_global.cache->unload = nwrap_sp_unload;
+	nwrap_sp_global.cache->mark = nwrap_sp_mark;
+	nwrap_sp_global.cache->truncate = nwrap_sp_truncate;
+	nwrap_sp_global.cache->swap = nwrap_sp_swap;
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+
+	/* group */
+	nwrap_gr_global.cache = &__nwrap_cache_gr;
+
+	nwrap_gr_global.cache->path = getenv("NSS_WRAPPER_GROUP");
+	nwrap_gr_global.cache->private_data = &nwrap_gr_global;
+	nwrap_gr_global.cache->parse_line = nwrap_gr_parse_line;
+	nwrap_gr_global.cache->unload = nwrap_gr_unload;
+	nwrap_gr_global.cache->mark = nwrap_gr_mark;
+	nwrap_gr_global.cache->truncate = nwrap_gr_truncate;
+	nwrap_gr_global.cache->swap = nwrap_gr_swap;
+	nwrap_gr_global.cache->discard_lines = true;
+
+	/* hosts */
+	nwrap_he_global.cache = &__nwrap_cache_he;
+
+	nwrap_he_global.cache->path = getenv("NSS_WRAPPER_HOSTS");
+	nwrap_he_global.cache->private_data = &nwrap_he_global;
+	nwrap_he_global.cache->parse_line = nwrap_he_parse_line;
+	nwrap_he_global.cache->unload = nwrap_he_unload;
+	nwrap_he_global.cache->swap = nwrap_he_swap;
+
+#ifdef HAVE_INNETGR
+	/* netgroup */
+	nwrap_ng_global.cache = &__nwrap_cache_ng;
+
+	nwrap_ng_global.cache->path = getenv("NSS_WRAPPER_NETGROUP");
+	nwrap_ng_global.cache->private_data = &nwrap_ng_global;
+	nwrap_ng_global.cache->parse_line = nwrap_ng_parse_line;
+	nwrap_ng_global.cache->unload = nwrap_ng_unload;
+	nwrap_ng_global.cache->swap = nwrap_ng_swap;
+	nwrap_ng_global.cache->discard_lines = true;
+#endif /* HAVE_INNETGR */
+
+	env = getenv("NSS_WRAPPER_HOSTS_STRICT");
+	if (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0) {
+		nwrap_he_global.strict = true;
 	}
-	if (e == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
-		return false;
+
+	env = getenv("NSS_WRAPPER_GAI_CACHE_TTL");
+	if (env != NULL && env[0] != '\0') {
+		long ttl = strtol(env, &endptr, 10);
+
+		if (endptr[0] != '\0' || ttl < 0) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Invalid NSS_WRAPPER_GAI_CACHE_TTL: %s",
+				  env);
+		} else {
+			nwrap_gai_cache.ttl = (time_t)ttl;
+		}
 	}
-	if (e[0] != '\0') {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
-		return false;
+
+	env = getenv("NSS_WRAPPER_GAI_CACHE_POSITIVE");
+	if (env != NULL && env[0] != '\0' && strcmp(env, "0") != 0) {
+		nwrap_gai_cache.positive = true;
 	}
-	c = p;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "uid[%u]", pw->pw_uid);
+	env = getenv("NSS_WRAPPER_TRACE_FILE");
+	if (env != NULL && env[0] != '\0') {
+		nwrap_trace_open(env);
+	}
 
-	/* gid */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid line[%s]: '%s'", line, c);
-		return false;
+	env = getenv("NSS_WRAPPER_PROFILE_RATE");
+	if (env != NULL && env[0] != '\0') {
+		nwrap_profile_init(env);
 	}
-	*p = '\0';
-	p++;
-	e = NULL;
-	pw->pw_gid = (gid_t)strtoul(c, &e, 10);
-	if (c == e) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
-		return false;
+
+	env = getenv("NSS_WRAPPER_RELOAD_INTERVAL");
+	if (env != NULL && env[0] != '\0') {
+		nwrap_reload_init(env);
 	}
-	if (e == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
+
+	__atomic_store_n(&nwrap_init_done, true, __ATOMIC_RELEASE);
+
+	NWRAP_RWUNLOCK(nwrap_ng_global);
+	NWRAP_RWUNLOCK(nwrap_sp_global);
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+	NWRAP_RWUNLOCK(nwrap_he_global);
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+	NWRAP_UNLOCK(nwrap_global);
+	NWRAP_UNLOCK(nwrap_initialized);
+}
+
+bool nss_wrapper_enabled(void)
+{
+	nwrap_init();
+
+	if (nwrap_pw_global.cache->path == NULL ||
+	    nwrap_pw_global.cache->path[0] == '\0') {
 		return false;
 	}
-	if (e[0] != '\0') {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
+	if (nwrap_gr_global.cache->path == NULL ||
+	    nwrap_gr_global.cache->path[0] == '\0') {
 		return false;
 	}
-	c = p;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "gid[%u]\n", pw->pw_gid);
+	return true;
+}
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+bool nss_wrapper_shadow_enabled(void)
+{
+	nwrap_init();
 
-	/* gecos */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "invalid line[%s]: '%s'", line, c);
+	if (nwrap_sp_global.cache->path == NULL ||
+	    nwrap_sp_global.cache->path[0] == '\0') {
 		return false;
 	}
-	*p = '\0';
-	p++;
-	pw->pw_gecos = c;
-	c = p;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "gecos[%s]", pw->pw_gecos);
+	return true;
+}
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+
+#ifdef HAVE_INNETGR
+bool nss_wrapper_netgroup_enabled(void)
+{
+	nwrap_init();
 
-	/* dir */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "'%s'", c);
+	if (nwrap_ng_global.cache->path == NULL ||
+	    nwrap_ng_global.cache->path[0] == '\0') {
 		return false;
 	}
-	*p = '\0';
-	p++;
-	pw->pw_dir = c;
-	c = p;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "dir[%s]", pw->pw_dir);
-
-	/* shell */
-	pw->pw_shell = c;
-	NWRAP_LOG(NWRAP_LOG_TRACE, "shell[%s]", pw->pw_shell);
+	return true;
+}
+#endif /* HAVE_INNETGR */
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "Added user[%s:%s:%u:%u:%s:%s:%s]",
-		  pw->pw_name, pw->pw_passwd,
-		  pw->pw_uid, pw->pw_gid,
-		  pw->pw_gecos, pw->pw_dir, pw->pw_shell);
+bool nss_wrapper_hosts_enabled(void)
+{
+	nwrap_init();
+
+	if (nwrap_he_global.cache->path == NULL ||
+	    nwrap_he_global.cache->path[0] == '\0') {
+		return false;
+	}
 
-	nwrap_pw->num++;
 	return true;
 }
 
-static void nwrap_pw_unload(struct nwrap_cache *nwrap)
+static bool nwrap_hostname_enabled(void)
 {
-	struct nwrap_pw *nwrap_pw;
-	nwrap_pw = (struct nwrap_pw *)nwrap->private_data;
+	nwrap_init();
 
-	SAFE_FREE(nwrap_pw->list);
-	nwrap_pw->num = 0;
-	nwrap_pw->idx = 0;
+	if (getenv("NSS_WRAPPER_HOSTNAME") == NULL) {
+		return false;
+	}
+
+	return true;
 }
 
-static int nwrap_pw_copy_r(const struct passwd *src, struct passwd *dst,
-			   char *buf, size_t buflen, struct passwd **dstp)
+/* The parsers modify the line, so the memory layer is parsed from copies */
+static bool nwrap_parse_mem_line(struct nwrap_cache *nwrap, const char *line)
 {
-	char *first;
-	char *last;
-	off_t ofs;
-
-	first = src->pw_name;
-
-	last = src->pw_shell;
-	while (*last) last++;
-
-	ofs = PTR_DIFF(last + 1, first);
+	char *copy;
+	bool ok;
 
-	if (ofs > (off_t) buflen) {
-		return ERANGE;
+	copy = strdup(line);
+	if (copy == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
 	}
 
-	memcpy(buf, first, ofs);
+	ok = nwrap->parse_line(nwrap, copy);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to parse line: %s", line);
+		SAFE_FREE(copy);
+		return false;
+	}
 
-	ofs = PTR_DIFF(src->pw_name, first);
-	dst->pw_name = buf + ofs;
-	ofs = PTR_DIFF(src->pw_passwd, first);
-	dst->pw_passwd = buf + ofs;
-	dst->pw_uid = src->pw_uid;
-	dst->pw_gid = src->pw_gid;
-	ofs = PTR_DIFF(src->pw_gecos, first);
-	dst->pw_gecos = buf + ofs;
-	ofs = PTR_DIFF(src->pw_dir, first);
-	dst->pw_dir = buf + ofs;
-	ofs = PTR_DIFF(src->pw_shell, first);
-	dst->pw_shell = buf + ofs;
+	if (nwrap->discard_lines) {
+		SAFE_FREE(copy);
+		return true;
+	}
 
-	if (dstp) {
-		*dstp = dst;
+	ok = nwrap_vector_add_item(&(nwrap->lines), (void *const) copy);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add line to vector");
+		return false;
 	}
 
-	return 0;
+	return true;
 }
 
-#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
-static bool nwrap_sp_parse_line(struct nwrap_cache *nwrap, char *line)
+static bool nwrap_parse_file(struct nwrap_cache *nwrap,
+			     struct nwrap_layer *layer)
 {
-	struct nwrap_sp *nwrap_sp;
-	struct spwd *sp;
-	size_t list_size;
-	char *c;
-	char *e;
-	char *p;
-
-	nwrap_sp = (struct nwrap_sp *)nwrap->private_data;
+	const char *mem_line;
+	char *line = NULL;
+	ssize_t n;
+	/* Unused but getline needs it */
+	size_t len;
+	size_t i;
+	bool ok;
 
-	list_size = sizeof(*nwrap_sp->list) * (nwrap_sp->num+1);
-	sp = (struct spwd *)realloc(nwrap_sp->list, list_size);
-	if (sp == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "realloc(%u) failed",
-			  (unsigned)list_size);
-		return false;
+	if (layer->path == NULL) {
+		nwrap_vector_foreach(mem_line, nwrap->mem_lines, i) {
+			ok = nwrap_parse_mem_line(nwrap, mem_line);
+			if (!ok) {
+				return false;
+			}
+		}
+		return true;
 	}
-	nwrap_sp->list = sp;
-
-	sp = &nwrap_sp->list[nwrap_sp->num];
 
-	c = line;
+	if (layer->st.st_size == 0) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "size == 0");
+		return true;
+	}
 
-	/* name */
-	p = strchr(c, ':');
-	if (p == NULL) {
+	/* Support for 32-bit system I guess */
+	if (layer->st.st_size > INT32_MAX) {
 		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "name -- Invalid line[%s]: '%s'",
-			  line,
-			  c);
+			  "Size[%u] larger than INT32_MAX",
+			  (unsigned)layer->st.st_size);
 		return false;
 	}
-	*p = '\0';
-	p++;
-	sp->sp_namp = c;
-	c = p;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "name[%s]\n", sp->sp_namp);
+	rewind(layer->fp);
 
-	/* pwd */
-	p = strchr(c, ':');
-	if (p == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "pwd -- Invalid line[%s]: '%s'",
-			  line,
-			  c);
-		return false;
-	}
-	*p = '\0';
-	p++;
-	sp->sp_pwdp = c;
-	c = p;
+	do {
+		n = getline(&line, &len, layer->fp);
+		if (n < 0) {
+			SAFE_FREE(line);
+			if (feof(layer->fp)) {
+				break;
+			}
 
-	/* lstchg (long) */
-	if (c[0] == ':') {
-		sp->sp_lstchg = -1;
-		p++;
-	} else {
-		p = strchr(c, ':');
-		if (p == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "lstchg -- Invalid line[%s]: '%s'",
-				  line,
-				  c);
-			return false;
-		}
-		*p = '\0';
-		p++;
-		sp->sp_lstchg = strtol(c, &e, 10);
-		if (c == e) {
 			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "lstchg -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "lstchg -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e[0] != '\0') {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "lstchg -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
+				  "Unable to read line from file: %s",
+				  layer->path);
 			return false;
 		}
-	}
-	c = p;
 
-	/* min (long) */
-	if (c[0] == ':') {
-		sp->sp_min = -1;
-		p++;
-	} else {
-		p = strchr(c, ':');
-		if (p == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "min -- Invalid line[%s]: '%s'",
-				  line,
-				  c);
-			return false;
-		}
-		*p = '\0';
-		p++;
-		sp->sp_min = strtol(c, &e, 10);
-		if (c == e) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "min -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "min -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e[0] != '\0') {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "min -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
+		if (line[n - 1] == '\n') {
+			line[n - 1] = '\0';
 		}
-	}
-	c = p;
 
-	/* max (long) */
-	if (c[0] == ':') {
-		sp->sp_max = -1;
-		p++;
-	} else {
-		p = strchr(c, ':');
-		if (p == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "max -- Invalid line[%s]: '%s'",
-				  line,
-				  c);
-			return false;
-		}
-		*p = '\0';
-		p++;
-		sp->sp_max = strtol(c, &e, 10);
-		if (c == e) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "max -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "max -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e[0] != '\0') {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "max -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
+		if (line[0] == '\0') {
+			SAFE_FREE(line);
+			continue;
 		}
-	}
-	c = p;
 
-	/* warn (long) */
-	if (c[0] == ':') {
-		sp->sp_warn = -1;
-		p++;
-	} else {
-		p = strchr(c, ':');
-		if (p == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "warn -- Invalid line[%s]: '%s'",
-				  line,
-				  c);
-			return false;
-		}
-		*p = '\0';
-		p++;
-		sp->sp_warn = strtol(c, &e, 10);
-		if (c == e) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "warn -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "warn -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e[0] != '\0') {
+		ok = nwrap->parse_line(nwrap, line);
+		if (!ok) {
 			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "warn -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
+				  "Unable to parse line file: %s",
+				  line);
+			SAFE_FREE(line);
 			return false;
 		}
-	}
-	c = p;
 
-	/* inact (long) */
-	if (c[0] == ':') {
-		sp->sp_inact = -1;
-		p++;
-	} else {
-		p = strchr(c, ':');
-		if (p == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "inact -- Invalid line[%s]: '%s'",
-				  line,
-				  c);
-			return false;
-		}
-		*p = '\0';
-		p++;
-		sp->sp_inact = strtol(c, &e, 10);
-		if (c == e) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "inact -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "inact -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e[0] != '\0') {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "inact -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
+		if (nwrap->discard_lines) {
+			/* Let getline reuse the buffer */
+			continue;
 		}
-	}
-	c = p;
 
-	/* expire (long) */
-	if (c[0] == ':') {
-		sp->sp_expire = -1;
-		p++;
-	} else {
-		p = strchr(c, ':');
-		if (p == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "expire -- Invalid line[%s]: '%s'",
-				  line,
-				  c);
-			return false;
-		}
-		*p = '\0';
-		p++;
-		sp->sp_expire = strtol(c, &e, 10);
-		if (c == e) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "expire -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e == NULL) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "expire -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
-			return false;
-		}
-		if (e[0] != '\0') {
+		/* Line is parsed without issues so add it to list */
+		ok = nwrap_vector_add_item(&(nwrap->lines), (void *const) line);
+		if (!ok) {
 			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "expire -- Invalid line[%s]: '%s' - %s",
-				  line, c, strerror(errno));
+				  "Unable to add line to vector");
 			return false;
 		}
-	}
-	c = p;
 
-	nwrap_sp->num++;
+		/* This forces getline to allocate new memory for line. */
+		line = NULL;
+	} while (!feof(layer->fp));
+
+	SAFE_FREE(line);
+
 	return true;
 }
 
-static void nwrap_sp_unload(struct nwrap_cache *nwrap)
+static void nwrap_files_cache_unload(struct nwrap_cache *nwrap)
 {
-	struct nwrap_sp *nwrap_sp;
-	nwrap_sp = (struct nwrap_sp *)nwrap->private_data;
+	nwrap->unload(nwrap);
 
-	SAFE_FREE(nwrap_sp->list);
-	nwrap_sp->num = 0;
-	nwrap_sp->idx = 0;
+	nwrap_lines_unload(nwrap);
 }
-#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
-/*
- * the caller has to call nwrap_unload() on failure
- */
-static bool nwrap_gr_parse_line(struct nwrap_cache *nwrap, char *line)
+/* Free the lines of the layers which get reparsed */
+static void nwrap_lines_truncate(struct nwrap_cache *nwrap, size_t count)
 {
-	struct nwrap_gr *nwrap_gr;
-	char *c;
-	char *p;
-	char *e;
-	struct group *gr;
-	size_t list_size;
-	unsigned nummem;
+	size_t i;
 
-	nwrap_gr = (struct nwrap_gr *)nwrap->private_data;
+	for (i = count; i < nwrap->lines.count; i++) {
+		SAFE_FREE(nwrap->lines.items[i]);
+	}
+	if (nwrap->lines.count > count) {
+		nwrap->lines.count = count;
+		nwrap->lines.items[count] = NULL;
+	}
+}
 
-	list_size = sizeof(*nwrap_gr->list) * (nwrap_gr->num+1);
-	gr = (struct group *)realloc(nwrap_gr->list, list_size);
-	if (!gr) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "realloc failed");
-		return false;
+static void nwrap_layer_close(struct nwrap_layer *layer)
+{
+	if (layer->fp != NULL) {
+		fclose(layer->fp);
+		layer->fp = NULL;
 	}
-	nwrap_gr->list = gr;
+	layer->fd = -1;
+	memset(&layer->st, 0, sizeof(layer->st));
+}
 
-	gr = &nwrap_gr->list[nwrap_gr->num];
+static void nwrap_layers_free(struct nwrap_cache *nwrap)
+{
+	void *line;
+	size_t i;
 
-	c = line;
+	for (i = 0; i < nwrap->num_layers; i++) {
+		nwrap_layer_close(&nwrap->layers[i]);
+		SAFE_FREE(nwrap->layers[i].path);
+	}
+	SAFE_FREE(nwrap->layers);
+	nwrap->num_layers = 0;
 
-	/* name */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid line[%s]: '%s'", line, c);
-		return false;
+	for (i = 0; i < nwrap->num_dirs; i++) {
+		SAFE_FREE(nwrap->dirs[i].path);
 	}
-	*p = '\0';
-	p++;
-	gr->gr_name = c;
-	c = p;
+	SAFE_FREE(nwrap->dirs);
+	nwrap->num_dirs = 0;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "name[%s]", gr->gr_name);
-
-	/* password */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid line[%s]: '%s'", line, c);
-		return false;
+	nwrap_vector_foreach(line, nwrap->mem_lines, i) {
+		SAFE_FREE(line);
 	}
-	*p = '\0';
-	p++;
-	gr->gr_passwd = c;
-	c = p;
+	SAFE_FREE(nwrap->mem_lines.items);
+	ZERO_STRUCTP(&nwrap->mem_lines);
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "password[%s]", gr->gr_passwd);
+	nwrap->scanned = false;
+}
 
-	/* gid */
-	p = strchr(c, ':');
-	if (!p) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid line[%s]: '%s'", line, c);
-		return false;
-	}
-	*p = '\0';
-	p++;
-	e = NULL;
-	gr->gr_gid = (gid_t)strtoul(c, &e, 10);
-	if (c == e) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
+static bool nwrap_layers_add(struct nwrap_layer **layers,
+			     size_t *num_layers,
+			     const char *path,
+			     size_t len)
+{
+	struct nwrap_layer *tmp;
+	struct nwrap_layer *layer;
+
+	tmp = (struct nwrap_layer *)realloc(*layers,
+			(*num_layers + 1) * sizeof(struct nwrap_layer));
+	if (tmp == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
 		return false;
 	}
-	if (e == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
-		return false;
+	*layers = tmp;
+
+	layer = &tmp[*num_layers];
+	ZERO_STRUCTP(layer);
+	layer->fd = -1;
+	if (path != NULL) {
+		layer->path = strndup(path, len);
+		if (layer->path == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			return false;
+		}
 	}
-	if (e[0] != '\0') {
+	(*num_layers)++;
+
+	return true;
+}
+
+static int nwrap_strcmp_p(const void *p1, const void *p2)
+{
+	return strcmp(*(char * const *)p1, *(char * const *)p2);
+}
+
+/*
+ * Add the files of a drop-in directory in alphabetical order. Hidden files
+ * and backups ending with '~' are skipped.
+ */
+static bool nwrap_layers_add_dir(struct nwrap_layer **layers,
+				 size_t *num_layers,
+				 const char *dir)
+{
+	struct nwrap_vector names;
+	struct dirent *de;
+	DIR *d;
+	size_t i;
+	bool ok = true;
+
+	d = opendir(dir);
+	if (d == NULL) {
 		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s' - %s",
-			  line, c, strerror(errno));
+			  "Unable to open directory '%s': %s",
+			  dir, strerror(errno));
 		return false;
 	}
-	c = p;
 
-	NWRAP_LOG(NWRAP_LOG_TRACE, "gid[%u]", gr->gr_gid);
-
-	/* members */
-	gr->gr_mem = (char **)malloc(sizeof(char *));
-	if (!gr->gr_mem) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+	ok = nwrap_vector_init(&names);
+	if (!ok) {
+		closedir(d);
 		return false;
 	}
-	gr->gr_mem[0] = NULL;
 
-	for(nummem=0; p; nummem++) {
-		char **m;
-		size_t m_size;
-		c = p;
-		p = strchr(c, ',');
-		if (p) {
-			*p = '\0';
-			p++;
+	while (ok && (de = readdir(d)) != NULL) {
+		size_t len = strlen(de->d_name);
+		struct stat st;
+		char *path;
+		int ret;
+
+		if (de->d_name[0] == '.' || de->d_name[len - 1] == '~') {
+			continue;
 		}
 
-		if (strlen(c) == 0) {
+		ret = asprintf(&path, "%s/%s", dir, de->d_name);
+		if (ret == -1) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			ok = false;
 			break;
 		}
 
-		m_size = sizeof(char *) * (nummem+2);
-		m = (char **)realloc(gr->gr_mem, m_size);
-		if (!m) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "realloc(%zd) failed",
-				  m_size);
-			return false;
+		ret = stat(path, &st);
+		if (ret != 0 || !S_ISREG(st.st_mode)) {
+			SAFE_FREE(path);
+			continue;
 		}
-		gr->gr_mem = m;
-		gr->gr_mem[nummem] = c;
-		gr->gr_mem[nummem+1] = NULL;
 
-		NWRAP_LOG(NWRAP_LOG_TRACE,
-			  "member[%u]: '%s'",
-			  nummem, gr->gr_mem[nummem]);
+		ok = nwrap_vector_add_item(&names, path);
+		if (!ok) {
+			SAFE_FREE(path);
+		}
 	}
+	closedir(d);
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "Added group[%s:%s:%u:] with %u members",
-		  gr->gr_name, gr->gr_passwd, gr->gr_gid, nummem);
-
-	nwrap_gr->num++;
-	return true;
-}
+	if (ok && names.count > 0) {
+		qsort(names.items, names.count, sizeof(void *), nwrap_strcmp_p);
+	}
 
-static void nwrap_gr_unload(struct nwrap_cache *nwrap)
-{
-	int i;
-	struct nwrap_gr *nwrap_gr;
-	nwrap_gr = (struct nwrap_gr *)nwrap->private_data;
+	for (i = 0; i < names.count; i++) {
+		const char *path = (const char *)names.items[i];
 
-	if (nwrap_gr->list) {
-		for (i=0; i < nwrap_gr->num; i++) {
-			SAFE_FREE(nwrap_gr->list[i].gr_mem);
+		if (ok) {
+			ok = nwrap_layers_add(layers, num_layers,
+					      path, strlen(path));
 		}
-		SAFE_FREE(nwrap_gr->list);
+		SAFE_FREE(names.items[i]);
 	}
+	SAFE_FREE(names.items);
 
-	nwrap_gr->num = 0;
-	nwrap_gr->idx = 0;
+	return ok;
 }
 
-#define align_address_charptr(d) \
-	((char *)(((uintptr_t)(d) + 15) & ~(uintptr_t)0x0F));
-
-/* Function silently expect alignment of buf address */
-static int nwrap_gr_copy_r(const struct group *src, struct group *dst,
-			   char *buf, size_t buflen, struct group **dstp)
-{
-	unsigned i;
-	char *new_addr;
-
-	/* Count size of bytes needed. We lost track of counts and we need alignment. */
-	new_addr = (char *)((uintptr_t)buf + (uintptr_t)(strlen(src->gr_name) + strlen(src->gr_passwd) + 2));
-
-	for (i=0; src->gr_mem[i]; ++i);
-	new_addr = align_address_charptr(new_addr + ((i + 1) * sizeof(char *)));
-	for (i=0; src->gr_mem[i]; ++i) {
-		new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)(strlen(src->gr_mem[i]) + 1));
-	}
+/*
+ * Build the list of layers from the colon separated path. The layers which
+ * are still the same file are kept, *pfirst is set to the index of the first
+ * layer which is new or dropped and *pmark to the size of the database
+ * before it. If the list is the same, *pfirst is set to SIZE_MAX.
+ */
+static bool nwrap_layers_scan(struct nwrap_cache *nwrap,
+			      size_t *pfirst,
+			      struct nwrap_mark *pmark)
+{
+	struct nwrap_layer *layers = NULL;
+	size_t num_layers = 0;
+	struct nwrap_layer_dir *dirs = NULL;
+	size_t num_dirs = 0;
+	const char *p = nwrap->path;
+	bool list = p != NULL && strchr(p, ':') != NULL;
+	size_t first;
+	size_t i;
+	bool ok = true;
+
+	while (ok && p != NULL && p[0] != '\0') {
+		const char *e = strchr(p, ':');
+		size_t len = e != NULL ? (size_t)(e - p) : strlen(p);
+		struct nwrap_layer_dir *tmp;
+		struct stat st;
+		bool missing = false;
+		char *path;
+		int ret;
 
-	if ((uintptr_t)PTR_DIFF(new_addr, buf) > (uintptr_t)buflen) {
-		*dstp = NULL;
-		return ERANGE;
-	}
+		if (len == 0) {
+			p = e != NULL ? e + 1 : NULL;
+			continue;
+		}
 
+		path = strndup(p, len);
+		if (path == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			ok = false;
+			break;
+		}
 
-	/* Point new_addr to buf again */
-	new_addr = buf;
+		ret = stat(path, &st);
+		if (ret != 0 && errno == ENOENT && list) {
+			/*
+			 * A drop-in directory of a list may not exist yet, it
+			 * is watched like a directory until it shows up.
+			 */
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "Skipping missing '%s' of %s",
+				  path, nwrap->path);
+			memset(&st, 0, sizeof(st));
+			missing = true;
+		} else if (ret != 0 || !S_ISDIR(st.st_mode)) {
+			/* A missing file is reported when it gets opened */
+			ok = nwrap_layers_add(&layers, &num_layers, path, len);
+			SAFE_FREE(path);
+			p = e != NULL ? e + 1 : NULL;
+			continue;
+		}
 
-	dst->gr_gid = src->gr_gid;
+		tmp = (struct nwrap_layer_dir *)realloc(dirs,
+				(num_dirs + 1) * sizeof(struct nwrap_layer_dir));
+		if (tmp == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			SAFE_FREE(path);
+			ok = false;
+			break;
+		}
+		dirs = tmp;
+		dirs[num_dirs].path = path;
+		dirs[num_dirs].st = st;
+		dirs[num_dirs].missing = missing;
+		num_dirs++;
 
-	memcpy((void *)new_addr, src->gr_name, strlen(src->gr_name) + 1);
-	dst->gr_name = new_addr;
-	new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)(strlen(src->gr_name) + 1));
+		if (!missing) {
+			ok = nwrap_layers_add_dir(&layers, &num_layers, path);
+		}
+		p = e != NULL ? e + 1 : NULL;
+	}
 
-	memcpy((void *)new_addr, src->gr_passwd, strlen(src->gr_passwd) + 1);
-	dst->gr_passwd = new_addr;
+	if (ok) {
+		/* The memory layer for nss_wrapper_add_user() and friends */
+		ok = nwrap_layers_add(&layers, &num_layers, NULL, 0);
+	}
 
-	/* Allocate alignmed space for field of pointers */
-	new_addr = align_address_charptr(new_addr + strlen(src->gr_passwd) + 1);
-	dst->gr_mem = (char **) new_addr;
+	if (!ok) {
+		for (i = 0; i < num_layers; i++) {
+			SAFE_FREE(layers[i].path);
+		}
+		SAFE_FREE(layers);
+		for (i = 0; i < num_dirs; i++) {
+			SAFE_FREE(dirs[i].path);
+		}
+		SAFE_FREE(dirs);
+		return false;
+	}
 
-	new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)((i + 1) * sizeof(char *))); 
+	/* Keep the open files and marks of the unchanged layers */
+	for (first = 0;
+	     first < num_layers && first < nwrap->num_layers;
+	     first++) {
+		const char *path = layers[first].path;
+		const char *old_path = nwrap->layers[first].path;
 
-	for (i=0; src->gr_mem[i]; ++i) {
-		memcpy((void *)new_addr, src->gr_mem[i], strlen(src->gr_mem[i]) + 1);
-		dst->gr_mem[i] = new_addr;
-		new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)(strlen(src->gr_mem[i]) + 1));
+		if (path == NULL || old_path == NULL) {
+			if (path != old_path) {
+				break;
+			}
+		} else if (strcmp(path, old_path) != 0) {
+			break;
+		}
+		SAFE_FREE(layers[first].path);
+		layers[first] = nwrap->layers[first];
+		nwrap->layers[first].path = NULL;
+		nwrap->layers[first].fp = NULL;
 	}
-	dst->gr_mem[i] = NULL;
-	if (dstp) {
-		*dstp = dst;
+	if (first < nwrap->num_layers) {
+		/* Drop what the first replaced layer and the later ones added */
+		*pmark = nwrap->layers[first].mark;
+	} else {
+		/* Layers were only added */
+		ZERO_STRUCTP(pmark);
+		if (nwrap->mark != NULL) {
+			nwrap->mark(nwrap, pmark);
+		}
+		pmark->num_lines = nwrap->lines.count;
 	}
 
-	return 0;
-}
-
-static struct nwrap_entlist *nwrap_entlist_init(struct nwrap_entdata *ed)
-{
-	struct nwrap_entlist *el;
-
-	if (ed == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "entry is NULL, can't create list item");
-		return NULL;
+	for (i = 0; i < nwrap->num_layers; i++) {
+		nwrap_layer_close(&nwrap->layers[i]);
+		SAFE_FREE(nwrap->layers[i].path);
+	}
+	SAFE_FREE(nwrap->layers);
+	for (i = 0; i < nwrap->num_dirs; i++) {
+		SAFE_FREE(nwrap->dirs[i].path);
 	}
+	SAFE_FREE(nwrap->dirs);
 
-	el = (struct nwrap_entlist *)malloc(sizeof(struct nwrap_entlist));
-	if (el == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "malloc failed");
-		return NULL;
+	if (first == num_layers && first == nwrap->num_layers) {
+		/* Nothing was added or dropped */
+		first = SIZE_MAX;
 	}
 
-	el->next = NULL;
-	el->ed = ed;
+	nwrap->layers = layers;
+	nwrap->num_layers = num_layers;
+	nwrap->dirs = dirs;
+	nwrap->num_dirs = num_dirs;
+	nwrap->scanned = true;
 
-	return el;
-}
+	*pfirst = first;
 
-static bool nwrap_ed_inventarize_add_new(char *const h_name,
-					 struct nwrap_entdata *const ed)
+	return true;
+}
+/*
+ * Files of a test are often rewritten within the same second, so compare the
+ * nanoseconds of the mtime and the inode too.
+ */
+static bool nwrap_stat_equal(const struct stat *st1, const struct stat *st2)
 {
-	ENTRY e;
-	ENTRY *p;
-	struct nwrap_entlist *el;
-	bool ok;
-
-	if (h_name == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "h_name NULL - can't add");
+	if (st1->st_mtime != st2->st_mtime ||
+	    st1->st_size != st2->st_size ||
+	    st1->st_ino != st2->st_ino) {
 		return false;
 	}
-
-	el = nwrap_entlist_init(ed);
-	if (el == NULL) {
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+	if (st1->st_mtim.tv_nsec != st2->st_mtim.tv_nsec) {
 		return false;
 	}
-
-#ifdef OSX
-	e.key = strdup(h_name);
-#else
-	e.key = h_name;
 #endif
-	e.data = (void *)el;
-
-	p = hsearch(e, ENTER);
-	if (p == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Hash table is full!");
-		return false;
-	}
-
-	ok = nwrap_vector_add_item(&(nwrap_he_global.lists), (void *)el);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Failed to add list entry to vector.");
-		return false;
-	}
 
 	return true;
 }
 
-static bool nwrap_ed_inventarize_add_to_existing(struct nwrap_entdata *const ed,
-						 struct nwrap_entlist *const el)
+/* Open the file of the layer if needed and check if it has been changed */
+static bool nwrap_layer_check(struct nwrap_layer *layer, bool *pchanged)
 {
-	struct nwrap_entlist *cursor;
-	struct nwrap_entlist *el_new;
+	struct stat st;
+	int ret;
+	bool retried = false;
 
-	if (el == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "list is NULL, can not add");
-		return false;
+	if (layer->path == NULL) {
+		/* The memory layer is only changed by the mutation functions */
+		*pchanged = false;
+		return true;
 	}
 
-
-	for (cursor = el; cursor->next != NULL; cursor = cursor->next)
-	{
-		if (cursor->ed == ed) {
+reopen:
+	if (layer->fd < 0) {
+		layer->fp = fopen(layer->path, "re");
+		if (layer->fp == NULL) {
+			layer->fd = -1;
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Unable to open '%s' readonly %d:%s",
+				  layer->path, layer->fd,
+				  strerror(errno));
 			return false;
+
 		}
+		layer->fd = fileno(layer->fp);
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "Open '%s'", layer->path);
 	}
 
-	if (cursor->ed == ed) {
+	ret = fstat(layer->fd, &st);
+	if (ret != 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "fstat(%s) - %d:%s",
+			  layer->path,
+			  ret,
+			  strerror(errno));
+		nwrap_layer_close(layer);
 		return false;
 	}
 
-	el_new = nwrap_entlist_init(ed);
-	if (el_new == NULL) {
-		return false;
+	if (retried == false && st.st_nlink == 0) {
+		/* maybe someone has replaced the file... */
+		NWRAP_LOG(NWRAP_LOG_TRACE,
+			  "st_nlink == 0, reopen %s",
+			  layer->path);
+		retried = true;
+		nwrap_layer_close(layer);
+		goto reopen;
+	}
+
+	if (nwrap_stat_equal(&st, &layer->st)) {
+		NWRAP_LOG(NWRAP_LOG_TRACE,
+			  "st_mtime[%u] hasn't changed, skip reload",
+			  (unsigned)st.st_mtime);
+		*pchanged = false;
+		return true;
 	}
 
-	cursor->next = el_new;
+	NWRAP_LOG(NWRAP_LOG_TRACE,
+		  "st_mtime has changed [%u] => [%u], start reload",
+		  (unsigned)st.st_mtime,
+		  (unsigned)layer->st.st_mtime);
+
+	layer->st = st;
+	*pchanged = true;
+
 	return true;
 }
 
-static bool nwrap_ed_inventarize(char *const name,
-				 struct nwrap_entdata *const ed)
+/* A file was added to or removed from a drop-in directory */
+static bool nwrap_layer_dirs_changed(const struct nwrap_cache *nwrap)
 {
-	ENTRY e;
-	ENTRY *p;
-	bool ok;
-
-	e.key = name;
-	e.data = NULL;
-
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "Searching name: %s", e.key);
+	size_t i;
 
-	p = hsearch(e, FIND);
-	if (p == NULL) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s not found. Adding...", name);
-		ok = nwrap_ed_inventarize_add_new(name, ed);
-	} else {
-		struct nwrap_entlist *el = (struct nwrap_entlist *)p->data;
+	for (i = 0; i < nwrap->num_dirs; i++) {
+		const struct nwrap_layer_dir *dir = &nwrap->dirs[i];
+		struct stat st;
+		int ret;
 
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s found. Add record to list.", name);
-		ok = nwrap_ed_inventarize_add_to_existing(ed, el);
+		ret = stat(dir->path, &st);
+		if (ret != 0 && errno == ENOENT && dir->missing) {
+			continue;
+		}
+		if (ret != 0 || dir->missing ||
+		    !nwrap_stat_equal(&st, &dir->st)) {
+			return true;
+		}
 	}
 
-	return ok;
+	return false;
 }
 
-static bool nwrap_add_hname(struct nwrap_entdata *const ed)
+static bool nwrap_files_cache_reload(struct nwrap_cache *nwrap)
 {
-	char *const h_name = (char *const)(ed->ht.h_name);
-	unsigned i;
+	struct nwrap_mark mark;
+	size_t first = SIZE_MAX;
+	bool check_files = true;
+	size_t i;
 	bool ok;
 
-	ok = nwrap_ed_inventarize(h_name, ed);
-	if (!ok) {
-		return false;
-	}
-
-	if (ed->ht.h_aliases == NULL) {
-		return true;
-	}
-
-	/* Itemize aliases */
-	for (i = 0; ed->ht.h_aliases[i] != NULL; ++i) {
-		char *h_name_alias;
+	assert(nwrap != NULL);
 
-		h_name_alias = ed->ht.h_aliases[i];
+	ZERO_STRUCTP(&mark);
 
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Add alias: %s", h_name_alias);
+	if (nwrap->background && nwrap->loaded) {
+		/*
+		 * The reloader thread checks the files, only the changes of
+		 * the memory layer are parsed here.
+		 */
+		nwrap_reload_start();
+		check_files = false;
+	}
 
-		if (!nwrap_ed_inventarize(h_name_alias, ed)) {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Unable to add alias: %s", h_name_alias);
+	if (check_files &&
+	    (!nwrap->scanned || nwrap_layer_dirs_changed(nwrap))) {
+		ok = nwrap_layers_scan(nwrap, &first, &mark);
+		if (!ok) {
 			return false;
 		}
 	}
 
-	return true;
-}
+	for (i = 0; i < nwrap->num_layers; i++) {
+		bool changed = false;
 
-static bool nwrap_he_parse_line(struct nwrap_cache *nwrap, char *line)
-{
-	struct nwrap_he *nwrap_he = (struct nwrap_he *)nwrap->private_data;
-	bool do_aliases = true;
-	ssize_t aliases_count = 0;
-	char *p;
-	char *i;
-	char *n;
+		if (check_files) {
+			ok = nwrap_layer_check(&nwrap->layers[i], &changed);
+			if (!ok) {
+				return false;
+			}
+		}
+		if ((changed || nwrap->layers[i].dirty) && i < first) {
+			first = i;
+			mark = nwrap->layers[i].mark;
+		}
+	}
 
-	char *ip;
-	bool ok;
+	if (first == SIZE_MAX) {
+		return true;
+	}
 
-	struct nwrap_entdata *ed = (struct nwrap_entdata *)
-				   malloc(sizeof(struct nwrap_entdata));
-	if (ed == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Unable to allocate memory for nwrap_entdata");
-		return false;
+	if (first == 0 || nwrap->truncate == NULL) {
+		nwrap_files_cache_unload(nwrap);
+		first = 0;
+	} else {
+		/* The layers which get reparsed are empty for now */
+		for (i = first; i < nwrap->num_layers; i++) {
+			nwrap->layers[i].mark = mark;
+		}
+		nwrap->truncate(nwrap, &mark);
+		nwrap_lines_truncate(nwrap, mark.num_lines);
 	}
-	ZERO_STRUCTP(ed);
 
-	i = line;
+	for (i = first; i < nwrap->num_layers; i++) {
+		struct nwrap_layer *layer = &nwrap->layers[i];
 
-	/*
-	 * IP
-	 */
+		ZERO_STRUCTP(&layer->mark);
+		if (nwrap->mark != NULL) {
+			nwrap->mark(nwrap, &layer->mark);
+		}
+		layer->mark.num_lines = nwrap->lines.count;
 
-	/* Walk to first char */
-	for (p = i; *p != '.' && *p != ':' && !isxdigit((int) *p); p++) {
-		if (*p == '\0') {
+		ok = nwrap_parse_file(nwrap, layer);
+		if (!ok) {
 			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Invalid line[%s]: '%s'",
-				  line, i);
-			free(ed);
+				  "Failed to reload %s",
+				  layer->path != NULL ? layer->path : "memory layer");
+			nwrap_files_cache_unload(nwrap);
+			/* Parse everything again on the next call */
+			for (i = 0; i < nwrap->num_layers; i++) {
+				nwrap->layers[i].dirty = true;
+			}
+			nwrap->loaded = false;
 			return false;
 		}
+		layer->dirty = false;
+
+		NWRAP_LOG(NWRAP_LOG_TRACE,
+			  "Reloaded %s",
+			  layer->path != NULL ? layer->path : "memory layer");
 	}
+	nwrap->loaded = true;
 
-	for (i = p; !isspace((int)*p); p++) {
-		if (*p == '\0') {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Invalid line[%s]: '%s'",
-				  line, i);
-			free(ed);
-			return false;
-		}
+	if (nwrap->background) {
+		/* The thread takes over once the first version is loaded */
+		nwrap_reload_start();
 	}
 
-	*p = '\0';
+	return true;
+}
 
-	if (inet_pton(AF_INET, i, ed->addr.host_addr) == 1) {
-		ed->ht.h_addrtype = AF_INET;
-		ed->ht.h_length = 4;
-#ifdef HAVE_IPV6
-	} else if (inet_pton(AF_INET6, i, ed->addr.host_addr) == 1) {
-		ed->ht.h_addrtype = AF_INET6;
-		ed->ht.h_length = 16;
-#endif
-	} else {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Invalid line[%s]: '%s'",
-			  line, i);
+/*
+ * Check without changing anything that the loaded version is up to date, so
+ * the lookups can share the lock of the database. Everything else, also an
+ * error, is left to nwrap_files_cache_reload().
+ */
+static bool nwrap_files_cache_fresh(const struct nwrap_cache *nwrap)
+{
+	size_t i;
 
-		free(ed);
+	if (!nwrap->loaded) {
 		return false;
 	}
-	ip = i;
 
-	ok = nwrap_vector_add_item(&(ed->nwrap_addrdata),
-				   (void *const)ed->addr.host_addr);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add addrdata to vector");
-		free(ed);
-		return false;
+	for (i = 0; i < nwrap->num_layers; i++) {
+		if (nwrap->layers[i].dirty) {
+			return false;
+		}
 	}
-	ed->ht.h_addr_list = nwrap_vector_head(&ed->nwrap_addrdata);
 
-	p++;
+	if (nwrap->background) {
+		nwrap_reload_start();
+		return true;
+	}
 
-	/*
-	 * FQDN
-	 */
+	if (!nwrap->scanned || nwrap_layer_dirs_changed(nwrap)) {
+		return false;
+	}
 
-	/* Walk to first char */
-	for (n = p; *p != '_' && !isalnum((int) *p); p++) {
-		if (*p == '\0') {
-			NWRAP_LOG(NWRAP_LOG_ERROR,
-				  "Invalid line[%s]: '%s'",
-				  line, n);
+	for (i = 0; i < nwrap->num_layers; i++) {
+		const struct nwrap_layer *layer = &nwrap->layers[i];
+		struct stat st;
+		int ret;
 
-			free(ed);
+		if (layer->path == NULL) {
+			continue;
+		}
+		if (layer->fd < 0) {
+			return false;
+		}
+		ret = fstat(layer->fd, &st);
+		if (ret != 0 || st.st_nlink == 0 ||
+		    !nwrap_stat_equal(&st, &layer->st)) {
 			return false;
 		}
 	}
 
-	for (n = p; !isspace((int)*p); p++) {
-		if (*p == '\0') {
-			do_aliases = false;
-			break;
-		}
+	return true;
+}
+
+/*
+ * Lock a database for a lookup. The lock is only taken exclusively if the
+ * files have to be reloaded. Returns false if they failed to load, the caller
+ * has to unlock the database in any case.
+ */
+static bool nwrap_files_cache_rdlock(struct nwrap_cache *nwrap,
+				     pthread_rwlock_t *lock)
+{
+	bool ok;
+
+	pthread_rwlock_rdlock(lock);
+	if (nwrap_files_cache_fresh(nwrap)) {
+		return true;
 	}
+	pthread_rwlock_unlock(lock);
 
-	*p = '\0';
+	pthread_rwlock_wrlock(lock);
+	ok = nwrap_files_cache_reload(nwrap);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading %s", nwrap->path);
+	}
 
-	/* Convert to lowercase. This operate on same memory region */
-	str_tolower(n, n);
-	ed->ht.h_name = n;
+	return ok;
+}
 
-	/* glib's getent always dereferences he->h_aliases */
-	ed->ht.h_aliases = malloc(sizeof(char *));
-	if (ed->ht.h_aliases == NULL) {
-		free(ed);
+/*
+ * RELOADER THREAD
+ */
+
+/* Both caches loaded the same version of the files */
+static bool nwrap_layers_equal(const struct nwrap_cache *a,
+			       const struct nwrap_cache *b)
+{
+	size_t i;
+
+	if (a->num_layers != b->num_layers) {
 		return false;
 	}
-	ed->ht.h_aliases[0] = NULL;
 
-	/*
-	 * Aliases
-	 */
-	while (do_aliases) {
-		char **aliases;
-		char *a;
-
-		p++;
+	for (i = 0; i < a->num_layers; i++) {
+		const struct nwrap_layer *la = &a->layers[i];
+		const struct nwrap_layer *lb = &b->layers[i];
 
-		/* Walk to first char */
-		for (a = p; *p != '_' && !isalnum((int) *p); p++) {
-			if (*p == '\0') {
-				do_aliases = false;
-				break;
+		if (la->path == NULL || lb->path == NULL) {
+			if (la->path != lb->path) {
+				return false;
 			}
+			continue;
 		}
-		/* Only trailing spaces are left */
-		if (!do_aliases) {
-			break;
+		if (strcmp(la->path, lb->path) != 0 ||
+		    !nwrap_stat_equal(&la->st, &lb->st)) {
+			return false;
 		}
+	}
 
-		for (a = p; !isspace((int)*p); p++) {
-			if (*p == '\0') {
-				do_aliases = false;
-				break;
-			}
-		}
+	return true;
+}
 
-		*p = '\0';
+/*
+ * Copy the lines of nss_wrapper_add_user() and friends, so the next cache
+ * parses them too. The caller holds the lock of the database.
+ */
+static bool nwrap_reload_mem_lines(struct nwrap_cache *next,
+				   const struct nwrap_cache *live)
+{
+	struct nwrap_vector lines;
+	const char *line;
+	void *old;
+	size_t i;
+	bool ok = true;
 
-		aliases = realloc(ed->ht.h_aliases, sizeof(char *) * (aliases_count + 2));
-		if (aliases == NULL) {
-			free(ed);
-			return false;
-		}
-		ed->ht.h_aliases = aliases;
+	ZERO_STRUCTP(&lines);
 
-		str_tolower(a, a);
-		aliases[aliases_count] = a;
-		aliases[aliases_count + 1] = NULL;
+	nwrap_vector_foreach(line, live->mem_lines, i) {
+		char *copy = strdup(line);
 
-		aliases_count += 1;
+		if (copy == NULL) {
+			ok = false;
+			break;
+		}
+		ok = nwrap_vector_add_item(&lines, copy);
+		if (!ok) {
+			SAFE_FREE(copy);
+			break;
+		}
 	}
 
-	ok = nwrap_vector_add_item(&(nwrap_he->entries), (void *const)ed);
 	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add entry to vector");
-		free(ed);
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		nwrap_vector_foreach(old, lines, i) {
+			SAFE_FREE(old);
+		}
+		SAFE_FREE(lines.items);
 		return false;
 	}
 
-	ed->aliases_count = aliases_count;
-	/* Inventarize item */
-	ok = nwrap_add_hname(ed);
-	if (!ok) {
-		return false;
+	nwrap_vector_foreach(old, next->mem_lines, i) {
+		SAFE_FREE(old);
 	}
+	SAFE_FREE(next->mem_lines.items);
+	next->mem_lines = lines;
+	next->mem_generation = live->mem_generation;
 
-	ok = nwrap_ed_inventarize(ip, ed);
-	if (!ok) {
-		return false;
+	/* The memory layer is the last one */
+	if (next->num_layers > 0) {
+		next->layers[next->num_layers - 1].dirty = true;
 	}
 
-	nwrap_he->num++;
 	return true;
 }
 
-static void nwrap_he_unload(struct nwrap_cache *nwrap)
+/*
+ * Only the loaded files change places. The settings like the path are read
+ * by the lookups without the lock, so they are not written.
+ */
+static void nwrap_cache_swap(struct nwrap_cache *live,
+			     struct nwrap_cache *next)
+{
+	struct nwrap_cache tmp = *live;
+
+	live->layers = next->layers;
+	next->layers = tmp.layers;
+	live->num_layers = next->num_layers;
+	next->num_layers = tmp.num_layers;
+	live->dirs = next->dirs;
+	next->dirs = tmp.dirs;
+	live->num_dirs = next->num_dirs;
+	next->num_dirs = tmp.num_dirs;
+	live->scanned = next->scanned;
+	next->scanned = tmp.scanned;
+	live->lines = next->lines;
+	next->lines = tmp.lines;
+	live->mem_lines = next->mem_lines;
+	next->mem_lines = tmp.mem_lines;
+	live->mem_generation = next->mem_generation;
+	next->mem_generation = tmp.mem_generation;
+	live->loaded = next->loaded;
+	next->loaded = tmp.loaded;
+
+	live->swap(live, next);
+}
+
+/*
+ * Swap the entries of two versions of a database. They start with the
+ * pointer to their cache, which the lookups read without the lock, so it
+ * stays where it is.
+ */
+static void nwrap_db_swap(void *live, void *next, size_t size)
 {
-	struct nwrap_he *nwrap_he =
-		(struct nwrap_he *)nwrap->private_data;
-	struct nwrap_entdata *ed;
-	struct nwrap_entlist *el;
+	char *a = (char *)live;
+	char *b = (char *)next;
 	size_t i;
 
-	nwrap_vector_foreach (ed, nwrap_he->entries, i)
-	{
-		SAFE_FREE(ed->nwrap_addrdata.items);
-		SAFE_FREE(ed->ht.h_aliases);
-		SAFE_FREE(ed);
-	}
-	SAFE_FREE(nwrap_he->entries.items);
-	nwrap_he->entries.count = nwrap_he->entries.capacity = 0;
-
-	nwrap_vector_foreach(el, nwrap_he->lists, i)
-	{
-		while (el != NULL) {
-			struct nwrap_entlist *el_next;
+	for (i = sizeof(struct nwrap_cache *); i < size; i++) {
+		char c = a[i];
 
-			el_next = el->next;
-			SAFE_FREE(el);
-			el = el_next;
-		}
+		a[i] = b[i];
+		b[i] = c;
 	}
-	SAFE_FREE(nwrap_he->lists.items);
-	nwrap_he->lists.count = nwrap_he->lists.capacity = 0;
-
-	nwrap_he->num = 0;
-	nwrap_he->idx = 0;
 }
 
-
-/* user functions */
-static struct passwd *nwrap_files_getpwnam(struct nwrap_backend *b,
-					   const char *name)
+/*
+ * Bring the next cache up to date without holding the lock of the database,
+ * then swap it in if the files changed. The old version is kept in the next
+ * cache until the files are parsed again, at the earliest one interval later.
+ */
+static void nwrap_reload_db(struct nwrap_reload_db *db)
 {
-	int i;
-	bool ok;
+	struct nwrap_cache *live = db->live;
+	struct nwrap_cache *next = db->next;
+	bool ok = true;
 
-	(void) b; /* unused */
-
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "Lookup user %s in files", name);
+	pthread_rwlock_wrlock(db->lock);
+	if (!live->loaded) {
+		/* Nobody asked for the database yet or it failed to load */
+		pthread_rwlock_unlock(db->lock);
+		return;
+	}
+	if (next->mem_generation != live->mem_generation) {
+		ok = nwrap_reload_mem_lines(next, live);
+	}
+	pthread_rwlock_unlock(db->lock);
+	if (!ok) {
+		return;
+	}
 
-	ok = nwrap_files_cache_reload(nwrap_pw_global.cache);
+	ok = nwrap_files_cache_reload(next);
 	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading passwd file");
-		return NULL;
+		return;
 	}
 
-	for (i=0; i<nwrap_pw_global.num; i++) {
-		if (strcmp(nwrap_pw_global.list[i].pw_name, name) == 0) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] found", name);
-			return &nwrap_pw_global.list[i];
-		}
+	pthread_rwlock_wrlock(db->lock);
+	/* Lines added meanwhile are taken over in the next round */
+	if (next->mem_generation == live->mem_generation &&
+	    !nwrap_layers_equal(live, next)) {
+		nwrap_cache_swap(live, next);
+		nwrap_reload.swaps++;
 		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "user[%s] does not match [%s]",
-			  name,
-			  nwrap_pw_global.list[i].pw_name);
+			  "Swapped in a new version of %s",
+			  live->path);
 	}
-
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] not found\n", name);
-
-	errno = ENOENT;
-	return NULL;
+	pthread_rwlock_unlock(db->lock);
 }
 
-static int nwrap_files_getpwnam_r(struct nwrap_backend *b,
-				  const char *name, struct passwd *pwdst,
-				  char *buf, size_t buflen, struct passwd **pwdstp)
+static void *nwrap_reload_thread(void *arg)
 {
-	struct passwd *pw;
+	(void) arg; /* unused */
 
-	pw = nwrap_files_getpwnam(b, name);
-	if (!pw) {
-		if (errno == 0) {
-			return ENOENT;
+	NWRAP_LOCK(nwrap_reload_global);
+	while (!nwrap_reload.stop) {
+		struct timespec ts;
+		size_t i;
+
+		for (i = 0; i < nwrap_reload.num_dbs; i++) {
+			nwrap_reload_db(&nwrap_reload.dbs[i]);
 		}
-		return errno;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += nwrap_reload.interval_ms / 1000;
+		ts.tv_nsec += (nwrap_reload.interval_ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&nwrap_reload.cond,
+				       &nwrap_reload_global_mutex,
+				       &ts);
 	}
+	NWRAP_UNLOCK(nwrap_reload_global);
 
-	return nwrap_pw_copy_r(pw, pwdst, buf, buflen, pwdstp);
+	return NULL;
 }
 
-static struct passwd *nwrap_files_getpwuid(struct nwrap_backend *b,
-					   uid_t uid)
+/*
+ * Called by the lookups once a version was loaded, so the thread is only
+ * started for databases which are used. It is started again in a child.
+ */
+static void nwrap_reload_start(void)
 {
-	int i;
-	bool ok;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rc;
 
-	(void) b; /* unused */
+	/* Checked by every lookup of a database loaded in the background */
+	if (__atomic_load_n(&nwrap_reload.running, __ATOMIC_ACQUIRE)) {
+		return;
+	}
 
-	ok = nwrap_files_cache_reload(nwrap_pw_global.cache);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading passwd file");
-		return NULL;
+	NWRAP_LOCK(nwrap_reload_thread);
+	if (nwrap_reload.running) {
+		NWRAP_UNLOCK(nwrap_reload_thread);
+		return;
 	}
 
-	for (i=0; i<nwrap_pw_global.num; i++) {
-		if (nwrap_pw_global.list[i].pw_uid == uid) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG, "uid[%u] found", uid);
-			return &nwrap_pw_global.list[i];
-		}
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "uid[%u] does not match [%u]",
-			  uid,
-			  nwrap_pw_global.list[i].pw_uid);
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&thread, &attr, nwrap_reload_thread, NULL);
+	pthread_attr_destroy(&attr);
+	if (rc != 0) {
+		/* The next lookup tries again */
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Failed to create the reloader thread: %s",
+			  strerror(rc));
+	} else {
+		__atomic_store_n(&nwrap_reload.running, true, __ATOMIC_RELEASE);
 	}
+	NWRAP_UNLOCK(nwrap_reload_thread);
+}
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "uid[%u] not found\n", uid);
+unsigned long nss_wrapper_reload_swaps(void)
+{
+	unsigned long swaps;
 
-	errno = ENOENT;
-	return NULL;
+	nwrap_init();
+
+	NWRAP_LOCK(nwrap_reload_global);
+	swaps = nwrap_reload.swaps;
+	NWRAP_UNLOCK(nwrap_reload_global);
+
+	return swaps;
 }
 
-static int nwrap_files_getpwuid_r(struct nwrap_backend *b,
-				  uid_t uid, struct passwd *pwdst,
-				  char *buf, size_t buflen, struct passwd **pwdstp)
+/* The thread doesn't exist in the child, the next lookup starts a new one */
+static void nwrap_reload_thread_child(void)
 {
-	struct passwd *pw;
+	nwrap_reload.running = false;
+	pthread_cond_init(&nwrap_reload.cond, NULL);
+}
 
-	pw = nwrap_files_getpwuid(b, uid);
-	if (!pw) {
-		if (errno == 0) {
-			return ENOENT;
-		}
-		return errno;
+static void nwrap_reload_add(struct nwrap_cache *live,
+			     struct nwrap_cache *next,
+			     void *next_private,
+			     pthread_rwlock_t *lock)
+{
+	struct nwrap_reload_db *db;
+
+	if (live->path == NULL || live->path[0] == '\0' ||
+	    live->swap == NULL) {
+		return;
 	}
+	assert(nwrap_reload.num_dbs < ARRAY_SIZE(nwrap_reload.dbs));
+
+	/* Nothing was loaded yet, so only the settings are copied */
+	*next = *live;
+	next->private_data = next_private;
+	live->background = true;
 
-	return nwrap_pw_copy_r(pw, pwdst, buf, buflen, pwdstp);
+	db = &nwrap_reload.dbs[nwrap_reload.num_dbs++];
+	db->live = live;
+	db->next = next;
+	db->lock = lock;
 }
 
-/* user enum functions */
-static void nwrap_files_setpwent(struct nwrap_backend *b)
+/* Called by nwrap_init() after the caches were set up */
+static void nwrap_reload_init(const char *env)
 {
-	(void) b; /* unused */
+	unsigned long interval;
+	char *endptr;
 
-	nwrap_pw_global.idx = 0;
+	interval = strtoul(env, &endptr, 10);
+	if (endptr[0] != '\0' || interval == 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid NSS_WRAPPER_RELOAD_INTERVAL: %s",
+			  env);
+		return;
+	}
+	nwrap_reload.interval_ms = interval;
+
+	nwrap_pw_next.cache = &__nwrap_cache_pw_next;
+	nwrap_reload_add(nwrap_pw_global.cache,
+			 &__nwrap_cache_pw_next,
+			 &nwrap_pw_next,
+			 &nwrap_pw_global_rwlock);
+
+	nwrap_gr_next.cache = &__nwrap_cache_gr_next;
+	nwrap_reload_add(nwrap_gr_global.cache,
+			 &__nwrap_cache_gr_next,
+			 &nwrap_gr_next,
+			 &nwrap_gr_global_rwlock);
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+	nwrap_sp_next.cache = &__nwrap_cache_sp_next;
+	nwrap_reload_add(nwrap_sp_global.cache,
+			 &__nwrap_cache_sp_next,
+			 &nwrap_sp_next,
+			 &nwrap_sp_global_rwlock);
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+
+#ifdef HAVE_INNETGR
+	nwrap_ng_next.cache = &__nwrap_cache_ng_next;
+	nwrap_reload_add(nwrap_ng_global.cache,
+			 &__nwrap_cache_ng_next,
+			 &nwrap_ng_next,
+			 &nwrap_ng_global_rwlock);
+#endif /* HAVE_INNETGR */
+
+	nwrap_he_next.cache = &__nwrap_cache_he_next;
+	nwrap_reload_add(nwrap_he_global.cache,
+			 &__nwrap_cache_he_next,
+			 &nwrap_he_next,
+			 &nwrap_he_global_rwlock);
 }
 
-static struct passwd *nwrap_files_getpwent(struct nwrap_backend *b)
+/* Called by the destructor, which holds all locks */
+static void nwrap_reload_free(void)
 {
-	struct passwd *pw;
+	size_t i;
 
-	(void) b; /* unused */
+	nwrap_reload.stop = true;
+	pthread_cond_broadcast(&nwrap_reload.cond);
 
-	if (nwrap_pw_global.idx == 0) {
-		bool ok;
-		ok = nwrap_files_cache_reload(nwrap_pw_global.cache);
-		if (!ok) {
-			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading passwd file");
-			return NULL;
-		}
-	}
+	for (i = 0; i < nwrap_reload.num_dbs; i++) {
+		struct nwrap_cache *next = nwrap_reload.dbs[i].next;
 
-	if (nwrap_pw_global.idx >= nwrap_pw_global.num) {
-		errno = ENOENT;
-		return NULL;
+		nwrap_files_cache_unload(next);
+		nwrap_layers_free(next);
 	}
+	nwrap_reload.num_dbs = 0;
 
-	pw = &nwrap_pw_global.list[nwrap_pw_global.idx++];
-
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "return user[%s] uid[%u]",
-		  pw->pw_name, pw->pw_uid);
+	SAFE_FREE(nwrap_he_next.slots);
+	nwrap_he_next.num_slots = 0;
 
-	return pw;
+	if (nwrap_reload.swaps > 0) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG,
+			  "The reloader thread swapped in %lu versions",
+			  nwrap_reload.swaps);
+	}
 }
 
-static int nwrap_files_getpwent_r(struct nwrap_backend *b,
-				  struct passwd *pwdst, char *buf,
-				  size_t buflen, struct passwd **pwdstp)
+/*
+ * The entries of layer l are [*pfirst, *pend). Later layers override earlier
+ * ones, so the lookups walk the layers backwards.
+ */
+static void nwrap_layer_entries(const struct nwrap_cache *nwrap,
+				size_t l,
+				int num,
+				int *pfirst,
+				int *pend)
 {
-	struct passwd *pw;
+	int first = nwrap->layers[l].mark.num;
+	int end = num;
 
-	pw = nwrap_files_getpwent(b);
-	if (!pw) {
-		if (errno == 0) {
-			return ENOENT;
-		}
-		return errno;
+	if (l + 1 < nwrap->num_layers) {
+		end = nwrap->layers[l + 1].mark.num;
 	}
 
-	return nwrap_pw_copy_r(pw, pwdst, buf, buflen, pwdstp);
+	*pfirst = first < num ? first : num;
+	*pend = end < num ? end : num;
 }
 
-static void nwrap_files_endpwent(struct nwrap_backend *b)
+/* The index after the last entry of the layer of entry i */
+static int nwrap_layer_end(const struct nwrap_cache *nwrap, int i, int num)
 {
-	(void) b; /* unused */
+	size_t l;
 
-	nwrap_pw_global.idx = 0;
+	for (l = 0; l < nwrap->num_layers; l++) {
+		if (nwrap->layers[l].mark.num > i) {
+			return nwrap->layers[l].mark.num < num ?
+			       nwrap->layers[l].mark.num : num;
+		}
+	}
+
+	return num;
 }
 
-/* shadow */
+/* FNV-1a, used to skip most of the string compares in the name lookups */
+static uint32_t nwrap_name_hash(const char *name)
+{
+	uint32_t hash = 2166136261U;
+	const unsigned char *c;
 
-#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+	for (c = (const unsigned char *)name; *c != '\0'; c++) {
+		hash ^= *c;
+		hash *= 16777619U;
+	}
 
-#ifdef HAVE_SETSPENT
-static void nwrap_files_setspent(void)
-{
-	nwrap_sp_global.idx = 0;
+	return hash;
 }
 
-static struct spwd *nwrap_files_getspent(void)
+static bool nwrap_strpool_reserve(struct nwrap_strpool *pool, size_t len)
 {
-	struct spwd *sp;
+	size_t size;
+	char *buf;
 
-	if (nwrap_sp_global.idx == 0) {
-		bool ok;
+	if (pool->size - pool->used >= len) {
+		return true;
+	}
 
-		ok = nwrap_files_cache_reload(nwrap_sp_global.cache);
-		if (!ok) {
-			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading shadow file");
-			return NULL;
+	size = pool->size * 2;
+	if (size < pool->used + len) {
+		size = pool->used + len;
+	}
+	if (size < 4096) {
+		size = 4096;
+	}
+	/* The entries reference the strings using 32-bit offsets */
+	if (size > UINT32_MAX) {
+		size = UINT32_MAX;
+		if (size - pool->used < len) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "String pool exhausted");
+			return false;
 		}
 	}
 
-	if (nwrap_sp_global.idx >= nwrap_sp_global.num) {
-		errno = ENOENT;
-		return NULL;
+	buf = (char *)realloc(pool->buf, size);
+	if (buf == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "realloc(%zu) failed", size);
+		return false;
 	}
+	pool->buf = buf;
+	pool->size = size;
 
-	sp = &nwrap_sp_global.list[nwrap_sp_global.idx++];
+	return true;
+}
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "return user[%s]",
-		  sp->sp_namp);
+/* The caller has to reserve the space */
+static void nwrap_strpool_add(struct nwrap_strpool *pool, const char *str)
+{
+	size_t len = strlen(str) + 1;
 
-	return sp;
+	memcpy(pool->buf + pool->used, str, len);
+	pool->used += len;
 }
 
-static void nwrap_files_endspent(void)
+static void nwrap_strpool_free(struct nwrap_strpool *pool)
 {
-	nwrap_sp_global.idx = 0;
+	SAFE_FREE(pool->buf);
+	pool->size = 0;
+	pool->used = 0;
 }
-#endif /* HAVE_SETSPENT */
 
-static struct spwd *nwrap_files_getspnam(const char *name)
-{
-	int i;
-	bool ok;
+struct nwrap_column {
+	void **data;
+	size_t size;
+};
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "Lookup user %s in files", name);
+/* Make room for one more entry in each column of a database */
+static bool nwrap_columns_reserve(int num, int *capacity,
+				  const struct nwrap_column *columns,
+				  size_t num_columns)
+{
+	size_t i;
+	int n;
 
-	ok = nwrap_files_cache_reload(nwrap_sp_global.cache);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading shadow file");
-		return NULL;
+	if (num < *capacity) {
+		return true;
 	}
 
-	for (i=0; i<nwrap_sp_global.num; i++) {
-		if (strcmp(nwrap_sp_global.list[i].sp_namp, name) == 0) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] found", name);
-			return &nwrap_sp_global.list[i];
+	n = *capacity > 0 ? *capacity * 2 : 64;
+
+	for (i = 0; i < num_columns; i++) {
+		void *c;
+
+		c = realloc(*columns[i].data, n * columns[i].size);
+		if (c == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "realloc(%zu) failed",
+				  n * columns[i].size);
+			return false;
 		}
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "user[%s] does not match [%s]",
-			  name,
-			  nwrap_sp_global.list[i].sp_namp);
+		*columns[i].data = c;
 	}
+	*capacity = n;
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] not found\n", name);
+	return true;
+}
 
-	errno = ENOENT;
-	return NULL;
+/* A template contains at most one %d and no other conversion */
+static bool nwrap_tmpl_valid(const char *tmpl, bool need_num)
+{
+	const char *d = strchr(tmpl, '%');
+
+	if (d == NULL) {
+		return !need_num;
+	}
+
+	return d[1] == 'd' && strchr(d + 2, '%') == NULL;
 }
-#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
-/* misc functions */
-static int nwrap_files_initgroups(struct nwrap_backend *b,
-				  const char *user,
-				  gid_t group)
+/* Expand the template to *pp and move *pp behind the terminating NUL */
+static char *nwrap_tmpl_expand(const char *tmpl, uint32_t idx, char **pp)
 {
-	struct group *grp;
-	gid_t *groups;
-	int size = 1;
-	int rc;
+	const char *d = strstr(tmpl, "%d");
+	char *p = *pp;
+	size_t n;
 
-	groups = (gid_t *)malloc(size * sizeof(gid_t));
-	if (groups == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
-		errno = ENOMEM;
-		return -1;
+	if (d == NULL) {
+		n = strlen(tmpl) + 1;
+		memcpy(p, tmpl, n);
+	} else {
+		n = d - tmpl;
+		memcpy(p, tmpl, n);
+		n += sprintf(p + n, "%u", idx);
+		strcpy(p + n, d + 2);
+		n += strlen(d + 2) + 1;
 	}
-	groups[0] = group;
+	*pp = p + n;
 
-	nwrap_files_setgrent(b);
-	while ((grp = nwrap_files_getgrent(b)) != NULL) {
-		int i = 0;
+	return p;
+}
 
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "Inspecting %s for group membership",
-			  grp->gr_name);
+/*
+ * Find the offset a name was expanded from. The number needs to be without
+ * leading zeros, so every offset has exactly one name.
+ */
+static bool nwrap_tmpl_match(const char *tmpl,
+			     const char *name,
+			     uint32_t count,
+			     uint32_t *pidx)
+{
+	const char *d = strstr(tmpl, "%d");
+	size_t prefix_len;
+	size_t suffix_len;
+	size_t len;
+	uint64_t idx = 0;
+	size_t i;
 
-		for (i=0; grp->gr_mem && grp->gr_mem[i] != NULL; i++) {
-			if (group != grp->gr_gid &&
-			    (strcmp(user, grp->gr_mem[i]) == 0)) {
-				NWRAP_LOG(NWRAP_LOG_DEBUG,
-					  "%s is member of %s",
-					  user,
-					  grp->gr_name);
-
-				groups = (gid_t *)realloc(groups,
-							  (size + 1) * sizeof(gid_t));
-				if (groups == NULL) {
-					NWRAP_LOG(NWRAP_LOG_ERROR,
-						  "Out of memory");
-					errno = ENOMEM;
-					return -1;
-				}
+	if (d == NULL) {
+		return false;
+	}
 
-				groups[size] = grp->gr_gid;
-				size++;
-			}
+	prefix_len = d - tmpl;
+	suffix_len = strlen(d + 2);
+	len = strlen(name);
+
+	if (len <= prefix_len + suffix_len ||
+	    strncmp(name, tmpl, prefix_len) != 0 ||
+	    strcmp(name + len - suffix_len, d + 2) != 0) {
+		return false;
+	}
+
+	name += prefix_len;
+	len -= prefix_len + suffix_len;
+
+	if (len > 10 || (len > 1 && name[0] == '0')) {
+		return false;
+	}
+	for (i = 0; i < len; i++) {
+		if (!isdigit((int)name[i])) {
+			return false;
 		}
+		idx = idx * 10 + (name[i] - '0');
+	}
+	if (idx >= count) {
+		return false;
 	}
 
-	nwrap_files_endgrent(b);
+	*pidx = (uint32_t)idx;
+	return true;
+}
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "%s is member of %d groups",
-		  user, size);
+struct nwrap_pw_buf {
+	struct passwd pw;
+	char *buf;
+	size_t size;
+};
 
-	/* This really only works if uid_wrapper is loaded */
-	rc = setgroups(size, groups);
+struct nwrap_gr_buf {
+	struct group gr;
+	char *buf;
+	size_t size;
+};
 
-	free(groups);
+struct nwrap_ent_tls {
+	struct nwrap_pw_buf pwnam;
+	struct nwrap_pw_buf pwuid;
+	struct nwrap_pw_buf pwent;
+	struct nwrap_gr_buf grnam;
+	struct nwrap_gr_buf grgid;
+	struct nwrap_gr_buf grent;
 
-	return rc;
-}
+	/*
+	 * The entries are materialized from the columns of the databases
+	 * here, so the lookups only read the shared state.
+	 */
+	struct passwd pw;
+	char *pw_range_buf;
+	size_t pw_range_buf_size;
+	struct group gr;
+	char *gr_mem_buf;
+	size_t gr_mem_buf_size;
+	char *gr_range_buf;
+	size_t gr_range_buf_size;
+};
 
-/* group functions */
-static struct group *nwrap_files_getgrnam(struct nwrap_backend *b,
-					  const char *name)
+static __thread struct nwrap_ent_tls nwrap_ent_tls;
+static pthread_key_t nwrap_ent_tls_key;
+static pthread_once_t nwrap_ent_tls_once = PTHREAD_ONCE_INIT;
+
+static void nwrap_ent_tls_free(void *p)
+{
+	struct nwrap_ent_tls *tls = (struct nwrap_ent_tls *)p;
+
+	SAFE_FREE(tls->pwnam.buf);
+	tls->pwnam.size = 0;
+	SAFE_FREE(tls->pwuid.buf);
+	tls->pwuid.size = 0;
+	SAFE_FREE(tls->pwent.buf);
+	tls->pwent.size = 0;
+	SAFE_FREE(tls->grnam.buf);
+	tls->grnam.size = 0;
+	SAFE_FREE(tls->grgid.buf);
+	tls->grgid.size = 0;
+	SAFE_FREE(tls->grent.buf);
+	tls->grent.size = 0;
+	SAFE_FREE(tls->pw_range_buf);
+	tls->pw_range_buf_size = 0;
+	SAFE_FREE(tls->gr_mem_buf);
+	tls->gr_mem_buf_size = 0;
+	SAFE_FREE(tls->gr_range_buf);
+	tls->gr_range_buf_size = 0;
+}
+
+/* The key only frees the buffers of a thread when it exits */
+static void nwrap_ent_tls_key_create(void)
 {
-	int i;
-	bool ok;
+	int ret;
 
-	(void) b; /* unused */
+	ret = pthread_key_create(&nwrap_ent_tls_key, nwrap_ent_tls_free);
+	if (ret != 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to create thread key: %s",
+			  strerror(ret));
+	}
+}
 
-	ok = nwrap_files_cache_reload(nwrap_gr_global.cache);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading group file");
-		return NULL;
+/* Grow a buffer of the thread to at least needed bytes */
+static bool nwrap_ent_buf_reserve(char **pbuf, size_t *psize, size_t needed)
+{
+	char *buf;
+
+	if (needed <= *psize) {
+		return true;
 	}
 
-	for (i=0; i<nwrap_gr_global.num; i++) {
-		if (strcmp(nwrap_gr_global.list[i].gr_name, name) == 0) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG, "group[%s] found", name);
-			return &nwrap_gr_global.list[i];
-		}
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "group[%s] does not match [%s]",
-			  name,
-			  nwrap_gr_global.list[i].gr_name);
+	if (*pbuf == NULL) {
+		pthread_once(&nwrap_ent_tls_once, nwrap_ent_tls_key_create);
+		pthread_setspecific(nwrap_ent_tls_key, &nwrap_ent_tls);
 	}
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "group[%s] not found", name);
+	buf = (char *)realloc(*pbuf, needed);
+	if (buf == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "realloc(%zu) failed", needed);
+		errno = ENOMEM;
+		return false;
+	}
+	*pbuf = buf;
+	*psize = needed;
 
-	errno = ENOENT;
-	return NULL;
+	return true;
 }
 
-static int nwrap_files_getgrnam_r(struct nwrap_backend *b,
-				  const char *name, struct group *grdst,
-				  char *buf, size_t buflen, struct group **grdstp)
+static bool nwrap_ent_buf_grow(char **pbuf, size_t *psize)
 {
-	struct group *gr;
-
-	gr = nwrap_files_getgrnam(b, name);
-	if (!gr) {
-		if (errno == 0) {
-			return ENOENT;
-		}
-		return errno;
-	}
-
-	return nwrap_gr_copy_r(gr, grdst, buf, buflen, grdstp);
+	return nwrap_ent_buf_reserve(pbuf,
+				     psize,
+				     *psize > 0 ? *psize * 2 : 256);
 }
 
-static struct group *nwrap_files_getgrgid(struct nwrap_backend *b,
-					  gid_t gid)
+static bool nwrap_pw_add(struct nwrap_pw *nwrap_pw, const struct passwd *pw)
 {
-	int i;
+	const struct nwrap_column columns[] = {
+		{ (void **)&nwrap_pw->uids, sizeof(uid_t) },
+		{ (void **)&nwrap_pw->gids, sizeof(gid_t) },
+		{ (void **)&nwrap_pw->hashes, sizeof(uint32_t) },
+		{ (void **)&nwrap_pw->offsets, sizeof(uint32_t) },
+		{ (void **)&nwrap_pw->deleted, sizeof(bool) },
+	};
+	size_t len;
+	int i = nwrap_pw->num;
 	bool ok;
 
-	(void) b; /* unused */
-
-	ok = nwrap_files_cache_reload(nwrap_gr_global.cache);
+	ok = nwrap_columns_reserve(nwrap_pw->num, &nwrap_pw->capacity,
+				   columns, ARRAY_SIZE(columns));
 	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading group file");
-		return NULL;
+		return false;
 	}
 
-	for (i=0; i<nwrap_gr_global.num; i++) {
-		if (nwrap_gr_global.list[i].gr_gid == gid) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG, "gid[%u] found", gid);
-			return &nwrap_gr_global.list[i];
-		}
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "gid[%u] does not match [%u]",
-			  gid,
-			  nwrap_gr_global.list[i].gr_gid);
+	len = strlen(pw->pw_name) + strlen(pw->pw_passwd) +
+	      strlen(pw->pw_gecos) + strlen(pw->pw_dir) +
+	      strlen(pw->pw_shell) + 5;
+	ok = nwrap_strpool_reserve(&nwrap_pw->pool, len);
+	if (!ok) {
+		return false;
 	}
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "gid[%u] not found", gid);
+	nwrap_pw->uids[i] = pw->pw_uid;
+	nwrap_pw->gids[i] = pw->pw_gid;
+	nwrap_pw->hashes[i] = nwrap_name_hash(pw->pw_name);
+	nwrap_pw->offsets[i] = (uint32_t)nwrap_pw->pool.used;
+	nwrap_pw->deleted[i] = false;
 
-	errno = ENOENT;
-	return NULL;
-}
-
-static int nwrap_files_getgrgid_r(struct nwrap_backend *b,
-				  gid_t gid, struct group *grdst,
-				  char *buf, size_t buflen, struct group **grdstp)
-{
-	struct group *gr;
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_name);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_passwd);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_gecos);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_dir);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_shell);
 
-	gr = nwrap_files_getgrgid(b, gid);
-	if (!gr) {
-		if (errno == 0) {
-			return ENOENT;
-		}
-		return errno;
+	if (len > nwrap_pw->max_size) {
+		nwrap_pw->max_size = len;
 	}
 
-	return nwrap_gr_copy_r(gr, grdst, buf, buflen, grdstp);
+	nwrap_pw->num++;
+
+	return true;
 }
 
-/* group enum functions */
-static void nwrap_files_setgrent(struct nwrap_backend *b)
-{
-	(void) b; /* unused */
+/*
+ * Materialize the entry at index i. The returned struct belongs to the thread
+ * and is overwritten by its next call.
+ */
+static struct passwd *nwrap_pw_entry(const struct nwrap_pw *nwrap_pw, int i)
+{
+	struct passwd *pw = &nwrap_ent_tls.pw;
+	char *p = nwrap_pw->pool.buf + nwrap_pw->offsets[i];
+
+	pw->pw_name = p;
+	p += strlen(p) + 1;
+	pw->pw_passwd = p;
+	p += strlen(p) + 1;
+	pw->pw_uid = nwrap_pw->uids[i];
+	pw->pw_gid = nwrap_pw->gids[i];
+	pw->pw_gecos = p;
+	p += strlen(p) + 1;
+	pw->pw_dir = p;
+	p += strlen(p) + 1;
+	pw->pw_shell = p;
 
-	nwrap_gr_global.idx = 0;
+	return pw;
 }
 
-static struct group *nwrap_files_getgrent(struct nwrap_backend *b)
+static bool nwrap_pw_add_range(struct nwrap_pw *nwrap_pw,
+			       const struct passwd *pw,
+			       uint32_t count,
+			       bool gid_range)
 {
-	struct group *gr;
+	struct nwrap_pw_range *ranges;
+	struct nwrap_pw_range *r;
+	size_t len;
+	bool ok;
 
-	(void) b; /* unused */
+	if (!nwrap_tmpl_valid(pw->pw_name, true) ||
+	    !nwrap_tmpl_valid(pw->pw_passwd, false) ||
+	    !nwrap_tmpl_valid(pw->pw_gecos, false) ||
+	    !nwrap_tmpl_valid(pw->pw_dir, false) ||
+	    !nwrap_tmpl_valid(pw->pw_shell, false)) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid template in range of user[%s]",
+			  pw->pw_name);
+		return false;
+	}
 
-	if (nwrap_gr_global.idx == 0) {
-		bool ok;
+	ranges = (struct nwrap_pw_range *)realloc(nwrap_pw->ranges,
+			(nwrap_pw->num_ranges + 1) * sizeof(struct nwrap_pw_range));
+	if (ranges == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
+	}
+	nwrap_pw->ranges = ranges;
 
-		ok = nwrap_files_cache_reload(nwrap_gr_global.cache);
-		if (!ok) {
-			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading group file");
-			return NULL;
-		}
+	len = strlen(pw->pw_name) + strlen(pw->pw_passwd) +
+	      strlen(pw->pw_gecos) + strlen(pw->pw_dir) +
+	      strlen(pw->pw_shell) + 5;
+	ok = nwrap_strpool_reserve(&nwrap_pw->pool, len);
+	if (!ok) {
+		return false;
 	}
+	r = &ranges[nwrap_pw->num_ranges];
+	r->uid = pw->pw_uid;
+	r->gid = pw->pw_gid;
+	r->count = count;
+	r->gid_range = gid_range;
+	r->offset = (uint32_t)nwrap_pw->pool.used;
 
-	if (nwrap_gr_global.idx >= nwrap_gr_global.num) {
-		errno = ENOENT;
-		return NULL;
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_name);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_passwd);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_gecos);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_dir);
+	nwrap_strpool_add(&nwrap_pw->pool, pw->pw_shell);
+
+	/* Every expanded id adds at most ten digits to a field */
+	if (len + 5 * 10 > nwrap_pw->max_size) {
+		nwrap_pw->max_size = len + 5 * 10;
+	}
+	if (len + 5 * 10 > nwrap_pw->range_size) {
+		nwrap_pw->range_size = len + 5 * 10;
 	}
 
-	gr = &nwrap_gr_global.list[nwrap_gr_global.idx++];
+	nwrap_pw->num_ranges++;
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "return group[%s] gid[%u]",
-		  gr->gr_name, gr->gr_gid);
+	return true;
+}
 
-	return gr;
+/* Compute the entry at offset idx of a range, like nwrap_pw_entry() */
+static struct passwd *nwrap_pw_range_entry(const struct nwrap_pw *nwrap_pw,
+					   const struct nwrap_pw_range *r,
+					   uint32_t idx)
+{
+	struct passwd *pw = &nwrap_ent_tls.pw;
+	const char *t = nwrap_pw->pool.buf + r->offset;
+	char *p;
+	bool ok;
+
+	ok = nwrap_ent_buf_reserve(&nwrap_ent_tls.pw_range_buf,
+				   &nwrap_ent_tls.pw_range_buf_size,
+				   nwrap_pw->range_size);
+	if (!ok) {
+		return NULL;
+	}
+	p = nwrap_ent_tls.pw_range_buf;
+
+	pw->pw_name = nwrap_tmpl_expand(t, idx, &p);
+	t += strlen(t) + 1;
+	pw->pw_passwd = nwrap_tmpl_expand(t, idx, &p);
+	t += strlen(t) + 1;
+	pw->pw_uid = r->uid + idx;
+	pw->pw_gid = r->gid_range ? r->gid + idx : r->gid;
+	pw->pw_gecos = nwrap_tmpl_expand(t, idx, &p);
+	t += strlen(t) + 1;
+	pw->pw_dir = nwrap_tmpl_expand(t, idx, &p);
+	t += strlen(t) + 1;
+	pw->pw_shell = nwrap_tmpl_expand(t, idx, &p);
+
+	return pw;
 }
 
-static int nwrap_files_getgrent_r(struct nwrap_backend *b,
-				  struct group *grdst, char *buf,
-				  size_t buflen, struct group **grdstp)
+/* The next computed entry of the enumeration */
+static struct passwd *nwrap_pw_range_next(struct nwrap_pw *nwrap_pw)
 {
-	struct group *gr;
+	while (nwrap_pw->range_idx < nwrap_pw->num_ranges) {
+		const struct nwrap_pw_range *r =
+			&nwrap_pw->ranges[nwrap_pw->range_idx];
 
-	gr = nwrap_files_getgrent(b);
-	if (!gr) {
-		if (errno == 0) {
-			return ENOENT;
+		if (nwrap_pw->range_off < r->count) {
+			return nwrap_pw_range_entry(nwrap_pw,
+						    r,
+						    nwrap_pw->range_off++);
 		}
-		return errno;
+
+		nwrap_pw->range_idx++;
+		nwrap_pw->range_off = 0;
 	}
 
-	return nwrap_gr_copy_r(gr, grdst, buf, buflen, grdstp);
+	return NULL;
 }
 
-static void nwrap_files_endgrent(struct nwrap_backend *b)
+/*
+ * Scanners for the lines of the databases. The vector versions compare a block
+ * of bytes at once and return a bit mask of the matching bytes.
+ */
+#if defined(__AVX2__)
+#define NWRAP_SCAN_BLOCK 32
+
+static inline uint32_t nwrap_scan_char(const char *p, char c)
 {
-	(void) b; /* unused */
+	__m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+	__m256i eq = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c));
 
-	nwrap_gr_global.idx = 0;
+	return (uint32_t)_mm256_movemask_epi8(eq);
 }
 
-/* hosts functions */
-static int nwrap_files_gethostbyname(const char *name, int af,
-				     struct hostent *result,
-				     struct nwrap_vector *addr_list)
+static inline uint32_t nwrap_scan_space(const char *p)
 {
-	struct nwrap_entlist *el;
-	struct hostent *he;
-	char *h_name_lower;
-	ENTRY e;
-	ENTRY *e_p;
-	char canon_name[DNS_NAME_MAX] = { 0 };
-	size_t name_len;
-	bool he_found = false;
-	bool ok;
+	__m256i v = _mm256_loadu_si256((const __m256i *)(const void *)p);
+	/* ' ' or '\t' to '\r', bytes >= 0x80 are negative */
+	__m256i sp = _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' '));
+	__m256i ge = _mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1));
+	__m256i le = _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v);
 
-	ok = nwrap_files_cache_reload(nwrap_he_global.cache);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "error loading hosts file");
-		goto no_ent;
-	}
+	return (uint32_t)_mm256_movemask_epi8(
+		_mm256_or_si256(sp, _mm256_and_si256(ge, le)));
+}
+#elif defined(__SSE2__)
+#define NWRAP_SCAN_BLOCK 16
 
-	name_len = strlen(name);
-	if (name_len < sizeof(canon_name) && name[name_len - 1] == '.') {
-		strncpy(canon_name, name, name_len - 1);
-		name = canon_name;
-	}
+static inline uint32_t nwrap_scan_char(const char *p, char c)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+	__m128i eq = _mm_cmpeq_epi8(v, _mm_set1_epi8(c));
 
-	if (!str_tolower_copy(&h_name_lower, name)) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "Out of memory while converting to lower case");
-		goto no_ent;
-	}
+	return (uint32_t)_mm_movemask_epi8(eq);
+}
 
-	/* Look at hash table for element */
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "Searching for name: %s", h_name_lower);
-	e.key = h_name_lower;
-	e.data = NULL;
-	e_p = hsearch(e, FIND);
-	if (e_p == NULL) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s not found.", h_name_lower);
-		SAFE_FREE(h_name_lower);
-		goto no_ent;
-	}
-	SAFE_FREE(h_name_lower);
+static inline uint32_t nwrap_scan_space(const char *p)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)(const void *)p);
+	/* ' ' or '\t' to '\r', bytes >= 0x80 are negative */
+	__m128i sp = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	__m128i ge = _mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1));
+	__m128i le = _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1));
 
-	/* Always cleanup vector and results */
-	if (!nwrap_vector_is_initialized(addr_list)) {
-		if (!nwrap_vector_init(addr_list)) {
-			NWRAP_LOG(NWRAP_LOG_DEBUG,
-				  "Unable to initialize memory for addr_list vector");
-			goto no_ent;
-		}
-	} else {
-		/* When vector is initialized data are valid no more.
-		 * Quick way how to free vector is: */
-		addr_list->count = 0;
+	return (uint32_t)_mm_movemask_epi8(
+		_mm_or_si128(sp, _mm_and_si128(ge, le)));
+}
+#endif /* __SSE2__ */
+
+/* isspace() of the C locale */
+static inline bool nwrap_is_space(char c)
+{
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/*
+ * Split the line at sep into at most num fields and terminate them, the last
+ * field keeps the rest of the line. All separators are found in one pass.
+ * Returns the number of fields, which is less than num if the line has fewer
+ * separators.
+ */
+static size_t nwrap_split_line(char *line, char sep, char **fields, size_t num)
+{
+	size_t len = strlen(line);
+	size_t n = 1;
+	size_t i = 0;
+
+	fields[0] = line;
+	if (n == num) {
+		return n;
 	}
 
-	/* Iterate through results */
-	for (el = (struct nwrap_entlist *)e_p->data; el != NULL; el = el->next)
-	{
-		he = &(el->ed->ht);
+#ifdef NWRAP_SCAN_BLOCK
+	for (; i + NWRAP_SCAN_BLOCK <= len; i += NWRAP_SCAN_BLOCK) {
+		uint32_t mask = nwrap_scan_char(line + i, sep);
 
-		/* Filter by address familiy if provided */
-		if (af != AF_UNSPEC && he->h_addrtype != af) {
-			continue;
-		}
+		while (mask != 0) {
+			size_t pos = i + (size_t)__builtin_ctz(mask);
 
-		/*
-		 * GLIBC HACK?
-		 * glibc doesn't return ipv6 addresses when AF_UNSPEC is used
-		 */
-		if (af == AF_UNSPEC && he->h_addrtype != AF_INET) {
+			line[pos] = '\0';
+			fields[n++] = line + pos + 1;
+			if (n == num) {
+				return n;
+			}
+			mask &= mask - 1;
+		}
+	}
+#endif
+	for (; i < len; i++) {
+		if (line[i] != sep) {
 			continue;
 		}
-
-		if (!he_found) {
-			memcpy(result, he, sizeof(struct hostent));
-			NWRAP_LOG(NWRAP_LOG_DEBUG,
-				  "Name found. Returning record for %s",
-				  he->h_name);
-			he_found = true;
+		line[i] = '\0';
+		fields[n++] = line + i + 1;
+		if (n == num) {
+			return n;
 		}
-		nwrap_vector_merge(addr_list, &el->ed->nwrap_addrdata);
-		result->h_addr_list = nwrap_vector_head(addr_list);
 	}
 
-	if (he_found) {
-		return 0;
+	return n;
+}
+
+/* The number of c in the string */
+static size_t nwrap_count_char(const char *s, char c)
+{
+	size_t len = strlen(s);
+	size_t count = 0;
+	size_t i = 0;
+
+#ifdef NWRAP_SCAN_BLOCK
+	for (; i + NWRAP_SCAN_BLOCK <= len; i += NWRAP_SCAN_BLOCK) {
+		count += (size_t)__builtin_popcount(nwrap_scan_char(s + i, c));
+	}
+#endif
+	for (; i < len; i++) {
+		count += (s[i] == c);
 	}
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "Name found in database. No records matches type.");
 
-no_ent:
-	errno = ENOENT;
-	return -1;
+	return count;
 }
 
-#ifdef HAVE_GETHOSTBYNAME_R
-static int nwrap_gethostbyname_r(const char *name,
-				 struct hostent *ret,
-				 char *buf, size_t buflen,
-				 struct hostent **result, int *h_errnop)
+/* The first whitespace in [p, end) or end */
+static char *nwrap_find_space(char *p, const char *end)
 {
-	struct nwrap_vector *addr_list = malloc(sizeof(struct nwrap_vector));
-	int rc;
+#ifdef NWRAP_SCAN_BLOCK
+	while ((size_t)(end - p) >= NWRAP_SCAN_BLOCK) {
+		uint32_t mask = nwrap_scan_space(p);
 
-	if (addr_list == NULL) {
-		NWRAP_LOG(NWRAP_LOG_ERROR,
-			  "Unable to allocate memory for address list");
-		errno = ENOENT;
-		return -1;
+		if (mask != 0) {
+			return p + __builtin_ctz(mask);
+		}
+		p += NWRAP_SCAN_BLOCK;
+	}
+#endif
+	while (p < end && !nwrap_is_space(*p)) {
+		p++;
 	}
 
-	ZERO_STRUCTP(addr_list);
+	return p;
+}
 
-	rc = nwrap_files_gethostbyname(name, AF_UNSPEC, ret, addr_list);
-	if (rc == -1) {
-		*h_errnop = h_errno;
-		if (addr_list->items != NULL) {
-			free(addr_list->items);
+/*
+ * Parse a decimal id without sign or whitespace, *end points behind the
+ * digits. Unlike strtoul() it fails if the id doesn't fit in 32 bits, so no
+ * errno checks are needed.
+ */
+static bool nwrap_parse_uint32(const char *s, const char **end, uint32_t *id)
+{
+	uint64_t v = 0;
+	unsigned d;
+	size_t i;
+
+	/* At most 10 digits, so v can't overflow */
+	for (i = 0; i < 10; i++) {
+		d = (unsigned)(unsigned char)s[i] - '0';
+		if (d > 9) {
+			break;
 		}
-		SAFE_FREE(addr_list);
-		errno = ENOENT;
-		return -1;
+		v = v * 10 + d;
 	}
 
-	if (buflen < (addr_list->count * sizeof(void *))) {
-		SAFE_FREE(addr_list->items);
-		SAFE_FREE(addr_list);
-		return ERANGE;
+	d = (unsigned)(unsigned char)s[i] - '0';
+	if (i == 0 || d <= 9 || v > UINT32_MAX) {
+		return false;
 	}
 
-	/* Copy all to user provided buffer and change
-	 * pointers in returned structure.
-	 * +1 is for ending NULL pointer. */
-	memcpy(buf, addr_list->items, (addr_list->count + 1) * sizeof(void *));
+	*end = s + i;
+	*id = (uint32_t)v;
+	return true;
+}
 
-	free(addr_list->items);
-	free(addr_list);
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+/* Parse a whole field as a decimal long with an optional minus sign */
+static bool nwrap_parse_long(const char *s, long *value)
+{
+	bool neg = (s[0] == '-');
+	uint64_t v = 0;
+	unsigned d;
+	size_t i;
 
-	ret->h_addr_list = (char **)buf;
-	*result = ret;
-	return 0;
+	s += neg;
+
+	/* At most 19 digits, so v can't overflow */
+	for (i = 0; i < 19; i++) {
+		d = (unsigned)(unsigned char)s[i] - '0';
+		if (d > 9) {
+			break;
+		}
+		v = v * 10 + d;
+	}
+
+	if (i == 0 || s[i] != '\0' || v > (uint64_t)LONG_MAX) {
+		return false;
+	}
+
+	*value = neg ? -(long)v : (long)v;
+	return true;
 }
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
-int gethostbyname_r(const char *name,
-		    struct hostent *ret,
-		    char *buf, size_t buflen,
-		    struct hostent **result, int *h_errnop)
+/*
+ * Parse the end of an id range "first-last", s points behind the dash. The
+ * range may not be empty or cover all 2^32 ids.
+ */
+static bool nwrap_parse_id_range(const char *s, uint32_t first, uint32_t *count)
 {
-	if (!nss_wrapper_hosts_enabled()) {
-		return libc_gethostbyname_r(name,
-					    ret,
-					    buf,
-					    buflen,
-					    result,
-					    h_errnop);
+	const char *e = NULL;
+	uint32_t last;
+	bool ok;
+
+	ok = nwrap_parse_uint32(s, &e, &last);
+	if (!ok || e[0] != '\0' ||
+	    last < first || last - first >= UINT32_MAX) {
+		return false;
 	}
 
-	return nwrap_gethostbyname_r(name, ret, buf, buflen, result, h_errnop);
+	*count = last - first + 1;
+	return true;
 }
-#endif
 
-static int nwrap_files_getaddrinfo(const char *name,
-				   unsigned short port,
-				   const struct addrinfo *hints,
-				   struct addrinfo **ai)
+/* A "-name" line, it removes the entries of the name in earlier layers */
+static bool nwrap_pw_add_deleted(struct nwrap_pw *nwrap_pw, char *name)
 {
-	struct nwrap_entlist *el;
-	struct hostent *he;
-	struct addrinfo *ai_head = NULL;
-	struct addrinfo *ai_cur = NULL;
-	char *h_name_lower;
-	size_t name_len;
-	char canon_name[DNS_NAME_MAX] = { 0 };
-	bool skip_canonname = false;
-	ENTRY e = {
-		.key = NULL,
-	};
-	ENTRY *e_p = NULL;
-	int rc;
+	char empty[] = "";
+	struct passwd pw;
+	char *p;
 	bool ok;
 
-	ok = nwrap_files_cache_reload(nwrap_he_global.cache);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "error loading hosts file");
-		return EAI_SYSTEM;
+	p = strchr(name, ':');
+	if (p != NULL) {
+		*p = '\0';
+	}
+	if (name[0] == '\0') {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Missing name in '-' line");
+		return false;
 	}
 
-	name_len = strlen(name);
-	if (name_len < DNS_NAME_MAX && name[name_len - 1] == '.') {
-		strncpy(canon_name, name, name_len - 1);
-		name = canon_name;
+	ZERO_STRUCTP(&pw);
+	pw.pw_name = name;
+	pw.pw_passwd = empty;
+	pw.pw_uid = (uid_t)-1;
+	pw.pw_gid = (gid_t)-1;
+	pw.pw_gecos = empty;
+	pw.pw_dir = empty;
+	pw.pw_shell = empty;
+
+	ok = nwrap_pw_add(nwrap_pw, &pw);
+	if (!ok) {
+		return false;
 	}
+	nwrap_pw->deleted[nwrap_pw->num - 1] = true;
 
-	if (!str_tolower_copy(&h_name_lower, name)) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "Out of memory while converting to lower case");
-		return EAI_MEMORY;
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Removed user[%s]", name);
+
+	return true;
+}
+
+/*
+ * the caller has to call nwrap_unload() on failure
+ */
+static bool nwrap_pw_parse_line(struct nwrap_cache *nwrap, char *line)
+{
+	struct nwrap_pw *nwrap_pw;
+	/* name:passwd:uid:gid:gecos:dir:shell */
+	char *fields[7];
+	const char *e = NULL;
+	struct passwd _pw;
+	struct passwd *pw = &_pw;
+	uint32_t id;
+	uint32_t count = 0;
+	bool gid_range = false;
+	size_t num;
+	bool ok;
+
+	nwrap_pw = (struct nwrap_pw *)nwrap->private_data;
+
+	if (line[0] == '-') {
+		return nwrap_pw_add_deleted(nwrap_pw, line + 1);
 	}
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "Searching for name: %s", h_name_lower);
-	e.key = h_name_lower;
-	e.data = NULL;
-	e_p = hsearch(e, FIND);
-	if (e_p == NULL) {
-		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s not found.", h_name_lower);
-		SAFE_FREE(h_name_lower);
-		errno = ENOENT;
-		return EAI_NONAME;
+	num = nwrap_split_line(line, ':', fields, ARRAY_SIZE(fields));
+	if (num != ARRAY_SIZE(fields)) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid line[%s]: only %zu fields",
+			  line, num);
+		return false;
 	}
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "Name: %s found.", h_name_lower);
-	SAFE_FREE(h_name_lower);
 
-	rc = EAI_NONAME;
-	for (el = (struct nwrap_entlist *)e_p->data; el != NULL; el = el->next)
-	{
-		int rc2;
-		struct addrinfo *ai_new = NULL;
+	pw->pw_name = fields[0];
+	pw->pw_passwd = fields[1];
 
-		he = &(el->ed->ht);
+	/* uid */
+	ok = nwrap_parse_uint32(fields[2], &e, &id);
+	if (ok && e[0] == '-') {
+		ok = nwrap_parse_id_range(e + 1, id, &count);
+		e += strlen(e);
+	}
+	if (!ok || e[0] != '\0') {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid uid[%s] of user[%s]",
+			  fields[2], pw->pw_name);
+		return false;
+	}
+	pw->pw_uid = (uid_t)id;
 
-		if (hints->ai_family != AF_UNSPEC &&
-		    he->h_addrtype != hints->ai_family)
-		{
-			NWRAP_LOG(NWRAP_LOG_DEBUG,
-				  "Entry found but with wrong AF - "
-				  "remembering EAI_ADDRINFO.");
-			rc = EAI_ADDRFAMILY;
-			continue;
-		}
-
-		/* Function allocates memory and returns it in ai. */
-		rc2 = nwrap_convert_he_ai(he,
-					 port,
-					 hints,
-					 &ai_new,
-					 skip_canonname);
-		if (rc2 != 0) {
-			NWRAP_LOG(NWRAP_LOG_ERROR, "Error converting he to ai");
-			if (ai_head != NULL) {
-				freeaddrinfo(ai_head);
-			}
-			return rc2;
-		}
-		skip_canonname = true;
+	/* gid, a range needs the same size as the uid range */
+	ok = nwrap_parse_uint32(fields[3], &e, &id);
+	if (ok && e[0] == '-' && count > 0) {
+		uint32_t gid_count = 0;
 
-		if (ai_head == NULL) {
-			ai_head = ai_new;
-		}
-		if (ai_cur != NULL) {
-			ai_cur->ai_next = ai_new;
-		}
-		ai_cur = ai_new;
+		ok = nwrap_parse_id_range(e + 1, id, &gid_count) &&
+		     gid_count == count;
+		gid_range = true;
+		e += strlen(e);
 	}
-
-	if (ai_head != NULL) {
-		rc = 0;
+	if (!ok || e[0] != '\0') {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid gid[%s] of user[%s]",
+			  fields[3], pw->pw_name);
+		return false;
 	}
+	pw->pw_gid = (gid_t)id;
 
-	*ai = ai_head;
-
-	return rc;
-}
-
-static struct hostent *nwrap_files_gethostbyaddr(const void *addr,
-						 socklen_t len, int type)
-{
-	struct hostent *he;
-	char ip[NWRAP_INET_ADDRSTRLEN] = {0};
-	struct nwrap_entdata *ed;
-	const char *a;
-	size_t i;
-	bool ok;
+	pw->pw_gecos = fields[4];
+	pw->pw_dir = fields[5];
+	pw->pw_shell = fields[6];
 
-	(void) len; /* unused */
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Added user[%s:%s:%u:%u:%s:%s:%s]",
+		  pw->pw_name, pw->pw_passwd,
+		  pw->pw_uid, pw->pw_gid,
+		  pw->pw_gecos, pw->pw_dir, pw->pw_shell);
 
-	ok = nwrap_files_cache_reload(nwrap_he_global.cache);
-	if (!ok) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "error loading hosts file");
-		return NULL;
+	if (count > 0) {
+		return nwrap_pw_add_range(nwrap_pw, pw, count, gid_range);
 	}
 
-	a = inet_ntop(type, addr, ip, sizeof(ip));
-	if (a == NULL) {
-		errno = EINVAL;
-		return NULL;
-	}
+	return nwrap_pw_add(nwrap_pw, pw);
+}
 
-	nwrap_vector_foreach(ed, nwrap_he_global.entries, i)
-	{
-		he = &(ed->ht);
-		if (he->h_addrtype != type) {
-			continue;
-		}
+static void nwrap_pw_unload(struct nwrap_cache *nwrap)
+{
+	struct nwrap_pw *nwrap_pw;
+	nwrap_pw = (struct nwrap_pw *)nwrap->private_data;
 
-		if (memcmp(addr, he->h_addr_list[0], he->h_length) == 0) {
-			return he;
-		}
-	}
+	SAFE_FREE(nwrap_pw->uids);
+	SAFE_FREE(nwrap_pw->gids);
+	SAFE_FREE(nwrap_pw->hashes);
+	SAFE_FREE(nwrap_pw->offsets);
+	SAFE_FREE(nwrap_pw->deleted);
+	nwrap_strpool_free(&nwrap_pw->pool);
+	nwrap_pw->num = 0;
+	nwrap_pw->capacity = 0;
+	nwrap_pw->idx = 0;
 
-	errno = ENOENT;
-	return NULL;
+	SAFE_FREE(nwrap_pw->ranges);
+	nwrap_pw->num_ranges = 0;
+	nwrap_pw->range_idx = 0;
+	nwrap_pw->range_off = 0;
+	nwrap_pw->max_size = 0;
+	nwrap_pw->range_size = 0;
 }
 
-#ifdef HAVE_GETHOSTBYADDR_R
-static int nwrap_gethostbyaddr_r(const void *addr, socklen_t len, int type,
-				 struct hostent *ret,
-				 char *buf, size_t buflen,
-				 struct hostent **result, int *h_errnop)
+static void nwrap_pw_mark(struct nwrap_cache *nwrap, struct nwrap_mark *mark)
 {
-	*result = nwrap_files_gethostbyaddr(addr, len, type);
-	if (*result != NULL) {
-		memset(buf, '\0', buflen);
-		*ret = **result;
-		return 0;
-	} else {
-		*h_errnop = h_errno;
-		return -1;
-	}
+	struct nwrap_pw *nwrap_pw = (struct nwrap_pw *)nwrap->private_data;
+
+	mark->num = nwrap_pw->num;
+	mark->num_ranges = nwrap_pw->num_ranges;
+	mark->pool_used = nwrap_pw->pool.used;
+	mark->max_size = nwrap_pw->max_size;
 }
 
-int gethostbyaddr_r(const void *addr, socklen_t len, int type,
-		    struct hostent *ret,
-		    char *buf, size_t buflen,
-		    struct hostent **result, int *h_errnop)
+static void nwrap_pw_truncate(struct nwrap_cache *nwrap,
+			      const struct nwrap_mark *mark)
 {
-	if (!nss_wrapper_hosts_enabled()) {
-		return libc_gethostbyaddr_r(addr,
-					    len,
-					    type,
-					    ret,
-					    buf,
-					    buflen,
-					    result,
-					    h_errnop);
-	}
+	struct nwrap_pw *nwrap_pw = (struct nwrap_pw *)nwrap->private_data;
+
+	nwrap_pw->num = mark->num;
+	nwrap_pw->num_ranges = mark->num_ranges;
+	nwrap_pw->pool.used = mark->pool_used;
+	nwrap_pw->max_size = mark->max_size;
 
-	return nwrap_gethostbyaddr_r(addr, len, type, ret, buf, buflen, result, h_errnop);
+	nwrap_pw->idx = 0;
+	nwrap_pw->range_idx = 0;
+	nwrap_pw->range_off = 0;
 }
-#endif
 
-/* hosts enum functions */
-static void nwrap_files_sethostent(void)
+static void nwrap_pw_swap(struct nwrap_cache *live, struct nwrap_cache *next)
 {
-	nwrap_he_global.idx = 0;
+	struct nwrap_pw *live_pw = (struct nwrap_pw *)live->private_data;
+	struct nwrap_pw *next_pw = (struct nwrap_pw *)next->private_data;
+
+	nwrap_db_swap(live_pw, next_pw, sizeof(struct nwrap_pw));
 }
 
-static struct hostent *nwrap_files_gethostent(void)
+/* Entry i is a "-name" line or its name is overridden by a later layer */
+static bool nwrap_pw_hidden(const struct nwrap_pw *nwrap_pw, int i)
 {
-	struct hostent *he;
-
-	if (nwrap_he_global.idx == 0) {
-		bool ok;
+	const char *name = nwrap_pw->pool.buf + nwrap_pw->offsets[i];
+	int j;
 
-		ok = nwrap_files_cache_reload(nwrap_he_global.cache);
-		if (!ok) {
-			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading hosts file");
-			return NULL;
-		}
+	if (nwrap_pw->deleted[i]) {
+		return true;
 	}
 
-	if (nwrap_he_global.idx >= nwrap_he_global.num) {
-		errno = ENOENT;
-		return NULL;
+	for (j = nwrap_layer_end(nwrap_pw->cache, i, nwrap_pw->num);
+	     j < nwrap_pw->num;
+	     j++) {
+		if (nwrap_pw->hashes[j] == nwrap_pw->hashes[i] &&
+		    strcmp(nwrap_pw->pool.buf + nwrap_pw->offsets[j],
+			   name) == 0) {
+			return true;
+		}
 	}
 
-	he = &((struct nwrap_entdata *)nwrap_he_global.entries.items[nwrap_he_global.idx++])->ht;
-
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "return hosts[%s]", he->h_name);
-
-	return he;
+	return false;
 }
 
-static void nwrap_files_endhostent(void)
+static int nwrap_pw_copy_r(const struct passwd *src, struct passwd *dst,
+			   char *buf, size_t buflen, struct passwd **dstp)
 {
-	nwrap_he_global.idx = 0;
-}
+	char *first;
+	char *last;
+	off_t ofs;
 
-/*
- * module backend
- */
+	first = src->pw_name;
 
-#ifndef NO_NSS_SUPPORT
-static struct passwd *nwrap_module_getpwnam(struct nwrap_backend *b,
-					    const char *name)
-{
-	static struct passwd pwd;
-	static char buf[1000];
-	NSS_STATUS status;
+	last = src->pw_shell;
+	while (*last) last++;
 
-	if (!b->fns->_nss_getpwnam_r) {
-		return NULL;
-	}
+	ofs = PTR_DIFF(last + 1, first);
 
-	status = b->fns->_nss_getpwnam_r(name, &pwd, buf, sizeof(buf), &errno);
-	if (status == NSS_STATUS_NOTFOUND) {
-		return NULL;
+	if (ofs > (off_t) buflen) {
+		return ERANGE;
 	}
-	if (status != NSS_STATUS_SUCCESS) {
-		return NULL;
+
+	memcpy(buf, first, ofs);
+
+	ofs = PTR_DIFF(src->pw_name, first);
+	dst->pw_name = buf + ofs;
+	ofs = PTR_DIFF(src->pw_passwd, first);
+	dst->pw_passwd = buf + ofs;
+	dst->pw_uid = src->pw_uid;
+	dst->pw_gid = src->pw_gid;
+	ofs = PTR_DIFF(src->pw_gecos, first);
+	dst->pw_gecos = buf + ofs;
+	ofs = PTR_DIFF(src->pw_dir, first);
+	dst->pw_dir = buf + ofs;
+	ofs = PTR_DIFF(src->pw_shell, first);
+	dst->pw_shell = buf + ofs;
+
+	if (dstp) {
+		*dstp = dst;
 	}
 
-	return &pwd;
+	return 0;
 }
 
-static int nwrap_module_getpwnam_r(struct nwrap_backend *b,
-				   const char *name, struct passwd *pwdst,
-				   char *buf, size_t buflen, struct passwd **pwdstp)
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+/* Returns the slot of the name or the free slot to add it */
+static uint32_t *nwrap_sp_slot(struct nwrap_sp *nwrap_sp,
+			       const char *name,
+			       uint32_t hash)
 {
-	int ret;
-
-	(void) b; /* unused */
-	(void) pwdst; /* unused */
-	(void) pwdstp; /* unused */
+	size_t mask = nwrap_sp->num_slots - 1;
+	size_t i;
 
-	if (!b->fns->_nss_getpwnam_r) {
-		return NSS_STATUS_NOTFOUND;
-	}
+	for (i = hash & mask; nwrap_sp->slots[i] != 0; i = (i + 1) & mask) {
+		uint32_t idx = nwrap_sp->slots[i] - 1;
 
-	ret = b->fns->_nss_getpwnam_r(name, pwdst, buf, buflen, &errno);
-	switch (ret) {
-	case NSS_STATUS_SUCCESS:
-		return 0;
-	case NSS_STATUS_NOTFOUND:
-		if (errno != 0) {
-			return errno;
-		}
-		return ENOENT;
-	case NSS_STATUS_TRYAGAIN:
-		if (errno != 0) {
-			return errno;
-		}
-		return ERANGE;
-	default:
-		if (errno != 0) {
-			return errno;
+		if (nwrap_sp->hashes[idx] == hash &&
+		    strcmp(nwrap_sp->list[idx].sp_namp, name) == 0) {
+			break;
 		}
-		return ret;
 	}
+
+	return &nwrap_sp->slots[i];
 }
 
-static struct passwd *nwrap_module_getpwuid(struct nwrap_backend *b,
-					    uid_t uid)
+/*
+ * The table is kept at most half full. first is the index of the first entry
+ * of the layer idx belongs to.
+ */
+static bool nwrap_sp_index_add(struct nwrap_sp *nwrap_sp, int idx, int first)
 {
-	static struct passwd pwd;
-	static char buf[1000];
-	NSS_STATUS status;
+	uint32_t *slot;
 
-	if (!b->fns->_nss_getpwuid_r) {
-		return NULL;
-	}
+	if ((size_t)(idx + 1) * 2 > nwrap_sp->num_slots) {
+		size_t num_slots = nwrap_sp->num_slots > 0 ?
+				   nwrap_sp->num_slots * 2 : 64;
+		uint32_t *old_slots = nwrap_sp->slots;
+		size_t old_num_slots = nwrap_sp->num_slots;
+		size_t i;
 
-	status = b->fns->_nss_getpwuid_r(uid, &pwd, buf, sizeof(buf), &errno);
-	if (status == NSS_STATUS_NOTFOUND) {
-		return NULL;
+		nwrap_sp->slots = (uint32_t *)calloc(num_slots,
+						     sizeof(uint32_t));
+		if (nwrap_sp->slots == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Unable to allocate hash table");
+			nwrap_sp->slots = old_slots;
+			return false;
+		}
+		nwrap_sp->num_slots = num_slots;
+
+		for (i = 0; i < old_num_slots; i++) {
+			uint32_t n = old_slots[i];
+
+			if (n == 0) {
+				continue;
+			}
+			slot = nwrap_sp_slot(nwrap_sp,
+					     nwrap_sp->list[n - 1].sp_namp,
+					     nwrap_sp->hashes[n - 1]);
+			*slot = n;
+		}
+		SAFE_FREE(old_slots);
 	}
-	if (status != NSS_STATUS_SUCCESS) {
-		return NULL;
+
+	slot = nwrap_sp_slot(nwrap_sp,
+			     nwrap_sp->list[idx].sp_namp,
+			     nwrap_sp->hashes[idx]);
+	/*
+	 * The first entry of a name in a layer wins, it overrides the entries
+	 * of earlier layers.
+	 */
+	if (*slot == 0 || *slot - 1 < (uint32_t)first) {
+		*slot = (uint32_t)idx + 1;
 	}
-	return &pwd;
+
+	return true;
 }
 
-static int nwrap_module_getpwuid_r(struct nwrap_backend *b,
-				   uid_t uid, struct passwd *pwdst,
-				   char *buf, size_t buflen, struct passwd **pwdstp)
+static bool nwrap_sp_parse_line(struct nwrap_cache *nwrap, char *line)
 {
-	int ret;
+	struct nwrap_sp *nwrap_sp = (struct nwrap_sp *)nwrap->private_data;
+	const struct nwrap_column columns[] = {
+		{ (void **)&nwrap_sp->list, sizeof(struct spwd) },
+		{ (void **)&nwrap_sp->hashes, sizeof(uint32_t) },
+	};
+	/* name:pwd:lstchg:min:max:warn:inact:expire:flag */
+	char *fields[9];
+	struct spwd *sp;
+	size_t num;
+	size_t i;
+	bool ok;
 
-	(void) pwdstp; /* unused */
+	ok = nwrap_columns_reserve(nwrap_sp->num, &nwrap_sp->capacity,
+				   columns, ARRAY_SIZE(columns));
+	if (!ok) {
+		return false;
+	}
 
-	if (!b->fns->_nss_getpwuid_r) {
-		return ENOENT;
+	sp = &nwrap_sp->list[nwrap_sp->num];
+
+	num = nwrap_split_line(line, ':', fields, ARRAY_SIZE(fields));
+	if (num != ARRAY_SIZE(fields)) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid line[%s]: only %zu fields",
+			  line, num);
+		return false;
 	}
 
-	ret = b->fns->_nss_getpwuid_r(uid, pwdst, buf, buflen, &errno);
-	switch (ret) {
-	case NSS_STATUS_SUCCESS:
-		return 0;
-	case NSS_STATUS_NOTFOUND:
-		if (errno != 0) {
-			return errno;
-		}
-		return ENOENT;
-	case NSS_STATUS_TRYAGAIN:
-		if (errno != 0) {
-			return errno;
-		}
-		return ERANGE;
-	default:
-		if (errno != 0) {
-			return errno;
+	sp->sp_namp = fields[0];
+	sp->sp_pwdp = fields[1];
+
+	{
+		long *values[] = {
+			&sp->sp_lstchg,
+			&sp->sp_min,
+			&sp->sp_max,
+			&sp->sp_warn,
+			&sp->sp_inact,
+			&sp->sp_expire,
+		};
+
+		/* An empty field is -1 */
+		for (i = 0; i < ARRAY_SIZE(values); i++) {
+			const char *f = fields[2 + i];
+
+			if (f[0] == '\0') {
+				*values[i] = -1;
+				continue;
+			}
+			ok = nwrap_parse_long(f, values[i]);
+			if (!ok) {
+				NWRAP_LOG(NWRAP_LOG_ERROR,
+					  "Invalid field[%s] of user[%s]",
+					  f, sp->sp_namp);
+				return false;
+			}
 		}
-		return ret;
 	}
-}
 
-static void nwrap_module_setpwent(struct nwrap_backend *b)
-{
-	if (!b->fns->_nss_setpwent) {
-		return;
+	nwrap_sp->hashes[nwrap_sp->num] = nwrap_name_hash(sp->sp_namp);
+
+	ok = nwrap_sp_index_add(nwrap_sp, nwrap_sp->num, nwrap_sp->layer_first);
+	if (!ok) {
+		return false;
 	}
 
-	b->fns->_nss_setpwent();
+	nwrap_sp->num++;
+	return true;
 }
 
-static struct passwd *nwrap_module_getpwent(struct nwrap_backend *b)
+static void nwrap_sp_unload(struct nwrap_cache *nwrap)
 {
-	static struct passwd pwd;
-	static char buf[1000];
-	NSS_STATUS status;
+	struct nwrap_sp *nwrap_sp;
+	nwrap_sp = (struct nwrap_sp *)nwrap->private_data;
 
-	if (!b->fns->_nss_getpwent_r) {
-		return NULL;
-	}
+	SAFE_FREE(nwrap_sp->list);
+	SAFE_FREE(nwrap_sp->hashes);
+	nwrap_sp->num = 0;
+	nwrap_sp->capacity = 0;
+	nwrap_sp->idx = 0;
 
-	status = b->fns->_nss_getpwent_r(&pwd, buf, sizeof(buf), &errno);
-	if (status == NSS_STATUS_NOTFOUND) {
-		return NULL;
-	}
-	if (status != NSS_STATUS_SUCCESS) {
-		return NULL;
-	}
-	return &pwd;
+	SAFE_FREE(nwrap_sp->slots);
+	nwrap_sp->num_slots = 0;
+	nwrap_sp->layer_first = 0;
 }
 
-static int nwrap_module_getpwent_r(struct nwrap_backend *b,
-				   struct passwd *pwdst, char *buf,
-				   size_t buflen, struct passwd **pwdstp)
+static void nwrap_sp_mark(struct nwrap_cache *nwrap, struct nwrap_mark *mark)
 {
-	int ret;
+	struct nwrap_sp *nwrap_sp = (struct nwrap_sp *)nwrap->private_data;
+
+	mark->num = nwrap_sp->num;
+	nwrap_sp->layer_first = nwrap_sp->num;
+}
 
-	(void) pwdstp; /* unused */
+/* The strings point into the lines, they are freed by the caller */
+static void nwrap_sp_truncate(struct nwrap_cache *nwrap,
+			      const struct nwrap_mark *mark)
+{
+	struct nwrap_sp *nwrap_sp = (struct nwrap_sp *)nwrap->private_data;
+	size_t l;
+	int first;
+	int end;
+	int i;
 
-	if (!b->fns->_nss_getpwent_r) {
-		return ENOENT;
-	}
+	nwrap_sp->num = mark->num;
+	nwrap_sp->idx = 0;
 
-	ret = b->fns->_nss_getpwent_r(pwdst, buf, buflen, &errno);
-	switch (ret) {
-	case NSS_STATUS_SUCCESS:
-		return 0;
-	case NSS_STATUS_NOTFOUND:
-		if (errno != 0) {
-			return errno;
-		}
-		return ENOENT;
-	case NSS_STATUS_TRYAGAIN:
-		if (errno != 0) {
-			return errno;
-		}
-		return ERANGE;
-	default:
-		if (errno != 0) {
-			return errno;
+	/* Rebuild the index, the removed entries may override others */
+	if (nwrap_sp->slots != NULL) {
+		memset(nwrap_sp->slots, 0,
+		       nwrap_sp->num_slots * sizeof(uint32_t));
+	}
+	for (l = 0; l < nwrap->num_layers; l++) {
+		nwrap_layer_entries(nwrap, l, nwrap_sp->num, &first, &end);
+		for (i = first; i < end; i++) {
+			/* The table is big enough already */
+			nwrap_sp_index_add(nwrap_sp, i, first);
 		}
-		return ret;
 	}
 }
 
-static void nwrap_module_endpwent(struct nwrap_backend *b)
+static void nwrap_sp_swap(struct nwrap_cache *live, struct nwrap_cache *next)
 {
-	if (!b->fns->_nss_endpwent) {
-		return;
-	}
+	struct nwrap_sp *live_sp = (struct nwrap_sp *)live->private_data;
+	struct nwrap_sp *next_sp = (struct nwrap_sp *)next->private_data;
 
-	b->fns->_nss_endpwent();
+	nwrap_db_swap(live_sp, next_sp, sizeof(struct nwrap_sp));
 }
 
-static int nwrap_module_initgroups(struct nwrap_backend *b,
-				   const char *user, gid_t group)
+/* The name of entry i is overridden by a later layer */
+static bool nwrap_sp_hidden(struct nwrap_sp *nwrap_sp, int i)
 {
-	gid_t *groups;
-	long int start;
-	long int size;
-
-	if (!b->fns->_nss_initgroups) {
-		return NSS_STATUS_UNAVAIL;
-	}
+	uint32_t *slot = nwrap_sp_slot(nwrap_sp,
+				       nwrap_sp->list[i].sp_namp,
+				       nwrap_sp->hashes[i]);
 
-	return b->fns->_nss_initgroups(user, group, &start, &size, &groups, 0, &errno);
+	return *slot - 1 >= (uint32_t)nwrap_layer_end(nwrap_sp->cache,
+							i,
+							nwrap_sp->num);
 }
 
-static struct group *nwrap_module_getgrnam(struct nwrap_backend *b,
-					   const char *name)
+#if defined(HAVE_GETSPNAM_R) || defined(HAVE_GETSPENT_R)
+static int nwrap_sp_copy_r(const struct spwd *src, struct spwd *dst,
+			   char *buf, size_t buflen, struct spwd **dstp)
 {
-	static struct group grp;
-	static char *buf;
-	static int buflen = 1000;
-	NSS_STATUS status;
+	size_t namelen = strlen(src->sp_namp) + 1;
+	size_t pwdlen = strlen(src->sp_pwdp) + 1;
 
-	if (!b->fns->_nss_getgrnam_r) {
-		return NULL;
+	if (namelen + pwdlen > buflen) {
+		return ERANGE;
 	}
 
-	if (!buf) {
-		buf = (char *)malloc(buflen);
-	}
-again:
-	status = b->fns->_nss_getgrnam_r(name, &grp, buf, buflen, &errno);
-	if (status == NSS_STATUS_TRYAGAIN) {
-		buflen *= 2;
-		buf = (char *)realloc(buf, buflen);
-		if (!buf) {
-			return NULL;
-		}
-		goto again;
-	}
-	if (status == NSS_STATUS_NOTFOUND) {
-		SAFE_FREE(buf);
-		return NULL;
-	}
-	if (status != NSS_STATUS_SUCCESS) {
-		SAFE_FREE(buf);
-		return NULL;
+	*dst = *src;
+
+	memcpy(buf, src->sp_namp, namelen);
+	dst->sp_namp = buf;
+	memcpy(buf + namelen, src->sp_pwdp, pwdlen);
+	dst->sp_pwdp = buf + namelen;
+
+	if (dstp != NULL) {
+		*dstp = dst;
 	}
-	return &grp;
+
+	return 0;
 }
+#endif /* HAVE_GETSPNAM_R || HAVE_GETSPENT_R */
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
-static int nwrap_module_getgrnam_r(struct nwrap_backend *b,
-				   const char *name, struct group *grdst,
-				   char *buf, size_t buflen, struct group **grdstp)
+#ifdef HAVE_INNETGR
+static char *nwrap_ng_trim(char *s)
 {
-	int ret;
-
-	(void) grdstp; /* unused */
+	char *e;
 
-	if (!b->fns->_nss_getgrnam_r) {
-		return ENOENT;
+	s += strspn(s, " \t");
+	e = s + strlen(s);
+	while (e > s && isspace((unsigned char)e[-1])) {
+		e--;
 	}
+	*e = '\0';
 
-	ret = b->fns->_nss_getgrnam_r(name, grdst, buf, buflen, &errno);
-	switch (ret) {
-	case NSS_STATUS_SUCCESS:
-		return 0;
-	case NSS_STATUS_NOTFOUND:
-		if (errno != 0) {
-			return errno;
-		}
-		return ENOENT;
-	case NSS_STATUS_TRYAGAIN:
-		if (errno != 0) {
-			return errno;
-		}
-		return ERANGE;
-	default:
-		if (errno != 0) {
-			return errno;
-		}
-		return ret;
-	}
+	return s;
 }
 
-static struct group *nwrap_module_getgrgid(struct nwrap_backend *b,
-					   gid_t gid)
+/* Copy a field to the pool, an empty one becomes NWRAP_NG_EMPTY */
+static bool nwrap_ng_add_str(struct nwrap_ng *nwrap_ng,
+			     const char *str,
+			     uint32_t *poffset)
 {
-	static struct group grp;
-	static char *buf;
-	static int buflen = 1000;
-	NSS_STATUS status;
+	size_t len = strlen(str);
+	bool ok;
 
-	if (!b->fns->_nss_getgrgid_r) {
-		return NULL;
+	if (len == 0) {
+		*poffset = NWRAP_NG_EMPTY;
+		return true;
 	}
 
-	if (!buf) {
-		buf = (char *)malloc(buflen);
+	ok = nwrap_strpool_reserve(&nwrap_ng->pool, len + 1);
+	if (!ok) {
+		return false;
 	}
+	*poffset = (uint32_t)nwrap_ng->pool.used;
+	nwrap_strpool_add(&nwrap_ng->pool, str);
 
-again:
-	status = b->fns->_nss_getgrgid_r(gid, &grp, buf, buflen, &errno);
-	if (status == NSS_STATUS_TRYAGAIN) {
-		buflen *= 2;
-		buf = (char *)realloc(buf, buflen);
-		if (!buf) {
-			return NULL;
-		}
-		goto again;
-	}
-	if (status == NSS_STATUS_NOTFOUND) {
-		SAFE_FREE(buf);
-		return NULL;
-	}
-	if (status != NSS_STATUS_SUCCESS) {
-		SAFE_FREE(buf);
+	return true;
+}
+
+static char *nwrap_ng_str(const struct nwrap_ng *nwrap_ng, uint32_t offset)
+{
+	if (offset == NWRAP_NG_EMPTY) {
 		return NULL;
 	}
-	return &grp;
+
+	return nwrap_ng->pool.buf + offset;
 }
 
-static int nwrap_module_getgrgid_r(struct nwrap_backend *b,
-				   gid_t gid, struct group *grdst,
-				   char *buf, size_t buflen, struct group **grdstp)
+/* Parse "(host,user,domain)" with *pp pointing behind the '(' */
+static bool nwrap_ng_parse_triple(struct nwrap_ng *nwrap_ng,
+				  char **pp,
+				  struct nwrap_ng_member *m)
 {
-	int ret;
+	char *p = *pp;
+	char *user;
+	char *domain;
+	char *e;
+	bool ok;
 
-	(void) grdstp; /* unused */
+	e = strchr(p, ')');
+	if (e == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Missing ')' in triple (%s", p);
+		return false;
+	}
+	*e = '\0';
 
-	if (!b->fns->_nss_getgrgid_r) {
-		return ENOENT;
+	user = strchr(p, ',');
+	if (user == NULL) {
+		goto invalid;
 	}
+	*user++ = '\0';
 
-	ret = b->fns->_nss_getgrgid_r(gid, grdst, buf, buflen, &errno);
-	switch (ret) {
-	case NSS_STATUS_SUCCESS:
-		return 0;
-	case NSS_STATUS_NOTFOUND:
-		if (errno != 0) {
-			return errno;
-		}
-		return ENOENT;
-	case NSS_STATUS_TRYAGAIN:
-		if (errno != 0) {
-			return errno;
-		}
-		return ERANGE;
-	default:
-		if (errno != 0) {
-			return errno;
-		}
-		return ret;
+	domain = strchr(user, ',');
+	if (domain == NULL) {
+		goto invalid;
 	}
-}
+	*domain++ = '\0';
 
-static void nwrap_module_setgrent(struct nwrap_backend *b)
-{
-	if (!b->fns->_nss_setgrent) {
-		return;
+	if (strchr(domain, ',') != NULL) {
+		goto invalid;
 	}
 
-	b->fns->_nss_setgrent();
+	ok = nwrap_ng_add_str(nwrap_ng, nwrap_ng_trim(p), &m->host);
+	if (ok) {
+		ok = nwrap_ng_add_str(nwrap_ng, nwrap_ng_trim(user), &m->user);
+	}
+	if (ok) {
+		ok = nwrap_ng_add_str(nwrap_ng,
+				      nwrap_ng_trim(domain),
+				      &m->domain);
+	}
+	m->nested = NWRAP_NG_EMPTY;
+
+	*pp = e + 1;
+	return ok;
+
+invalid:
+	NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid triple (%s)", p);
+	return false;
 }
 
-static struct group *nwrap_module_getgrent(struct nwrap_backend *b)
+/*
+ * A line is "name member...", where a member is a (host,user,domain) triple
+ * or the name of another netgroup. A backslash at the end of a line continues
+ * the members on the next line.
+ */
+static bool nwrap_ng_parse_line(struct nwrap_cache *nwrap, char *line)
 {
-	static struct group grp;
-	static char *buf;
-	static int buflen = 1024;
-	NSS_STATUS status;
+	struct nwrap_ng *nwrap_ng = (struct nwrap_ng *)nwrap->private_data;
+	const struct nwrap_column groups[] = {
+		{ (void **)&nwrap_ng->groups, sizeof(struct nwrap_ng_group) },
+	};
+	const struct nwrap_column members[] = {
+		{ (void **)&nwrap_ng->members, sizeof(struct nwrap_ng_member) },
+	};
+	struct nwrap_ng_group *g;
+	bool continued = nwrap_ng->continued;
+	size_t len = strlen(line);
+	char *p;
+	char *e;
+	bool ok;
 
-	if (!b->fns->_nss_getgrent_r) {
-		return NULL;
+	while (len > 0 && isspace((unsigned char)line[len - 1])) {
+		len--;
 	}
-
-	if (!buf) {
-		buf = (char *)malloc(buflen);
+	nwrap_ng->continued = len > 0 && line[len - 1] == '\\';
+	if (nwrap_ng->continued) {
+		len--;
 	}
+	line[len] = '\0';
 
-again:
-	status = b->fns->_nss_getgrent_r(&grp, buf, buflen, &errno);
-	if (status == NSS_STATUS_TRYAGAIN) {
-		buflen *= 2;
-		buf = (char *)realloc(buf, buflen);
-		if (!buf) {
-			return NULL;
+	p = line + strspn(line, " \t");
+
+	if (!continued) {
+		if (p[0] == '\0' || p[0] == '#') {
+			nwrap_ng->continued = false;
+			return true;
 		}
-		goto again;
-	}
-	if (status == NSS_STATUS_NOTFOUND) {
-		SAFE_FREE(buf);
-		return NULL;
-	}
-	if (status != NSS_STATUS_SUCCESS) {
-		SAFE_FREE(buf);
-		return NULL;
-	}
-	return &grp;
-}
 
-static int nwrap_module_getgrent_r(struct nwrap_backend *b,
-				   struct group *grdst, char *buf,
-				   size_t buflen, struct group **grdstp)
-{
-	int ret;
+		ok = nwrap_columns_reserve(nwrap_ng->num_groups,
+					   &nwrap_ng->groups_capacity,
+					   groups, ARRAY_SIZE(groups));
+		if (!ok) {
+			return false;
+		}
 
-	(void) grdstp; /* unused */
+		e = p + strcspn(p, " \t");
+		if (e[0] != '\0') {
+			*e++ = '\0';
+		}
 
-	if (!b->fns->_nss_getgrent_r) {
-		return ENOENT;
+		g = &nwrap_ng->groups[nwrap_ng->num_groups];
+		memset(g, 0, sizeof(*g));
+		ok = nwrap_ng_add_str(nwrap_ng, p, &g->name);
+		if (!ok) {
+			return false;
+		}
+		g->hash = nwrap_name_hash(p);
+		g->first_member = nwrap_ng->num_members;
+		nwrap_ng->num_groups++;
+
+		NWRAP_LOG(NWRAP_LOG_TRACE, "netgroup[%s]", p);
+
+		p = e;
 	}
 
-	ret = b->fns->_nss_getgrent_r(grdst, buf, buflen, &errno);
-	switch (ret) {
-	case NSS_STATUS_SUCCESS:
-		return 0;
-	case NSS_STATUS_NOTFOUND:
-		if (errno != 0) {
-			return errno;
+	g = &nwrap_ng->groups[nwrap_ng->num_groups - 1];
+
+	for (;;) {
+		struct nwrap_ng_member *m;
+
+		p += strspn(p, " \t");
+		if (p[0] == '\0') {
+			break;
 		}
-		return ENOENT;
-	case NSS_STATUS_TRYAGAIN:
-		if (errno != 0) {
-			return errno;
+
+		ok = nwrap_columns_reserve(nwrap_ng->num_members,
+					   &nwrap_ng->members_capacity,
+					   members, ARRAY_SIZE(members));
+		if (!ok) {
+			return false;
 		}
-		return ERANGE;
-	default:
-		if (errno != 0) {
-			return errno;
+		m = &nwrap_ng->members[nwrap_ng->num_members];
+
+		if (p[0] == '(') {
+			p++;
+			ok = nwrap_ng_parse_triple(nwrap_ng, &p, m);
+		} else {
+			e = p + strcspn(p, " \t");
+			if (e[0] != '\0') {
+				*e++ = '\0';
+			}
+			m->host = m->user = m->domain = NWRAP_NG_EMPTY;
+			ok = nwrap_ng_add_str(nwrap_ng, p, &m->nested);
+			p = e;
+		}
+		if (!ok) {
+			return false;
 		}
-		return ret;
-	}
-}
 
-static void nwrap_module_endgrent(struct nwrap_backend *b)
-{
-	if (!b->fns->_nss_endgrent) {
-		return;
+		nwrap_ng->num_members++;
+		g->num_members++;
 	}
 
-	b->fns->_nss_endgrent();
+	return true;
 }
-#endif
 
-/****************************************************************************
- *   GETPWNAM
- ***************************************************************************/
-
-static struct passwd *nwrap_getpwnam(const char *name)
+static void nwrap_ng_unload(struct nwrap_cache *nwrap)
 {
-	int i;
-	struct passwd *pwd;
+	struct nwrap_ng *nwrap_ng = (struct nwrap_ng *)nwrap->private_data;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		pwd = b->ops->nw_getpwnam(b, name);
-		if (pwd) {
-			return pwd;
-		}
-	}
+	nwrap_strpool_free(&nwrap_ng->pool);
+	SAFE_FREE(nwrap_ng->groups);
+	nwrap_ng->num_groups = 0;
+	nwrap_ng->groups_capacity = 0;
+	SAFE_FREE(nwrap_ng->members);
+	nwrap_ng->num_members = 0;
+	nwrap_ng->members_capacity = 0;
+	nwrap_ng->continued = false;
 
-	return NULL;
+	SAFE_FREE(nwrap_ng->flat);
+	nwrap_ng->num_flat = 0;
+	nwrap_ng->flat_capacity = 0;
+	SAFE_FREE(nwrap_ng->names);
+	nwrap_ng->num_name_slots = 0;
+	SAFE_FREE(nwrap_ng->keys);
+	nwrap_ng->num_keys = 0;
+	nwrap_ng->num_key_slots = 0;
+	nwrap_ng->indexed = false;
+
+	nwrap_ng->cur_group = -1;
+	nwrap_ng->cur_idx = 0;
 }
 
-struct passwd *getpwnam(const char *name)
+/* Like a reload it ends the walk of setnetgrent() */
+static void nwrap_ng_swap(struct nwrap_cache *live, struct nwrap_cache *next)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwnam(name);
-	}
+	struct nwrap_ng *live_ng = (struct nwrap_ng *)live->private_data;
+	struct nwrap_ng *next_ng = (struct nwrap_ng *)next->private_data;
 
-	return nwrap_getpwnam(name);
+	nwrap_db_swap(live_ng, next_ng, sizeof(struct nwrap_ng));
 }
 
-/****************************************************************************
- *   GETPWNAM_R
- ***************************************************************************/
-
-static int nwrap_getpwnam_r(const char *name, struct passwd *pwdst,
-			    char *buf, size_t buflen, struct passwd **pwdstp)
+static int nwrap_ng_find_group(const struct nwrap_ng *nwrap_ng,
+			       const char *name)
 {
-	int i,ret;
+	uint32_t hash = nwrap_name_hash(name);
+	size_t mask = nwrap_ng->num_name_slots - 1;
+	size_t i;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		ret = b->ops->nw_getpwnam_r(b, name, pwdst, buf, buflen, pwdstp);
-		if (ret == ENOENT) {
-			continue;
-		}
-		return ret;
+	if (nwrap_ng->num_name_slots == 0) {
+		return -1;
 	}
 
-	return ENOENT;
-}
+	for (i = hash & mask; nwrap_ng->names[i] != 0; i = (i + 1) & mask) {
+		const struct nwrap_ng_group *g =
+			&nwrap_ng->groups[nwrap_ng->names[i] - 1];
 
-#ifdef HAVE_GETPWNAM_R
-# ifdef HAVE_SOLARIS_GETPWNAM_R
-int getpwnam_r(const char *name, struct passwd *pwdst,
-	       char *buf, int buflen, struct passwd **pwdstp)
-# else /* HAVE_SOLARIS_GETPWNAM_R */
-int getpwnam_r(const char *name, struct passwd *pwdst,
-	       char *buf, size_t buflen, struct passwd **pwdstp)
-# endif /* HAVE_SOLARIS_GETPWNAM_R */
-{
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwnam_r(name, pwdst, buf, buflen, pwdstp);
+		if (g->hash == hash &&
+		    strcmp(nwrap_ng->pool.buf + g->name, name) == 0) {
+			return nwrap_ng->names[i] - 1;
+		}
 	}
 
-	return nwrap_getpwnam_r(name, pwdst, buf, buflen, pwdstp);
+	return -1;
 }
-#endif
 
-/****************************************************************************
- *   GETPWUID
- ***************************************************************************/
+/*
+ * A field of an index key: a string, or s is NULL and offset is
+ * NWRAP_NG_EMPTY or NWRAP_NG_ANY.
+ */
+struct nwrap_ng_field {
+	const char *s;
+	uint32_t offset;
+};
 
-static struct passwd *nwrap_getpwuid(uid_t uid)
+static uint32_t nwrap_ng_key_hash(int group,
+				  const struct nwrap_ng_field f[3])
 {
+	uint32_t hash = 2166136261U;
+	const unsigned char *c;
 	int i;
-	struct passwd *pwd;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		pwd = b->ops->nw_getpwuid(b, uid);
-		if (pwd) {
-			return pwd;
+	hash = (hash ^ (uint32_t)group) * 16777619U;
+
+	for (i = 0; i < 3; i++) {
+		if (f[i].s == NULL) {
+			hash = (hash ^ (f[i].offset & 0xff)) * 16777619U;
+		} else {
+			for (c = (const unsigned char *)f[i].s; *c != '\0'; c++) {
+				/* Only the user is case sensitive */
+				hash ^= i == 1 ? *c : (unsigned char)tolower(*c);
+				hash *= 16777619U;
+			}
 		}
+		hash *= 16777619U;
 	}
 
-	return NULL;
+	return hash;
 }
 
-struct passwd *getpwuid(uid_t uid)
+static bool nwrap_ng_field_equal(const struct nwrap_ng *nwrap_ng,
+				 uint32_t offset,
+				 const struct nwrap_ng_field *f,
+				 int i)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwuid(uid);
+	const char *s;
+
+	if (f->s == NULL || offset >= NWRAP_NG_ANY) {
+		return f->s == NULL && f->offset == offset;
 	}
 
-	return nwrap_getpwuid(uid);
-}
+	s = nwrap_ng->pool.buf + offset;
+	if (i == 1) {
+		return strcmp(s, f->s) == 0;
+	}
 
-/****************************************************************************
- *   GETPWUID_R
- ***************************************************************************/
+	return strcasecmp(s, f->s) == 0;
+}
 
-static int nwrap_getpwuid_r(uid_t uid, struct passwd *pwdst,
-			    char *buf, size_t buflen, struct passwd **pwdstp)
+/* Returns the slot of the key or the free slot to insert it */
+static struct nwrap_ng_key *nwrap_ng_key_slot(struct nwrap_ng *nwrap_ng,
+					      int group,
+					      const struct nwrap_ng_field f[3],
+					      uint32_t hash)
 {
-	int i,ret;
+	size_t mask = nwrap_ng->num_key_slots - 1;
+	size_t i;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		ret = b->ops->nw_getpwuid_r(b, uid, pwdst, buf, buflen, pwdstp);
-		if (ret == ENOENT) {
-			continue;
+	for (i = hash & mask; nwrap_ng->keys[i].group != 0; i = (i + 1) & mask) {
+		struct nwrap_ng_key *k = &nwrap_ng->keys[i];
+
+		if (k->hash == hash &&
+		    k->group == (uint32_t)group + 1 &&
+		    nwrap_ng_field_equal(nwrap_ng, k->host, &f[0], 0) &&
+		    nwrap_ng_field_equal(nwrap_ng, k->user, &f[1], 1) &&
+		    nwrap_ng_field_equal(nwrap_ng, k->domain, &f[2], 2)) {
+			return k;
 		}
-		return ret;
 	}
 
-	return ENOENT;
+	return &nwrap_ng->keys[i];
 }
 
-#ifdef HAVE_SOLARIS_GETPWUID_R
-int getpwuid_r(uid_t uid, struct passwd *pwdst,
-	       char *buf, int buflen, struct passwd **pwdstp)
-#else
-int getpwuid_r(uid_t uid, struct passwd *pwdst,
-	       char *buf, size_t buflen, struct passwd **pwdstp)
-#endif
+/* Keep the index at most half full */
+static bool nwrap_ng_keys_reserve(struct nwrap_ng *nwrap_ng)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwuid_r(uid, pwdst, buf, buflen, pwdstp);
-	}
+	struct nwrap_ng_key *keys;
+	size_t num_slots;
+	size_t mask;
+	size_t i;
+	size_t j;
 
-	return nwrap_getpwuid_r(uid, pwdst, buf, buflen, pwdstp);
-}
+	if ((nwrap_ng->num_keys + 1) * 2 <= nwrap_ng->num_key_slots) {
+		return true;
+	}
 
-/****************************************************************************
- *   SETPWENT
- ***************************************************************************/
+	num_slots = nwrap_ng->num_key_slots > 0 ?
+		    nwrap_ng->num_key_slots * 2 : 256;
+	keys = (struct nwrap_ng_key *)calloc(num_slots, sizeof(*keys));
+	if (keys == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
+	}
+	mask = num_slots - 1;
 
-static void nwrap_setpwent(void)
-{
-	int i;
+	for (i = 0; i < nwrap_ng->num_key_slots; i++) {
+		const struct nwrap_ng_key *k = &nwrap_ng->keys[i];
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		b->ops->nw_setpwent(b);
+		if (k->group == 0) {
+			continue;
+		}
+		for (j = k->hash & mask; keys[j].group != 0; j = (j + 1) & mask);
+		keys[j] = *k;
 	}
-}
 
-void setpwent(void)
-{
-	if (!nss_wrapper_enabled()) {
-		libc_setpwent();
-		return;
-	}
+	SAFE_FREE(nwrap_ng->keys);
+	nwrap_ng->keys = keys;
+	nwrap_ng->num_key_slots = num_slots;
 
-	nwrap_setpwent();
+	return true;
 }
 
-/****************************************************************************
- *   GETPWENT
- ***************************************************************************/
-
-static struct passwd *nwrap_getpwent(void)
+/* Add the triple in member m to the flattened group */
+static bool nwrap_ng_add_triple(struct nwrap_ng *nwrap_ng, int group, uint32_t m)
 {
+	const struct nwrap_ng_member *member = &nwrap_ng->members[m];
+	const uint32_t offsets[3] = {
+		member->host, member->user, member->domain,
+	};
+	struct nwrap_ng_field f[3];
+	struct nwrap_ng_key *k;
+	uint32_t hash;
+	unsigned any;
 	int i;
-	struct passwd *pwd;
+	bool ok;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		pwd = b->ops->nw_getpwent(b);
-		if (pwd) {
-			return pwd;
+	for (any = 0; any < 8; any++) {
+		for (i = 0; i < 3; i++) {
+			if (any & (1U << i)) {
+				f[i].s = NULL;
+				f[i].offset = NWRAP_NG_ANY;
+			} else {
+				f[i].s = nwrap_ng_str(nwrap_ng, offsets[i]);
+				f[i].offset = offsets[i];
+			}
+		}
+
+		ok = nwrap_ng_keys_reserve(nwrap_ng);
+		if (!ok) {
+			return false;
+		}
+
+		hash = nwrap_ng_key_hash(group, f);
+		k = nwrap_ng_key_slot(nwrap_ng, group, f, hash);
+		if (k->group != 0) {
+			if (any == 0) {
+				/* Reached the same triple on another path */
+				return true;
+			}
+			continue;
 		}
+
+		k->group = (uint32_t)group + 1;
+		k->host = f[0].offset;
+		k->user = f[1].offset;
+		k->domain = f[2].offset;
+		k->hash = hash;
+		nwrap_ng->num_keys++;
 	}
 
-	return NULL;
-}
+	if (nwrap_ng->num_flat == nwrap_ng->flat_capacity) {
+		size_t n = nwrap_ng->flat_capacity > 0 ?
+			   nwrap_ng->flat_capacity * 2 : 64;
+		uint32_t *flat;
 
-struct passwd *getpwent(void)
-{
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwent();
+		flat = (uint32_t *)realloc(nwrap_ng->flat, n * sizeof(*flat));
+		if (flat == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			return false;
+		}
+		nwrap_ng->flat = flat;
+		nwrap_ng->flat_capacity = n;
 	}
+	nwrap_ng->flat[nwrap_ng->num_flat++] = m;
 
-	return nwrap_getpwent();
+	return true;
 }
 
-#if !(defined OSX || defined OPENBSD)
+/* Collect the triples of the group and all netgroups nested in it */
+static bool nwrap_ng_flatten(struct nwrap_ng *nwrap_ng,
+			     int group,
+			     int *seen,
+			     int *stack)
+{
+	struct nwrap_ng_group *g = &nwrap_ng->groups[group];
+	int sp = 0;
+	bool ok;
 
-/****************************************************************************
- *   GETPWENT_R
- ***************************************************************************/
+	g->first_triple = nwrap_ng->num_flat;
 
-static int nwrap_getpwent_r(struct passwd *pwdst, char *buf,
-			    size_t buflen, struct passwd **pwdstp)
-{
-	int i,ret;
+	seen[group] = group + 1;
+	stack[sp++] = group;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		ret = b->ops->nw_getpwent_r(b, pwdst, buf, buflen, pwdstp);
-		if (ret == ENOENT) {
-			continue;
+	while (sp > 0) {
+		const struct nwrap_ng_group *cur = &nwrap_ng->groups[stack[--sp]];
+		int i;
+
+		for (i = 0; i < cur->num_members; i++) {
+			uint32_t m = (uint32_t)(cur->first_member + i);
+			const char *nested = nwrap_ng_str(nwrap_ng,
+							  nwrap_ng->members[m].nested);
+			int n;
+
+			if (nested == NULL) {
+				ok = nwrap_ng_add_triple(nwrap_ng, group, m);
+				if (!ok) {
+					return false;
+				}
+				continue;
+			}
+
+			n = nwrap_ng_find_group(nwrap_ng, nested);
+			if (n < 0) {
+				NWRAP_LOG(NWRAP_LOG_DEBUG,
+					  "netgroup[%s] not found",
+					  nested);
+				continue;
+			}
+			/* Also breaks loops */
+			if (seen[n] == group + 1) {
+				continue;
+			}
+			seen[n] = group + 1;
+			stack[sp++] = n;
 		}
-		return ret;
 	}
 
-	return ENOENT;
+	g->num_triples = nwrap_ng->num_flat - g->first_triple;
+
+	return true;
 }
 
-#ifdef HAVE_SOLARIS_GETPWENT_R
-struct passwd *getpwent_r(struct passwd *pwdst, char *buf, int buflen)
+/*
+ * Flatten the nested netgroups and index the triples, so innetgr() doesn't
+ * depend on the nesting and size of the netgroups.
+ */
+static bool nwrap_ng_index(struct nwrap_ng *nwrap_ng)
 {
-	struct passwd *pwdstp = NULL;
-	int rc;
+	size_t num_slots = 64;
+	size_t mask;
+	int *seen = NULL;
+	int *stack = NULL;
+	bool ok = false;
+	int i;
 
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwent_r(pwdst, buf, buflen);
-	}
-	rc = nwrap_getpwent_r(pwdst, buf, buflen, &pwdstp);
-	if (rc < 0) {
-		return NULL;
+	if (nwrap_ng->indexed) {
+		return true;
 	}
 
-	return pwdstp;
-}
-#else /* HAVE_SOLARIS_GETPWENT_R */
-int getpwent_r(struct passwd *pwdst, char *buf,
-	       size_t buflen, struct passwd **pwdstp)
-{
-	if (!nss_wrapper_enabled()) {
-		return libc_getpwent_r(pwdst, buf, buflen, pwdstp);
+	while (num_slots < (size_t)nwrap_ng->num_groups * 2) {
+		num_slots *= 2;
 	}
+	nwrap_ng->names = (uint32_t *)calloc(num_slots, sizeof(uint32_t));
+	seen = (int *)calloc(nwrap_ng->num_groups + 1, sizeof(int));
+	stack = (int *)malloc((nwrap_ng->num_groups + 1) * sizeof(int));
+	if (nwrap_ng->names == NULL || seen == NULL || stack == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		goto done;
+	}
+	nwrap_ng->num_name_slots = num_slots;
+	mask = num_slots - 1;
 
-	return nwrap_getpwent_r(pwdst, buf, buflen, pwdstp);
-}
-#endif /* HAVE_SOLARIS_GETPWENT_R */
-#endif /* OSX || OPENBSD */
-
-/****************************************************************************
- *   ENDPWENT
- ***************************************************************************/
+	for (i = 0; i < nwrap_ng->num_groups; i++) {
+		const struct nwrap_ng_group *g = &nwrap_ng->groups[i];
+		size_t j;
 
-static void nwrap_endpwent(void)
-{
-	int i;
+		/* The first definition of a netgroup wins */
+		if (nwrap_ng_find_group(nwrap_ng,
+					nwrap_ng->pool.buf + g->name) >= 0) {
+			continue;
+		}
+		for (j = g->hash & mask; nwrap_ng->names[j] != 0; j = (j + 1) & mask);
+		nwrap_ng->names[j] = (uint32_t)i + 1;
+	}
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		b->ops->nw_endpwent(b);
+	for (i = 0; i < nwrap_ng->num_groups; i++) {
+		ok = nwrap_ng_flatten(nwrap_ng, i, seen, stack);
+		if (!ok) {
+			goto done;
+		}
 	}
-}
 
-void endpwent(void)
-{
-	if (!nss_wrapper_enabled()) {
-		libc_endpwent();
-		return;
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Indexed %d netgroups with %zu triples",
+		  nwrap_ng->num_groups,
+		  nwrap_ng->num_flat);
+
+	nwrap_ng->indexed = true;
+	ok = true;
+done:
+	SAFE_FREE(seen);
+	SAFE_FREE(stack);
+	if (!ok) {
+		SAFE_FREE(nwrap_ng->names);
+		nwrap_ng->num_name_slots = 0;
+		SAFE_FREE(nwrap_ng->flat);
+		nwrap_ng->num_flat = 0;
+		nwrap_ng->flat_capacity = 0;
+		SAFE_FREE(nwrap_ng->keys);
+		nwrap_ng->num_keys = 0;
+		nwrap_ng->num_key_slots = 0;
 	}
 
-	nwrap_endpwent();
+	return ok;
 }
 
-/****************************************************************************
- *   INITGROUPS
- ***************************************************************************/
-
-static int nwrap_initgroups(const char *user, gid_t group)
+/* A given field matches the same value and an empty field */
+static bool nwrap_ng_match(struct nwrap_ng *nwrap_ng,
+			   int group,
+			   const char *host,
+			   const char *user,
+			   const char *domain)
 {
+	const char *q[3] = { host, user, domain };
+	struct nwrap_ng_field f[3];
+	struct nwrap_ng_key *k;
+	unsigned empty;
 	int i;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		int rc;
+	if (nwrap_ng->num_key_slots == 0) {
+		return false;
+	}
 
-		rc = b->ops->nw_initgroups(b, user, group);
-		if (rc == 0) {
-			return 0;
+	for (empty = 0; empty < 8; empty++) {
+		bool valid = true;
+
+		for (i = 0; i < 3; i++) {
+			if (q[i] == NULL) {
+				valid = valid && (empty & (1U << i)) == 0;
+				f[i].s = NULL;
+				f[i].offset = NWRAP_NG_ANY;
+			} else if (empty & (1U << i)) {
+				f[i].s = NULL;
+				f[i].offset = NWRAP_NG_EMPTY;
+			} else {
+				f[i].s = q[i];
+				f[i].offset = 0;
+			}
+		}
+		if (!valid) {
+			continue;
+		}
+
+		k = nwrap_ng_key_slot(nwrap_ng, group, f,
+				      nwrap_ng_key_hash(group, f));
+		if (k->group != 0) {
+			return true;
 		}
 	}
 
-	errno = ENOENT;
-	return -1;
+	return false;
 }
+#endif /* HAVE_INNETGR */
 
-#ifndef OSX
-int initgroups(const char *user, gid_t group)
-#else
-int initgroups(const char *user, int group)
-#endif /* OSX */
+/* The member array of a thread is reserved once for the largest entry */
+static void nwrap_gr_note_nummem(struct nwrap_gr *nwrap_gr, unsigned nummem)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_initgroups(user, group);
+	if (nummem + 1 > nwrap_gr->mem_size) {
+		nwrap_gr->mem_size = nummem + 1;
 	}
-
-	return nwrap_initgroups(user, group);
 }
 
-/****************************************************************************
- *   GETGRNAM
- ***************************************************************************/
-
-static struct group *nwrap_getgrnam(const char *name)
+/* The member array of the thread for an entry of the database */
+static char **nwrap_gr_mem(const struct nwrap_gr *nwrap_gr)
 {
-	int i;
-	struct group *grp;
+	bool ok;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		grp = b->ops->nw_getgrnam(b, name);
-		if (grp) {
-			return grp;
-		}
+	ok = nwrap_ent_buf_reserve(&nwrap_ent_tls.gr_mem_buf,
+				   &nwrap_ent_tls.gr_mem_buf_size,
+				   nwrap_gr->mem_size * sizeof(char *));
+	if (!ok) {
+		return NULL;
 	}
 
-	return NULL;
+	return (char **)(void *)nwrap_ent_tls.gr_mem_buf;
 }
 
-struct group *getgrnam(const char *name)
+/*
+ * Track the buffer size the largest entry needs in getgrnam_r(): the
+ * alignment of the member array, the array itself and the strings.
+ */
+static void nwrap_gr_note_size(struct nwrap_gr *nwrap_gr,
+			       unsigned nummem,
+			       size_t len)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrnam(name);
-	}
+	size_t size = (sizeof(char *) - 1) +
+		      (nummem + 1) * sizeof(char *) + len;
 
-	return nwrap_getgrnam(name);
+	if (size > nwrap_gr->max_size) {
+		nwrap_gr->max_size = size;
+	}
 }
 
-/****************************************************************************
- *   GETGRNAM_R
- ***************************************************************************/
-
-static int nwrap_getgrnam_r(const char *name, struct group *grdst,
-			    char *buf, size_t buflen, struct group **grdstp)
+static bool nwrap_gr_add(struct nwrap_gr *nwrap_gr,
+			 const struct group *gr,
+			 unsigned nummem)
 {
-	int i, ret;
+	const struct nwrap_column columns[] = {
+		{ (void **)&nwrap_gr->gids, sizeof(gid_t) },
+		{ (void **)&nwrap_gr->hashes, sizeof(uint32_t) },
+		{ (void **)&nwrap_gr->offsets, sizeof(uint32_t) },
+		{ (void **)&nwrap_gr->nummem, sizeof(uint32_t) },
+		{ (void **)&nwrap_gr->sizes, sizeof(uint32_t) },
+		{ (void **)&nwrap_gr->first_rel, sizeof(uint32_t) },
+		{ (void **)&nwrap_gr->deleted, sizeof(bool) },
+	};
+	uint32_t *rels;
+	size_t len;
+	unsigned m;
+	int i = nwrap_gr->num;
+	bool ok;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		ret = b->ops->nw_getgrnam_r(b, name, grdst, buf, buflen, grdstp);
-		if (ret == ENOENT) {
-			continue;
+	ok = nwrap_columns_reserve(nwrap_gr->num, &nwrap_gr->capacity,
+				   columns, ARRAY_SIZE(columns));
+	if (!ok) {
+		return false;
+	}
+
+	nwrap_gr_note_nummem(nwrap_gr, nummem);
+
+	if (nwrap_gr->num_rels + nummem + 1 > nwrap_gr->rels_capacity) {
+		size_t n = nwrap_gr->rels_capacity > 0 ?
+			   nwrap_gr->rels_capacity * 2 : 256;
+
+		if (n < nwrap_gr->num_rels + nummem + 1) {
+			n = nwrap_gr->num_rels + nummem + 1;
 		}
-		return ret;
+		rels = (uint32_t *)realloc(nwrap_gr->rels, n * sizeof(uint32_t));
+		if (rels == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			return false;
+		}
+		nwrap_gr->rels = rels;
+		nwrap_gr->rels_capacity = n;
 	}
+	rels = &nwrap_gr->rels[nwrap_gr->num_rels];
 
-	return ENOENT;
-}
+	len = strlen(gr->gr_name) + 1;
+	rels[0] = (uint32_t)len;
+	len += strlen(gr->gr_passwd) + 1;
+	for (m = 0; m < nummem; m++) {
+		rels[m + 1] = (uint32_t)len;
+		len += strlen(gr->gr_mem[m]) + 1;
+	}
+	ok = nwrap_strpool_reserve(&nwrap_gr->pool, len);
+	if (!ok) {
+		return false;
+	}
 
-#ifdef HAVE_GETGRNAM_R
-# ifdef HAVE_SOLARIS_GETGRNAM_R
-int getgrnam_r(const char *name, struct group *grp,
-		char *buf, int buflen, struct group **pgrp)
-# else /* HAVE_SOLARIS_GETGRNAM_R */
-int getgrnam_r(const char *name, struct group *grp,
-	       char *buf, size_t buflen, struct group **pgrp)
-# endif /* HAVE_SOLARIS_GETGRNAM_R */
-{
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrnam_r(name,
-				       grp,
-				       buf,
-				       buflen,
-				       pgrp);
+	nwrap_gr->gids[i] = gr->gr_gid;
+	nwrap_gr->hashes[i] = nwrap_name_hash(gr->gr_name);
+	nwrap_gr->offsets[i] = (uint32_t)nwrap_gr->pool.used;
+	nwrap_gr->nummem[i] = nummem;
+	nwrap_gr->sizes[i] = (uint32_t)len;
+	nwrap_gr->first_rel[i] = (uint32_t)nwrap_gr->num_rels;
+	nwrap_gr->deleted[i] = false;
+
+	nwrap_strpool_add(&nwrap_gr->pool, gr->gr_name);
+	nwrap_strpool_add(&nwrap_gr->pool, gr->gr_passwd);
+	for (m = 0; m < nummem; m++) {
+		nwrap_strpool_add(&nwrap_gr->pool, gr->gr_mem[m]);
 	}
 
-	return nwrap_getgrnam_r(name, grp, buf, buflen, pgrp);
-}
-#endif /* HAVE_GETGRNAM_R */
+	nwrap_gr_note_size(nwrap_gr, nummem, len);
 
-/****************************************************************************
- *   GETGRGID
- ***************************************************************************/
+	nwrap_gr->num_rels += nummem + 1;
+	nwrap_gr->num++;
 
-static struct group *nwrap_getgrgid(gid_t gid)
+	return true;
+}
+
+/*
+ * Materialize the entry at index i. The returned struct belongs to the thread
+ * and is overwritten by its next call.
+ */
+static struct group *nwrap_gr_entry(const struct nwrap_gr *nwrap_gr, int i)
 {
-	int i;
-	struct group *grp;
+	struct group *gr = &nwrap_ent_tls.gr;
+	char *p = nwrap_gr->pool.buf + nwrap_gr->offsets[i];
+	const uint32_t *rels = &nwrap_gr->rels[nwrap_gr->first_rel[i]];
+	char **mem;
+	uint32_t m;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		grp = b->ops->nw_getgrgid(b, gid);
-		if (grp) {
-			return grp;
-		}
+	mem = nwrap_gr_mem(nwrap_gr);
+	if (mem == NULL) {
+		return NULL;
 	}
 
-	return NULL;
-}
+	gr->gr_name = p;
+	gr->gr_passwd = p + rels[0];
+	gr->gr_gid = nwrap_gr->gids[i];
 
-struct group *getgrgid(gid_t gid)
-{
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrgid(gid);
+	for (m = 0; m < nwrap_gr->nummem[i]; m++) {
+		mem[m] = p + rels[m + 1];
 	}
+	mem[m] = NULL;
+	gr->gr_mem = mem;
 
-	return nwrap_getgrgid(gid);
+	return gr;
 }
 
-/****************************************************************************
- *   GETGRGID_R
- ***************************************************************************/
-
-static int nwrap_getgrgid_r(gid_t gid, struct group *grdst,
-			    char *buf, size_t buflen, struct group **grdstp)
-{
-	int i,ret;
+/*
+ * Copy the entry at index i to buf: the member array first, then the blob
+ * of strings with a single memcpy. The pointers are rebased using the
+ * offsets computed when the file was loaded.
+ */
+static int nwrap_gr_blob_copy_r(const struct nwrap_gr *nwrap_gr, int i,
+				struct group *dst, char *buf, size_t buflen,
+				struct group **dstp)
+{
+	const uint32_t *rels = &nwrap_gr->rels[nwrap_gr->first_rel[i]];
+	uint32_t nummem = nwrap_gr->nummem[i];
+	size_t pad = (sizeof(char *) - (uintptr_t)buf % sizeof(char *)) %
+		     sizeof(char *);
+	size_t memlen = (nummem + 1) * sizeof(char *);
+	char **mem;
+	char *p;
+	uint32_t m;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		ret = b->ops->nw_getgrgid_r(b, gid, grdst, buf, buflen, grdstp);
-		if (ret == ENOENT) {
-			continue;
+	if (pad + memlen + nwrap_gr->sizes[i] > buflen) {
+		if (dstp != NULL) {
+			*dstp = NULL;
 		}
-		return ret;
+		return ERANGE;
 	}
 
-	return ENOENT;
+	mem = (char **)(void *)(buf + pad);
+	p = buf + pad + memlen;
+	memcpy(p, nwrap_gr->pool.buf + nwrap_gr->offsets[i], nwrap_gr->sizes[i]);
+
+	dst->gr_name = p;
+	dst->gr_passwd = p + rels[0];
+	dst->gr_gid = nwrap_gr->gids[i];
+	for (m = 0; m < nummem; m++) {
+		mem[m] = p + rels[m + 1];
+	}
+	mem[m] = NULL;
+	dst->gr_mem = mem;
+
+	if (dstp != NULL) {
+		*dstp = dst;
+	}
+
+	return 0;
 }
 
-#ifdef HAVE_GETGRGID_R
-# ifdef HAVE_SOLARIS_GETGRGID_R
-int getgrgid_r(gid_t gid, struct group *grdst,
-	       char *buf, int buflen, struct group **grdstp)
-# else /* HAVE_SOLARIS_GETGRGID_R */
-int getgrgid_r(gid_t gid, struct group *grdst,
-	       char *buf, size_t buflen, struct group **grdstp)
-# endif /* HAVE_SOLARIS_GETGRGID_R */
+static bool nwrap_gr_add_range(struct nwrap_gr *nwrap_gr,
+			       const struct group *gr,
+			       unsigned nummem,
+			       uint32_t count)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrgid_r(gid, grdst, buf, buflen, grdstp);
+	struct nwrap_gr_range *ranges;
+	struct nwrap_gr_range *r;
+	size_t len;
+	unsigned m;
+	bool ok;
+
+	ok = nwrap_tmpl_valid(gr->gr_name, true) &&
+	     nwrap_tmpl_valid(gr->gr_passwd, false);
+	for (m = 0; ok && m < nummem; m++) {
+		ok = nwrap_tmpl_valid(gr->gr_mem[m], false);
+	}
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid template in range of group[%s]",
+			  gr->gr_name);
+		return false;
 	}
 
-	return nwrap_getgrgid_r(gid, grdst, buf, buflen, grdstp);
-}
-#endif
+	ranges = (struct nwrap_gr_range *)realloc(nwrap_gr->ranges,
+			(nwrap_gr->num_ranges + 1) * sizeof(struct nwrap_gr_range));
+	if (ranges == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
+	}
+	nwrap_gr->ranges = ranges;
 
-/****************************************************************************
- *   SETGRENT
- ***************************************************************************/
+	nwrap_gr_note_nummem(nwrap_gr, nummem);
 
-static void nwrap_setgrent(void)
-{
-	int i;
+	len = strlen(gr->gr_name) + strlen(gr->gr_passwd) + 2;
+	for (m = 0; m < nummem; m++) {
+		len += strlen(gr->gr_mem[m]) + 1;
+	}
+	ok = nwrap_strpool_reserve(&nwrap_gr->pool, len);
+	if (!ok) {
+		return false;
+	}
+	r = &ranges[nwrap_gr->num_ranges];
+	r->gid = gr->gr_gid;
+	r->count = count;
+	r->nummem = nummem;
+	r->offset = (uint32_t)nwrap_gr->pool.used;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		b->ops->nw_setgrent(b);
+	nwrap_strpool_add(&nwrap_gr->pool, gr->gr_name);
+	nwrap_strpool_add(&nwrap_gr->pool, gr->gr_passwd);
+	for (m = 0; m < nummem; m++) {
+		nwrap_strpool_add(&nwrap_gr->pool, gr->gr_mem[m]);
 	}
-}
 
-#ifdef HAVE_BSD_SETGRENT
-int setgrent(void)
-#else
-void setgrent(void)
-#endif
-{
-	if (!nss_wrapper_enabled()) {
-		libc_setgrent();
-		goto out;
+	/* Every expanded id adds at most ten digits to a field */
+	nwrap_gr_note_size(nwrap_gr, nummem, len + (nummem + 2) * 10);
+	if (len + (nummem + 2) * 10 > nwrap_gr->range_size) {
+		nwrap_gr->range_size = len + (nummem + 2) * 10;
 	}
 
-	nwrap_setgrent();
+	nwrap_gr->num_ranges++;
 
-out:
-#ifdef HAVE_BSD_SETGRENT
-	return 0;
-#else
-	return;
-#endif
+	return true;
 }
 
-/****************************************************************************
- *   GETGRENT
- ***************************************************************************/
+/* Compute the entry at offset idx of a range, like nwrap_gr_entry() */
+static struct group *nwrap_gr_range_entry(const struct nwrap_gr *nwrap_gr,
+					  const struct nwrap_gr_range *r,
+					  uint32_t idx)
+{
+	struct group *gr = &nwrap_ent_tls.gr;
+	const char *t = nwrap_gr->pool.buf + r->offset;
+	char **mem;
+	char *p;
+	uint32_t m;
+	bool ok;
 
-static struct group *nwrap_getgrent(void)
+	mem = nwrap_gr_mem(nwrap_gr);
+	if (mem == NULL) {
+		return NULL;
+	}
+	ok = nwrap_ent_buf_reserve(&nwrap_ent_tls.gr_range_buf,
+				   &nwrap_ent_tls.gr_range_buf_size,
+				   nwrap_gr->range_size);
+	if (!ok) {
+		return NULL;
+	}
+	p = nwrap_ent_tls.gr_range_buf;
+
+	gr->gr_name = nwrap_tmpl_expand(t, idx, &p);
+	t += strlen(t) + 1;
+	gr->gr_passwd = nwrap_tmpl_expand(t, idx, &p);
+	t += strlen(t) + 1;
+	gr->gr_gid = r->gid + idx;
+
+	for (m = 0; m < r->nummem; m++) {
+		mem[m] = nwrap_tmpl_expand(t, idx, &p);
+		t += strlen(t) + 1;
+	}
+	mem[m] = NULL;
+	gr->gr_mem = mem;
+
+	return gr;
+}
+
+static struct group *nwrap_gr_range_next(struct nwrap_gr *nwrap_gr)
 {
-	int i;
-	struct group *grp;
+	while (nwrap_gr->range_idx < nwrap_gr->num_ranges) {
+		const struct nwrap_gr_range *r =
+			&nwrap_gr->ranges[nwrap_gr->range_idx];
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		grp = b->ops->nw_getgrent(b);
-		if (grp) {
-			return grp;
+		if (nwrap_gr->range_off < r->count) {
+			return nwrap_gr_range_entry(nwrap_gr,
+						    r,
+						    nwrap_gr->range_off++);
 		}
+
+		nwrap_gr->range_idx++;
+		nwrap_gr->range_off = 0;
 	}
 
 	return NULL;
 }
 
-struct group *getgrent(void)
+/* Same as nwrap_pw_add_deleted() */
+static bool nwrap_gr_add_deleted(struct nwrap_gr *nwrap_gr, char *name)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrent();
+	char empty[] = "";
+	char *mem[] = { NULL };
+	struct group gr;
+	char *p;
+	bool ok;
+
+	p = strchr(name, ':');
+	if (p != NULL) {
+		*p = '\0';
+	}
+	if (name[0] == '\0') {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Missing name in '-' line");
+		return false;
 	}
 
-	return nwrap_getgrent();
-}
+	ZERO_STRUCTP(&gr);
+	gr.gr_name = name;
+	gr.gr_passwd = empty;
+	gr.gr_gid = (gid_t)-1;
+	gr.gr_mem = mem;
 
-#if !(defined OSX || defined OPENBSD)
+	ok = nwrap_gr_add(nwrap_gr, &gr, 0);
+	if (!ok) {
+		return false;
+	}
+	nwrap_gr->deleted[nwrap_gr->num - 1] = true;
 
-/****************************************************************************
- *   GETGRENT_R
- ***************************************************************************/
-static int nwrap_getgrent_r(struct group *grdst, char *buf,
-			    size_t buflen, struct group **grdstp)
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Removed group[%s]", name);
+
+	return true;
+}
+
+/*
+ * the caller has to call nwrap_unload() on failure
+ */
+static bool nwrap_gr_parse_line(struct nwrap_cache *nwrap, char *line)
 {
-	int i,ret;
+	struct nwrap_gr *nwrap_gr;
+	/* name:password:gid:members */
+	char *fields[4];
+	const char *e = NULL;
+	struct group _gr;
+	struct group *gr = &_gr;
+	unsigned nummem;
+	uint32_t id;
+	uint32_t count = 0;
+	size_t num;
+	bool ok;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		ret = b->ops->nw_getgrent_r(b, grdst, buf, buflen, grdstp);
-		if (ret == ENOENT) {
-			continue;
-		}
-		return ret;
+	nwrap_gr = (struct nwrap_gr *)nwrap->private_data;
+
+	if (line[0] == '-') {
+		return nwrap_gr_add_deleted(nwrap_gr, line + 1);
 	}
 
-	return ENOENT;
-}
+	num = nwrap_split_line(line, ':', fields, ARRAY_SIZE(fields));
+	if (num != ARRAY_SIZE(fields)) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid line[%s]: only %zu fields",
+			  line, num);
+		return false;
+	}
 
-#ifdef HAVE_SOLARIS_GETGRENT_R
-struct group *getgrent_r(struct group *src, char *buf, int buflen)
-{
-	struct group *grdstp = NULL;
-	int rc;
+	gr->gr_name = fields[0];
+	gr->gr_passwd = fields[1];
 
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrent_r(src, buf, buflen);
+	/* gid */
+	ok = nwrap_parse_uint32(fields[2], &e, &id);
+	if (ok && e[0] == '-') {
+		ok = nwrap_parse_id_range(e + 1, id, &count);
+		e += strlen(e);
 	}
+	if (!ok || e[0] != '\0') {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid gid[%s] of group[%s]",
+			  fields[2], gr->gr_name);
+		return false;
+	}
+	gr->gr_gid = (gid_t)id;
 
-	rc = nwrap_getgrent_r(src, buf, buflen, &grdstp);
-	if (rc < 0) {
-		return NULL;
+	/* members, they end at the first empty one */
+	num = nwrap_count_char(fields[3], ',') + 1;
+	gr->gr_mem = (char **)malloc(sizeof(char *) * (num + 1));
+	if (gr->gr_mem == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
 	}
+	num = nwrap_split_line(fields[3], ',', gr->gr_mem, num);
 
-	return grdstp;
+	nummem = 0;
+	while (nummem < num && gr->gr_mem[nummem][0] != '\0') {
+		nummem++;
+	}
+	gr->gr_mem[nummem] = NULL;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Added group[%s:%s:%u:] with %u members",
+		  gr->gr_name, gr->gr_passwd, gr->gr_gid, nummem);
+
+	if (count > 0) {
+		ok = nwrap_gr_add_range(nwrap_gr, gr, nummem, count);
+	} else {
+		ok = nwrap_gr_add(nwrap_gr, gr, nummem);
+	}
+	SAFE_FREE(gr->gr_mem);
+
+	return ok;
 }
-#else /* HAVE_SOLARIS_GETGRENT_R */
-int getgrent_r(struct group *src, char *buf,
-	       size_t buflen, struct group **grdstp)
+
+static void nwrap_gr_unload(struct nwrap_cache *nwrap)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrent_r(src, buf, buflen, grdstp);
-	}
+	struct nwrap_gr *nwrap_gr;
+	nwrap_gr = (struct nwrap_gr *)nwrap->private_data;
+
+	SAFE_FREE(nwrap_gr->gids);
+	SAFE_FREE(nwrap_gr->hashes);
+	SAFE_FREE(nwrap_gr->offsets);
+	SAFE_FREE(nwrap_gr->nummem);
+	SAFE_FREE(nwrap_gr->sizes);
+	SAFE_FREE(nwrap_gr->first_rel);
+	SAFE_FREE(nwrap_gr->deleted);
+	SAFE_FREE(nwrap_gr->rels);
+	nwrap_gr->num_rels = 0;
+	nwrap_gr->rels_capacity = 0;
+	nwrap_strpool_free(&nwrap_gr->pool);
+	nwrap_gr->mem_size = 0;
+	nwrap_gr->num = 0;
+	nwrap_gr->capacity = 0;
+	nwrap_gr->idx = 0;
 
-	return nwrap_getgrent_r(src, buf, buflen, grdstp);
+	SAFE_FREE(nwrap_gr->ranges);
+	nwrap_gr->num_ranges = 0;
+	nwrap_gr->range_idx = 0;
+	nwrap_gr->range_off = 0;
+	nwrap_gr->max_size = 0;
+	nwrap_gr->range_size = 0;
 }
-#endif /* HAVE_SOLARIS_GETGRENT_R */
-#endif /* OSX || OPENBSD */
 
-/****************************************************************************
- *   ENDGRENT
- ***************************************************************************/
+static void nwrap_gr_mark(struct nwrap_cache *nwrap, struct nwrap_mark *mark)
+{
+	struct nwrap_gr *nwrap_gr = (struct nwrap_gr *)nwrap->private_data;
 
-static void nwrap_endgrent(void)
+	mark->num = nwrap_gr->num;
+	mark->num_ranges = nwrap_gr->num_ranges;
+	mark->pool_used = nwrap_gr->pool.used;
+	mark->num_rels = nwrap_gr->num_rels;
+	mark->max_size = nwrap_gr->max_size;
+}
+
+static void nwrap_gr_truncate(struct nwrap_cache *nwrap,
+			      const struct nwrap_mark *mark)
 {
-	int i;
+	struct nwrap_gr *nwrap_gr = (struct nwrap_gr *)nwrap->private_data;
 
-	for (i=0; i < nwrap_main_global->num_backends; i++) {
-		struct nwrap_backend *b = &nwrap_main_global->backends[i];
-		b->ops->nw_endgrent(b);
-	}
+	nwrap_gr->num = mark->num;
+	nwrap_gr->num_ranges = mark->num_ranges;
+	nwrap_gr->pool.used = mark->pool_used;
+	nwrap_gr->num_rels = mark->num_rels;
+	nwrap_gr->max_size = mark->max_size;
+
+	nwrap_gr->idx = 0;
+	nwrap_gr->range_idx = 0;
+	nwrap_gr->range_off = 0;
 }
 
-void endgrent(void)
+static void nwrap_gr_swap(struct nwrap_cache *live, struct nwrap_cache *next)
 {
-	if (!nss_wrapper_enabled()) {
-		libc_endgrent();
-		return;
+	struct nwrap_gr *live_gr = (struct nwrap_gr *)live->private_data;
+	struct nwrap_gr *next_gr = (struct nwrap_gr *)next->private_data;
+
+	nwrap_db_swap(live_gr, next_gr, sizeof(struct nwrap_gr));
+}
+
+/* Entry i is a "-name" line or its name is overridden by a later layer */
+static bool nwrap_gr_hidden(const struct nwrap_gr *nwrap_gr, int i)
+{
+	const char *name = nwrap_gr->pool.buf + nwrap_gr->offsets[i];
+	int j;
+
+	if (nwrap_gr->deleted[i]) {
+		return true;
 	}
 
-	nwrap_endgrent();
+	for (j = nwrap_layer_end(nwrap_gr->cache, i, nwrap_gr->num);
+	     j < nwrap_gr->num;
+	     j++) {
+		if (nwrap_gr->hashes[j] == nwrap_gr->hashes[i] &&
+		    strcmp(nwrap_gr->pool.buf + nwrap_gr->offsets[j],
+			   name) == 0) {
+			return true;
+		}
+	}
+
+	return false;
 }
 
-/****************************************************************************
- *   GETGROUPLIST
- ***************************************************************************/
+#define align_address_charptr(d) \
+	((char *)(((uintptr_t)(d) + 15) & ~(uintptr_t)0x0F));
 
-#ifdef HAVE_GETGROUPLIST
-#ifndef OSX
-static int nwrap_getgrouplist(const char *user, gid_t group,
-			      gid_t *groups, int *ngroups)
-#else
-static int nwrap_getgrouplist(const char *user, int group,
-			      int *groups, int *ngroups)
-#endif /* OSX */
+/* Function silently expect alignment of buf address */
+static int nwrap_gr_copy_r(const struct group *src, struct group *dst,
+			   char *buf, size_t buflen, struct group **dstp)
 {
-	struct group *grp;
-	gid_t *groups_tmp;
-	int count = 1;
+	unsigned i;
+	char *new_addr;
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG, "getgrouplist called for %s", user);
+	/* Count size of bytes needed. We lost track of counts and we need alignment. */
+	new_addr = (char *)((uintptr_t)buf + (uintptr_t)(strlen(src->gr_name) + strlen(src->gr_passwd) + 2));
 
-	groups_tmp = (gid_t *)malloc(count * sizeof(gid_t));
-	if (!groups_tmp) {
-		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
-		errno = ENOMEM;
-		return -1;
+	/* The members are aligned before the pointers, like below */
+	for (i=0; src->gr_mem[i]; ++i);
+	new_addr = align_address_charptr(new_addr);
+	new_addr += (i + 1) * sizeof(char *);
+	for (i=0; src->gr_mem[i]; ++i) {
+		new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)(strlen(src->gr_mem[i]) + 1));
 	}
-	groups_tmp[0] = group;
 
-	nwrap_setgrent();
-	while ((grp = nwrap_getgrent()) != NULL) {
-		int i = 0;
+	if ((uintptr_t)PTR_DIFF(new_addr, buf) > (uintptr_t)buflen) {
+		*dstp = NULL;
+		return ERANGE;
+	}
 
-		NWRAP_LOG(NWRAP_LOG_DEBUG,
-			  "Inspecting %s for group membership",
-			  grp->gr_name);
 
-		for (i=0; grp->gr_mem && grp->gr_mem[i] != NULL; i++) {
-			/* Cast to git_t here is necessary for OSX port */
-			if ((gid_t)group != grp->gr_gid &&
-			    (strcmp(user, grp->gr_mem[i]) == 0)) {
+	/* Point new_addr to buf again */
+	new_addr = buf;
 
-				NWRAP_LOG(NWRAP_LOG_DEBUG,
-					  "%s is member of %s",
-					  user,
-					  grp->gr_name);
-
-				groups_tmp = (gid_t *)realloc(groups_tmp, (count + 1) * sizeof(gid_t));
-				if (!groups_tmp) {
-					NWRAP_LOG(NWRAP_LOG_ERROR,
-						  "Out of memory");
-					errno = ENOMEM;
-					return -1;
-				}
-				groups_tmp[count] = grp->gr_gid;
+	dst->gr_gid = src->gr_gid;
 
-				count++;
-			}
-		}
-	}
+	memcpy((void *)new_addr, src->gr_name, strlen(src->gr_name) + 1);
+	dst->gr_name = new_addr;
+	new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)(strlen(src->gr_name) + 1));
 
-	nwrap_endgrent();
+	memcpy((void *)new_addr, src->gr_passwd, strlen(src->gr_passwd) + 1);
+	dst->gr_passwd = new_addr;
 
-	NWRAP_LOG(NWRAP_LOG_DEBUG,
-		  "%s is member of %d groups",
-		  user, *ngroups);
+	/* Allocate alignmed space for field of pointers */
+	new_addr = align_address_charptr(new_addr + strlen(src->gr_passwd) + 1);
+	dst->gr_mem = (char **) new_addr;
 
-	if (*ngroups < count) {
-		*ngroups = count;
-		free(groups_tmp);
-		return -1;
-	}
+	new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)((i + 1) * sizeof(char *))); 
 
-	*ngroups = count;
-	memcpy(groups, groups_tmp, count * sizeof(gid_t));
-	free(groups_tmp);
+	for (i=0; src->gr_mem[i]; ++i) {
+		memcpy((void *)new_addr, src->gr_mem[i], strlen(src->gr_mem[i]) + 1);
+		dst->gr_mem[i] = new_addr;
+		new_addr = (char *)((uintptr_t)new_addr + (uintptr_t)(strlen(src->gr_mem[i]) + 1));
+	}
+	dst->gr_mem[i] = NULL;
+	if (dstp) {
+		*dstp = dst;
+	}
 
-	return count;
+	return 0;
 }
 
-#ifndef OSX
-int getgrouplist(const char *user, gid_t group, gid_t *groups, int *ngroups)
-#else
-int getgrouplist(const char *user, int group, int *groups, int *ngroups)
-#endif /* OSX */
+/*
+ * Helpers for the batch lookups: figure out how much of buf has been used by
+ * a record copied into it, either by us or by a module backend, and skip it.
+ */
+static size_t nwrap_buf_used_by(size_t used,
+				const char *buf, size_t buflen,
+				const char *p, size_t len)
 {
-	if (!nss_wrapper_enabled()) {
-		return libc_getgrouplist(user, group, groups, ngroups);
+	uintptr_t start = (uintptr_t)buf;
+	uintptr_t addr = (uintptr_t)p;
+	size_t end;
+
+	if (p == NULL || addr < start || addr >= start + buflen) {
+		return used;
 	}
 
-	return nwrap_getgrouplist(user, group, groups, ngroups);
-}
-#endif
+	end = (size_t)(addr - start) + len;
+	if (end > used) {
+		used = end;
+	}
 
-/**********************************************************
- * SHADOW
- **********************************************************/
+	return used;
+}
 
-#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+#define nwrap_buf_used_by_str(used, buf, buflen, str) \
+	nwrap_buf_used_by((used), (buf), (buflen), (str), \
+			  (str) != NULL ? strlen(str) + 1 : 0)
 
-#ifdef HAVE_SETSPENT
-static void nwrap_setspent(void)
+static size_t nwrap_pw_buf_used(const struct passwd *pw,
+				const char *buf, size_t buflen)
 {
-	nwrap_files_setspent();
+	size_t used = 0;
+
+	used = nwrap_buf_used_by_str(used, buf, buflen, pw->pw_name);
+	used = nwrap_buf_used_by_str(used, buf, buflen, pw->pw_passwd);
+	used = nwrap_buf_used_by_str(used, buf, buflen, pw->pw_gecos);
+	used = nwrap_buf_used_by_str(used, buf, buflen, pw->pw_dir);
+	used = nwrap_buf_used_by_str(used, buf, buflen, pw->pw_shell);
+
+	return used;
 }
 
-void setspent(void)
+static size_t nwrap_gr_buf_used(const struct group *gr,
+				const char *buf, size_t buflen)
 {
-	if (!nss_wrapper_shadow_enabled()) {
-		return;
+	size_t used = 0;
+	size_t i;
+
+	used = nwrap_buf_used_by_str(used, buf, buflen, gr->gr_name);
+	used = nwrap_buf_used_by_str(used, buf, buflen, gr->gr_passwd);
+
+	if (gr->gr_mem == NULL) {
+		return used;
 	}
 
-	nwrap_setspent();
+	for (i = 0; gr->gr_mem[i] != NULL; i++) {
+		used = nwrap_buf_used_by_str(used, buf, buflen, gr->gr_mem[i]);
+	}
+	/* The NULL terminated array of member pointers */
+	used = nwrap_buf_used_by(used, buf, buflen,
+				 (const char *)gr->gr_mem,
+				 (i + 1) * sizeof(char *));
+
+	return used;
 }
 
-static struct spwd *nwrap_getspent(void)
+static void nwrap_buf_consume(char **buf, size_t *buflen, size_t used)
 {
-	return nwrap_files_getspent();
+	/* Keep the next record pointer aligned */
+	used = (used + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	if (used > *buflen) {
+		used = *buflen;
+	}
+
+	*buf += used;
+	*buflen -= used;
 }
 
-struct spwd *getspent(void)
+/* Copy a string to buf and skip it, NULL if it doesn't fit */
+static char *nwrap_buf_strdup(char **buf, size_t *buflen, const char *str)
 {
-	if (!nss_wrapper_shadow_enabled()) {
+	size_t len;
+	char *p;
+
+	if (str == NULL) {
+		str = "";
+	}
+
+	len = strlen(str) + 1;
+	if (len > *buflen) {
 		return NULL;
 	}
 
-	return nwrap_getspent();
+	p = *buf;
+	memcpy(p, str, len);
+	*buf += len;
+	*buflen -= len;
+
+	return p;
 }
 
-static void nwrap_endspent(void)
+static struct nwrap_entlist *nwrap_entlist_init(struct nwrap_entdata *ed)
 {
-	nwrap_files_endspent();
+	struct nwrap_entlist *el;
+
+	if (ed == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "entry is NULL, can't create list item");
+		return NULL;
+	}
+
+	el = (struct nwrap_entlist *)malloc(sizeof(struct nwrap_entlist));
+	if (el == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "malloc failed");
+		return NULL;
+	}
+
+	el->next = NULL;
+	el->ed = ed;
+
+	return el;
 }
 
-void endspent(void)
+static struct nwrap_he_slot *nwrap_he_slot_find(struct nwrap_he *nwrap_he,
+					       const char *name,
+					       size_t len,
+					       uint32_t hash)
 {
-	if (!nss_wrapper_shadow_enabled()) {
-		return;
+	size_t mask = nwrap_he->num_slots - 1;
+	size_t i;
+
+	if (nwrap_he->num_slots == 0) {
+		return NULL;
 	}
 
-	nwrap_endspent();
+	/* The table is never more than half full, so this terminates */
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		struct nwrap_he_slot *slot = &nwrap_he->slots[i];
+
+		if (slot->name == NULL) {
+			return slot;
+		}
+		if (slot->hash == hash &&
+		    slot->len == len &&
+		    nwrap_hostname_equal(slot->name, name, len)) {
+			return slot;
+		}
+	}
 }
-#endif /* HAVE_SETSPENT */
 
-static struct spwd *nwrap_getspnam(const char *name)
+static bool nwrap_he_slots_grow(struct nwrap_he *nwrap_he)
 {
-	return nwrap_files_getspnam(name);
+	struct nwrap_he_slot *old_slots = nwrap_he->slots;
+	size_t old_num_slots = nwrap_he->num_slots;
+	size_t num_slots;
+	size_t i;
+
+	if (old_num_slots == 0) {
+		num_slots = 16;
+		while (num_slots < max_hostents * 2) {
+			num_slots *= 2;
+		}
+	} else {
+		num_slots = old_num_slots * 2;
+	}
+
+	nwrap_he->slots = (struct nwrap_he_slot *)calloc(num_slots,
+							 sizeof(struct nwrap_he_slot));
+	if (nwrap_he->slots == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to allocate hash table");
+		nwrap_he->slots = old_slots;
+		return false;
+	}
+	nwrap_he->num_slots = num_slots;
+
+	for (i = 0; i < old_num_slots; i++) {
+		struct nwrap_he_slot *slot;
+
+		if (old_slots[i].name == NULL) {
+			continue;
+		}
+
+		slot = nwrap_he_slot_find(nwrap_he,
+					  old_slots[i].name,
+					  old_slots[i].len,
+					  old_slots[i].hash);
+		*slot = old_slots[i];
+	}
+	SAFE_FREE(old_slots);
+
+	return true;
 }
 
-struct spwd *getspnam(const char *name)
+/*
+ * Look up the list of entries for a name or address. The name is hashed and
+ * compared in place, so this doesn't allocate.
+ */
+static struct nwrap_he_name *nwrap_he_lookup(const char *name)
 {
-	if (!nss_wrapper_shadow_enabled()) {
+	struct nwrap_he_slot *slot;
+	size_t len = nwrap_hostname_len(name);
+
+	slot = nwrap_he_slot_find(&nwrap_he_global,
+				  name,
+				  len,
+				  nwrap_hostname_hash(name, len));
+	if (slot == NULL || slot->name == NULL) {
 		return NULL;
 	}
 
-	return nwrap_getspnam(name);
+	return slot->hn;
 }
 
-#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+static bool nwrap_he_result_pack(struct nwrap_he_result *r)
+{
+	const struct hostent *ht = &r->ht;
+	size_t num_ptrs;
+	size_t size;
+	size_t len;
+	size_t i;
+	char **ptrs;
+	char *blob;
+	char *p;
+
+	r->num_addrs = 0;
+	while (ht->h_addr_list[r->num_addrs] != NULL) {
+		r->num_addrs++;
+	}
+	r->num_aliases = 0;
+	while (ht->h_aliases != NULL && ht->h_aliases[r->num_aliases] != NULL) {
+		r->num_aliases++;
+	}
+
+	num_ptrs = r->num_addrs + r->num_aliases + 2;
+	size = num_ptrs * sizeof(char *) +
+	       r->num_addrs * ht->h_length +
+	       strlen(ht->h_name) + 1;
+	for (i = 0; i < r->num_aliases; i++) {
+		size += strlen(ht->h_aliases[i]) + 1;
+	}
+
+	blob = (char *)malloc(size);
+	if (blob == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
+	}
+	ptrs = (char **)(void *)blob;
+	p = blob + num_ptrs * sizeof(char *);
+
+	for (i = 0; i < r->num_addrs; i++) {
+		memcpy(p, ht->h_addr_list[i], ht->h_length);
+		ptrs[i] = (char *)(uintptr_t)(p - blob);
+		p += ht->h_length;
+	}
+	ptrs[r->num_addrs] = NULL;
+
+	len = strlen(ht->h_name) + 1;
+	memcpy(p, ht->h_name, len);
+	r->name_offset = (size_t)(p - blob);
+	p += len;
+
+	for (i = 0; i < r->num_aliases; i++) {
+		len = strlen(ht->h_aliases[i]) + 1;
+		memcpy(p, ht->h_aliases[i], len);
+		ptrs[r->num_addrs + 1 + i] = (char *)(uintptr_t)(p - blob);
+		p += len;
+	}
+	ptrs[num_ptrs - 1] = NULL;
+
+	SAFE_FREE(r->blob);
+	r->blob = blob;
+	r->blob_size = size;
+
+	return true;
+}
+
+static bool nwrap_he_name_add_result(struct nwrap_he_name *hn,
+				     struct nwrap_entdata *const ed)
+{
+	struct nwrap_he_result *r;
+	bool ok;
+
+	switch (ed->ht.h_addrtype) {
+	case AF_INET:
+		r = &hn->inet;
+		break;
+	case AF_INET6:
+		r = &hn->inet6;
+		break;
+	default:
+		return true;
+	}
+
+	/* The first entry of a family provides the name and the aliases */
+	if (r->ht.h_name == NULL) {
+		r->ht = ed->ht;
+	}
+
+	ok = nwrap_vector_add_item(&r->addrs, (void *const)ed->addr.host_addr);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add addrdata to vector");
+		return false;
+	}
+	r->ht.h_addr_list = nwrap_vector_head(&r->addrs);
+
+	return nwrap_he_result_pack(r);
+}
+
+static void nwrap_he_name_free(struct nwrap_he_name *hn)
+{
+	struct nwrap_entlist *el = hn->list;
+
+	while (el != NULL) {
+		struct nwrap_entlist *el_next;
+
+		el_next = el->next;
+		SAFE_FREE(el);
+		el = el_next;
+	}
+
+	SAFE_FREE(hn->inet.addrs.items);
+	SAFE_FREE(hn->inet.blob);
+	SAFE_FREE(hn->inet6.addrs.items);
+	SAFE_FREE(hn->inet6.blob);
+	SAFE_FREE(hn);
+}
+
+/* Copy the packed result to buf and rebase the pointers */
+static int nwrap_he_result_copy_r(const struct nwrap_he_result *r,
+				  struct hostent *ret,
+				  char *buf, size_t buflen)
+{
+	size_t pad = (sizeof(char *) - (uintptr_t)buf % sizeof(char *)) %
+		     sizeof(char *);
+	char **ptrs;
+	char *base;
+	size_t i;
+
+	if (pad + r->blob_size > buflen) {
+		return ERANGE;
+	}
+
+	base = buf + pad;
+	memcpy(base, r->blob, r->blob_size);
+
+	ptrs = (char **)(void *)base;
+	for (i = 0; i < r->num_addrs; i++) {
+		ptrs[i] = base + (uintptr_t)ptrs[i];
+	}
+	for (i = r->num_addrs + 1; i <= r->num_addrs + r->num_aliases; i++) {
+		ptrs[i] = base + (uintptr_t)ptrs[i];
+	}
+
+	ret->h_name = base + r->name_offset;
+	ret->h_aliases = &ptrs[r->num_addrs + 1];
+	ret->h_addrtype = r->ht.h_addrtype;
+	ret->h_length = r->ht.h_length;
+	ret->h_addr_list = ptrs;
+
+	return 0;
+}
+
+static bool nwrap_ed_inventarize_add_new(struct nwrap_he *nwrap_he,
+					 struct nwrap_he_slot *slot,
+					 const char *h_name,
+					 size_t len,
+					 uint32_t hash,
+					 struct nwrap_entdata *const ed)
+{
+	struct nwrap_he_name *hn;
+	bool ok;
+
+	if (h_name == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "h_name NULL - can't add");
+		return false;
+	}
+
+	hn = (struct nwrap_he_name *)calloc(1, sizeof(struct nwrap_he_name));
+	if (hn == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "calloc failed");
+		return false;
+	}
+
+	hn->list = nwrap_entlist_init(ed);
+	if (hn->list == NULL) {
+		SAFE_FREE(hn);
+		return false;
+	}
+	hn->tail = hn->list;
+
+	ok = nwrap_vector_add_item(&(nwrap_he->names), (void *)hn);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Failed to add list entry to vector.");
+		nwrap_he_name_free(hn);
+		return false;
+	}
+
+	slot->name = h_name;
+	slot->len = len;
+	slot->hash = hash;
+	slot->hn = hn;
+	nwrap_he->num_used++;
+
+	return nwrap_he_name_add_result(hn, ed);
+}
+
+static bool nwrap_ed_inventarize_add_to_existing(struct nwrap_entdata *const ed,
+						 struct nwrap_he_name *const hn)
+{
+	struct nwrap_entlist *el_new;
+
+	if (hn == NULL || hn->tail == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "list is NULL, can not add");
+		return false;
+	}
+
+	/*
+	 * All names of an entry are added before the next entry, so it can
+	 * only be a duplicate of the tail.
+	 */
+	if (hn->tail->ed == ed) {
+		return false;
+	}
+
+	el_new = nwrap_entlist_init(ed);
+	if (el_new == NULL) {
+		return false;
+	}
+
+	hn->tail->next = el_new;
+	hn->tail = el_new;
+
+	return nwrap_he_name_add_result(hn, ed);
+}
+
+static bool nwrap_ed_inventarize(struct nwrap_he *nwrap_he,
+				 char *const name,
+				 struct nwrap_entdata *const ed)
+{
+	struct nwrap_he_slot *slot;
+	size_t len = nwrap_hostname_len(name);
+	uint32_t hash = nwrap_hostname_hash(name, len);
+	bool ok;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Searching name: %s", name);
+
+	if (nwrap_he->num_used + 1 > nwrap_he->num_slots / 2) {
+		ok = nwrap_he_slots_grow(nwrap_he);
+		if (!ok) {
+			return false;
+		}
+	}
+
+	slot = nwrap_he_slot_find(nwrap_he, name, len, hash);
+	if (slot->name == NULL) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s not found. Adding...", name);
+		ok = nwrap_ed_inventarize_add_new(nwrap_he, slot, name, len, hash,
+						  ed);
+	} else {
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s found. Add record to list.", name);
+		ok = nwrap_ed_inventarize_add_to_existing(ed, slot->hn);
+	}
+
+	return ok;
+}
+
+static bool nwrap_add_hname(struct nwrap_he *nwrap_he,
+			    struct nwrap_entdata *const ed)
+{
+	char *const h_name = (char *const)(ed->ht.h_name);
+	unsigned i;
+	bool ok;
+
+	ok = nwrap_ed_inventarize(nwrap_he, h_name, ed);
+	if (!ok) {
+		return false;
+	}
+
+	if (ed->ht.h_aliases == NULL) {
+		return true;
+	}
+
+	/* Itemize aliases */
+	for (i = 0; ed->ht.h_aliases[i] != NULL; ++i) {
+		char *h_name_alias;
+
+		h_name_alias = ed->ht.h_aliases[i];
+
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "Add alias: %s", h_name_alias);
+
+		if (!nwrap_ed_inventarize(nwrap_he, h_name_alias, ed)) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Unable to add alias: %s", h_name_alias);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static __thread struct nwrap_he_synth nwrap_he_synth;
+
+/*
+ * Parse a rule line. The address is "net/prefix" and the template needs to
+ * contain exactly one %d. At most 32 bits of an address are computed.
+ */
+static bool nwrap_he_parse_rule(struct nwrap_he *nwrap_he,
+				char *line,
+				char *net,
+				char *p)
+{
+	struct nwrap_he_rule *rule;
+	unsigned long prefix;
+	unsigned int bits;
+	unsigned int i;
+	char *slash;
+	char *e = NULL;
+	char *t;
+	char *d;
+	bool ok;
+
+	rule = (struct nwrap_he_rule *)calloc(1, sizeof(struct nwrap_he_rule));
+	if (rule == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "calloc failed");
+		return false;
+	}
+
+	slash = strchr(net, '/');
+	*slash = '\0';
+
+	if (inet_pton(AF_INET, net, rule->net) == 1) {
+		rule->af = AF_INET;
+		rule->length = 4;
+#ifdef HAVE_IPV6
+	} else if (inet_pton(AF_INET6, net, rule->net) == 1) {
+		rule->af = AF_INET6;
+		rule->length = 16;
+#endif
+	} else {
+		goto invalid;
+	}
+
+	prefix = strtoul(slash + 1, &e, 10);
+	if (slash[1] == '\0' || *e != '\0' ||
+	    prefix > (unsigned long)rule->length * 8) {
+		goto invalid;
+	}
+	bits = rule->length * 8 - prefix;
+	if (bits > 32) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid line[%s]: blocks of more than 2^32 "
+			  "addresses are not supported",
+			  line);
+		free(rule);
+		return false;
+	}
+	rule->count = (uint64_t)1 << bits;
+
+	/* Clear the host bits */
+	for (i = 0; i < bits; i++) {
+		rule->net[rule->length - 1 - i / 8] &= ~(1 << (i % 8));
+	}
+
+	/* The template */
+	for (t = p; isspace((int)*t); t++);
+	for (p = t; *p != '\0' && !isspace((int)*p); p++);
+	*p = '\0';
+
+	d = strchr(t, '%');
+	if (d == NULL || d[1] != 'd' || strchr(d + 2, '%') != NULL) {
+		goto invalid;
+	}
+	str_tolower(t, t);
+
+	rule->prefix = t;
+	rule->prefix_len = d - t;
+	rule->suffix = d + 2;
+	rule->suffix_len = nwrap_hostname_len(d + 2);
+	if (rule->suffix_len == 1 && rule->suffix[0] == '.') {
+		rule->suffix_len = 0;
+	}
+
+	/* 10 digits for the number and the terminating NUL */
+	if (rule->prefix_len + rule->suffix_len + 11 > NWRAP_HE_RULE_NAME_MAX) {
+		goto invalid;
+	}
+
+	ok = nwrap_vector_add_item(&nwrap_he->rules, rule);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add rule to vector");
+		free(rule);
+		return false;
+	}
+
+	return true;
+
+invalid:
+	NWRAP_LOG(NWRAP_LOG_ERROR, "Invalid rule line[%s]", line);
+	free(rule);
+	return false;
+}
+
+/* Fill the per thread result with the address number idx of the rule */
+static struct hostent *nwrap_he_rule_result(const struct nwrap_he_rule *rule,
+					    uint64_t idx)
+{
+	struct nwrap_he_synth *synth = &nwrap_he_synth;
+	int i;
+
+	memcpy(synth->addr, rule->net, rule->length);
+	for (i = 0; i < 4; i++) {
+		synth->addr[rule->length - 1 - i] |= (idx >> (8 * i)) & 0xff;
+	}
+
+	snprintf(synth->name, sizeof(synth->name),
+		 "%.*s%llu%.*s",
+		 (int)rule->prefix_len, rule->prefix,
+		 (unsigned long long)idx,
+		 (int)rule->suffix_len, rule->suffix);
+
+	synth->aliases[0] = NULL;
+	synth->addr_list[0] = (char *)synth->addr;
+	synth->addr_list[1] = NULL;
+
+	synth->ht.h_name = synth->name;
+	synth->ht.h_aliases = synth->aliases;
+	synth->ht.h_addrtype = rule->af;
+	synth->ht.h_length = rule->length;
+	synth->ht.h_addr_list = synth->addr_list;
+
+	return &synth->ht;
+}
+
+/* The number in the name needs to be in the block and without leading zeros */
+static bool nwrap_he_rule_match_name(const struct nwrap_he_rule *rule,
+				     const char *name,
+				     size_t len,
+				     uint64_t *pidx)
+{
+	uint64_t idx = 0;
+	size_t i;
+
+	if (len <= rule->prefix_len + rule->suffix_len ||
+	    !nwrap_hostname_equal(rule->prefix, name, rule->prefix_len) ||
+	    !nwrap_hostname_equal(rule->suffix,
+				  name + len - rule->suffix_len,
+				  rule->suffix_len)) {
+		return false;
+	}
+
+	name += rule->prefix_len;
+	len -= rule->prefix_len + rule->suffix_len;
+
+	if (len > 10 || (len > 1 && name[0] == '0')) {
+		return false;
+	}
+	for (i = 0; i < len; i++) {
+		if (!isdigit((int)name[i])) {
+			return false;
+		}
+		idx = idx * 10 + (name[i] - '0');
+	}
+	if (idx >= rule->count) {
+		return false;
+	}
+
+	*pidx = idx;
+	return true;
+}
+
+/*
+ * Look up a name in the rules, starting at *iter. AF_UNSPEC matches the rules
+ * of all families. The result is valid until the next lookup of the thread.
+ */
+static struct hostent *nwrap_he_rule_byname(const char *name,
+					    int af,
+					    size_t *iter)
+{
+	size_t len = nwrap_hostname_len(name);
+
+	for (; *iter < nwrap_he_global.rules.count; (*iter)++) {
+		struct nwrap_he_rule *rule = nwrap_he_global.rules.items[*iter];
+		uint64_t idx;
+
+		if (af != AF_UNSPEC && rule->af != af) {
+			continue;
+		}
+
+		if (nwrap_he_rule_match_name(rule, name, len, &idx)) {
+			(*iter)++;
+			return nwrap_he_rule_result(rule, idx);
+		}
+	}
+
+	return NULL;
+}
+
+static struct hostent *nwrap_he_rule_byaddr(const void *addr, int type)
+{
+	const unsigned char *a = (const unsigned char *)addr;
+	struct nwrap_he_rule *rule;
+	size_t i;
+
+	nwrap_vector_foreach(rule, nwrap_he_global.rules, i)
+	{
+		uint64_t idx = 0;
+		int j;
+
+		if (rule->af != type) {
+			continue;
+		}
+
+		/* The bytes in front of the last four belong to the net */
+		if (memcmp(a, rule->net, rule->length - 4) != 0) {
+			continue;
+		}
+		for (j = rule->length - 4; j < rule->length; j++) {
+			idx = (idx << 8) | a[j];
+		}
+		idx -= (((uint64_t)rule->net[rule->length - 4] << 24) |
+			((uint64_t)rule->net[rule->length - 3] << 16) |
+			((uint64_t)rule->net[rule->length - 2] << 8) |
+			(uint64_t)rule->net[rule->length - 1]);
+
+		if (idx < rule->count) {
+			return nwrap_he_rule_result(rule, idx);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * The _r functions must not return pointers to the per thread result, so copy
+ * it to the buffer of the caller.
+ */
+static int nwrap_he_synth_copy_r(struct hostent *ret, char *buf, size_t buflen)
+{
+	size_t name_len = strlen(nwrap_he_synth.name) + 1;
+	char **ptrs = (char **)buf;
+
+	if (ret->h_name != nwrap_he_synth.name) {
+		return 0;
+	}
+
+	/* addr_list[2] and aliases[1] */
+	if (buflen < 3 * sizeof(char *) + ret->h_length + name_len) {
+		return ERANGE;
+	}
+
+	ptrs[0] = buf + 3 * sizeof(char *);
+	ptrs[1] = NULL;
+	ptrs[2] = NULL;
+	memcpy(ptrs[0], nwrap_he_synth.addr, ret->h_length);
+	memcpy(ptrs[0] + ret->h_length, nwrap_he_synth.name, name_len);
+
+	ret->h_addr_list = &ptrs[0];
+	ret->h_aliases = &ptrs[2];
+	ret->h_name = ptrs[0] + ret->h_length;
+
+	return 0;
+}
+
+static bool nwrap_he_parse_line(struct nwrap_cache *nwrap, char *line)
+{
+	struct nwrap_he *nwrap_he = (struct nwrap_he *)nwrap->private_data;
+	bool do_aliases = true;
+	ssize_t aliases_count = 0;
+	const char *end = line + strlen(line);
+	char *p;
+	char *i;
+	char *n;
+
+	char *ip;
+	bool ok;
+
+	struct nwrap_entdata *ed = (struct nwrap_entdata *)
+				   malloc(sizeof(struct nwrap_entdata));
+	if (ed == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to allocate memory for nwrap_entdata");
+		return false;
+	}
+	ZERO_STRUCTP(ed);
+
+	i = line;
+
+	/*
+	 * IP
+	 */
+
+	/* Walk to first char */
+	for (p = i; *p != '.' && *p != ':' && !isxdigit((int) *p); p++) {
+		if (*p == '\0') {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Invalid line[%s]: '%s'",
+				  line, i);
+			free(ed);
+			return false;
+		}
+	}
+
+	i = p;
+	p = nwrap_find_space(p, end);
+	if (p == end) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid line[%s]: '%s'",
+			  line, i);
+		free(ed);
+		return false;
+	}
+
+	*p = '\0';
+
+	if (strchr(i, '/') != NULL) {
+		free(ed);
+		return nwrap_he_parse_rule(nwrap_he, line, i, p + 1);
+	}
+
+	if (inet_pton(AF_INET, i, ed->addr.host_addr) == 1) {
+		ed->ht.h_addrtype = AF_INET;
+		ed->ht.h_length = 4;
+#ifdef HAVE_IPV6
+	} else if (inet_pton(AF_INET6, i, ed->addr.host_addr) == 1) {
+		ed->ht.h_addrtype = AF_INET6;
+		ed->ht.h_length = 16;
+#endif
+	} else {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Invalid line[%s]: '%s'",
+			  line, i);
+
+		free(ed);
+		return false;
+	}
+	ip = i;
+
+	ok = nwrap_vector_add_item(&(ed->nwrap_addrdata),
+				   (void *const)ed->addr.host_addr);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add addrdata to vector");
+		free(ed);
+		return false;
+	}
+	ed->ht.h_addr_list = nwrap_vector_head(&ed->nwrap_addrdata);
+
+	p++;
+
+	/*
+	 * FQDN
+	 */
+
+	/* Walk to first char */
+	for (n = p; *p != '_' && !isalnum((int) *p); p++) {
+		if (*p == '\0') {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Invalid line[%s]: '%s'",
+				  line, n);
+
+			free(ed);
+			return false;
+		}
+	}
+
+	n = p;
+	p = nwrap_find_space(p, end);
+	if (p == end) {
+		do_aliases = false;
+	}
+
+	*p = '\0';
+
+	/* Convert to lowercase. This operate on same memory region */
+	str_tolower(n, n);
+	ed->ht.h_name = n;
+
+	/* glib's getent always dereferences he->h_aliases */
+	ed->ht.h_aliases = malloc(sizeof(char *));
+	if (ed->ht.h_aliases == NULL) {
+		free(ed);
+		return false;
+	}
+	ed->ht.h_aliases[0] = NULL;
+
+	/*
+	 * Aliases
+	 */
+	while (do_aliases) {
+		char **aliases;
+		char *a;
+
+		p++;
+
+		/* Walk to first char */
+		for (a = p; *p != '_' && !isalnum((int) *p); p++) {
+			if (*p == '\0') {
+				do_aliases = false;
+				break;
+			}
+		}
+		/* Only trailing spaces are left */
+		if (!do_aliases) {
+			break;
+		}
+
+		a = p;
+		p = nwrap_find_space(p, end);
+		if (p == end) {
+			do_aliases = false;
+		}
+
+		*p = '\0';
+
+		aliases = realloc(ed->ht.h_aliases, sizeof(char *) * (aliases_count + 2));
+		if (aliases == NULL) {
+			free(ed);
+			return false;
+		}
+		ed->ht.h_aliases = aliases;
+
+		str_tolower(a, a);
+		aliases[aliases_count] = a;
+		aliases[aliases_count + 1] = NULL;
+
+		aliases_count += 1;
+	}
+
+	ok = nwrap_vector_add_item(&(nwrap_he->entries), (void *const)ed);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Unable to add entry to vector");
+		free(ed);
+		return false;
+	}
+
+	ed->aliases_count = aliases_count;
+	/* Inventarize item */
+	ok = nwrap_add_hname(nwrap_he, ed);
+	if (!ok) {
+		return false;
+	}
+
+	ok = nwrap_ed_inventarize(nwrap_he, ip, ed);
+	if (!ok) {
+		return false;
+	}
+
+	nwrap_he->num++;
+	return true;
+}
+
+static void nwrap_he_unload(struct nwrap_cache *nwrap)
+{
+	struct nwrap_he *nwrap_he =
+		(struct nwrap_he *)nwrap->private_data;
+	struct nwrap_entdata *ed;
+	struct nwrap_he_name *hn;
+	struct nwrap_he_rule *rule;
+	size_t i;
+
+	nwrap_vector_foreach (ed, nwrap_he->entries, i)
+	{
+		SAFE_FREE(ed->nwrap_addrdata.items);
+		SAFE_FREE(ed->ht.h_aliases);
+		SAFE_FREE(ed);
+	}
+	SAFE_FREE(nwrap_he->entries.items);
+	nwrap_he->entries.count = nwrap_he->entries.capacity = 0;
+
+	nwrap_vector_foreach(hn, nwrap_he->names, i)
+	{
+		nwrap_he_name_free(hn);
+	}
+	SAFE_FREE(nwrap_he->names.items);
+	nwrap_he->names.count = nwrap_he->names.capacity = 0;
+
+	nwrap_vector_foreach(rule, nwrap_he->rules, i)
+	{
+		SAFE_FREE(rule);
+	}
+	SAFE_FREE(nwrap_he->rules.items);
+	nwrap_he->rules.count = nwrap_he->rules.capacity = 0;
+
+	/* The slots point to the entries */
+	if (nwrap_he->slots != NULL) {
+		memset(nwrap_he->slots, 0,
+		       nwrap_he->num_slots * sizeof(struct nwrap_he_slot));
+	}
+	nwrap_he->num_used = 0;
+
+	nwrap_he->num = 0;
+	nwrap_he->idx = 0;
+}
+
+static void nwrap_he_swap(struct nwrap_cache *live, struct nwrap_cache *next)
+{
+	struct nwrap_he *live_he = (struct nwrap_he *)live->private_data;
+	struct nwrap_he *next_he = (struct nwrap_he *)next->private_data;
+	bool strict = live_he->strict;
+	unsigned long fallbacks = live_he->fallbacks;
+
+	nwrap_db_swap(live_he, next_he, sizeof(struct nwrap_he));
+
+	/* The settings and the counter aren't part of the files */
+	live_he->strict = strict;
+	live_he->fallbacks = fallbacks;
+}
+
+
+/*
+ * The results of getpwnam(), getpwuid(), getgrnam(), getgrgid() and the
+ * enumerations. The entries are materialized from the columns, so every
+ * function of every thread copies its result to a buffer of its own which
+ * grows to the largest entry. A result stays valid until the same function is
+ * called again in the thread, like with the static buffers of libc.
+ */
+/* Copy an entry of the cache to the buffer, the caller holds the lock */
+static struct passwd *nwrap_pw_buf_copy(const struct passwd *pw,
+					struct nwrap_pw_buf *b)
+{
+	struct passwd *result = NULL;
+	int rc;
+
+	if (pw == NULL) {
+		return NULL;
+	}
+
+	for (;;) {
+		rc = ERANGE;
+		if (b->buf != NULL) {
+			rc = nwrap_pw_copy_r(pw, &b->pw, b->buf, b->size,
+					     &result);
+		}
+		if (rc != ERANGE) {
+			break;
+		}
+		if (!nwrap_ent_buf_grow(&b->buf, &b->size)) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	return result;
+}
+
+static struct group *nwrap_gr_buf_copy(const struct group *gr,
+				       struct nwrap_gr_buf *b)
+{
+	struct group *result = NULL;
+	int rc;
+
+	if (gr == NULL) {
+		return NULL;
+	}
+
+	for (;;) {
+		rc = ERANGE;
+		if (b->buf != NULL) {
+			rc = nwrap_gr_copy_r(gr, &b->gr, b->buf, b->size,
+					     &result);
+		}
+		if (rc != ERANGE) {
+			break;
+		}
+		if (!nwrap_ent_buf_grow(&b->buf, &b->size)) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	return result;
+}
+
+/* user functions */
+
+static struct passwd *nwrap_files_find_pwnam_range(const char *name);
+
+/* The caller has to make sure the passwd cache is loaded */
+static struct passwd *nwrap_files_find_pwnam(const char *name)
+{
+	const struct nwrap_cache *c = nwrap_pw_global.cache;
+	uint32_t hash = nwrap_name_hash(name);
+	size_t l;
+	int first;
+	int end;
+	int i;
+
+	for (l = c->num_layers; l-- > 0;) {
+		nwrap_layer_entries(c, l, nwrap_pw_global.num, &first, &end);
+
+		for (i = first; i < end; i++) {
+			struct passwd *pw;
+
+			if (nwrap_pw_global.hashes[i] != hash) {
+				continue;
+			}
+
+			pw = nwrap_pw_entry(&nwrap_pw_global, i);
+			if (strcmp(pw->pw_name, name) != 0) {
+				continue;
+			}
+			if (nwrap_pw_global.deleted[i]) {
+				/* Removed, only the ranges are left */
+				l = 0;
+				break;
+			}
+
+			NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] found", name);
+			return pw;
+		}
+	}
+
+	return nwrap_files_find_pwnam_range(name);
+}
+
+/* The caller has to make sure the passwd cache is loaded */
+static struct passwd *nwrap_files_find_pwnam_range(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nwrap_pw_global.num_ranges; i++) {
+		const struct nwrap_pw_range *r = &nwrap_pw_global.ranges[i];
+		const char *tmpl = nwrap_pw_global.pool.buf + r->offset;
+		uint32_t idx;
+
+		if (nwrap_tmpl_match(tmpl, name, r->count, &idx)) {
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "user[%s] computed from a range", name);
+			return nwrap_pw_range_entry(&nwrap_pw_global, r, idx);
+		}
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] not found\n", name);
+
+	errno = ENOENT;
+	return NULL;
+}
+
+/* The entry is copied under the lock, so a reload can't free it */
+static struct passwd *nwrap_files_getpwnam(struct nwrap_backend *b,
+					   const char *name)
+{
+	struct passwd *pw = NULL;
+	bool ok;
+
+	(void) b; /* unused */
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Lookup user %s in files", name);
+
+	ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+				      &nwrap_pw_global_rwlock);
+	if (ok) {
+		pw = nwrap_pw_buf_copy(nwrap_files_find_pwnam(name),
+				       &nwrap_ent_tls.pwnam);
+	}
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return pw;
+}
+
+static int nwrap_files_getpwnam_r(struct nwrap_backend *b,
+				  const char *name, struct passwd *pwdst,
+				  char *buf, size_t buflen, struct passwd **pwdstp)
+{
+	struct passwd *pw = NULL;
+	bool ok;
+	int rc;
+
+	(void) b; /* unused */
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Lookup user %s in files", name);
+
+	ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+				      &nwrap_pw_global_rwlock);
+	if (ok) {
+		pw = nwrap_files_find_pwnam(name);
+	}
+	if (!pw) {
+		rc = errno != 0 ? errno : ENOENT;
+	} else {
+		rc = nwrap_pw_copy_r(pw, pwdst, buf, buflen, pwdstp);
+	}
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return rc;
+}
+
+/* The caller has to make sure the passwd cache is loaded */
+static struct passwd *nwrap_files_find_pwuid(uid_t uid)
+{
+	const struct nwrap_cache *c = nwrap_pw_global.cache;
+	size_t l;
+	int first;
+	int end;
+	int i;
+
+	for (l = c->num_layers; l-- > 0;) {
+		nwrap_layer_entries(c, l, nwrap_pw_global.num, &first, &end);
+
+		for (i = first; i < end; i++) {
+			if (nwrap_pw_global.uids[i] == uid &&
+			    !nwrap_pw_hidden(&nwrap_pw_global, i)) {
+				NWRAP_LOG(NWRAP_LOG_DEBUG,
+					  "uid[%u] found", uid);
+				return nwrap_pw_entry(&nwrap_pw_global, i);
+			}
+		}
+	}
+
+	for (i = 0; i < nwrap_pw_global.num_ranges; i++) {
+		const struct nwrap_pw_range *r = &nwrap_pw_global.ranges[i];
+
+		if (uid >= r->uid && uid - r->uid < r->count) {
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "uid[%u] computed from a range", uid);
+			return nwrap_pw_range_entry(&nwrap_pw_global,
+						    r,
+						    uid - r->uid);
+		}
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "uid[%u] not found\n", uid);
+
+	errno = ENOENT;
+	return NULL;
+}
+
+static struct passwd *nwrap_files_getpwuid(struct nwrap_backend *b,
+					   uid_t uid)
+{
+	struct passwd *pw = NULL;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+				      &nwrap_pw_global_rwlock);
+	if (ok) {
+		pw = nwrap_pw_buf_copy(nwrap_files_find_pwuid(uid),
+				       &nwrap_ent_tls.pwuid);
+	}
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return pw;
+}
+
+static int nwrap_files_getpwuid_r(struct nwrap_backend *b,
+				  uid_t uid, struct passwd *pwdst,
+				  char *buf, size_t buflen, struct passwd **pwdstp)
+{
+	struct passwd *pw = NULL;
+	bool ok;
+	int rc;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+				      &nwrap_pw_global_rwlock);
+	if (ok) {
+		pw = nwrap_files_find_pwuid(uid);
+	}
+	if (!pw) {
+		rc = errno != 0 ? errno : ENOENT;
+	} else {
+		rc = nwrap_pw_copy_r(pw, pwdst, buf, buflen, pwdstp);
+	}
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return rc;
+}
+
+/* user enum functions */
+static void nwrap_files_setpwent(struct nwrap_backend *b)
+{
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_pw_global);
+	nwrap_pw_global.idx = 0;
+	nwrap_pw_global.range_idx = 0;
+	nwrap_pw_global.range_off = 0;
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+}
+
+/* The caller holds nwrap_pw_global_rwlock */
+static struct passwd *nwrap_files_next_pw(void)
+{
+	struct passwd *pw;
+
+	if (nwrap_pw_global.idx == 0) {
+		bool ok;
+		ok = nwrap_files_cache_reload(nwrap_pw_global.cache);
+		if (!ok) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading passwd file");
+			return NULL;
+		}
+	}
+
+	while (nwrap_pw_global.idx < nwrap_pw_global.num &&
+	       nwrap_pw_hidden(&nwrap_pw_global, nwrap_pw_global.idx)) {
+		nwrap_pw_global.idx++;
+	}
+
+	if (nwrap_pw_global.idx < nwrap_pw_global.num) {
+		pw = nwrap_pw_entry(&nwrap_pw_global, nwrap_pw_global.idx++);
+	} else {
+		/* The ranges are computed one entry at a time */
+		errno = ENOENT;
+		pw = nwrap_pw_range_next(&nwrap_pw_global);
+	}
+	if (pw == NULL) {
+		/* ENOMEM if the buffer of the thread can't grow */
+		return NULL;
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "return user[%s] uid[%u]",
+		  pw->pw_name, pw->pw_uid);
+
+	return pw;
+}
+
+static struct passwd *nwrap_files_getpwent(struct nwrap_backend *b)
+{
+	struct passwd *pw;
+
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_pw_global);
+	pw = nwrap_pw_buf_copy(nwrap_files_next_pw(), &nwrap_ent_tls.pwent);
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return pw;
+}
+
+static int nwrap_files_getpwent_r(struct nwrap_backend *b,
+				  struct passwd *pwdst, char *buf,
+				  size_t buflen, struct passwd **pwdstp)
+{
+	struct passwd *pw;
+	int rc;
+
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_pw_global);
+	pw = nwrap_files_next_pw();
+	if (!pw) {
+		rc = errno != 0 ? errno : ENOENT;
+	} else {
+		rc = nwrap_pw_copy_r(pw, pwdst, buf, buflen, pwdstp);
+	}
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return rc;
+}
+
+static void nwrap_files_endpwent(struct nwrap_backend *b)
+{
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_pw_global);
+	nwrap_pw_global.idx = 0;
+	nwrap_pw_global.range_idx = 0;
+	nwrap_pw_global.range_off = 0;
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+}
+
+/* shadow */
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+
+#ifdef HAVE_SETSPENT
+static void nwrap_files_setspent(void)
+{
+	nwrap_sp_global.idx = 0;
+}
+
+static struct spwd *nwrap_files_getspent(void)
+{
+	struct spwd *sp;
+
+	if (nwrap_sp_global.idx == 0) {
+		bool ok;
+
+		ok = nwrap_files_cache_reload(nwrap_sp_global.cache);
+		if (!ok) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading shadow file");
+			return NULL;
+		}
+	}
+
+	while (nwrap_sp_global.idx < nwrap_sp_global.num &&
+	       nwrap_sp_hidden(&nwrap_sp_global, nwrap_sp_global.idx)) {
+		nwrap_sp_global.idx++;
+	}
+
+	if (nwrap_sp_global.idx >= nwrap_sp_global.num) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	sp = &nwrap_sp_global.list[nwrap_sp_global.idx++];
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "return user[%s]",
+		  sp->sp_namp);
+
+	return sp;
+}
+
+#ifdef HAVE_GETSPENT_R
+static int nwrap_files_getspent_r(struct spwd *spdst,
+				  char *buf, size_t buflen,
+				  struct spwd **spdstp)
+{
+	struct spwd *sp;
+	int rc;
+
+	*spdstp = NULL;
+
+	sp = nwrap_files_getspent();
+	if (sp == NULL) {
+		return ENOENT;
+	}
+
+	rc = nwrap_sp_copy_r(sp, spdst, buf, buflen, spdstp);
+	if (rc == ERANGE) {
+		/* Return the same entry again with a larger buffer */
+		nwrap_sp_global.idx--;
+	}
+
+	return rc;
+}
+#endif /* HAVE_GETSPENT_R */
+
+static void nwrap_files_endspent(void)
+{
+	nwrap_sp_global.idx = 0;
+}
+#endif /* HAVE_SETSPENT */
+
+static struct spwd *nwrap_files_getspnam(const char *name)
+{
+	uint32_t idx;
+	bool ok;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Lookup user %s in files", name);
+
+	ok = nwrap_files_cache_reload(nwrap_sp_global.cache);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading shadow file");
+		return NULL;
+	}
+
+	if (nwrap_sp_global.num_slots > 0) {
+		idx = *nwrap_sp_slot(&nwrap_sp_global,
+				     name,
+				     nwrap_name_hash(name));
+		if (idx != 0) {
+			NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] found", name);
+			return &nwrap_sp_global.list[idx - 1];
+		}
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "user[%s] not found\n", name);
+
+	errno = ENOENT;
+	return NULL;
+}
+
+#ifdef HAVE_GETSPNAM_R
+static int nwrap_files_getspnam_r(const char *name, struct spwd *spdst,
+				  char *buf, size_t buflen,
+				  struct spwd **spdstp)
+{
+	struct spwd *sp;
+
+	*spdstp = NULL;
+
+	sp = nwrap_files_getspnam(name);
+	if (sp == NULL) {
+		return ENOENT;
+	}
+
+	return nwrap_sp_copy_r(sp, spdst, buf, buflen, spdstp);
+}
+#endif /* HAVE_GETSPNAM_R */
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+
+/* netgroup */
+
+#ifdef HAVE_INNETGR
+static bool nwrap_files_ng_load(void)
+{
+	bool ok;
+
+	ok = nwrap_files_cache_reload(nwrap_ng_global.cache);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading netgroup file");
+		return false;
+	}
+
+	return nwrap_ng_index(&nwrap_ng_global);
+}
+
+static int nwrap_files_setnetgrent(const char *netgroup)
+{
+	int g;
+	bool ok;
+
+	nwrap_ng_global.cur_group = -1;
+	nwrap_ng_global.cur_idx = 0;
+
+	ok = nwrap_files_ng_load();
+	if (!ok) {
+		return 0;
+	}
+
+	g = nwrap_ng_find_group(&nwrap_ng_global, netgroup);
+	if (g < 0) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "netgroup[%s] not found", netgroup);
+		errno = ENOENT;
+		return 0;
+	}
+	nwrap_ng_global.cur_group = g;
+
+	return 1;
+}
+
+/* The strings stay valid until the file gets reloaded */
+static int nwrap_files_getnetgrent(char **host, char **user, char **domain)
+{
+	const struct nwrap_ng_group *g;
+	const struct nwrap_ng_member *m;
+
+	if (nwrap_ng_global.cur_group < 0) {
+		return 0;
+	}
+
+	g = &nwrap_ng_global.groups[nwrap_ng_global.cur_group];
+	if (nwrap_ng_global.cur_idx >= g->num_triples) {
+		return 0;
+	}
+
+	m = &nwrap_ng_global.members[nwrap_ng_global.flat[g->first_triple +
+						      nwrap_ng_global.cur_idx]];
+	nwrap_ng_global.cur_idx++;
+
+	*host = nwrap_ng_str(&nwrap_ng_global, m->host);
+	*user = nwrap_ng_str(&nwrap_ng_global, m->user);
+	*domain = nwrap_ng_str(&nwrap_ng_global, m->domain);
+
+	return 1;
+}
+
+#ifdef HAVE_GETNETGRENT_R
+static int nwrap_files_getnetgrent_r(char **host, char **user, char **domain,
+				     char *buf, size_t buflen)
+{
+	char *f[3];
+	char **r[3] = { host, user, domain };
+	size_t len = 0;
+	int i;
+	int rc;
+
+	rc = nwrap_files_getnetgrent(&f[0], &f[1], &f[2]);
+	if (rc == 0) {
+		return 0;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (f[i] != NULL) {
+			len += strlen(f[i]) + 1;
+		}
+	}
+	if (len > buflen) {
+		/* Return the same triple again with a larger buffer */
+		nwrap_ng_global.cur_idx--;
+		errno = ERANGE;
+		return 0;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (f[i] == NULL) {
+			*r[i] = NULL;
+			continue;
+		}
+		len = strlen(f[i]) + 1;
+		memcpy(buf, f[i], len);
+		*r[i] = buf;
+		buf += len;
+	}
+
+	return 1;
+}
+#endif /* HAVE_GETNETGRENT_R */
+
+static void nwrap_files_endnetgrent(void)
+{
+	nwrap_ng_global.cur_group = -1;
+	nwrap_ng_global.cur_idx = 0;
+}
+
+static int nwrap_files_innetgr(const char *netgroup,
+			       const char *host,
+			       const char *user,
+			       const char *domain)
+{
+	int g;
+	bool ok;
+
+	if (netgroup == NULL) {
+		return 0;
+	}
+
+	ok = nwrap_files_ng_load();
+	if (!ok) {
+		return 0;
+	}
+
+	g = nwrap_ng_find_group(&nwrap_ng_global, netgroup);
+	if (g < 0) {
+		return 0;
+	}
+
+	ok = nwrap_ng_match(&nwrap_ng_global, g, host, user, domain);
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "(%s,%s,%s) %s in netgroup[%s]",
+		  host != NULL ? host : "",
+		  user != NULL ? user : "",
+		  domain != NULL ? domain : "",
+		  ok ? "is" : "is not",
+		  netgroup);
+
+	return ok ? 1 : 0;
+}
+#endif /* HAVE_INNETGR */
+
+/* misc functions */
+
+/* Append the gids first to first + n - 1 except skip */
+static bool nwrap_groups_add(gid_t **pgroups, int *pcount,
+			     gid_t first, uint32_t n, gid_t skip)
+{
+	gid_t *groups;
+	uint32_t i;
+
+	groups = (gid_t *)realloc(*pgroups, (*pcount + n) * sizeof(gid_t));
+	if (groups == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		errno = ENOMEM;
+		return false;
+	}
+	*pgroups = groups;
+
+	for (i = 0; i < n; i++) {
+		if (first + i != skip) {
+			groups[(*pcount)++] = first + i;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Add the groups of the ranges the user is a member of. The member templates
+ * are matched against the name, so the groups don't need to be enumerated.
+ */
+/* The caller locked the group database with nwrap_files_cache_rdlock() */
+static bool nwrap_files_range_groups(const char *user, gid_t group,
+				     gid_t **pgroups, int *pcount)
+{
+	int i;
+	bool ok;
+
+	for (i = 0; i < nwrap_gr_global.num_ranges; i++) {
+		const struct nwrap_gr_range *r = &nwrap_gr_global.ranges[i];
+		const char *t = nwrap_gr_global.pool.buf + r->offset;
+		uint32_t idx;
+		uint32_t m;
+
+		/* Skip the name and the passwd */
+		t += strlen(t) + 1;
+		t += strlen(t) + 1;
+
+		for (m = 0; m < r->nummem; m++, t += strlen(t) + 1) {
+			if (nwrap_tmpl_match(t, user, r->count, &idx)) {
+				ok = nwrap_groups_add(pgroups, pcount,
+						      r->gid + idx, 1, group);
+			} else if (strcmp(t, user) == 0) {
+				/* A plain member is in every group */
+				ok = nwrap_groups_add(pgroups, pcount,
+						      r->gid, r->count, group);
+			} else {
+				continue;
+			}
+			if (!ok) {
+				return false;
+			}
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "%s is member of groups of a range", user);
+			break;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Add the groups of the group file the user is a member of, including the
+ * ones of the ranges. The entries are read by index, so the position of
+ * getgrent() and the entry it returned are left alone.
+ */
+/* The caller locked the group database with nwrap_files_cache_rdlock() */
+static bool nwrap_files_member_groups(const char *user, gid_t group,
+				      gid_t **pgroups, int *pcount)
+{
+	int i;
+	bool ok;
+
+	for (i = 0; i < nwrap_gr_global.num; i++) {
+		const char *p = nwrap_gr_global.pool.buf +
+				nwrap_gr_global.offsets[i];
+		const uint32_t *rels =
+			&nwrap_gr_global.rels[nwrap_gr_global.first_rel[i]];
+		gid_t gid = nwrap_gr_global.gids[i];
+		uint32_t m;
+
+		if (gid == group || nwrap_gr_hidden(&nwrap_gr_global, i)) {
+			continue;
+		}
+
+		for (m = 0; m < nwrap_gr_global.nummem[i]; m++) {
+			if (strcmp(user, p + rels[m + 1]) != 0) {
+				continue;
+			}
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "%s is member of %s",
+				  user, p);
+			ok = nwrap_groups_add(pgroups, pcount, gid, 1, group);
+			if (!ok) {
+				return false;
+			}
+			break;
+		}
+	}
+
+	return nwrap_files_range_groups(user, group, pgroups, pcount);
+}
+
+static int nwrap_files_initgroups(struct nwrap_backend *b,
+				  const char *user,
+				  gid_t group)
+{
+	gid_t *groups;
+	int size = 1;
+	bool ok;
+	int rc;
+
+	groups = (gid_t *)malloc(size * sizeof(gid_t));
+	if (groups == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+	groups[0] = group;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (ok) {
+		ok = nwrap_files_member_groups(user, group, &groups, &size);
+	}
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+	if (!ok) {
+		free(groups);
+		return -1;
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "%s is member of %d groups",
+		  user, size);
+
+	/* This really only works if uid_wrapper is loaded */
+	rc = setgroups(size, groups);
+
+	free(groups);
+
+	return rc;
+}
+
+/* group functions */
+
+/* Index of the entry of the file, -1 if there is none */
+static int nwrap_gr_find_name(const struct nwrap_gr *nwrap_gr,
+			      const char *name)
+{
+	const struct nwrap_cache *c = nwrap_gr->cache;
+	uint32_t hash = nwrap_name_hash(name);
+	size_t l;
+	int first;
+	int end;
+	int i;
+
+	for (l = c->num_layers; l-- > 0;) {
+		nwrap_layer_entries(c, l, nwrap_gr->num, &first, &end);
+
+		for (i = first; i < end; i++) {
+			const char *gr_name;
+
+			if (nwrap_gr->hashes[i] != hash) {
+				continue;
+			}
+
+			/* The name comes first in the pool */
+			gr_name = nwrap_gr->pool.buf + nwrap_gr->offsets[i];
+			if (strcmp(gr_name, name) != 0) {
+				continue;
+			}
+			if (nwrap_gr->deleted[i]) {
+				/* Removed, only the ranges are left */
+				return -1;
+			}
+
+			NWRAP_LOG(NWRAP_LOG_DEBUG, "group[%s] found", name);
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int nwrap_gr_find_gid(const struct nwrap_gr *nwrap_gr, gid_t gid)
+{
+	const struct nwrap_cache *c = nwrap_gr->cache;
+	size_t l;
+	int first;
+	int end;
+	int i;
+
+	for (l = c->num_layers; l-- > 0;) {
+		nwrap_layer_entries(c, l, nwrap_gr->num, &first, &end);
+
+		for (i = first; i < end; i++) {
+			if (nwrap_gr->gids[i] == gid &&
+			    !nwrap_gr_hidden(nwrap_gr, i)) {
+				NWRAP_LOG(NWRAP_LOG_DEBUG,
+					  "gid[%u] found", gid);
+				return i;
+			}
+		}
+	}
+
+	return -1;
+}
+
+/* The caller has to make sure the group cache is loaded */
+static struct group *nwrap_files_find_grnam_range(const char *name)
+{
+	int i;
+
+	for (i = 0; i < nwrap_gr_global.num_ranges; i++) {
+		const struct nwrap_gr_range *r = &nwrap_gr_global.ranges[i];
+		const char *tmpl = nwrap_gr_global.pool.buf + r->offset;
+		uint32_t idx;
+
+		if (nwrap_tmpl_match(tmpl, name, r->count, &idx)) {
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "group[%s] computed from a range", name);
+			return nwrap_gr_range_entry(&nwrap_gr_global, r, idx);
+		}
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "group[%s] not found", name);
+
+	errno = ENOENT;
+	return NULL;
+}
+
+/* The caller has to make sure the group cache is loaded */
+static struct group *nwrap_files_find_grnam(const char *name)
+{
+	int i = nwrap_gr_find_name(&nwrap_gr_global, name);
+
+	if (i >= 0) {
+		return nwrap_gr_entry(&nwrap_gr_global, i);
+	}
+
+	return nwrap_files_find_grnam_range(name);
+}
+
+/* The caller has to make sure the group cache is loaded */
+static int nwrap_files_copy_grnam_r(const char *name, struct group *grdst,
+				    char *buf, size_t buflen,
+				    struct group **grdstp)
+{
+	struct group *gr;
+	int i = nwrap_gr_find_name(&nwrap_gr_global, name);
+
+	if (i >= 0) {
+		return nwrap_gr_blob_copy_r(&nwrap_gr_global, i,
+					    grdst, buf, buflen, grdstp);
+	}
+
+	gr = nwrap_files_find_grnam_range(name);
+	if (gr == NULL) {
+		return ENOENT;
+	}
+
+	return nwrap_gr_copy_r(gr, grdst, buf, buflen, grdstp);
+}
+
+static struct group *nwrap_files_getgrnam(struct nwrap_backend *b,
+					  const char *name)
+{
+	struct group *gr = NULL;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (ok) {
+		gr = nwrap_gr_buf_copy(nwrap_files_find_grnam(name),
+				       &nwrap_ent_tls.grnam);
+	}
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return gr;
+}
+
+static int nwrap_files_getgrnam_r(struct nwrap_backend *b,
+				  const char *name, struct group *grdst,
+				  char *buf, size_t buflen, struct group **grdstp)
+{
+	bool ok;
+	int rc;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (!ok) {
+		rc = errno != 0 ? errno : ENOENT;
+	} else {
+		rc = nwrap_files_copy_grnam_r(name, grdst, buf, buflen, grdstp);
+	}
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return rc;
+}
+
+/* The caller has to make sure the group cache is loaded */
+static struct group *nwrap_files_find_grgid_range(gid_t gid)
+{
+	int i;
+
+	for (i = 0; i < nwrap_gr_global.num_ranges; i++) {
+		const struct nwrap_gr_range *r = &nwrap_gr_global.ranges[i];
+
+		if (gid >= r->gid && gid - r->gid < r->count) {
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "gid[%u] computed from a range", gid);
+			return nwrap_gr_range_entry(&nwrap_gr_global,
+						    r,
+						    gid - r->gid);
+		}
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "gid[%u] not found", gid);
+
+	errno = ENOENT;
+	return NULL;
+}
+
+/* The caller has to make sure the group cache is loaded */
+static struct group *nwrap_files_find_grgid(gid_t gid)
+{
+	int i = nwrap_gr_find_gid(&nwrap_gr_global, gid);
+
+	if (i >= 0) {
+		return nwrap_gr_entry(&nwrap_gr_global, i);
+	}
+
+	return nwrap_files_find_grgid_range(gid);
+}
+
+/* The caller has to make sure the group cache is loaded */
+static int nwrap_files_copy_grgid_r(gid_t gid, struct group *grdst,
+				    char *buf, size_t buflen,
+				    struct group **grdstp)
+{
+	struct group *gr;
+	int i = nwrap_gr_find_gid(&nwrap_gr_global, gid);
+
+	if (i >= 0) {
+		return nwrap_gr_blob_copy_r(&nwrap_gr_global, i,
+					    grdst, buf, buflen, grdstp);
+	}
+
+	gr = nwrap_files_find_grgid_range(gid);
+	if (gr == NULL) {
+		return ENOENT;
+	}
+
+	return nwrap_gr_copy_r(gr, grdst, buf, buflen, grdstp);
+}
+
+static struct group *nwrap_files_getgrgid(struct nwrap_backend *b,
+					  gid_t gid)
+{
+	struct group *gr = NULL;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (ok) {
+		gr = nwrap_gr_buf_copy(nwrap_files_find_grgid(gid),
+				       &nwrap_ent_tls.grgid);
+	}
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return gr;
+}
+
+static int nwrap_files_getgrgid_r(struct nwrap_backend *b,
+				  gid_t gid, struct group *grdst,
+				  char *buf, size_t buflen, struct group **grdstp)
+{
+	bool ok;
+	int rc;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (!ok) {
+		rc = errno != 0 ? errno : ENOENT;
+	} else {
+		rc = nwrap_files_copy_grgid_r(gid, grdst, buf, buflen, grdstp);
+	}
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return rc;
+}
+
+/* group enum functions, the caller holds nwrap_gr_global_rwlock */
+static void nwrap_files_rewind_gr(void)
+{
+	nwrap_gr_global.idx = 0;
+	nwrap_gr_global.range_idx = 0;
+	nwrap_gr_global.range_off = 0;
+}
+
+static void nwrap_files_setgrent(struct nwrap_backend *b)
+{
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_gr_global);
+	nwrap_files_rewind_gr();
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+}
+
+/* The caller holds nwrap_gr_global_rwlock */
+static struct group *nwrap_files_next_gr(void)
+{
+	struct group *gr;
+
+	if (nwrap_gr_global.idx == 0) {
+		bool ok;
+
+		ok = nwrap_files_cache_reload(nwrap_gr_global.cache);
+		if (!ok) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading group file");
+			return NULL;
+		}
+	}
+
+	while (nwrap_gr_global.idx < nwrap_gr_global.num &&
+	       nwrap_gr_hidden(&nwrap_gr_global, nwrap_gr_global.idx)) {
+		nwrap_gr_global.idx++;
+	}
+
+	if (nwrap_gr_global.idx < nwrap_gr_global.num) {
+		gr = nwrap_gr_entry(&nwrap_gr_global, nwrap_gr_global.idx++);
+	} else {
+		errno = ENOENT;
+		gr = nwrap_gr_range_next(&nwrap_gr_global);
+	}
+	if (gr == NULL) {
+		/* ENOMEM if the buffer of the thread can't grow */
+		return NULL;
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "return group[%s] gid[%u]",
+		  gr->gr_name, gr->gr_gid);
+
+	return gr;
+}
+
+static struct group *nwrap_files_getgrent(struct nwrap_backend *b)
+{
+	struct group *gr;
+
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_gr_global);
+	gr = nwrap_gr_buf_copy(nwrap_files_next_gr(), &nwrap_ent_tls.grent);
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return gr;
+}
+
+/* The caller holds nwrap_gr_global_rwlock */
+static int nwrap_files_next_gr_r(struct group *grdst, char *buf,
+				 size_t buflen, struct group **grdstp)
+{
+	struct group *gr;
+	int rc;
+
+	if (nwrap_gr_global.idx == 0) {
+		bool ok;
+
+		ok = nwrap_files_cache_reload(nwrap_gr_global.cache);
+		if (!ok) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading group file");
+			return errno != 0 ? errno : ENOENT;
+		}
+	}
+
+	while (nwrap_gr_global.idx < nwrap_gr_global.num &&
+	       nwrap_gr_hidden(&nwrap_gr_global, nwrap_gr_global.idx)) {
+		nwrap_gr_global.idx++;
+	}
+
+	if (nwrap_gr_global.idx < nwrap_gr_global.num) {
+		rc = nwrap_gr_blob_copy_r(&nwrap_gr_global, nwrap_gr_global.idx,
+					  grdst, buf, buflen, grdstp);
+		if (rc == 0) {
+			nwrap_gr_global.idx++;
+		}
+		return rc;
+	}
+
+	gr = nwrap_files_next_gr();
+	if (!gr) {
+		if (errno == 0) {
+			return ENOENT;
+		}
+		return errno;
+	}
+
+	return nwrap_gr_copy_r(gr, grdst, buf, buflen, grdstp);
+}
+
+static int nwrap_files_getgrent_r(struct nwrap_backend *b,
+				  struct group *grdst, char *buf,
+				  size_t buflen, struct group **grdstp)
+{
+	int rc;
+
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_gr_global);
+	rc = nwrap_files_next_gr_r(grdst, buf, buflen, grdstp);
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return rc;
+}
+
+static void nwrap_files_endgrent(struct nwrap_backend *b)
+{
+	(void) b; /* unused */
+
+	NWRAP_WRLOCK(nwrap_gr_global);
+	nwrap_files_rewind_gr();
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+}
+
+/* batch functions */
+
+/*
+ * All entries of a batch are resolved against the same snapshot of the file,
+ * so the cache is only revalidated once.
+ */
+static int nwrap_files_getpwnam_batch(struct nwrap_backend *b,
+				      const char * const *names, size_t num,
+				      struct passwd *pwdst, int *errors,
+				      char **buf, size_t *buflen)
+{
+	size_t i;
+	int found = 0;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+				      &nwrap_pw_global_rwlock);
+	if (!ok) {
+		NWRAP_RWUNLOCK(nwrap_pw_global);
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct passwd *pw;
+
+		if (errors[i] != ENOENT) {
+			continue;
+		}
+
+		pw = nwrap_files_find_pwnam(names[i]);
+		if (pw == NULL) {
+			continue;
+		}
+
+		errors[i] = nwrap_pw_copy_r(pw, &pwdst[i], *buf, *buflen, NULL);
+		if (errors[i] != 0) {
+			continue;
+		}
+		nwrap_buf_consume(buf, buflen,
+				  nwrap_pw_buf_used(&pwdst[i], *buf, *buflen));
+		found++;
+	}
+
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return found;
+}
+
+static int nwrap_files_getpwuid_batch(struct nwrap_backend *b,
+				      const uid_t *uids, size_t num,
+				      struct passwd *pwdst, int *errors,
+				      char **buf, size_t *buflen)
+{
+	size_t i;
+	int found = 0;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+				      &nwrap_pw_global_rwlock);
+	if (!ok) {
+		NWRAP_RWUNLOCK(nwrap_pw_global);
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct passwd *pw;
+
+		if (errors[i] != ENOENT) {
+			continue;
+		}
+
+		pw = nwrap_files_find_pwuid(uids[i]);
+		if (pw == NULL) {
+			continue;
+		}
+
+		errors[i] = nwrap_pw_copy_r(pw, &pwdst[i], *buf, *buflen, NULL);
+		if (errors[i] != 0) {
+			continue;
+		}
+		nwrap_buf_consume(buf, buflen,
+				  nwrap_pw_buf_used(&pwdst[i], *buf, *buflen));
+		found++;
+	}
+
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return found;
+}
+
+static int nwrap_files_getgrnam_batch(struct nwrap_backend *b,
+				      const char * const *names, size_t num,
+				      struct group *grdst, int *errors,
+				      char **buf, size_t *buflen)
+{
+	size_t i;
+	int found = 0;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (!ok) {
+		NWRAP_RWUNLOCK(nwrap_gr_global);
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct group *grdstp = NULL;
+
+		if (errors[i] != ENOENT) {
+			continue;
+		}
+
+		errors[i] = nwrap_files_copy_grnam_r(names[i], &grdst[i],
+						     *buf, *buflen, &grdstp);
+		if (errors[i] != 0) {
+			continue;
+		}
+		nwrap_buf_consume(buf, buflen,
+				  nwrap_gr_buf_used(&grdst[i], *buf, *buflen));
+		found++;
+	}
+
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return found;
+}
+
+static int nwrap_files_getgrgid_batch(struct nwrap_backend *b,
+				      const gid_t *gids, size_t num,
+				      struct group *grdst, int *errors,
+				      char **buf, size_t *buflen)
+{
+	size_t i;
+	int found = 0;
+	bool ok;
+
+	(void) b; /* unused */
+
+	ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+				      &nwrap_gr_global_rwlock);
+	if (!ok) {
+		NWRAP_RWUNLOCK(nwrap_gr_global);
+		return 0;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct group *grdstp = NULL;
+
+		if (errors[i] != ENOENT) {
+			continue;
+		}
+
+		errors[i] = nwrap_files_copy_grgid_r(gids[i], &grdst[i],
+						     *buf, *buflen, &grdstp);
+		if (errors[i] != 0) {
+			continue;
+		}
+		nwrap_buf_consume(buf, buflen,
+				  nwrap_gr_buf_used(&grdst[i], *buf, *buflen));
+		found++;
+	}
+
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return found;
+}
+
+/* hosts functions */
+/*
+ * Look up the name in the hosts file. The pointers of result refer to the
+ * shared data, *presult is set to the stored result or NULL if the entry has
+ * been computed by a rule. The caller locked the hosts database with
+ * nwrap_files_cache_rdlock().
+ */
+static int nwrap_files_gethostbyname_result(const char *name, int af,
+					    struct hostent *result,
+					    struct nwrap_he_result **presult)
+{
+	struct nwrap_he_name *hn;
+	struct nwrap_he_result *r;
+	struct hostent *he;
+	size_t iter = 0;
+
+	*presult = NULL;
+
+	/* Look at hash table for element */
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Searching for name: %s", name);
+	hn = nwrap_he_lookup(name);
+	if (hn == NULL) {
+		/* Like above, AF_UNSPEC only returns IPv4 addresses */
+		he = nwrap_he_rule_byname(name,
+					  af == AF_UNSPEC ? AF_INET : af,
+					  &iter);
+		if (he != NULL) {
+			memcpy(result, he, sizeof(struct hostent));
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "Name %s computed by a rule.", name);
+			return 0;
+		}
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s not found.", name);
+		goto no_ent;
+	}
+
+	switch (af) {
+	case AF_UNSPEC:
+		/*
+		 * GLIBC HACK?
+		 * glibc doesn't return ipv6 addresses when AF_UNSPEC is used
+		 */
+	case AF_INET:
+		r = &hn->inet;
+		break;
+	case AF_INET6:
+		r = &hn->inet6;
+		break;
+	default:
+		r = NULL;
+		break;
+	}
+
+	if (r != NULL && r->ht.h_name != NULL) {
+		memcpy(result, &r->ht, sizeof(struct hostent));
+		*presult = r;
+		NWRAP_LOG(NWRAP_LOG_DEBUG,
+			  "Name found. Returning record for %s",
+			  result->h_name);
+		return 0;
+	}
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Name found in database. No records matches type.");
+
+no_ent:
+	errno = ENOENT;
+	return -1;
+}
+
+/*
+ * The result of gethostbyname() and gethostbyname2(). Every thread has its
+ * own, the addresses and aliases are copied to a buffer which grows to the
+ * largest result, so concurrent lookups don't share any data.
+ */
+struct nwrap_he_buf {
+	struct hostent he;
+	char *buf;
+	size_t size;
+};
+
+struct nwrap_he_tls {
+	struct nwrap_he_buf byname;
+	struct nwrap_he_buf byname2;
+};
+
+static __thread struct nwrap_he_tls nwrap_he_tls;
+static pthread_key_t nwrap_he_tls_key;
+static pthread_once_t nwrap_he_tls_once = PTHREAD_ONCE_INIT;
+
+static void nwrap_he_tls_free(void *p)
+{
+	struct nwrap_he_tls *tls = (struct nwrap_he_tls *)p;
+
+	SAFE_FREE(tls->byname.buf);
+	tls->byname.size = 0;
+	SAFE_FREE(tls->byname2.buf);
+	tls->byname2.size = 0;
+}
+
+/* The key only frees the buffers of a thread when it exits */
+static void nwrap_he_tls_key_create(void)
+{
+	int ret;
+
+	ret = pthread_key_create(&nwrap_he_tls_key, nwrap_he_tls_free);
+	if (ret != 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to create thread key: %s",
+			  strerror(ret));
+	}
+}
+
+static bool nwrap_he_buf_grow(struct nwrap_he_buf *b)
+{
+	size_t size = b->size > 0 ? b->size * 2 : 256;
+	char *buf;
+
+	if (b->buf == NULL) {
+		pthread_once(&nwrap_he_tls_once, nwrap_he_tls_key_create);
+		pthread_setspecific(nwrap_he_tls_key, &nwrap_he_tls);
+	}
+
+	buf = (char *)realloc(b->buf, size);
+	if (buf == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		return false;
+	}
+	b->buf = buf;
+	b->size = size;
+
+	return true;
+}
+
+static int nwrap_files_gethostbyname(const char *name, int af,
+				     struct nwrap_he_buf *b)
+{
+	struct nwrap_he_result *r;
+	bool ok;
+	int rc;
+
+	ok = nwrap_files_cache_rdlock(nwrap_he_global.cache,
+				      &nwrap_he_global_rwlock);
+	if (!ok) {
+		NWRAP_RWUNLOCK(nwrap_he_global);
+		errno = ENOENT;
+		return -1;
+	}
+
+	rc = nwrap_files_gethostbyname_result(name, af, &b->he, &r);
+	if (rc == -1) {
+		NWRAP_RWUNLOCK(nwrap_he_global);
+		return -1;
+	}
+
+	do {
+		if (r == NULL) {
+			rc = nwrap_he_synth_copy_r(&b->he, b->buf, b->size);
+		} else {
+			rc = nwrap_he_result_copy_r(r, &b->he, b->buf, b->size);
+		}
+		if (rc == ERANGE && !nwrap_he_buf_grow(b)) {
+			rc = ENOMEM;
+		}
+	} while (rc == ERANGE);
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	if (rc != 0) {
+		errno = rc;
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef HAVE_GETHOSTBYNAME_R
+static int nwrap_gethostbyname_r(const char *name,
+				 struct hostent *ret,
+				 char *buf, size_t buflen,
+				 struct hostent **result, int *h_errnop)
+{
+	struct nwrap_he_result *r;
+	bool ok;
+	int rc = -1;
+
+	ok = nwrap_files_cache_rdlock(nwrap_he_global.cache,
+				      &nwrap_he_global_rwlock);
+	if (ok) {
+		rc = nwrap_files_gethostbyname_result(name, AF_UNSPEC, ret, &r);
+	}
+	if (rc == -1) {
+		NWRAP_RWUNLOCK(nwrap_he_global);
+		*h_errnop = h_errno;
+		errno = ENOENT;
+		return -1;
+	}
+
+	if (r == NULL) {
+		rc = nwrap_he_synth_copy_r(ret, buf, buflen);
+	} else {
+		rc = nwrap_he_result_copy_r(r, ret, buf, buflen);
+	}
+	NWRAP_RWUNLOCK(nwrap_he_global);
+	if (rc != 0) {
+		return rc;
+	}
+
+	*result = ret;
+	return 0;
+}
+
+int gethostbyname_r(const char *name,
+		    struct hostent *ret,
+		    char *buf, size_t buflen,
+		    struct hostent **result, int *h_errnop)
+{
+	uint64_t start;
+	int rc;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gethostbyname_r(name,
+					    ret,
+					    buf,
+					    buflen,
+					    result,
+					    h_errnop);
+	}
+
+	start = nwrap_trace_begin();
+	rc = nwrap_gethostbyname_r(name, ret, buf, buflen, result, h_errnop);
+	nwrap_trace_name(start, NWRAP_TRACE_GETHOSTBYNAME_R, name,
+			 (int32_t)buflen, rc);
+
+	return rc;
+}
+#endif
+
+static int nwrap_he_rule_getaddrinfo(const char *name,
+				     unsigned short port,
+				     const struct addrinfo *hints,
+				     struct addrinfo **ai)
+{
+	struct addrinfo *ai_head = NULL;
+	struct addrinfo *ai_cur = NULL;
+	struct hostent *he;
+	bool skip_canonname = false;
+	size_t iter = 0;
+	int rc = EAI_NONAME;
+
+	while ((he = nwrap_he_rule_byname(name, AF_UNSPEC, &iter)) != NULL) {
+		struct addrinfo *ai_new = NULL;
+		int rc2;
+
+		if (hints->ai_family != AF_UNSPEC &&
+		    he->h_addrtype != hints->ai_family) {
+			rc = EAI_ADDRFAMILY;
+			continue;
+		}
+
+		rc2 = nwrap_convert_he_ai(he,
+					  port,
+					  hints,
+					  &ai_new,
+					  skip_canonname);
+		if (rc2 != 0) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error converting he to ai");
+			if (ai_head != NULL) {
+				freeaddrinfo(ai_head);
+			}
+			return rc2;
+		}
+		skip_canonname = true;
+
+		if (ai_head == NULL) {
+			ai_head = ai_new;
+		}
+		if (ai_cur != NULL) {
+			ai_cur->ai_next = ai_new;
+		}
+		ai_cur = ai_new;
+	}
+
+	if (ai_head == NULL) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG, "Name %s not found.", name);
+		errno = ENOENT;
+		return rc;
+	}
+
+	*ai = ai_head;
+	return 0;
+}
+
+/* The caller locked the hosts database with nwrap_files_cache_rdlock() */
+static int nwrap_files_getaddrinfo(const char *name,
+				   unsigned short port,
+				   const struct addrinfo *hints,
+				   struct addrinfo **ai)
+{
+	struct nwrap_entlist *el;
+	struct hostent *he;
+	struct addrinfo *ai_head = NULL;
+	struct addrinfo *ai_cur = NULL;
+	struct nwrap_he_name *hn;
+	bool skip_canonname = false;
+	int rc;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Searching for name: %s", name);
+	hn = nwrap_he_lookup(name);
+	if (hn == NULL) {
+		return nwrap_he_rule_getaddrinfo(name, port, hints, ai);
+	}
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Name: %s found.", name);
+
+	rc = EAI_NONAME;
+	for (el = hn->list; el != NULL; el = el->next)
+	{
+		int rc2;
+		struct addrinfo *ai_new = NULL;
+
+		he = &(el->ed->ht);
+
+		if (hints->ai_family != AF_UNSPEC &&
+		    he->h_addrtype != hints->ai_family)
+		{
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "Entry found but with wrong AF - "
+				  "remembering EAI_ADDRINFO.");
+			rc = EAI_ADDRFAMILY;
+			continue;
+		}
+
+		/* Function allocates memory and returns it in ai. */
+		rc2 = nwrap_convert_he_ai(he,
+					 port,
+					 hints,
+					 &ai_new,
+					 skip_canonname);
+		if (rc2 != 0) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error converting he to ai");
+			if (ai_head != NULL) {
+				freeaddrinfo(ai_head);
+			}
+			return rc2;
+		}
+		skip_canonname = true;
+
+		if (ai_head == NULL) {
+			ai_head = ai_new;
+		}
+		if (ai_cur != NULL) {
+			ai_cur->ai_next = ai_new;
+		}
+		ai_cur = ai_new;
+	}
+
+	if (ai_head != NULL) {
+		rc = 0;
+	}
+
+	*ai = ai_head;
+
+	return rc;
+}
+
+static struct hostent *nwrap_files_gethostbyaddr(const void *addr,
+						 socklen_t len, int type)
+{
+	struct hostent *he;
+	char ip[NWRAP_INET_ADDRSTRLEN] = {0};
+	struct nwrap_entdata *ed;
+	const char *a;
+	size_t i;
+	bool ok;
+
+	(void) len; /* unused */
+
+	ok = nwrap_files_cache_reload(nwrap_he_global.cache);
+	if (!ok) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "error loading hosts file");
+		return NULL;
+	}
+
+	a = inet_ntop(type, addr, ip, sizeof(ip));
+	if (a == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	nwrap_vector_foreach(ed, nwrap_he_global.entries, i)
+	{
+		he = &(ed->ht);
+		if (he->h_addrtype != type) {
+			continue;
+		}
+
+		if (memcmp(addr, he->h_addr_list[0], he->h_length) == 0) {
+			return he;
+		}
+	}
+
+	he = nwrap_he_rule_byaddr(addr, type);
+	if (he != NULL) {
+		return he;
+	}
+
+	errno = ENOENT;
+	return NULL;
+}
+
+#ifdef HAVE_GETHOSTBYADDR_R
+static int nwrap_gethostbyaddr_r(const void *addr, socklen_t len, int type,
+				 struct hostent *ret,
+				 char *buf, size_t buflen,
+				 struct hostent **result, int *h_errnop)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	*result = nwrap_files_gethostbyaddr(addr, len, type);
+	if (*result != NULL) {
+		memset(buf, '\0', buflen);
+		*ret = **result;
+		rc = nwrap_he_synth_copy_r(ret, buf, buflen);
+		NWRAP_RWUNLOCK(nwrap_he_global);
+		if (rc != 0) {
+			*result = NULL;
+			return rc;
+		}
+		*result = ret;
+		return 0;
+	} else {
+		NWRAP_RWUNLOCK(nwrap_he_global);
+		*h_errnop = h_errno;
+		return -1;
+	}
+}
+
+int gethostbyaddr_r(const void *addr, socklen_t len, int type,
+		    struct hostent *ret,
+		    char *buf, size_t buflen,
+		    struct hostent **result, int *h_errnop)
+{
+	uint64_t start;
+	int rc;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gethostbyaddr_r(addr,
+					    len,
+					    type,
+					    ret,
+					    buf,
+					    buflen,
+					    result,
+					    h_errnop);
+	}
+
+	start = nwrap_trace_begin();
+	rc = nwrap_gethostbyaddr_r(addr, len, type, ret, buf, buflen, result, h_errnop);
+	nwrap_trace_end(start, NWRAP_TRACE_GETHOSTBYADDR_R, addr, len, type,
+			rc);
+
+	return rc;
+}
+#endif
+
+/* hosts enum functions */
+static void nwrap_files_sethostent(void)
+{
+	nwrap_he_global.idx = 0;
+}
+
+static struct hostent *nwrap_files_gethostent(void)
+{
+	struct hostent *he;
+
+	if (nwrap_he_global.idx == 0) {
+		bool ok;
+
+		ok = nwrap_files_cache_reload(nwrap_he_global.cache);
+		if (!ok) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Error loading hosts file");
+			return NULL;
+		}
+	}
+
+	if (nwrap_he_global.idx >= nwrap_he_global.num) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	he = &((struct nwrap_entdata *)nwrap_he_global.entries.items[nwrap_he_global.idx++])->ht;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "return hosts[%s]", he->h_name);
+
+	return he;
+}
+
+static void nwrap_files_endhostent(void)
+{
+	nwrap_he_global.idx = 0;
+}
+
+/*
+ * module backend
+ */
+
+#ifndef NO_NSS_SUPPORT
+static struct passwd *nwrap_module_getpwnam(struct nwrap_backend *b,
+					    const char *name)
+{
+	static struct passwd pwd;
+	static char buf[1000];
+	NSS_STATUS status;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getpwnam_r) {
+		return NULL;
+	}
+
+	status = b->fns->_nss_getpwnam_r(name, &pwd, buf, sizeof(buf), &errno);
+	if (status == NSS_STATUS_NOTFOUND) {
+		return NULL;
+	}
+	if (status != NSS_STATUS_SUCCESS) {
+		return NULL;
+	}
+
+	return &pwd;
+}
+
+static int nwrap_module_getpwnam_r(struct nwrap_backend *b,
+				   const char *name, struct passwd *pwdst,
+				   char *buf, size_t buflen, struct passwd **pwdstp)
+{
+	int ret;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getpwnam_r) {
+		return ENOENT;
+	}
+
+	ret = b->fns->_nss_getpwnam_r(name, pwdst, buf, buflen, &errno);
+	*pwdstp = NULL;
+	switch (ret) {
+	case NSS_STATUS_SUCCESS:
+		*pwdstp = pwdst;
+		return 0;
+	case NSS_STATUS_NOTFOUND:
+		if (errno != 0) {
+			return errno;
+		}
+		return ENOENT;
+	case NSS_STATUS_TRYAGAIN:
+		if (errno != 0) {
+			return errno;
+		}
+		return ERANGE;
+	default:
+		if (errno != 0) {
+			return errno;
+		}
+		return ret;
+	}
+}
+
+static struct passwd *nwrap_module_getpwuid(struct nwrap_backend *b,
+					    uid_t uid)
+{
+	static struct passwd pwd;
+	static char buf[1000];
+	NSS_STATUS status;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getpwuid_r) {
+		return NULL;
+	}
+
+	status = b->fns->_nss_getpwuid_r(uid, &pwd, buf, sizeof(buf), &errno);
+	if (status == NSS_STATUS_NOTFOUND) {
+		return NULL;
+	}
+	if (status != NSS_STATUS_SUCCESS) {
+		return NULL;
+	}
+	return &pwd;
+}
+
+static int nwrap_module_getpwuid_r(struct nwrap_backend *b,
+				   uid_t uid, struct passwd *pwdst,
+				   char *buf, size_t buflen, struct passwd **pwdstp)
+{
+	int ret;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getpwuid_r) {
+		return ENOENT;
+	}
+
+	ret = b->fns->_nss_getpwuid_r(uid, pwdst, buf, buflen, &errno);
+	*pwdstp = NULL;
+	switch (ret) {
+	case NSS_STATUS_SUCCESS:
+		*pwdstp = pwdst;
+		return 0;
+	case NSS_STATUS_NOTFOUND:
+		if (errno != 0) {
+			return errno;
+		}
+		return ENOENT;
+	case NSS_STATUS_TRYAGAIN:
+		if (errno != 0) {
+			return errno;
+		}
+		return ERANGE;
+	default:
+		if (errno != 0) {
+			return errno;
+		}
+		return ret;
+	}
+}
+
+/*
+ * Allocate the buffers of a batch. Returns false if a call of the module
+ * needs more than NWRAP_MODULE_ENUM_MAX_BUFLEN bytes.
+ */
+static bool nwrap_module_enum_alloc(struct nwrap_module_enum *e,
+				    size_t entry_size,
+				    void **entries,
+				    bool grow)
+{
+	size_t buflen = e->buflen;
+	char *buf;
+
+	if (*entries == NULL) {
+		*entries = calloc(NWRAP_MODULE_ENUM_ENTRIES, entry_size);
+		if (*entries == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			errno = ENOMEM;
+			return false;
+		}
+	}
+
+	if (buflen == 0) {
+		buflen = NWRAP_MODULE_ENUM_BUFLEN;
+	} else if (grow) {
+		if (buflen >= NWRAP_MODULE_ENUM_MAX_BUFLEN) {
+			errno = ERANGE;
+			return false;
+		}
+		buflen *= 2;
+	}
+
+	if (buflen == e->buflen) {
+		return true;
+	}
+
+	/* Only grown while it holds no entries */
+	buf = (char *)realloc(e->buf, buflen);
+	if (buf == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		errno = ENOMEM;
+		return false;
+	}
+	e->buf = buf;
+	e->buflen = buflen;
+
+	return true;
+}
+
+/* The error of a module call, which didn't return an entry */
+static int nwrap_module_enum_error(NSS_STATUS status, int err)
+{
+	switch (status) {
+	case NSS_STATUS_TRYAGAIN:
+		if (err != 0) {
+			return err;
+		}
+		return ERANGE;
+	case NSS_STATUS_NOTFOUND:
+		return ENOENT;
+	default:
+		if (err != 0) {
+			return err;
+		}
+		return ENOENT;
+	}
+}
+
+/*
+ * Read the next batch of users. Returns 0 if there are entries, ENOENT at
+ * the end of the enumeration or the error of the module. If the module fails
+ * after it returned some entries, the error is returned by the next call, the
+ * module didn't move on.
+ */
+static int nwrap_module_pw_fill(struct nwrap_backend *b)
+{
+	struct nwrap_module_enum *e = &b->pw_enum;
+	size_t used = 0;
+	bool ok;
+
+	e->num = 0;
+	e->idx = 0;
+
+	if (e->done) {
+		return ENOENT;
+	}
+
+	ok = nwrap_module_enum_alloc(e, sizeof(struct passwd),
+				     (void **)&e->pw, false);
+	if (!ok) {
+		return errno;
+	}
+
+	while (e->num < NWRAP_MODULE_ENUM_ENTRIES) {
+		struct passwd *pw = &e->pw[e->num];
+		char *buf = e->buf + used;
+		size_t buflen = e->buflen - used;
+		NSS_STATUS status;
+		int err = 0;
+
+		status = b->fns->_nss_getpwent_r(pw, buf, buflen, &err);
+		if (status == NSS_STATUS_SUCCESS) {
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_pw_buf_used(pw, buf, buflen));
+			used = e->buflen - buflen;
+			e->num++;
+			continue;
+		}
+		if (status == NSS_STATUS_NOTFOUND) {
+			e->done = true;
+			break;
+		}
+		if (e->num > 0) {
+			break;
+		}
+		if (status == NSS_STATUS_TRYAGAIN && err == ERANGE) {
+			ok = nwrap_module_enum_alloc(e, sizeof(struct passwd),
+						     (void **)&e->pw, true);
+			if (!ok) {
+				return errno;
+			}
+			continue;
+		}
+
+		return nwrap_module_enum_error(status, err);
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Read %zu users of module %s, %zu bytes",
+		  e->num, b->name, used);
+
+	return e->num > 0 ? 0 : ENOENT;
+}
+
+static void nwrap_module_setpwent(struct nwrap_backend *b)
+{
+	if (!nwrap_module_load(b) || !b->fns->_nss_setpwent) {
+		return;
+	}
+
+	b->pw_enum.num = 0;
+	b->pw_enum.idx = 0;
+	b->pw_enum.done = false;
+
+	b->fns->_nss_setpwent();
+}
+
+static struct passwd *nwrap_module_getpwent(struct nwrap_backend *b)
+{
+	struct nwrap_module_enum *e = &b->pw_enum;
+	int rc;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getpwent_r) {
+		return NULL;
+	}
+
+	if (e->idx >= e->num) {
+		rc = nwrap_module_pw_fill(b);
+		if (rc != 0) {
+			errno = rc;
+			return NULL;
+		}
+	}
+
+	/* Valid until the next batch is read */
+	return &e->pw[e->idx++];
+}
+
+static int nwrap_module_getpwent_r(struct nwrap_backend *b,
+				   struct passwd *pwdst, char *buf,
+				   size_t buflen, struct passwd **pwdstp)
+{
+	struct nwrap_module_enum *e = &b->pw_enum;
+	const struct passwd *pw;
+	int rc;
+
+	*pwdstp = NULL;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getpwent_r) {
+		return ENOENT;
+	}
+
+	if (e->idx >= e->num) {
+		rc = nwrap_module_pw_fill(b);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+	pw = &e->pw[e->idx];
+
+	/* The fields can be anywhere in the buffer of the module */
+	pwdst->pw_uid = pw->pw_uid;
+	pwdst->pw_gid = pw->pw_gid;
+	pwdst->pw_name = nwrap_buf_strdup(&buf, &buflen, pw->pw_name);
+	pwdst->pw_passwd = nwrap_buf_strdup(&buf, &buflen, pw->pw_passwd);
+	pwdst->pw_gecos = nwrap_buf_strdup(&buf, &buflen, pw->pw_gecos);
+	pwdst->pw_dir = nwrap_buf_strdup(&buf, &buflen, pw->pw_dir);
+	pwdst->pw_shell = nwrap_buf_strdup(&buf, &buflen, pw->pw_shell);
+	if (pwdst->pw_name == NULL || pwdst->pw_passwd == NULL ||
+	    pwdst->pw_gecos == NULL || pwdst->pw_dir == NULL ||
+	    pwdst->pw_shell == NULL) {
+		/* The caller retries the same entry with a larger buffer */
+		return ERANGE;
+	}
+
+	e->idx++;
+	*pwdstp = pwdst;
+
+	return 0;
+}
+
+static void nwrap_module_endpwent(struct nwrap_backend *b)
+{
+	if (!nwrap_module_load(b) || !b->fns->_nss_endpwent) {
+		return;
+	}
+
+	nwrap_module_enum_free(&b->pw_enum);
+
+	b->fns->_nss_endpwent();
+}
+
+static int nwrap_module_initgroups(struct nwrap_backend *b,
+				   const char *user, gid_t group)
+{
+	gid_t *groups;
+	long int start = 1;
+	long int size = 16;
+	NSS_STATUS status;
+	int rc;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_initgroups) {
+		return NSS_STATUS_UNAVAIL;
+	}
+
+	/* The module appends to the list, which starts with the group */
+	groups = (gid_t *)malloc(size * sizeof(gid_t));
+	if (groups == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+	groups[0] = group;
+
+	status = b->fns->_nss_initgroups(user, group, &start, &size, &groups,
+					 0, &errno);
+	if (status != NSS_STATUS_SUCCESS) {
+		free(groups);
+		return -1;
+	}
+
+	/* This really only works if uid_wrapper is loaded */
+	rc = setgroups(start, groups);
+
+	free(groups);
+
+	return rc;
+}
+
+static struct group *nwrap_module_getgrnam(struct nwrap_backend *b,
+					   const char *name)
+{
+	static struct group grp;
+	static char *buf;
+	static int buflen = 1000;
+	NSS_STATUS status;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getgrnam_r) {
+		return NULL;
+	}
+
+	if (!buf) {
+		buf = (char *)malloc(buflen);
+	}
+again:
+	status = b->fns->_nss_getgrnam_r(name, &grp, buf, buflen, &errno);
+	if (status == NSS_STATUS_TRYAGAIN) {
+		buflen *= 2;
+		buf = (char *)realloc(buf, buflen);
+		if (!buf) {
+			return NULL;
+		}
+		goto again;
+	}
+	if (status == NSS_STATUS_NOTFOUND) {
+		SAFE_FREE(buf);
+		return NULL;
+	}
+	if (status != NSS_STATUS_SUCCESS) {
+		SAFE_FREE(buf);
+		return NULL;
+	}
+	return &grp;
+}
+
+static int nwrap_module_getgrnam_r(struct nwrap_backend *b,
+				   const char *name, struct group *grdst,
+				   char *buf, size_t buflen, struct group **grdstp)
+{
+	int ret;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getgrnam_r) {
+		return ENOENT;
+	}
+
+	ret = b->fns->_nss_getgrnam_r(name, grdst, buf, buflen, &errno);
+	*grdstp = NULL;
+	switch (ret) {
+	case NSS_STATUS_SUCCESS:
+		*grdstp = grdst;
+		return 0;
+	case NSS_STATUS_NOTFOUND:
+		if (errno != 0) {
+			return errno;
+		}
+		return ENOENT;
+	case NSS_STATUS_TRYAGAIN:
+		if (errno != 0) {
+			return errno;
+		}
+		return ERANGE;
+	default:
+		if (errno != 0) {
+			return errno;
+		}
+		return ret;
+	}
+}
+
+static struct group *nwrap_module_getgrgid(struct nwrap_backend *b,
+					   gid_t gid)
+{
+	static struct group grp;
+	static char *buf;
+	static int buflen = 1000;
+	NSS_STATUS status;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getgrgid_r) {
+		return NULL;
+	}
+
+	if (!buf) {
+		buf = (char *)malloc(buflen);
+	}
+
+again:
+	status = b->fns->_nss_getgrgid_r(gid, &grp, buf, buflen, &errno);
+	if (status == NSS_STATUS_TRYAGAIN) {
+		buflen *= 2;
+		buf = (char *)realloc(buf, buflen);
+		if (!buf) {
+			return NULL;
+		}
+		goto again;
+	}
+	if (status == NSS_STATUS_NOTFOUND) {
+		SAFE_FREE(buf);
+		return NULL;
+	}
+	if (status != NSS_STATUS_SUCCESS) {
+		SAFE_FREE(buf);
+		return NULL;
+	}
+	return &grp;
+}
+
+static int nwrap_module_getgrgid_r(struct nwrap_backend *b,
+				   gid_t gid, struct group *grdst,
+				   char *buf, size_t buflen, struct group **grdstp)
+{
+	int ret;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getgrgid_r) {
+		return ENOENT;
+	}
+
+	ret = b->fns->_nss_getgrgid_r(gid, grdst, buf, buflen, &errno);
+	*grdstp = NULL;
+	switch (ret) {
+	case NSS_STATUS_SUCCESS:
+		*grdstp = grdst;
+		return 0;
+	case NSS_STATUS_NOTFOUND:
+		if (errno != 0) {
+			return errno;
+		}
+		return ENOENT;
+	case NSS_STATUS_TRYAGAIN:
+		if (errno != 0) {
+			return errno;
+		}
+		return ERANGE;
+	default:
+		if (errno != 0) {
+			return errno;
+		}
+		return ret;
+	}
+}
+
+/* Read the next batch of groups, see nwrap_module_pw_fill() */
+static int nwrap_module_gr_fill(struct nwrap_backend *b)
+{
+	struct nwrap_module_enum *e = &b->gr_enum;
+	size_t used = 0;
+	bool ok;
+
+	e->num = 0;
+	e->idx = 0;
+
+	if (e->done) {
+		return ENOENT;
+	}
+
+	ok = nwrap_module_enum_alloc(e, sizeof(struct group),
+				     (void **)&e->gr, false);
+	if (!ok) {
+		return errno;
+	}
+
+	while (e->num < NWRAP_MODULE_ENUM_ENTRIES) {
+		struct group *gr = &e->gr[e->num];
+		char *buf = e->buf + used;
+		size_t buflen = e->buflen - used;
+		NSS_STATUS status;
+		int err = 0;
+
+		status = b->fns->_nss_getgrent_r(gr, buf, buflen, &err);
+		if (status == NSS_STATUS_SUCCESS) {
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_gr_buf_used(gr, buf, buflen));
+			used = e->buflen - buflen;
+			e->num++;
+			continue;
+		}
+		if (status == NSS_STATUS_NOTFOUND) {
+			e->done = true;
+			break;
+		}
+		if (e->num > 0) {
+			break;
+		}
+		if (status == NSS_STATUS_TRYAGAIN && err == ERANGE) {
+			ok = nwrap_module_enum_alloc(e, sizeof(struct group),
+						     (void **)&e->gr, true);
+			if (!ok) {
+				return errno;
+			}
+			continue;
+		}
+
+		return nwrap_module_enum_error(status, err);
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "Read %zu groups of module %s, %zu bytes",
+		  e->num, b->name, used);
+
+	return e->num > 0 ? 0 : ENOENT;
+}
+
+static void nwrap_module_setgrent(struct nwrap_backend *b)
+{
+	if (!nwrap_module_load(b) || !b->fns->_nss_setgrent) {
+		return;
+	}
+
+	b->gr_enum.num = 0;
+	b->gr_enum.idx = 0;
+	b->gr_enum.done = false;
+
+	b->fns->_nss_setgrent();
+}
+
+static struct group *nwrap_module_getgrent(struct nwrap_backend *b)
+{
+	struct nwrap_module_enum *e = &b->gr_enum;
+	int rc;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getgrent_r) {
+		return NULL;
+	}
+
+	if (e->idx >= e->num) {
+		rc = nwrap_module_gr_fill(b);
+		if (rc != 0) {
+			errno = rc;
+			return NULL;
+		}
+	}
+
+	/* Valid until the next batch is read */
+	return &e->gr[e->idx++];
+}
+
+static int nwrap_module_getgrent_r(struct nwrap_backend *b,
+				   struct group *grdst, char *buf,
+				   size_t buflen, struct group **grdstp)
+{
+	struct nwrap_module_enum *e = &b->gr_enum;
+	int rc;
+
+	*grdstp = NULL;
+
+	if (!nwrap_module_load(b) || !b->fns->_nss_getgrent_r) {
+		return ENOENT;
+	}
+
+	if (e->idx >= e->num) {
+		rc = nwrap_module_gr_fill(b);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+
+	/* The caller retries the same entry with a larger buffer on ERANGE */
+	rc = nwrap_gr_copy_r(&e->gr[e->idx], grdst, buf, buflen, grdstp);
+	if (rc != 0) {
+		return rc;
+	}
+	e->idx++;
+
+	return 0;
+}
+
+static void nwrap_module_endgrent(struct nwrap_backend *b)
+{
+	if (!nwrap_module_load(b) || !b->fns->_nss_endgrent) {
+		return;
+	}
+
+	nwrap_module_enum_free(&b->gr_enum);
+
+	b->fns->_nss_endgrent();
+}
+#endif
+
+/****************************************************************************
+ *   GETPWNAM
+ ***************************************************************************/
+
+static struct passwd *nwrap_getpwnam(const char *name)
+{
+	int i;
+	struct passwd *pwd;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		pwd = b->ops->nw_getpwnam(b, name);
+		if (pwd) {
+			return pwd;
+		}
+	}
+
+	return NULL;
+}
+
+struct passwd *getpwnam(const char *name)
+{
+	struct passwd *pwd;
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwnam(name);
+	}
+
+	start = nwrap_trace_begin();
+	pwd = nwrap_getpwnam(name);
+	nwrap_trace_name(start, NWRAP_TRACE_GETPWNAM, name, 0,
+			 pwd != NULL ? 0 : ENOENT);
+
+	return pwd;
+}
+
+/****************************************************************************
+ *   GETPWNAM_R
+ ***************************************************************************/
+
+/*
+ * Count the calls which failed because the buffer was too small. Every one
+ * of them means the caller has to grow the buffer and ask again.
+ */
+static void nwrap_count_erange(int ret)
+{
+	if (ret == ERANGE) {
+		NWRAP_LOCK(nwrap_global);
+		nwrap_main_global->erange_retries++;
+		NWRAP_UNLOCK(nwrap_global);
+	}
+}
+
+unsigned long nss_wrapper_erange_retries(void)
+{
+	unsigned long retries;
+
+	nwrap_init();
+
+	NWRAP_LOCK(nwrap_global);
+	retries = nwrap_main_global->erange_retries;
+	NWRAP_UNLOCK(nwrap_global);
+
+	return retries;
+}
+
+static int nwrap_getpwnam_r(const char *name, struct passwd *pwdst,
+			    char *buf, size_t buflen, struct passwd **pwdstp)
+{
+	int i,ret;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		ret = b->ops->nw_getpwnam_r(b, name, pwdst, buf, buflen, pwdstp);
+		nwrap_count_erange(ret);
+		if (ret == ENOENT) {
+			continue;
+		}
+		return ret;
+	}
+
+	return ENOENT;
+}
+
+#ifdef HAVE_GETPWNAM_R
+# ifdef HAVE_SOLARIS_GETPWNAM_R
+int getpwnam_r(const char *name, struct passwd *pwdst,
+	       char *buf, int buflen, struct passwd **pwdstp)
+# else /* HAVE_SOLARIS_GETPWNAM_R */
+int getpwnam_r(const char *name, struct passwd *pwdst,
+	       char *buf, size_t buflen, struct passwd **pwdstp)
+# endif /* HAVE_SOLARIS_GETPWNAM_R */
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwnam_r(name, pwdst, buf, buflen, pwdstp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getpwnam_r(name, pwdst, buf, buflen, pwdstp);
+	nwrap_trace_name(start, NWRAP_TRACE_GETPWNAM_R, name,
+			 (int32_t)buflen, ret);
+
+	return ret;
+}
+#endif
+
+/****************************************************************************
+ *   GETPWUID
+ ***************************************************************************/
+
+static struct passwd *nwrap_getpwuid(uid_t uid)
+{
+	int i;
+	struct passwd *pwd;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		pwd = b->ops->nw_getpwuid(b, uid);
+		if (pwd) {
+			return pwd;
+		}
+	}
+
+	return NULL;
+}
+
+struct passwd *getpwuid(uid_t uid)
+{
+	struct passwd *pwd;
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwuid(uid);
+	}
+
+	start = nwrap_trace_begin();
+	pwd = nwrap_getpwuid(uid);
+	nwrap_trace_id(start, NWRAP_TRACE_GETPWUID, (uint32_t)uid, 0,
+		       pwd != NULL ? 0 : ENOENT);
+
+	return pwd;
+}
+
+/****************************************************************************
+ *   GETPWUID_R
+ ***************************************************************************/
+
+static int nwrap_getpwuid_r(uid_t uid, struct passwd *pwdst,
+			    char *buf, size_t buflen, struct passwd **pwdstp)
+{
+	int i,ret;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		ret = b->ops->nw_getpwuid_r(b, uid, pwdst, buf, buflen, pwdstp);
+		nwrap_count_erange(ret);
+		if (ret == ENOENT) {
+			continue;
+		}
+		return ret;
+	}
+
+	return ENOENT;
+}
+
+#ifdef HAVE_SOLARIS_GETPWUID_R
+int getpwuid_r(uid_t uid, struct passwd *pwdst,
+	       char *buf, int buflen, struct passwd **pwdstp)
+#else
+int getpwuid_r(uid_t uid, struct passwd *pwdst,
+	       char *buf, size_t buflen, struct passwd **pwdstp)
+#endif
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwuid_r(uid, pwdst, buf, buflen, pwdstp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getpwuid_r(uid, pwdst, buf, buflen, pwdstp);
+	nwrap_trace_id(start, NWRAP_TRACE_GETPWUID_R, (uint32_t)uid,
+		       (int32_t)buflen, ret);
+
+	return ret;
+}
+
+/****************************************************************************
+ *   SETPWENT
+ ***************************************************************************/
+
+static void nwrap_setpwent(void)
+{
+	int i;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		b->ops->nw_setpwent(b);
+	}
+}
+
+void setpwent(void)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		libc_setpwent();
+		return;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_setpwent();
+	nwrap_trace_end(start, NWRAP_TRACE_SETPWENT, NULL, 0, 0, 0);
+}
+
+/****************************************************************************
+ *   GETPWENT
+ ***************************************************************************/
+
+static struct passwd *nwrap_getpwent(void)
+{
+	int i;
+	struct passwd *pwd;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		pwd = b->ops->nw_getpwent(b);
+		if (pwd) {
+			return pwd;
+		}
+	}
+
+	return NULL;
+}
+
+struct passwd *getpwent(void)
+{
+	struct passwd *pwd;
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwent();
+	}
+
+	start = nwrap_trace_begin();
+	pwd = nwrap_getpwent();
+	nwrap_trace_end(start, NWRAP_TRACE_GETPWENT, NULL, 0, 0,
+			pwd != NULL ? 0 : ENOENT);
+
+	return pwd;
+}
+
+#if !(defined OSX || defined OPENBSD)
+
+/****************************************************************************
+ *   GETPWENT_R
+ ***************************************************************************/
+
+static int nwrap_getpwent_r(struct passwd *pwdst, char *buf,
+			    size_t buflen, struct passwd **pwdstp)
+{
+	int i,ret;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		ret = b->ops->nw_getpwent_r(b, pwdst, buf, buflen, pwdstp);
+		nwrap_count_erange(ret);
+		if (ret == ENOENT) {
+			continue;
+		}
+		return ret;
+	}
+
+	return ENOENT;
+}
+
+#ifdef HAVE_SOLARIS_GETPWENT_R
+struct passwd *getpwent_r(struct passwd *pwdst, char *buf, int buflen)
+{
+	struct passwd *pwdstp = NULL;
+	int rc;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwent_r(pwdst, buf, buflen);
+	}
+	rc = nwrap_getpwent_r(pwdst, buf, buflen, &pwdstp);
+	if (rc < 0) {
+		return NULL;
+	}
+
+	return pwdstp;
+}
+#else /* HAVE_SOLARIS_GETPWENT_R */
+int getpwent_r(struct passwd *pwdst, char *buf,
+	       size_t buflen, struct passwd **pwdstp)
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getpwent_r(pwdst, buf, buflen, pwdstp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getpwent_r(pwdst, buf, buflen, pwdstp);
+	nwrap_trace_end(start, NWRAP_TRACE_GETPWENT_R, NULL, 0,
+			(int32_t)buflen, ret);
+
+	return ret;
+}
+#endif /* HAVE_SOLARIS_GETPWENT_R */
+#endif /* OSX || OPENBSD */
+
+/****************************************************************************
+ *   ENDPWENT
+ ***************************************************************************/
+
+static void nwrap_endpwent(void)
+{
+	int i;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		b->ops->nw_endpwent(b);
+	}
+}
+
+void endpwent(void)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		libc_endpwent();
+		return;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_endpwent();
+	nwrap_trace_end(start, NWRAP_TRACE_ENDPWENT, NULL, 0, 0, 0);
+}
+
+/****************************************************************************
+ *   INITGROUPS
+ ***************************************************************************/
+
+static int nwrap_initgroups(const char *user, gid_t group)
+{
+	int i;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		int rc;
+
+		rc = b->ops->nw_initgroups(b, user, group);
+		if (rc == 0) {
+			return 0;
+		}
+	}
+
+	errno = ENOENT;
+	return -1;
+}
+
+#ifndef OSX
+int initgroups(const char *user, gid_t group)
+#else
+int initgroups(const char *user, int group)
+#endif /* OSX */
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_initgroups(user, group);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_initgroups(user, group);
+	nwrap_trace_name(start, NWRAP_TRACE_INITGROUPS, user,
+			 (int32_t)group, ret);
+
+	return ret;
+}
+
+/****************************************************************************
+ *   GETGRNAM
+ ***************************************************************************/
+
+static struct group *nwrap_getgrnam(const char *name)
+{
+	int i;
+	struct group *grp;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		grp = b->ops->nw_getgrnam(b, name);
+		if (grp) {
+			return grp;
+		}
+	}
+
+	return NULL;
+}
+
+struct group *getgrnam(const char *name)
+{
+	struct group *grp;
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrnam(name);
+	}
+
+	start = nwrap_trace_begin();
+	grp = nwrap_getgrnam(name);
+	nwrap_trace_name(start, NWRAP_TRACE_GETGRNAM, name, 0,
+			 grp != NULL ? 0 : ENOENT);
+
+	return grp;
+}
+
+/****************************************************************************
+ *   GETGRNAM_R
+ ***************************************************************************/
+
+static int nwrap_getgrnam_r(const char *name, struct group *grdst,
+			    char *buf, size_t buflen, struct group **grdstp)
+{
+	int i, ret;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		ret = b->ops->nw_getgrnam_r(b, name, grdst, buf, buflen, grdstp);
+		nwrap_count_erange(ret);
+		if (ret == ENOENT) {
+			continue;
+		}
+		return ret;
+	}
+
+	return ENOENT;
+}
+
+#ifdef HAVE_GETGRNAM_R
+# ifdef HAVE_SOLARIS_GETGRNAM_R
+int getgrnam_r(const char *name, struct group *grp,
+		char *buf, int buflen, struct group **pgrp)
+# else /* HAVE_SOLARIS_GETGRNAM_R */
+int getgrnam_r(const char *name, struct group *grp,
+	       char *buf, size_t buflen, struct group **pgrp)
+# endif /* HAVE_SOLARIS_GETGRNAM_R */
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrnam_r(name,
+				       grp,
+				       buf,
+				       buflen,
+				       pgrp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getgrnam_r(name, grp, buf, buflen, pgrp);
+	nwrap_trace_name(start, NWRAP_TRACE_GETGRNAM_R, name,
+			 (int32_t)buflen, ret);
+
+	return ret;
+}
+#endif /* HAVE_GETGRNAM_R */
+
+/****************************************************************************
+ *   GETGRGID
+ ***************************************************************************/
+
+static struct group *nwrap_getgrgid(gid_t gid)
+{
+	int i;
+	struct group *grp;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		grp = b->ops->nw_getgrgid(b, gid);
+		if (grp) {
+			return grp;
+		}
+	}
+
+	return NULL;
+}
+
+struct group *getgrgid(gid_t gid)
+{
+	struct group *grp;
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrgid(gid);
+	}
+
+	start = nwrap_trace_begin();
+	grp = nwrap_getgrgid(gid);
+	nwrap_trace_id(start, NWRAP_TRACE_GETGRGID, (uint32_t)gid, 0,
+		       grp != NULL ? 0 : ENOENT);
+
+	return grp;
+}
+
+/****************************************************************************
+ *   GETGRGID_R
+ ***************************************************************************/
+
+static int nwrap_getgrgid_r(gid_t gid, struct group *grdst,
+			    char *buf, size_t buflen, struct group **grdstp)
+{
+	int i,ret;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		ret = b->ops->nw_getgrgid_r(b, gid, grdst, buf, buflen, grdstp);
+		nwrap_count_erange(ret);
+		if (ret == ENOENT) {
+			continue;
+		}
+		return ret;
+	}
+
+	return ENOENT;
+}
+
+#ifdef HAVE_GETGRGID_R
+# ifdef HAVE_SOLARIS_GETGRGID_R
+int getgrgid_r(gid_t gid, struct group *grdst,
+	       char *buf, int buflen, struct group **grdstp)
+# else /* HAVE_SOLARIS_GETGRGID_R */
+int getgrgid_r(gid_t gid, struct group *grdst,
+	       char *buf, size_t buflen, struct group **grdstp)
+# endif /* HAVE_SOLARIS_GETGRGID_R */
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrgid_r(gid, grdst, buf, buflen, grdstp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getgrgid_r(gid, grdst, buf, buflen, grdstp);
+	nwrap_trace_id(start, NWRAP_TRACE_GETGRGID_R, (uint32_t)gid,
+		       (int32_t)buflen, ret);
+
+	return ret;
+}
+#endif
+
+/****************************************************************************
+ *   SETGRENT
+ ***************************************************************************/
+
+static void nwrap_setgrent(void)
+{
+	int i;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		b->ops->nw_setgrent(b);
+	}
+}
+
+#ifdef HAVE_BSD_SETGRENT
+int setgrent(void)
+#else
+void setgrent(void)
+#endif
+{
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		libc_setgrent();
+		goto out;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_setgrent();
+	nwrap_trace_end(start, NWRAP_TRACE_SETGRENT, NULL, 0, 0, 0);
+
+out:
+#ifdef HAVE_BSD_SETGRENT
+	return 0;
+#else
+	return;
+#endif
+}
+
+/****************************************************************************
+ *   GETGRENT
+ ***************************************************************************/
+
+static struct group *nwrap_getgrent(void)
+{
+	int i;
+	struct group *grp;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		grp = b->ops->nw_getgrent(b);
+		if (grp) {
+			return grp;
+		}
+	}
+
+	return NULL;
+}
+
+struct group *getgrent(void)
+{
+	struct group *grp;
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrent();
+	}
+
+	start = nwrap_trace_begin();
+	grp = nwrap_getgrent();
+	nwrap_trace_end(start, NWRAP_TRACE_GETGRENT, NULL, 0, 0,
+			grp != NULL ? 0 : ENOENT);
+
+	return grp;
+}
+
+#if !(defined OSX || defined OPENBSD)
+
+/****************************************************************************
+ *   GETGRENT_R
+ ***************************************************************************/
+static int nwrap_getgrent_r(struct group *grdst, char *buf,
+			    size_t buflen, struct group **grdstp)
+{
+	int i,ret;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		ret = b->ops->nw_getgrent_r(b, grdst, buf, buflen, grdstp);
+		nwrap_count_erange(ret);
+		if (ret == ENOENT) {
+			continue;
+		}
+		return ret;
+	}
+
+	return ENOENT;
+}
+
+#ifdef HAVE_SOLARIS_GETGRENT_R
+struct group *getgrent_r(struct group *src, char *buf, int buflen)
+{
+	struct group *grdstp = NULL;
+	int rc;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrent_r(src, buf, buflen);
+	}
+
+	rc = nwrap_getgrent_r(src, buf, buflen, &grdstp);
+	if (rc < 0) {
+		return NULL;
+	}
+
+	return grdstp;
+}
+#else /* HAVE_SOLARIS_GETGRENT_R */
+int getgrent_r(struct group *src, char *buf,
+	       size_t buflen, struct group **grdstp)
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrent_r(src, buf, buflen, grdstp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getgrent_r(src, buf, buflen, grdstp);
+	nwrap_trace_end(start, NWRAP_TRACE_GETGRENT_R, NULL, 0,
+			(int32_t)buflen, ret);
+
+	return ret;
+}
+#endif /* HAVE_SOLARIS_GETGRENT_R */
+#endif /* OSX || OPENBSD */
+
+/****************************************************************************
+ *   ENDGRENT
+ ***************************************************************************/
+
+static void nwrap_endgrent(void)
+{
+	int i;
+
+	for (i=0; i < nwrap_main_global->num_backends; i++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[i];
+		b->ops->nw_endgrent(b);
+	}
+}
+
+void endgrent(void)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_enabled()) {
+		libc_endgrent();
+		return;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_endgrent();
+	nwrap_trace_end(start, NWRAP_TRACE_ENDGRENT, NULL, 0, 0, 0);
+}
+
+/****************************************************************************
+ *   GETGROUPLIST
+ ***************************************************************************/
+
+#ifdef HAVE_GETGROUPLIST
+#ifndef OSX
+static int nwrap_getgrouplist(const char *user, gid_t group,
+			      gid_t *groups, int *ngroups)
+#else
+static int nwrap_getgrouplist(const char *user, int group,
+			      int *groups, int *ngroups)
+#endif /* OSX */
+{
+	struct group *grp;
+	gid_t *groups_tmp;
+	int count = 1;
+	bool ok;
+	int b;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "getgrouplist called for %s", user);
+
+	groups_tmp = (gid_t *)malloc(count * sizeof(gid_t));
+	if (!groups_tmp) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		errno = ENOMEM;
+		return -1;
+	}
+	groups_tmp[0] = group;
+
+	for (b = 0; b < nwrap_main_global->num_backends; b++) {
+		struct nwrap_backend *backend = &nwrap_main_global->backends[b];
+
+		if (backend->ops == &nwrap_files_ops) {
+			/* Doesn't use the getgrent() position of other threads */
+			ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+						      &nwrap_gr_global_rwlock);
+			if (ok) {
+				ok = nwrap_files_member_groups(user,
+							       (gid_t)group,
+							       &groups_tmp,
+							       &count);
+			}
+			NWRAP_RWUNLOCK(nwrap_gr_global);
+			if (!ok) {
+				free(groups_tmp);
+				return -1;
+			}
+			continue;
+		}
+
+		backend->ops->nw_setgrent(backend);
+		while ((grp = backend->ops->nw_getgrent(backend)) != NULL) {
+			int i = 0;
+
+			NWRAP_LOG(NWRAP_LOG_DEBUG,
+				  "Inspecting %s for group membership",
+				  grp->gr_name);
+
+			for (i=0; grp->gr_mem && grp->gr_mem[i] != NULL; i++) {
+				/* Cast to git_t here is necessary for OSX port */
+				if ((gid_t)group != grp->gr_gid &&
+				    (strcmp(user, grp->gr_mem[i]) == 0)) {
+
+					NWRAP_LOG(NWRAP_LOG_DEBUG,
+						  "%s is member of %s",
+						  user,
+						  grp->gr_name);
+
+					ok = nwrap_groups_add(&groups_tmp,
+							      &count,
+							      grp->gr_gid,
+							      1,
+							      (gid_t)group);
+					if (!ok) {
+						backend->ops->nw_endgrent(backend);
+						free(groups_tmp);
+						return -1;
+					}
+				}
+			}
+		}
+		backend->ops->nw_endgrent(backend);
+	}
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "%s is member of %d groups",
+		  user, *ngroups);
+
+	if (*ngroups < count) {
+		*ngroups = count;
+		free(groups_tmp);
+		return -1;
+	}
+
+	*ngroups = count;
+	memcpy(groups, groups_tmp, count * sizeof(gid_t));
+	free(groups_tmp);
+
+	return count;
+}
+
+#ifndef OSX
+int getgrouplist(const char *user, gid_t group, gid_t *groups, int *ngroups)
+#else
+int getgrouplist(const char *user, int group, int *groups, int *ngroups)
+#endif /* OSX */
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_enabled()) {
+		return libc_getgrouplist(user, group, groups, ngroups);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getgrouplist(user, group, groups, ngroups);
+	nwrap_trace_name(start, NWRAP_TRACE_GETGROUPLIST, user,
+			 (int32_t)group, *ngroups);
+
+	return ret;
+}
+#endif
+
+/**********************************************************
+ * BATCH LOOKUPS
+ **********************************************************/
+
+/*
+ * The batch lookups resolve num keys with one call. Every resolved entry is
+ * stored in the result array at the same index and its strings are packed
+ * one after another into buf. errors[i] is set to 0 on success, ENOENT if
+ * the key is unknown or ERANGE if buf was too small to hold the entry.
+ *
+ * The return value is the number of resolved entries or -1 with errno set.
+ */
+
+static int nwrap_getpwnam_batch(const char * const *names, size_t num,
+				struct passwd *pwds, int *errors,
+				char *buf, size_t buflen)
+{
+	size_t i;
+	int found = 0;
+	int b_idx;
+
+	for (i = 0; i < num; i++) {
+		errors[i] = ENOENT;
+	}
+
+	for (b_idx = 0; b_idx < nwrap_main_global->num_backends; b_idx++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[b_idx];
+
+		if (b->ops->nw_getpwnam_batch != NULL) {
+			found += b->ops->nw_getpwnam_batch(b, names, num,
+							   pwds, errors,
+							   &buf, &buflen);
+			continue;
+		}
+
+		for (i = 0; i < num; i++) {
+			struct passwd *pwdstp = NULL;
+
+			if (errors[i] != ENOENT) {
+				continue;
+			}
+
+			errors[i] = b->ops->nw_getpwnam_r(b, names[i], &pwds[i],
+							  buf, buflen, &pwdstp);
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_pw_buf_used(&pwds[i], buf, buflen));
+			found++;
+		}
+	}
+
+	return found;
+}
+
+static int nwrap_getpwuid_batch(const uid_t *uids, size_t num,
+				struct passwd *pwds, int *errors,
+				char *buf, size_t buflen)
+{
+	size_t i;
+	int found = 0;
+	int b_idx;
+
+	for (i = 0; i < num; i++) {
+		errors[i] = ENOENT;
+	}
+
+	for (b_idx = 0; b_idx < nwrap_main_global->num_backends; b_idx++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[b_idx];
+
+		if (b->ops->nw_getpwuid_batch != NULL) {
+			found += b->ops->nw_getpwuid_batch(b, uids, num,
+							   pwds, errors,
+							   &buf, &buflen);
+			continue;
+		}
+
+		for (i = 0; i < num; i++) {
+			struct passwd *pwdstp = NULL;
+
+			if (errors[i] != ENOENT) {
+				continue;
+			}
+
+			errors[i] = b->ops->nw_getpwuid_r(b, uids[i], &pwds[i],
+							  buf, buflen, &pwdstp);
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_pw_buf_used(&pwds[i], buf, buflen));
+			found++;
+		}
+	}
+
+	return found;
+}
+
+static int nwrap_getgrnam_batch(const char * const *names, size_t num,
+				struct group *grps, int *errors,
+				char *buf, size_t buflen)
+{
+	size_t i;
+	int found = 0;
+	int b_idx;
+
+	for (i = 0; i < num; i++) {
+		errors[i] = ENOENT;
+	}
+
+	for (b_idx = 0; b_idx < nwrap_main_global->num_backends; b_idx++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[b_idx];
+
+		if (b->ops->nw_getgrnam_batch != NULL) {
+			found += b->ops->nw_getgrnam_batch(b, names, num,
+							   grps, errors,
+							   &buf, &buflen);
+			continue;
+		}
+
+		for (i = 0; i < num; i++) {
+			struct group *grdstp = NULL;
+
+			if (errors[i] != ENOENT) {
+				continue;
+			}
+
+			errors[i] = b->ops->nw_getgrnam_r(b, names[i], &grps[i],
+							  buf, buflen, &grdstp);
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_gr_buf_used(&grps[i], buf, buflen));
+			found++;
+		}
+	}
+
+	return found;
+}
+
+static int nwrap_getgrgid_batch(const gid_t *gids, size_t num,
+				struct group *grps, int *errors,
+				char *buf, size_t buflen)
+{
+	size_t i;
+	int found = 0;
+	int b_idx;
+
+	for (i = 0; i < num; i++) {
+		errors[i] = ENOENT;
+	}
+
+	for (b_idx = 0; b_idx < nwrap_main_global->num_backends; b_idx++) {
+		struct nwrap_backend *b = &nwrap_main_global->backends[b_idx];
+
+		if (b->ops->nw_getgrgid_batch != NULL) {
+			found += b->ops->nw_getgrgid_batch(b, gids, num,
+							   grps, errors,
+							   &buf, &buflen);
+			continue;
+		}
+
+		for (i = 0; i < num; i++) {
+			struct group *grdstp = NULL;
+
+			if (errors[i] != ENOENT) {
+				continue;
+			}
+
+			errors[i] = b->ops->nw_getgrgid_r(b, gids[i], &grps[i],
+							  buf, buflen, &grdstp);
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_gr_buf_used(&grps[i], buf, buflen));
+			found++;
+		}
+	}
+
+	return found;
+}
+
+int nss_wrapper_getpwnam_batch(const char * const *names, size_t num,
+			       struct passwd *pwds, int *errors,
+			       char *buf, size_t buflen)
+{
+	if (names == NULL || pwds == NULL || errors == NULL ||
+	    (buf == NULL && buflen > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!nss_wrapper_enabled()) {
+#ifdef HAVE_GETPWNAM_R
+		size_t i;
+		int found = 0;
+
+		for (i = 0; i < num; i++) {
+			struct passwd *pwdstp = NULL;
+
+			errors[i] = libc_getpwnam_r(names[i], &pwds[i],
+						    buf, buflen, &pwdstp);
+			if (errors[i] == 0 && pwdstp == NULL) {
+				errors[i] = ENOENT;
+			}
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_pw_buf_used(&pwds[i], buf, buflen));
+			found++;
+		}
+
+		return found;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+
+	return nwrap_getpwnam_batch(names, num, pwds, errors, buf, buflen);
+}
+
+int nss_wrapper_getpwuid_batch(const uid_t *uids, size_t num,
+			       struct passwd *pwds, int *errors,
+			       char *buf, size_t buflen)
+{
+	if (uids == NULL || pwds == NULL || errors == NULL ||
+	    (buf == NULL && buflen > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!nss_wrapper_enabled()) {
+#ifdef HAVE_GETPWUID_R
+		size_t i;
+		int found = 0;
+
+		for (i = 0; i < num; i++) {
+			struct passwd *pwdstp = NULL;
+
+			errors[i] = libc_getpwuid_r(uids[i], &pwds[i],
+						    buf, buflen, &pwdstp);
+			if (errors[i] == 0 && pwdstp == NULL) {
+				errors[i] = ENOENT;
+			}
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_pw_buf_used(&pwds[i], buf, buflen));
+			found++;
+		}
+
+		return found;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+
+	return nwrap_getpwuid_batch(uids, num, pwds, errors, buf, buflen);
+}
+
+int nss_wrapper_getgrnam_batch(const char * const *names, size_t num,
+			       struct group *grps, int *errors,
+			       char *buf, size_t buflen)
+{
+	if (names == NULL || grps == NULL || errors == NULL ||
+	    (buf == NULL && buflen > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!nss_wrapper_enabled()) {
+#ifdef HAVE_GETGRNAM_R
+		size_t i;
+		int found = 0;
+
+		for (i = 0; i < num; i++) {
+			struct group *grdstp = NULL;
+
+			errors[i] = libc_getgrnam_r(names[i], &grps[i],
+						    buf, buflen, &grdstp);
+			if (errors[i] == 0 && grdstp == NULL) {
+				errors[i] = ENOENT;
+			}
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_gr_buf_used(&grps[i], buf, buflen));
+			found++;
+		}
+
+		return found;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+
+	return nwrap_getgrnam_batch(names, num, grps, errors, buf, buflen);
+}
+
+int nss_wrapper_getgrgid_batch(const gid_t *gids, size_t num,
+			       struct group *grps, int *errors,
+			       char *buf, size_t buflen)
+{
+	if (gids == NULL || grps == NULL || errors == NULL ||
+	    (buf == NULL && buflen > 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (!nss_wrapper_enabled()) {
+#ifdef HAVE_GETGRGID_R
+		size_t i;
+		int found = 0;
+
+		for (i = 0; i < num; i++) {
+			struct group *grdstp = NULL;
+
+			errors[i] = libc_getgrgid_r(gids[i], &grps[i],
+						    buf, buflen, &grdstp);
+			if (errors[i] == 0 && grdstp == NULL) {
+				errors[i] = ENOENT;
+			}
+			if (errors[i] != 0) {
+				continue;
+			}
+			nwrap_buf_consume(&buf, &buflen,
+					  nwrap_gr_buf_used(&grps[i], buf, buflen));
+			found++;
+		}
+
+		return found;
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	}
+
+	return nwrap_getgrgid_batch(gids, num, grps, errors, buf, buflen);
+}
+
+/**********************************************************
+ * SYSCONF
+ **********************************************************/
+
+/*
+ * Callers size the buffer for getpwnam_r() and getgrnam_r() with
+ * sysconf(_SC_GETPW_R_SIZE_MAX) and sysconf(_SC_GETGR_R_SIZE_MAX). The libc
+ * value knows nothing about our files, so a large group would cost an ERANGE
+ * round trip. Report the size of the largest entry instead if it is bigger.
+ */
+NWRAP_NO_SANITIZE_THREAD static long nwrap_sysconf_next(int name)
+{
+	static long (*next_sysconf)(int);
+	long (*f)(int);
+
+	f = __atomic_load_n(&next_sysconf, __ATOMIC_RELAXED);
+	if (f == NULL) {
+		*(void **)(&f) = dlsym(RTLD_NEXT, "sysconf");
+		if (f == NULL) {
+			errno = ENOSYS;
+			return -1;
+		}
+		__atomic_store_n(&next_sysconf, f, __ATOMIC_RELAXED);
+	}
+
+	return f(name);
+}
+
+static long nwrap_sysconf(int name)
+{
+	long ret = libc_sysconf(name);
+	size_t max_size = 0;
+	bool ok;
+
+	switch (name) {
+#ifdef _SC_GETPW_R_SIZE_MAX
+	case _SC_GETPW_R_SIZE_MAX:
+		ok = nwrap_files_cache_rdlock(nwrap_pw_global.cache,
+					      &nwrap_pw_global_rwlock);
+		if (ok) {
+			max_size = nwrap_pw_global.max_size;
+		}
+		NWRAP_RWUNLOCK(nwrap_pw_global);
+		break;
+#endif
+#ifdef _SC_GETGR_R_SIZE_MAX
+	case _SC_GETGR_R_SIZE_MAX:
+		ok = nwrap_files_cache_rdlock(nwrap_gr_global.cache,
+					      &nwrap_gr_global_rwlock);
+		if (ok) {
+			max_size = nwrap_gr_global.max_size;
+		}
+		NWRAP_RWUNLOCK(nwrap_gr_global);
+		break;
+#endif
+	default:
+		return ret;
+	}
+
+	if (max_size > 0 && (ret == -1 || (size_t)ret < max_size)) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG,
+			  "sysconf(%d): %zu instead of %ld",
+			  name, max_size, ret);
+		ret = (long)max_size;
+	}
+
+	return ret;
+}
+
+NWRAP_NO_SANITIZE_THREAD long sysconf(int name)
+{
+	switch (name) {
+#ifdef _SC_GETPW_R_SIZE_MAX
+	case _SC_GETPW_R_SIZE_MAX:
+#endif
+#ifdef _SC_GETGR_R_SIZE_MAX
+	case _SC_GETGR_R_SIZE_MAX:
+#endif
+		if (!__atomic_load_n(&nwrap_init_done, __ATOMIC_ACQUIRE)) {
+			nwrap_init();
+		}
+		if (nss_wrapper_enabled()) {
+			return nwrap_sysconf(name);
+		}
+		break;
+	default:
+		/*
+		 * Keys like _SC_PAGESIZE are asked for all the time, also by
+		 * sanitizer runtimes and constructors of other libraries
+		 * before ours ran. Those must not take any of our locks, so
+		 * until nwrap_init() is done they go to the next sysconf().
+		 */
+		if (!__atomic_load_n(&nwrap_init_done, __ATOMIC_ACQUIRE)) {
+			return nwrap_sysconf_next(name);
+		}
+		break;
+	}
+
+	return libc_sysconf(name);
+}
+
+/**********************************************************
+ * MUTATIONS
+ **********************************************************/
+
+/*
+ * Test drivers change accounts and hosts through nss_wrapper_add_user() and
+ * friends. The changes are kept as lines of the memory layer, which is parsed
+ * after the files, so they apply at once and survive reloads of the files.
+ * A removal of an entry of the files is stored as a "-name" line.
+ */
+
+/* The name of a passwd or group line, a leading '-' is skipped */
+static bool nwrap_line_has_name(const char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	if (line[0] == '-') {
+		line++;
+	}
+
+	if (strncmp(line, name, len) != 0) {
+		return false;
+	}
+
+	return line[len] == ':' || line[len] == '\0';
+}
+
+/* The canonical name of a hosts line, the first one after the address */
+static bool nwrap_he_line_has_name(const char *line, const char *name)
+{
+	size_t len = strlen(name);
+
+	line += strspn(line, " \t");
+	line += strcspn(line, " \t");
+	line += strspn(line, " \t");
+
+	if (strncasecmp(line, name, len) != 0) {
+		return false;
+	}
+
+	return line[len] == '\0' || line[len] == '#' ||
+	       isspace((unsigned char)line[len]);
+}
+
+/* A string of an entry must not break the line format */
+static bool nwrap_field_valid(const char *str, const char *reject)
+{
+	return str != NULL && strpbrk(str, reject) == NULL;
+}
+
+static bool nwrap_name_valid(const char *name, const char *reject)
+{
+	return nwrap_field_valid(name, reject) &&
+	       name[0] != '\0' && name[0] != '-';
+}
+
+/* NSS_WRAPPER_WRITE_BACK is read every time, so a test can switch it */
+static bool nwrap_write_back_enabled(void)
+{
+	const char *env = getenv("NSS_WRAPPER_WRITE_BACK");
+
+	return env != NULL && env[0] != '\0' && strcmp(env, "0") != 0;
+}
+
+/*
+ * Copy the file of a layer without the lines matching name. The new line
+ * replaces the first of them or, with append, is added at the end. The file
+ * is only replaced if it changes, *pfound tells if a line matched. With keep
+ * the layer is not parsed again, the memory layer has the change already.
+ */
+static bool nwrap_file_rewrite(struct nwrap_layer *layer,
+			       const char *name,
+			       bool (*match)(const char *line,
+					     const char *name),
+			       const char *line,
+			       bool append,
+			       bool keep,
+			       bool *pfound)
+{
+	const char *base;
+	char *tmp = NULL;
+	char *buf = NULL;
+	size_t len = 0;
+	struct stat st;
+	bool found = false;
+	bool same;
+	bool ok = true;
+	FILE *in;
+	FILE *out;
+	ssize_t n;
+	int fd;
+	int ret;
+
+	in = fopen(layer->path, "re");
+	if (in == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to open '%s': %s",
+			  layer->path, strerror(errno));
+		return false;
+	}
+
+	ret = fstat(fileno(in), &st);
+	if (ret != 0) {
+		fclose(in);
+		return false;
+	}
+	/* Nobody else changed the file since we parsed it */
+	same = nwrap_stat_equal(&st, &layer->st);
+
+	/* A dotfile is skipped if the file is in a drop-in directory */
+	base = strrchr(layer->path, '/');
+	base = base != NULL ? base + 1 : layer->path;
+	ret = asprintf(&tmp, "%.*s.%s.XXXXXX",
+		       (int)(base - layer->path), layer->path, base);
+	if (ret == -1) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+		fclose(in);
+		return false;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd == -1) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to create '%s': %s",
+			  tmp, strerror(errno));
+		SAFE_FREE(tmp);
+		fclose(in);
+		return false;
+	}
+	out = fdopen(fd, "w");
+	if (out == NULL) {
+		close(fd);
+		unlink(tmp);
+		SAFE_FREE(tmp);
+		fclose(in);
+		return false;
+	}
+
+	while ((n = getline(&buf, &len, in)) >= 0) {
+		if (n > 0 && buf[n - 1] == '\n') {
+			buf[n - 1] = '\0';
+		}
+
+		if (match != NULL && buf[0] != '\0' && match(buf, name)) {
+			if (line != NULL && !found) {
+				fprintf(out, "%s\n", line);
+			}
+			found = true;
+			continue;
+		}
+
+		fprintf(out, "%s\n", buf);
+	}
+	SAFE_FREE(buf);
+	if (ferror(in)) {
+		ok = false;
+	}
+	fclose(in);
+
+	if (line != NULL && !found && append) {
+		fprintf(out, "%s\n", line);
+	}
+
+	ret = fchmod(fd, st.st_mode & 07777);
+	if (ret != 0) {
+		ok = false;
+	}
+	ret = fclose(out);
+	if (ret != 0) {
+		ok = false;
+	}
+
+	if (!ok || (!found && !append)) {
+		unlink(tmp);
+		SAFE_FREE(tmp);
+		*pfound = false;
+		return ok;
+	}
+
+	ret = rename(tmp, layer->path);
+	if (ret != 0) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Unable to replace '%s': %s",
+			  layer->path, strerror(errno));
+		unlink(tmp);
+		SAFE_FREE(tmp);
+		return false;
+	}
+	SAFE_FREE(tmp);
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG, "Wrote '%s' back", layer->path);
+
+	if (keep && same) {
+		/* Reopen the file, so the new one is taken as parsed */
+		nwrap_layer_close(layer);
+		layer->fp = fopen(layer->path, "re");
+		if (layer->fp != NULL) {
+			layer->fd = fileno(layer->fp);
+			ret = fstat(layer->fd, &layer->st);
+			if (ret != 0) {
+				memset(&layer->st, 0, sizeof(layer->st));
+			}
+		}
+	}
+
+	*pfound = found;
+
+	return true;
+}
+
+/*
+ * Write a change through to the files. The lines of the name are removed
+ * from all of them, the new line takes the place of the one in the last file
+ * which had it or is appended to the last file of the list. *pfound tells if
+ * any file had the name.
+ */
+static bool nwrap_write_back(struct nwrap_cache *nwrap,
+			     const char *name,
+			     bool (*match)(const char *line, const char *name),
+			     const char *line,
+			     bool keep,
+			     bool *pfound)
+{
+	struct nwrap_layer *last = NULL;
+	size_t i;
+	bool found;
+	bool ok;
+
+	*pfound = false;
+
+	for (i = nwrap->num_layers; i-- > 0;) {
+		struct nwrap_layer *layer = &nwrap->layers[i];
+
+		if (layer->path == NULL) {
+			continue;
+		}
+		if (last == NULL) {
+			last = layer;
+		}
+
+		ok = nwrap_file_rewrite(layer, name, match, line,
+					false, keep, &found);
+		if (!ok) {
+			return false;
+		}
+		if (found) {
+			*pfound = true;
+			line = NULL;
+		}
+	}
+
+	if (line == NULL) {
+		return true;
+	}
+	if (last == NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR, "No file to write back to");
+		return false;
+	}
+
+	return nwrap_file_rewrite(last, NULL, NULL, line, true, keep, &found);
+}
+
+/*
+ * Drop the lines of the memory layer matching name and add the new line, the
+ * memory layer takes ownership of it. New entries are parsed and appended
+ * directly, only dropping lines parses the memory layer again.
+ */
+static int nwrap_mem_update(struct nwrap_cache *nwrap,
+			    const char *name,
+			    bool (*match)(const char *line, const char *name),
+			    char *line)
+{
+	struct nwrap_vector *mem = &nwrap->mem_lines;
+	struct nwrap_layer *layer;
+	bool dropped = false;
+	int ret = 0;
+	size_t i;
+	size_t j;
+	bool ok;
+
+	ok = nwrap_files_cache_reload(nwrap);
+	if (!ok) {
+		SAFE_FREE(line);
+		return EIO;
+	}
+	layer = &nwrap->layers[nwrap->num_layers - 1];
+
+	/* The reloader thread has to parse the lines again */
+	nwrap->mem_generation++;
+
+	if (match != NULL) {
+		for (i = 0, j = 0; i < mem->count; i++) {
+			char *l = (char *)mem->items[i];
+
+			if (match(l, name)) {
+				SAFE_FREE(l);
+				dropped = true;
+				continue;
+			}
+			mem->items[j++] = l;
+		}
+		mem->count = j;
+		if (mem->items != NULL) {
+			mem->items[j] = NULL;
+		}
+	}
+
+	if (line != NULL) {
+		ok = nwrap_vector_add_item(mem, line);
+		if (!ok) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			SAFE_FREE(line);
+			ret = ENOMEM;
+		}
+	}
+
+	if (!dropped && line != NULL && ret == 0) {
+		/* The memory layer is the last one, its entries are at the end */
+		ok = nwrap_parse_mem_line(nwrap, line);
+		if (ok) {
+			return 0;
+		}
+		mem->items[--mem->count] = NULL;
+		SAFE_FREE(line);
+		ret = ENOMEM;
+		/* Get rid of what the parser added so far */
+		dropped = true;
+	}
+
+	if (dropped) {
+		layer->dirty = true;
+		ok = nwrap_files_cache_reload(nwrap);
+		if (!ok && ret == 0) {
+			ret = EIO;
+		}
+	}
+
+	return ret;
+}
+
+/* Add or replace the entry of a passwd or group line */
+static int nwrap_files_add(struct nwrap_cache *nwrap,
+			   const char *name,
+			   char *line)
+{
+	bool found;
+	bool ok;
+
+	if (nwrap_write_back_enabled()) {
+		ok = nwrap_files_cache_reload(nwrap);
+		if (ok) {
+			ok = nwrap_write_back(nwrap,
+					      name,
+					      nwrap_line_has_name,
+					      line,
+					      true,
+					      &found);
+		}
+		if (!ok) {
+			SAFE_FREE(line);
+			return EIO;
+		}
+	}
+
+	return nwrap_mem_update(nwrap, name, nwrap_line_has_name, line);
+}
+
+/*
+ * Remove a user or group, a "-name" line hides the entries of the files. The
+ * names computed from a range are checked first, so a failed call doesn't
+ * change anything.
+ */
+static int nwrap_files_del(struct nwrap_cache *nwrap,
+			   const char *name,
+			   bool (*exists)(const char *name),
+			   bool (*in_range)(const char *name))
+{
+	char *line = NULL;
+	bool found;
+	int ret;
+	bool ok;
+
+	ok = nwrap_files_cache_reload(nwrap);
+	if (!ok) {
+		return EIO;
+	}
+	if (!exists(name)) {
+		return ENOENT;
+	}
+	if (in_range(name)) {
+		return ENOTSUP;
+	}
+
+	if (nwrap_write_back_enabled()) {
+		ok = nwrap_write_back(nwrap,
+				      name,
+				      nwrap_line_has_name,
+				      NULL,
+				      true,
+				      &found);
+		if (!ok) {
+			return EIO;
+		}
+	}
+
+	ret = nwrap_mem_update(nwrap, name, nwrap_line_has_name, NULL);
+	if (ret != 0 || !exists(name)) {
+		return ret;
+	}
+
+	ret = asprintf(&line, "-%s", name);
+	if (ret == -1) {
+		return ENOMEM;
+	}
+
+	return nwrap_mem_update(nwrap, NULL, NULL, line);
+}
+
+static bool nwrap_pw_exists(const char *name)
+{
+	return nwrap_files_find_pwnam(name) != NULL;
+}
+
+static bool nwrap_pw_in_range(const char *name)
+{
+	return nwrap_files_find_pwnam_range(name) != NULL;
+}
+
+static bool nwrap_gr_exists(const char *name)
+{
+	return nwrap_files_find_grnam(name) != NULL;
+}
+
+static bool nwrap_gr_in_range(const char *name)
+{
+	return nwrap_files_find_grnam_range(name) != NULL;
+}
+
+int nss_wrapper_add_user(const struct passwd *pwd)
+{
+	char *line = NULL;
+	int ret;
+
+	if (pwd == NULL ||
+	    !nwrap_name_valid(pwd->pw_name, ":\n") ||
+	    !nwrap_field_valid(pwd->pw_passwd, ":\n") ||
+	    !nwrap_field_valid(pwd->pw_gecos, ":\n") ||
+	    !nwrap_field_valid(pwd->pw_dir, ":\n") ||
+	    !nwrap_field_valid(pwd->pw_shell, ":\n")) {
+		return EINVAL;
+	}
+
+	if (!nss_wrapper_enabled()) {
+		return ENOTSUP;
+	}
+
+	ret = asprintf(&line, "%s:%s:%u:%u:%s:%s:%s",
+		       pwd->pw_name, pwd->pw_passwd,
+		       (unsigned)pwd->pw_uid, (unsigned)pwd->pw_gid,
+		       pwd->pw_gecos, pwd->pw_dir, pwd->pw_shell);
+	if (ret == -1) {
+		return ENOMEM;
+	}
+
+	NWRAP_WRLOCK(nwrap_pw_global);
+	ret = nwrap_files_add(nwrap_pw_global.cache, pwd->pw_name, line);
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return ret;
+}
+
+int nss_wrapper_del_user(const char *name)
+{
+	int ret;
+
+	if (!nwrap_name_valid(name, ":\n")) {
+		return EINVAL;
+	}
+
+	if (!nss_wrapper_enabled()) {
+		return ENOTSUP;
+	}
+
+	NWRAP_WRLOCK(nwrap_pw_global);
+	ret = nwrap_files_del(nwrap_pw_global.cache, name,
+			      nwrap_pw_exists, nwrap_pw_in_range);
+	NWRAP_RWUNLOCK(nwrap_pw_global);
+
+	return ret;
+}
+
+int nss_wrapper_add_group(const struct group *grp)
+{
+	char *line = NULL;
+	size_t len;
+	size_t i;
+	char *p;
+	int ret;
+
+	if (grp == NULL ||
+	    !nwrap_name_valid(grp->gr_name, ":\n") ||
+	    !nwrap_field_valid(grp->gr_passwd, ":\n")) {
+		return EINVAL;
+	}
+
+	len = strlen(grp->gr_name) + strlen(grp->gr_passwd) + 16;
+	for (i = 0; grp->gr_mem != NULL && grp->gr_mem[i] != NULL; i++) {
+		if (!nwrap_name_valid(grp->gr_mem[i], ":,\n")) {
+			return EINVAL;
+		}
+		len += strlen(grp->gr_mem[i]) + 1;
+	}
+
+	if (!nss_wrapper_enabled()) {
+		return ENOTSUP;
+	}
+
+	line = (char *)malloc(len);
+	if (line == NULL) {
+		return ENOMEM;
+	}
+	p = line + snprintf(line, len, "%s:%s:%u:",
+			    grp->gr_name, grp->gr_passwd,
+			    (unsigned)grp->gr_gid);
+	for (i = 0; grp->gr_mem != NULL && grp->gr_mem[i] != NULL; i++) {
+		p += sprintf(p, "%s%s", i > 0 ? "," : "", grp->gr_mem[i]);
+	}
+
+	NWRAP_WRLOCK(nwrap_gr_global);
+	ret = nwrap_files_add(nwrap_gr_global.cache, grp->gr_name, line);
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return ret;
+}
+
+int nss_wrapper_del_group(const char *name)
+{
+	int ret;
+
+	if (!nwrap_name_valid(name, ":\n")) {
+		return EINVAL;
+	}
+
+	if (!nss_wrapper_enabled()) {
+		return ENOTSUP;
+	}
+
+	NWRAP_WRLOCK(nwrap_gr_global);
+	ret = nwrap_files_del(nwrap_gr_global.cache, name,
+			      nwrap_gr_exists, nwrap_gr_in_range);
+	NWRAP_RWUNLOCK(nwrap_gr_global);
+
+	return ret;
+}
+
+int nss_wrapper_add_host(const char *name, const char *addr)
+{
+	unsigned char buf[16];
+	char *line = NULL;
+	int ret;
+	bool found;
+	bool ok;
+
+	if (!nwrap_name_valid(name, " \t\n#") || addr == NULL) {
+		return EINVAL;
+	}
+	if (inet_pton(AF_INET, addr, buf) != 1 &&
+	    inet_pton(AF_INET6, addr, buf) != 1) {
+		return EINVAL;
+	}
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return ENOTSUP;
+	}
+
+	ret = asprintf(&line, "%s %s", addr, name);
+	if (ret == -1) {
+		return ENOMEM;
+	}
+
+	NWRAP_WRLOCK(nwrap_he_global);
+
+	if (nwrap_write_back_enabled()) {
+		struct nwrap_cache *nwrap = nwrap_he_global.cache;
+
+		ok = nwrap_files_cache_reload(nwrap);
+		if (ok) {
+			/*
+			 * Hosts lines of the same name add up. The hosts have
+			 * no memory layer entry to override, a copy of the
+			 * line would list the address twice. Without keep the
+			 * rewritten file is parsed again to pick it up at once.
+			 */
+			ok = nwrap_write_back(nwrap,
+					      NULL, NULL, line, false, &found);
+		}
+		SAFE_FREE(line);
+		if (ok) {
+			ok = nwrap_files_cache_reload(nwrap);
+		}
+		NWRAP_RWUNLOCK(nwrap_he_global);
+
+		return ok ? 0 : EIO;
+	}
+
+	ret = nwrap_mem_update(nwrap_he_global.cache, NULL, NULL, line);
+
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return ret;
+}
+
+/*
+ * The hosts of the files can't be hidden, only the ones added by
+ * nss_wrapper_add_host() are removed. With write back the lines of the name
+ * are removed from the files too and they are read again.
+ */
+int nss_wrapper_del_host(const char *name)
+{
+	bool written = false;
+	bool found = false;
+	const char *l;
+	size_t i;
+	int ret;
+	bool ok;
+
+	if (!nwrap_name_valid(name, " \t\n#")) {
+		return EINVAL;
+	}
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return ENOTSUP;
+	}
+
+	NWRAP_WRLOCK(nwrap_he_global);
+
+	nwrap_vector_foreach(l, nwrap_he_global.cache->mem_lines, i) {
+		if (nwrap_he_line_has_name(l, name)) {
+			found = true;
+			break;
+		}
+	}
+
+	if (nwrap_write_back_enabled()) {
+		ok = nwrap_files_cache_reload(nwrap_he_global.cache);
+		if (ok) {
+			ok = nwrap_write_back(nwrap_he_global.cache,
+					      name,
+					      nwrap_he_line_has_name,
+					      NULL,
+					      false,
+					      &written);
+		}
+		if (!ok) {
+			NWRAP_RWUNLOCK(nwrap_he_global);
+			return EIO;
+		}
+		found = found || written;
+	}
+
+	if (!found) {
+		NWRAP_RWUNLOCK(nwrap_he_global);
+		return ENOENT;
+	}
+
+	ret = nwrap_mem_update(nwrap_he_global.cache,
+			       name,
+			       nwrap_he_line_has_name,
+			       NULL);
+
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return ret;
+}
+
+/**********************************************************
+ * SHADOW
+ **********************************************************/
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+
+#ifdef HAVE_SETSPENT
+static void nwrap_setspent(void)
+{
+	nwrap_files_setspent();
+}
+
+void setspent(void)
+{
+	if (!nss_wrapper_shadow_enabled()) {
+		return;
+	}
+
+	nwrap_setspent();
+}
+
+static struct spwd *nwrap_getspent(void)
+{
+	struct spwd *sp;
+
+	NWRAP_WRLOCK(nwrap_sp_global);
+	sp = nwrap_files_getspent();
+	NWRAP_RWUNLOCK(nwrap_sp_global);
+
+	return sp;
+}
+
+struct spwd *getspent(void)
+{
+	if (!nss_wrapper_shadow_enabled()) {
+		return NULL;
+	}
+
+	return nwrap_getspent();
+}
+
+static void nwrap_endspent(void)
+{
+	nwrap_files_endspent();
+}
+
+#ifdef HAVE_GETSPENT_R
+static int nwrap_getspent_r(struct spwd *spdst,
+			    char *buf, size_t buflen,
+			    struct spwd **spdstp)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_sp_global);
+	rc = nwrap_files_getspent_r(spdst, buf, buflen, spdstp);
+	NWRAP_RWUNLOCK(nwrap_sp_global);
+
+	return rc;
+}
+
+int getspent_r(struct spwd *spdst,
+	       char *buf, size_t buflen,
+	       struct spwd **spdstp)
+{
+	if (!nss_wrapper_shadow_enabled()) {
+		return libc_getspent_r(spdst, buf, buflen, spdstp);
+	}
+
+	return nwrap_getspent_r(spdst, buf, buflen, spdstp);
+}
+#endif /* HAVE_GETSPENT_R */
+
+void endspent(void)
+{
+	if (!nss_wrapper_shadow_enabled()) {
+		return;
+	}
+
+	nwrap_endspent();
+}
+#endif /* HAVE_SETSPENT */
+
+static struct spwd *nwrap_getspnam(const char *name)
+{
+	struct spwd *sp;
+
+	NWRAP_WRLOCK(nwrap_sp_global);
+	sp = nwrap_files_getspnam(name);
+	NWRAP_RWUNLOCK(nwrap_sp_global);
+
+	return sp;
+}
+
+struct spwd *getspnam(const char *name)
+{
+	struct spwd *spwd;
+	uint64_t start;
+
+	if (!nss_wrapper_shadow_enabled()) {
+		return NULL;
+	}
+
+	start = nwrap_trace_begin();
+	spwd = nwrap_getspnam(name);
+	nwrap_trace_name(start, NWRAP_TRACE_GETSPNAM, name, 0,
+			 spwd != NULL ? 0 : ENOENT);
+
+	return spwd;
+}
+
+#ifdef HAVE_GETSPNAM_R
+/* The lock keeps a reload from freeing the entry while it gets copied */
+static int nwrap_getspnam_r(const char *name, struct spwd *spdst,
+			    char *buf, size_t buflen,
+			    struct spwd **spdstp)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_sp_global);
+	rc = nwrap_files_getspnam_r(name, spdst, buf, buflen, spdstp);
+	NWRAP_RWUNLOCK(nwrap_sp_global);
+
+	return rc;
+}
+
+int getspnam_r(const char *name, struct spwd *spdst,
+	       char *buf, size_t buflen,
+	       struct spwd **spdstp)
+{
+	uint64_t start;
+	int ret;
+
+	if (!nss_wrapper_shadow_enabled()) {
+		return libc_getspnam_r(name, spdst, buf, buflen, spdstp);
+	}
+
+	start = nwrap_trace_begin();
+	ret = nwrap_getspnam_r(name, spdst, buf, buflen, spdstp);
+	nwrap_trace_name(start, NWRAP_TRACE_GETSPNAM_R, name,
+			 (int32_t)buflen, ret);
+
+	return ret;
+}
+#endif /* HAVE_GETSPNAM_R */
+
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+
+/**********************************************************
+ * NETGROUP
+ **********************************************************/
+
+#ifdef HAVE_INNETGR
+
+static int nwrap_setnetgrent(const char *netgroup)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_ng_global);
+	rc = nwrap_files_setnetgrent(netgroup);
+	NWRAP_RWUNLOCK(nwrap_ng_global);
+
+	return rc;
+}
+
+#ifdef HAVE_BSD_SETNETGRENT
+void setnetgrent(const char *netgroup)
+{
+	if (!nss_wrapper_netgroup_enabled()) {
+		libc_setnetgrent(netgroup);
+		return;
+	}
+
+	nwrap_setnetgrent(netgroup);
+}
+#else
+int setnetgrent(const char *netgroup)
+{
+	if (!nss_wrapper_netgroup_enabled()) {
+		return libc_setnetgrent(netgroup);
+	}
+
+	return nwrap_setnetgrent(netgroup);
+}
+#endif /* HAVE_BSD_SETNETGRENT */
+
+static int nwrap_getnetgrent(char **host, char **user, char **domain)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_ng_global);
+	rc = nwrap_files_getnetgrent(host, user, domain);
+	NWRAP_RWUNLOCK(nwrap_ng_global);
+
+	return rc;
+}
+
+int getnetgrent(char **host, char **user, char **domain)
+{
+	if (!nss_wrapper_netgroup_enabled()) {
+		return libc_getnetgrent(host, user, domain);
+	}
+
+	return nwrap_getnetgrent(host, user, domain);
+}
+
+#ifdef HAVE_GETNETGRENT_R
+static int nwrap_getnetgrent_r(char **host, char **user, char **domain,
+			       char *buf, size_t buflen)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_ng_global);
+	rc = nwrap_files_getnetgrent_r(host, user, domain, buf, buflen);
+	NWRAP_RWUNLOCK(nwrap_ng_global);
+
+	return rc;
+}
+
+int getnetgrent_r(char **host, char **user, char **domain,
+		  char *buf, size_t buflen)
+{
+	if (!nss_wrapper_netgroup_enabled()) {
+		return libc_getnetgrent_r(host, user, domain, buf, buflen);
+	}
+
+	return nwrap_getnetgrent_r(host, user, domain, buf, buflen);
+}
+#endif /* HAVE_GETNETGRENT_R */
+
+static void nwrap_endnetgrent(void)
+{
+	NWRAP_WRLOCK(nwrap_ng_global);
+	nwrap_files_endnetgrent();
+	NWRAP_RWUNLOCK(nwrap_ng_global);
+}
+
+void endnetgrent(void)
+{
+	if (!nss_wrapper_netgroup_enabled()) {
+		libc_endnetgrent();
+		return;
+	}
+
+	nwrap_endnetgrent();
+}
+
+static int nwrap_innetgr(const char *netgroup,
+			 const char *host,
+			 const char *user,
+			 const char *domain)
+{
+	int rc;
+
+	NWRAP_WRLOCK(nwrap_ng_global);
+	rc = nwrap_files_innetgr(netgroup, host, user, domain);
+	NWRAP_RWUNLOCK(nwrap_ng_global);
+
+	return rc;
+}
+
+/* The key are the four strings, arg has a bit for every one which is set */
+static void nwrap_trace_innetgr(uint64_t start,
+				const char *netgroup,
+				const char *host,
+				const char *user,
+				const char *domain,
+				int rc)
+{
+	const char *fields[] = { host, user, domain };
+	char key[NWRAP_TRACE_KEY_MAX];
+	size_t len = 0;
+	int32_t arg = 0;
+	size_t i;
+
+	if (nwrap_trace.fd == -1) {
+		return;
+	}
+
+	len = snprintf(key, sizeof(key), "%s", netgroup);
+	for (i = 0; i < ARRAY_SIZE(fields) && len < sizeof(key); i++) {
+		len++;
+		if (fields[i] != NULL) {
+			arg |= 1 << i;
+			len += snprintf(key + len, sizeof(key) - len,
+					"%s", fields[i]);
+		}
+	}
+	if (len > sizeof(key)) {
+		len = sizeof(key);
+	}
+
+	nwrap_trace_end(start, NWRAP_TRACE_INNETGR, key, len, arg, rc);
+}
+
+int innetgr(const char *netgroup,
+	    const char *host,
+	    const char *user,
+	    const char *domain)
+{
+	uint64_t start;
+	int rc;
+
+	if (!nss_wrapper_netgroup_enabled()) {
+		return libc_innetgr(netgroup, host, user, domain);
+	}
+
+	start = nwrap_trace_begin();
+	rc = nwrap_innetgr(netgroup, host, user, domain);
+	nwrap_trace_innetgr(start, netgroup, host, user, domain, rc);
+
+	return rc;
+}
+
+#endif /* HAVE_INNETGR */
+
+/**********************************************************
+ * NETDB
+ **********************************************************/
+
+static void nwrap_sethostent(int stayopen) {
+	(void) stayopen; /* ignored */
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	nwrap_files_sethostent();
+	NWRAP_RWUNLOCK(nwrap_he_global);
+}
+
+#ifdef HAVE_SOLARIS_SETHOSTENT
+int sethostent(int stayopen)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		libc_sethostent(stayopen);
+		return 0;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_sethostent(stayopen);
+	nwrap_trace_end(start, NWRAP_TRACE_SETHOSTENT, NULL, 0, stayopen, 0);
+
+	return 0;
+}
+#else /* HAVE_SOLARIS_SETHOSTENT */
+void sethostent(int stayopen)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		libc_sethostent(stayopen);
+		return;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_sethostent(stayopen);
+	nwrap_trace_end(start, NWRAP_TRACE_SETHOSTENT, NULL, 0, stayopen, 0);
+}
+#endif /* HAVE_SOLARIS_SETHOSTENT */
+
+static struct hostent *nwrap_gethostent(void)
+{
+	struct hostent *he;
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	he = nwrap_files_gethostent();
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return he;
+}
+
+struct hostent *gethostent(void) {
+	struct hostent *he;
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gethostent();
+	}
+
+	start = nwrap_trace_begin();
+	he = nwrap_gethostent();
+	nwrap_trace_end(start, NWRAP_TRACE_GETHOSTENT, NULL, 0, 0,
+			he != NULL ? 0 : ENOENT);
+
+	return he;
+}
+
+static void nwrap_endhostent(void) {
+	NWRAP_WRLOCK(nwrap_he_global);
+	nwrap_files_endhostent();
+	NWRAP_RWUNLOCK(nwrap_he_global);
+}
+
+#ifdef HAVE_SOLARIS_ENDHOSTENT
+int endhostent(void)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		libc_endhostent();
+		return 0;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_endhostent();
+	nwrap_trace_end(start, NWRAP_TRACE_ENDHOSTENT, NULL, 0, 0, 0);
+
+	return 0;
+}
+#else /* HAVE_SOLARIS_ENDHOSTENT */
+void endhostent(void)
+{
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		libc_endhostent();
+		return;
+	}
+
+	start = nwrap_trace_begin();
+	nwrap_endhostent();
+	nwrap_trace_end(start, NWRAP_TRACE_ENDHOSTENT, NULL, 0, 0, 0);
+}
+#endif /* HAVE_SOLARIS_ENDHOSTENT */
+
+static struct hostent *nwrap_gethostbyname(const char *name)
+{
+	struct nwrap_he_buf *b = &nwrap_he_tls.byname;
+
+	if (nwrap_files_gethostbyname(name, AF_UNSPEC, b) == -1) {
+		return NULL;
+	}
+	return &b->he;
+}
+
+struct hostent *gethostbyname(const char *name)
+{
+	struct hostent *he;
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gethostbyname(name);
+	}
+
+	start = nwrap_trace_begin();
+	he = nwrap_gethostbyname(name);
+	nwrap_trace_name(start, NWRAP_TRACE_GETHOSTBYNAME, name, 0,
+			 he != NULL ? 0 : h_errno);
+
+	return he;
+}
+
+/* This is a GNU extension - Also can be found on BSD systems */
+#ifdef HAVE_GETHOSTBYNAME2
+static struct hostent *nwrap_gethostbyname2(const char *name, int af)
+{
+	struct nwrap_he_buf *b = &nwrap_he_tls.byname2;
+
+	if (nwrap_files_gethostbyname(name, af, b) == -1) {
+		return NULL;
+	}
+	return &b->he;
+}
+
+struct hostent *gethostbyname2(const char *name, int af)
+{
+	struct hostent *he;
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gethostbyname2(name, af);
+	}
+
+	start = nwrap_trace_begin();
+	he = nwrap_gethostbyname2(name, af);
+	nwrap_trace_name(start, NWRAP_TRACE_GETHOSTBYNAME2, name, af,
+			 he != NULL ? 0 : h_errno);
+
+	return he;
+}
+#endif
+
+static struct hostent *nwrap_gethostbyaddr(const void *addr,
+					   socklen_t len, int type)
+{
+	struct hostent *he;
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	he = nwrap_files_gethostbyaddr(addr, len, type);
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return he;
+}
+
+struct hostent *gethostbyaddr(const void *addr,
+			      socklen_t len, int type)
+{
+	struct hostent *he;
+	uint64_t start;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gethostbyaddr(addr, len, type);
+	}
+
+	start = nwrap_trace_begin();
+	he = nwrap_gethostbyaddr(addr, len, type);
+	nwrap_trace_end(start, NWRAP_TRACE_GETHOSTBYADDR, addr, len, type,
+			he != NULL ? 0 : h_errno);
+
+	return he;
+}
+
+static const struct addrinfo default_hints =
+{
+#ifndef OPENBSD
+	.ai_flags = AI_ADDRCONFIG|AI_V4MAPPED,
+#else
+	.ai_flags = AI_ADDRCONFIG,
+#endif /* OPENBSD */
+	.ai_family = AF_UNSPEC,
+	.ai_socktype = 0,
+	.ai_protocol = 0,
+	.ai_addrlen = 0,
+	.ai_addr = NULL,
+	.ai_canonname = NULL,
+	.ai_next = NULL
+};
+
+static int nwrap_convert_he_ai(const struct hostent *he,
+			       unsigned short port,
+			       const struct addrinfo *hints,
+			       struct addrinfo **pai,
+			       bool skip_canonname)
+{
+	struct addrinfo *ai;
+	socklen_t socklen;
+
+	if (he == NULL) {
+		return EAI_MEMORY;
+	}
+
+	switch (he->h_addrtype) {
+		case AF_INET:
+			socklen = sizeof(struct sockaddr_in);
+			break;
+#ifdef HAVE_IPV6
+		case AF_INET6:
+			socklen = sizeof(struct sockaddr_in6);
+			break;
+#endif
+		default:
+			return EAI_FAMILY;
+	}
+
+#ifndef OSX
+	ai = (struct addrinfo *)malloc(sizeof(struct addrinfo) + socklen);
+#else
+	ai = (struct addrinfo *)malloc(sizeof(struct addrinfo));
+#endif /* OSX */
+	if (ai == NULL) {
+		return EAI_MEMORY;
+	}
+
+#ifndef OSX
+	ai->ai_addr = (struct sockaddr *) ((uintptr_t)ai + (uintptr_t)sizeof(struct addrinfo));
+#else
+	ai->ai_addr = malloc(socklen);
+	if (ai->ai_addr == NULL) {
+		free(ai);
+		return EAI_MEMORY;
+	}
+#endif /* OSX */
+
+	ai->ai_flags = hints->ai_flags;
+	ai->ai_family = he->h_addrtype;
+	ai->ai_socktype = hints->ai_socktype;
+	ai->ai_protocol = hints->ai_protocol;
+	ai->ai_canonname = NULL;
+
+	if (ai->ai_socktype == 0) {
+		ai->ai_socktype = SOCK_DGRAM;
+	}
+	if (ai->ai_protocol == 0) {
+		if (ai->ai_socktype == SOCK_DGRAM) {
+			ai->ai_protocol = IPPROTO_UDP;
+		} else if (ai->ai_socktype == SOCK_STREAM) {
+			ai->ai_protocol = IPPROTO_TCP;
+		}
+	}
+
+	ai->ai_addrlen = socklen;
+
+#ifdef HAVE_STRUCT_SOCKADDR_SA_LEN
+	ai->ai_addr->sa_len = socklen;
+#endif
+	ai->ai_addr->sa_family = he->h_addrtype;
+
+	switch (he->h_addrtype) {
+		case AF_INET:
+		{
+			struct sockaddr_in *sinp =
+				(struct sockaddr_in *) ai->ai_addr;
+
+			memset(sinp, 0, sizeof(struct sockaddr_in));
+
+			sinp->sin_port = htons(port);
+			sinp->sin_family = AF_INET;
+
+			memset (sinp->sin_zero, '\0', sizeof (sinp->sin_zero));
+			memcpy(&sinp->sin_addr, he->h_addr_list[0], he->h_length);
+
+		}
+		break;
+#ifdef HAVE_IPV6
+		case AF_INET6:
+		{
+			struct sockaddr_in6 *sin6p =
+				(struct sockaddr_in6 *) ai->ai_addr;
+
+			memset(sin6p, 0, sizeof(struct sockaddr_in6));
+
+			sin6p->sin6_port = htons(port);
+			sin6p->sin6_family = AF_INET6;
+
+			memcpy(&sin6p->sin6_addr,
+			       he->h_addr_list[0],
+			       he->h_length);
+		}
+		break;
+#endif
+	}
+
+	ai->ai_next = NULL;
+
+	if (he->h_name && !skip_canonname) {
+		ai->ai_canonname = strdup(he->h_name);
+		if (ai->ai_canonname == NULL) {
+			freeaddrinfo(ai);
+			return EAI_MEMORY;
+		}
+	}
+
+	*pai = ai;
+	return 0;
+}
+
+/*
+ * Check if a name missing in the hosts file may be looked up by libc. In
+ * strict mode it may not, as the resolver could block for a long time on a
+ * machine without network. Otherwise the fallbacks are counted, see
+ * nss_wrapper_hosts_fallbacks(), and reported when the library gets unloaded.
+ */
+static bool nwrap_hosts_fallback(const char *fn, const char *name)
+{
+	if (nwrap_he_global.strict) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG,
+			  "%s: %s not found in hosts file (strict mode)",
+			  fn, name);
+		return false;
+	}
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	nwrap_he_global.fallbacks++;
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	NWRAP_LOG(NWRAP_LOG_WARN,
+		  "%s: %s not found in hosts file, asking libc",
+		  fn, name);
+
+	return true;
+}
+
+unsigned long nss_wrapper_hosts_fallbacks(void)
+{
+	unsigned long fallbacks;
+
+	nwrap_init();
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	fallbacks = nwrap_he_global.fallbacks;
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return fallbacks;
+}
+
+static time_t nwrap_monotonic_seconds(void)
+{
+	struct timespec ts;
+	int rc;
+
+	rc = clock_gettime(CLOCK_MONOTONIC, &ts);
+	if (rc != 0) {
+		return time(NULL);
+	}
+
+	return ts.tv_sec;
+}
+
+/*
+ * Deep copy of an addrinfo list which can be released with freeaddrinfo(),
+ * it is allocated the same way as nwrap_convert_he_ai() does.
+ */
+static struct addrinfo *nwrap_addrinfo_clone(const struct addrinfo *src)
+{
+	struct addrinfo *head = NULL;
+	struct addrinfo *tail = NULL;
+
+	for (; src != NULL; src = src->ai_next) {
+		struct addrinfo *ai;
+
+#ifndef OSX
+		ai = (struct addrinfo *)malloc(sizeof(struct addrinfo) +
+					       src->ai_addrlen);
+#else
+		ai = (struct addrinfo *)malloc(sizeof(struct addrinfo));
+#endif /* OSX */
+		if (ai == NULL) {
+			goto fail;
+		}
+
+		*ai = *src;
+		ai->ai_canonname = NULL;
+		ai->ai_next = NULL;
+
+		if (src->ai_addr != NULL) {
+#ifndef OSX
+			ai->ai_addr = (struct sockaddr *)
+				((uintptr_t)ai + (uintptr_t)sizeof(struct addrinfo));
+#else
+			ai->ai_addr = malloc(src->ai_addrlen);
+			if (ai->ai_addr == NULL) {
+				free(ai);
+				goto fail;
+			}
+#endif /* OSX */
+			memcpy(ai->ai_addr, src->ai_addr, src->ai_addrlen);
+		}
+
+		if (head == NULL) {
+			head = ai;
+		} else {
+			tail->ai_next = ai;
+		}
+		tail = ai;
+
+		if (src->ai_canonname != NULL) {
+			ai->ai_canonname = strdup(src->ai_canonname);
+			if (ai->ai_canonname == NULL) {
+				goto fail;
+			}
+		}
+	}
+
+	return head;
+
+fail:
+	if (head != NULL) {
+		freeaddrinfo(head);
+	}
+	return NULL;
+}
+
+static uint32_t nwrap_gai_cache_hash(const char *node,
+				     const char *service,
+				     const struct addrinfo *hints)
+{
+	uint32_t hash = nwrap_name_hash(node);
+
+	if (service != NULL) {
+		hash = hash * 31 + nwrap_name_hash(service);
+	}
+	hash = hash * 31 + (uint32_t)hints->ai_flags;
+	hash = hash * 31 + (uint32_t)hints->ai_family;
+	hash = hash * 31 + (uint32_t)hints->ai_socktype;
+	hash = hash * 31 + (uint32_t)hints->ai_protocol;
+
+	return hash;
+}
+
+static bool nwrap_gai_cache_match(const struct nwrap_gai_cache_entry *e,
+				  uint32_t hash,
+				  const char *node,
+				  const char *service,
+				  const struct addrinfo *hints)
+{
+	if (e->node == NULL || e->hash != hash) {
+		return false;
+	}
+
+	if (e->flags != hints->ai_flags ||
+	    e->family != hints->ai_family ||
+	    e->socktype != hints->ai_socktype ||
+	    e->protocol != hints->ai_protocol) {
+		return false;
+	}
+
+	if (strcmp(e->node, node) != 0) {
+		return false;
+	}
+
+	if (e->service == NULL || service == NULL) {
+		return e->service == service;
+	}
+
+	return strcmp(e->service, service) == 0;
+}
+
+static void nwrap_gai_cache_entry_free(struct nwrap_gai_cache_entry *e)
+{
+	SAFE_FREE(e->node);
+	SAFE_FREE(e->service);
+	if (e->ai != NULL) {
+		freeaddrinfo(e->ai);
+		e->ai = NULL;
+	}
+}
+
+/*
+ * Returns true if a cached result was found, *prc is set to the return code
+ * of libc and *pai to a copy of its result.
+ */
+static bool nwrap_gai_cache_lookup(const char *node,
+				   const char *service,
+				   const struct addrinfo *hints,
+				   int *prc,
+				   struct addrinfo **pai)
+{
+	struct nwrap_gai_cache_entry *e;
+	uint32_t hash;
+	bool found = false;
+
+	if (nwrap_gai_cache.ttl == 0) {
+		return false;
+	}
+
+	hash = nwrap_gai_cache_hash(node, service, hints);
+
+	NWRAP_WRLOCK(nwrap_he_global);
+
+	e = &nwrap_gai_cache.entries[hash % NWRAP_GAI_CACHE_SIZE];
+	if (!nwrap_gai_cache_match(e, hash, node, service, hints)) {
+		goto done;
+	}
+
+	if (e->expires <= nwrap_monotonic_seconds()) {
+		nwrap_gai_cache_entry_free(e);
+		goto done;
+	}
+
+	*pai = NULL;
+	if (e->rc == 0) {
+		*pai = nwrap_addrinfo_clone(e->ai);
+		if (*pai == NULL) {
+			goto done;
+		}
+	}
+	*prc = e->rc;
+	found = true;
+	nwrap_gai_cache.hits++;
+
+	NWRAP_LOG(NWRAP_LOG_DEBUG,
+		  "getaddrinfo: using cached result %d for %s",
+		  e->rc, node);
+
+done:
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return found;
+}
+
+static void nwrap_gai_cache_store(const char *node,
+				  const char *service,
+				  const struct addrinfo *hints,
+				  int rc,
+				  const struct addrinfo *ai)
+{
+	struct nwrap_gai_cache_entry *e;
+	uint32_t hash;
+
+	if (nwrap_gai_cache.ttl == 0) {
+		return;
+	}
+
+	/* EAI_AGAIN is a temporary failure, the next try has to ask again */
+	switch (rc) {
+	case 0:
+		if (!nwrap_gai_cache.positive) {
+			return;
+		}
+		break;
+	case EAI_NONAME:
+#if EAI_NODATA != EAI_NONAME
+	case EAI_NODATA:
+#endif
+		break;
+	default:
+		return;
+	}
+
+	hash = nwrap_gai_cache_hash(node, service, hints);
+
+	NWRAP_WRLOCK(nwrap_he_global);
+
+	/* The cache is direct mapped, a collision replaces the old entry */
+	e = &nwrap_gai_cache.entries[hash % NWRAP_GAI_CACHE_SIZE];
+	nwrap_gai_cache_entry_free(e);
+
+	e->node = strdup(node);
+	if (service != NULL) {
+		e->service = strdup(service);
+	}
+	if (rc == 0) {
+		e->ai = nwrap_addrinfo_clone(ai);
+	}
+	if (e->node == NULL ||
+	    (service != NULL && e->service == NULL) ||
+	    (rc == 0 && e->ai == NULL)) {
+		nwrap_gai_cache_entry_free(e);
+		goto done;
+	}
+
+	e->hash = hash;
+	e->flags = hints->ai_flags;
+	e->family = hints->ai_family;
+	e->socktype = hints->ai_socktype;
+	e->protocol = hints->ai_protocol;
+	e->rc = rc;
+	e->expires = nwrap_monotonic_seconds() + nwrap_gai_cache.ttl;
+
+done:
+	NWRAP_RWUNLOCK(nwrap_he_global);
+}
+
+unsigned long nss_wrapper_gai_cache_hits(void)
+{
+	unsigned long hits;
+
+	nwrap_init();
+
+	NWRAP_WRLOCK(nwrap_he_global);
+	hits = nwrap_gai_cache.hits;
+	NWRAP_RWUNLOCK(nwrap_he_global);
+
+	return hits;
+}
+
+/*
+ * Build the result for an address which is not in the hosts file directly,
+ * there is nothing libc could add to it.
+ */
+static int nwrap_numeric_getaddrinfo(int family,
+				     const void *addr,
+				     const char *canon_name,
+				     unsigned short port,
+				     const struct addrinfo *hints,
+				     struct addrinfo **pai)
+{
+	char *addr_list[2] = { (char *)addr, NULL };
+	struct hostent he = {
+		.h_name = (char *)canon_name,
+		.h_addrtype = family,
+		.h_length = family == AF_INET ? 4 : 16,
+		.h_addr_list = addr_list,
+	};
+
+	return nwrap_convert_he_ai(&he, port, hints, pai, false);
+}
+
+/*
+ * Without a node getaddrinfo() returns the wildcard address for AI_PASSIVE
+ * and the loopback address otherwise, IPv6 first like glibc.
+ */
+static int nwrap_null_node_getaddrinfo(unsigned short port,
+				       const struct addrinfo *hints,
+				       struct addrinfo **pai)
+{
+	bool passive = (hints->ai_flags & AI_PASSIVE) != 0;
+	struct addrinfo *ai_head = NULL;
+	struct addrinfo *ai_v4 = NULL;
+	struct in_addr v4;
+	int rc;
+
+	if (hints->ai_family != AF_UNSPEC &&
+	    hints->ai_family != AF_INET
+#ifdef HAVE_IPV6
+	    && hints->ai_family != AF_INET6
+#endif
+	    ) {
+		return EAI_FAMILY;
+	}
+
+#ifdef HAVE_IPV6
+	if (hints->ai_family != AF_INET) {
+		rc = nwrap_numeric_getaddrinfo(AF_INET6,
+					       passive ? &in6addr_any :
+							 &in6addr_loopback,
+					       NULL,
+					       port,
+					       hints,
+					       &ai_head);
+		if (rc != 0) {
+			return rc;
+		}
+	}
+#endif
+
+	if (hints->ai_family != AF_INET6) {
+		v4.s_addr = htonl(passive ? INADDR_ANY : INADDR_LOOPBACK);
+
+		rc = nwrap_numeric_getaddrinfo(AF_INET,
+					       &v4,
+					       NULL,
+					       port,
+					       hints,
+					       &ai_v4);
+		if (rc != 0) {
+			if (ai_head != NULL) {
+				freeaddrinfo(ai_head);
+			}
+			return rc;
+		}
+
+		if (ai_head == NULL) {
+			ai_head = ai_v4;
+		} else {
+			ai_head->ai_next = ai_v4;
+		}
+	}
+
+	*pai = ai_head;
+
+	return 0;
+}
+
+/*
+ * With may_block set to false, EAI_INPROGRESS is returned instead of asking
+ * libc for names missing in the hosts file.
+ */
+static int nwrap_getaddrinfo(const char *node,
+			     const char *service,
+			     const struct addrinfo *hints,
+			     struct addrinfo **res,
+			     bool may_block)
+{
+	struct addrinfo *ai = NULL;
+	unsigned short port = 0;
+	struct {
+		int family;
+		union {
+			struct in_addr v4;
+#ifdef HAVE_IPV6
+			struct in6_addr v6;
+		} in;
+#endif
+	} addr = {
+		.family = AF_UNSPEC,
+	};
+	bool ok;
+	int rc;
+
+	if (node == NULL && service == NULL) {
+		return EAI_NONAME;
+	}
+
+	if (hints == NULL) {
+		hints = &default_hints;
+	}
+
+        /* EAI_BADFLAGS
+              hints.ai_flags   contains   invalid  flags;  or,  hints.ai_flags
+              included AI_CANONNAME and name was NULL.
+	*/
+	if ((hints->ai_flags & AI_CANONNAME) && (node == NULL)) {
+		return EAI_BADFLAGS;
+	}
+
+	if (service != NULL && service[0] != '\0') {
+		const char *proto = NULL;
+		struct servent *s;
+		char *end_ptr;
+		long sl;
+
+		errno = 0;
+		sl = strtol(service, &end_ptr, 10);
+
+		if (*end_ptr == '\0') {
+			port = sl;
+			goto valid_port;
+		} else if (hints->ai_flags & AI_NUMERICSERV) {
+			return EAI_NONAME;
+		}
+
+		if (hints->ai_protocol != 0) {
+			struct protoent *pent;
+
+			pent = getprotobynumber(hints->ai_protocol);
+			if (pent != NULL) {
+				proto = pent->p_name;
+			}
+		}
+
+		s = getservbyname(service, proto);
+		if (s == NULL) {
+			return EAI_NONAME;
+		}
+		port = ntohs(s->s_port);
+	}
+
+valid_port:
+
+	if (node == NULL) {
+		rc = nwrap_null_node_getaddrinfo(port, hints, &ai);
+		if (rc != 0) {
+			return rc;
+		}
+		goto add_socktypes;
+	}
+
+	rc = inet_pton(AF_INET, node, &addr.in.v4);
+	if (rc == 1) {
+		addr.family = AF_INET;
+	}
+#ifdef HAVE_IPV6
+	if (addr.family == AF_UNSPEC) {
+		rc = inet_pton(AF_INET6, node, &addr.in.v6);
+		if (rc == 1) {
+			addr.family = AF_INET6;
+		}
+	}
+#endif
+
+	if (addr.family == AF_UNSPEC) {
+	       if (hints->ai_flags & AI_NUMERICHOST) {
+			return EAI_NONAME;
+		}
+	} else if ((hints->ai_family != AF_UNSPEC) &&
+		   (hints->ai_family != addr.family))
+	{
+		return EAI_ADDRFAMILY;
+	}
+
+	ok = nwrap_files_cache_rdlock(nwrap_he_global.cache,
+				      &nwrap_he_global_rwlock);
+	if (ok) {
+		rc = nwrap_files_getaddrinfo(node, port, hints, &ai);
+	} else {
+		rc = EAI_SYSTEM;
+	}
+	NWRAP_RWUNLOCK(nwrap_he_global);
+	if (rc != 0 && addr.family != AF_UNSPEC) {
+		const char *canon_name = NULL;
+
+		/* Only a missing entry is answered from the numeric address */
+		if (rc != EAI_NONAME) {
+			return rc;
+		}
+
+		if (hints->ai_flags & AI_CANONNAME) {
+			canon_name = node;
+		}
+
+		rc = nwrap_numeric_getaddrinfo(addr.family,
+					       &addr.in,
+					       canon_name,
+					       port,
+					       hints,
+					       &ai);
+		if (rc != 0) {
+			return rc;
+		}
+	} else if (rc != 0) {
+		int ret;
+		struct addrinfo *p = NULL;
+
+		if (nwrap_gai_cache_lookup(node, service, hints, &ret, &p)) {
+			if (ret == 0) {
+				*res = p;
+				return 0;
+			}
+			return rc;
+		}
+
+#ifdef HAVE_GETADDRINFO_A
+		if (!may_block && !nwrap_he_global.strict) {
+			return EAI_INPROGRESS;
+		}
+#else
+		(void) may_block; /* unused */
+#endif
+
+		if (!nwrap_hosts_fallback("getaddrinfo", node)) {
+			return rc;
+		}
+
+		ret = libc_getaddrinfo(node, service, hints, &p);
+		nwrap_gai_cache_store(node, service, hints, ret, p);
+
+		if (ret == 0) {
+			/*
+			 * nwrap_files_getaddrinfo failed, but libc was
+			 * successful -- use the result from libc.
+			 */
+			*res = p;
+			return 0;
+		}
+
+		return rc;
+	}
+
+add_socktypes:
+	/*
+	 * If the socktype was not specified, duplicate
+	 * each ai returned, so that we have variants for
+	 * both UDP and TCP.
+	 */
+	if (hints->ai_socktype == 0) {
+		struct addrinfo *ai_cur;
+
+		/* freeaddrinfo() frees ai_canonname and ai so allocate them */
+		for (ai_cur = ai; ai_cur != NULL; ai_cur = ai_cur->ai_next) {
+			struct addrinfo *ai_new;
+
+			/* duplicate the current entry */
+
+			ai_new = malloc(sizeof(struct addrinfo));
+			if (ai_new == NULL) {
+				freeaddrinfo(ai);
+				return EAI_MEMORY;
+			}
+
+			memcpy(ai_new, ai_cur, sizeof(struct addrinfo));
+			ai_new->ai_next = NULL;
+
+			/* We need a deep copy or freeaddrinfo() will blow up */
+#ifdef OSX
+			ai_new->ai_addr = malloc(ai->ai_addrlen);
+			if (ai_new->ai_addr == NULL) {
+				freeaddrinfo(ai);
+				return EAI_MEMORY;
+			}
+
+			memcpy(ai_new->ai_addr, ai->ai_addr, ai->ai_addrlen);
+#endif /* OSX */
+			if (ai_cur->ai_canonname != NULL) {
+				ai_new->ai_canonname =
+					strdup(ai_cur->ai_canonname);
+			}
+
+			if (ai_cur->ai_socktype == SOCK_DGRAM) {
+				ai_new->ai_socktype = SOCK_STREAM;
+			} else if (ai_cur->ai_socktype == SOCK_STREAM) {
+				ai_new->ai_socktype = SOCK_DGRAM;
+			}
+			if (ai_cur->ai_protocol == IPPROTO_TCP) {
+				ai_new->ai_protocol = IPPROTO_UDP;
+			} else if (ai_cur->ai_protocol == IPPROTO_UDP) {
+				ai_new->ai_protocol = IPPROTO_TCP;
+			}
 
-/**********************************************************
- * NETDB
- **********************************************************/
+			/* now insert the new entry */
 
-static void nwrap_sethostent(int stayopen) {
-	(void) stayopen; /* ignored */
+			ai_new->ai_next = ai_cur->ai_next;
+			ai_cur->ai_next = ai_new;
 
-	nwrap_files_sethostent();
-}
+			/* and move on (don't duplicate the new entry) */
 
-#ifdef HAVE_SOLARIS_SETHOSTENT
-int sethostent(int stayopen)
-{
-	if (!nss_wrapper_hosts_enabled()) {
-		libc_sethostent(stayopen);
-		return 0;
+			ai_cur = ai_new;
+		}
 	}
 
-	nwrap_sethostent(stayopen);
+	*res = ai;
 
 	return 0;
 }
-#else /* HAVE_SOLARIS_SETHOSTENT */
-void sethostent(int stayopen)
+
+int getaddrinfo(const char *node, const char *service,
+		const struct addrinfo *hints,
+		struct addrinfo **res)
 {
+	uint64_t start;
+	int rc;
+
 	if (!nss_wrapper_hosts_enabled()) {
-		libc_sethostent(stayopen);
-		return;
+		return libc_getaddrinfo(node, service, hints, res);
 	}
 
-	nwrap_sethostent(stayopen);
-}
-#endif /* HAVE_SOLARIS_SETHOSTENT */
+	start = nwrap_trace_begin();
+	rc = nwrap_getaddrinfo(node, service, hints, res, true);
+	nwrap_trace_name(start, NWRAP_TRACE_GETADDRINFO, node,
+			 hints != NULL ? hints->ai_family : AF_UNSPEC, rc);
 
-static struct hostent *nwrap_gethostent(void)
-{
-	return nwrap_files_gethostent();
+	return rc;
 }
 
-struct hostent *gethostent(void) {
-	if (!nss_wrapper_hosts_enabled()) {
-		return libc_gethostent();
-	}
+/****************************************************************************
+ *   GETADDRINFO_A
+ ***************************************************************************/
 
-	return nwrap_gethostent();
-}
+#ifdef HAVE_GETADDRINFO_A
 
-static void nwrap_endhostent(void) {
-	nwrap_files_endhostent();
-}
+/*
+ * Requests the hosts file can answer are completed by getaddrinfo_a() itself,
+ * only the ones passed on to libc are queued for the workers. Like glibc the
+ * status of a request is kept in the gaicb, so gai_error() works for any
+ * completed request. A request in progress has a job, which is found by the
+ * address of the gaicb and freed once the request is completed.
+ */
+#define NWRAP_GAI_A_MAX_WORKERS 4
+#define NWRAP_GAI_A_BUCKETS 256
 
-#ifdef HAVE_SOLARIS_ENDHOSTENT
-int endhostent(void)
+/* The requests of one getaddrinfo_a() call */
+struct nwrap_gai_a_batch {
+	struct sigevent sev;
+	int pending;
+};
+
+struct nwrap_gai_a_job {
+	struct gaicb *req;
+	struct nwrap_gai_a_batch *batch;
+	/* The next job of the queue */
+	struct nwrap_gai_a_job *next;
+	/* The next job of the same bucket */
+	struct nwrap_gai_a_job *hnext;
+};
+
+/* Protected by nwrap_gai_a_global_mutex */
+struct nwrap_gai_a {
+	struct nwrap_gai_a_job *head;
+	struct nwrap_gai_a_job *tail;
+
+	/* The requests in progress */
+	struct nwrap_gai_a_job *jobs[NWRAP_GAI_A_BUCKETS];
+
+	int num_workers;
+	int idle_workers;
+
+	/* Signalled when a job is queued */
+	pthread_cond_t work_cond;
+	/* Broadcasted when a request is completed */
+	pthread_cond_t done_cond;
+};
+
+static struct nwrap_gai_a nwrap_gai_a = {
+	.work_cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct nwrap_gai_a_notify_thread {
+	void (*fn)(union sigval);
+	union sigval value;
+};
+
+static void *nwrap_gai_a_notify_fn(void *arg)
 {
-	if (!nss_wrapper_hosts_enabled()) {
-		libc_endhostent();
-		return 0;
-	}
+	struct nwrap_gai_a_notify_thread nt =
+		*(struct nwrap_gai_a_notify_thread *)arg;
 
-	nwrap_endhostent();
+	free(arg);
+	nt.fn(nt.value);
 
-	return 0;
+	return NULL;
 }
-#else /* HAVE_SOLARIS_ENDHOSTENT */
-void endhostent(void)
+
+static void nwrap_gai_a_notify(const struct sigevent *sev)
 {
-	if (!nss_wrapper_hosts_enabled()) {
-		libc_endhostent();
-		return;
+	struct nwrap_gai_a_notify_thread *nt;
+	pthread_attr_t attr;
+	pthread_t thread;
+	int rc;
+
+	switch (sev->sigev_notify) {
+	case SIGEV_SIGNAL:
+		rc = sigqueue(getpid(), sev->sigev_signo, sev->sigev_value);
+		if (rc != 0) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Failed to queue signal %d: %s",
+				  sev->sigev_signo, strerror(errno));
+		}
+		break;
+	case SIGEV_THREAD:
+		nt = (struct nwrap_gai_a_notify_thread *)
+			malloc(sizeof(struct nwrap_gai_a_notify_thread));
+		if (nt == NULL) {
+			NWRAP_LOG(NWRAP_LOG_ERROR, "Out of memory");
+			break;
+		}
+		nt->fn = sev->sigev_notify_function;
+		nt->value = sev->sigev_value;
+
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		rc = pthread_create(&thread, &attr, nwrap_gai_a_notify_fn, nt);
+		pthread_attr_destroy(&attr);
+		if (rc != 0) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Failed to create notification thread: %s",
+				  strerror(rc));
+			free(nt);
+		}
+		break;
+	default:
+		break;
 	}
+}
 
-	nwrap_endhostent();
+static size_t nwrap_gai_a_bucket(const struct gaicb *req)
+{
+	return ((uintptr_t)req / sizeof(void *)) % NWRAP_GAI_A_BUCKETS;
 }
-#endif /* HAVE_SOLARIS_ENDHOSTENT */
 
-#if defined(BSD) && !(defined OPENBSD)
-/* BSD (not OpenBSD) implementation stores data in thread local storage
- * but GLIBC does not */
-static __thread struct hostent user_he;
-static __thread struct nwrap_vector user_addrlist;
-#else
-static struct hostent user_he;
-static struct nwrap_vector user_addrlist;
-#endif /* BSD */
-static struct hostent *nwrap_gethostbyname(const char *name)
+/* The caller has to hold the lock */
+static struct nwrap_gai_a_job *nwrap_gai_a_find(const struct gaicb *req)
 {
-	if (nwrap_files_gethostbyname(name, AF_UNSPEC, &user_he, &user_addrlist) == -1) {
-		return NULL;
+	struct nwrap_gai_a_job *job;
+
+	for (job = nwrap_gai_a.jobs[nwrap_gai_a_bucket(req)];
+	     job != NULL;
+	     job = job->hnext) {
+		if (job->req == req) {
+			return job;
+		}
 	}
-	return &user_he;
+
+	return NULL;
 }
 
-struct hostent *gethostbyname(const char *name)
+/* The caller has to hold the lock */
+static int nwrap_gai_a_status(const struct gaicb *req)
 {
-	if (!nss_wrapper_hosts_enabled()) {
-		return libc_gethostbyname(name);
+	if (nwrap_gai_a_find(req) != NULL) {
+		return EAI_INPROGRESS;
 	}
 
-	return nwrap_gethostbyname(name);
+	return req->__return;
 }
 
-/* This is a GNU extension - Also can be found on BSD systems */
-#ifdef HAVE_GETHOSTBYNAME2
-#if defined(BSD) && !defined(OPENBSD)
-/* BSD (not OpenBSD) implementation stores data in  thread local storage
- * but GLIBC not */
-static __thread struct hostent user_he2;
-static __thread struct nwrap_vector user_addrlist2;
-#else
-static struct hostent user_he2;
-static struct nwrap_vector user_addrlist2;
-#endif /* BSD */
-static struct hostent *nwrap_gethostbyname2(const char *name, int af)
+/*
+ * Returns a new job for the request and marks the gaicb in progress. A
+ * request which is still in progress can't be submitted again, NULL is
+ * returned for it and its gaicb isn't touched. The caller has to hold the
+ * lock.
+ */
+static struct nwrap_gai_a_job *nwrap_gai_a_job_get(struct gaicb *req,
+						   int *prc)
 {
-	if (nwrap_files_gethostbyname(name, af, &user_he2, &user_addrlist2) == -1) {
+	struct nwrap_gai_a_job *job;
+	size_t b;
+
+	if (nwrap_gai_a_find(req) != NULL) {
+		NWRAP_LOG(NWRAP_LOG_ERROR,
+			  "Request for %s is still in progress",
+			  req->ar_name);
+		*prc = EAI_SYSTEM;
+		errno = EBUSY;
 		return NULL;
 	}
-	return &user_he2;
-}
 
-struct hostent *gethostbyname2(const char *name, int af)
-{
-	if (!nss_wrapper_hosts_enabled()) {
-		return libc_gethostbyname2(name, af);
+	job = (struct nwrap_gai_a_job *)calloc(1, sizeof(struct nwrap_gai_a_job));
+	if (job == NULL) {
+		*prc = EAI_MEMORY;
+		return NULL;
 	}
+	job->req = req;
 
-	return nwrap_gethostbyname2(name, af);
-}
-#endif
+	b = nwrap_gai_a_bucket(req);
+	job->hnext = nwrap_gai_a.jobs[b];
+	nwrap_gai_a.jobs[b] = job;
 
-static struct hostent *nwrap_gethostbyaddr(const void *addr,
-					   socklen_t len, int type)
-{
-	return nwrap_files_gethostbyaddr(addr, len, type);
+	req->ar_result = NULL;
+	req->__return = EAI_INPROGRESS;
+
+	return job;
 }
 
-struct hostent *gethostbyaddr(const void *addr,
-			      socklen_t len, int type)
+/* The caller has to hold the lock */
+static void nwrap_gai_a_job_free(struct nwrap_gai_a_job *job)
 {
-	if (!nss_wrapper_hosts_enabled()) {
-		return libc_gethostbyaddr(addr, len, type);
+	struct nwrap_gai_a_job **pjob;
+
+	pjob = &nwrap_gai_a.jobs[nwrap_gai_a_bucket(job->req)];
+	while (*pjob != job) {
+		pjob = &(*pjob)->hnext;
 	}
+	*pjob = job->hnext;
 
-	return nwrap_gethostbyaddr(addr, len, type);
+	free(job);
 }
 
-static const struct addrinfo default_hints =
-{
-#ifndef OPENBSD
-	.ai_flags = AI_ADDRCONFIG|AI_V4MAPPED,
-#else
-	.ai_flags = AI_ADDRCONFIG,
-#endif /* OPENBSD */
-	.ai_family = AF_UNSPEC,
-	.ai_socktype = 0,
-	.ai_protocol = 0,
-	.ai_addrlen = 0,
-	.ai_addr = NULL,
-	.ai_canonname = NULL,
-	.ai_next = NULL
-};
-
-static int nwrap_convert_he_ai(const struct hostent *he,
-			       unsigned short port,
-			       const struct addrinfo *hints,
-			       struct addrinfo **pai,
-			       bool skip_canonname)
+/* The caller has to hold the lock */
+static void nwrap_gai_a_complete(struct nwrap_gai_a_job *job, int rc)
 {
-	struct addrinfo *ai;
-	socklen_t socklen;
+	struct nwrap_gai_a_batch *batch = job->batch;
 
-	if (he == NULL) {
-		return EAI_MEMORY;
-	}
+	job->req->__return = rc;
+	nwrap_gai_a_job_free(job);
+	pthread_cond_broadcast(&nwrap_gai_a.done_cond);
 
-	switch (he->h_addrtype) {
-		case AF_INET:
-			socklen = sizeof(struct sockaddr_in);
-			break;
-#ifdef HAVE_IPV6
-		case AF_INET6:
-			socklen = sizeof(struct sockaddr_in6);
-			break;
-#endif
-		default:
-			return EAI_FAMILY;
+	if (batch != NULL && --batch->pending == 0) {
+		nwrap_gai_a_notify(&batch->sev);
+		free(batch);
 	}
+}
 
-#ifndef OSX
-	ai = (struct addrinfo *)malloc(sizeof(struct addrinfo) + socklen);
-#else
-	ai = (struct addrinfo *)malloc(sizeof(struct addrinfo));
-#endif /* OSX */
-	if (ai == NULL) {
-		return EAI_MEMORY;
-	}
+static void *nwrap_gai_a_worker(void *arg)
+{
+	(void) arg; /* unused */
 
-#ifndef OSX
-	ai->ai_addr = (struct sockaddr *) ((uintptr_t)ai + (uintptr_t)sizeof(struct addrinfo));
-#else
-	ai->ai_addr = malloc(socklen);
-	if (ai->ai_addr == NULL) {
-		free(ai);
-		return EAI_MEMORY;
-	}
-#endif /* OSX */
+	NWRAP_LOCK(nwrap_gai_a_global);
+	for (;;) {
+		struct nwrap_gai_a_job *job;
+		struct addrinfo *res = NULL;
+		int rc;
 
-	ai->ai_flags = hints->ai_flags;
-	ai->ai_family = he->h_addrtype;
-	ai->ai_socktype = hints->ai_socktype;
-	ai->ai_protocol = hints->ai_protocol;
-	ai->ai_canonname = NULL;
+		while (nwrap_gai_a.head == NULL) {
+			nwrap_gai_a.idle_workers++;
+			pthread_cond_wait(&nwrap_gai_a.work_cond,
+					  &nwrap_gai_a_global_mutex);
+			nwrap_gai_a.idle_workers--;
+		}
 
-	if (ai->ai_socktype == 0) {
-		ai->ai_socktype = SOCK_DGRAM;
-	}
-	if (ai->ai_protocol == 0) {
-		if (ai->ai_socktype == SOCK_DGRAM) {
-			ai->ai_protocol = IPPROTO_UDP;
-		} else if (ai->ai_socktype == SOCK_STREAM) {
-			ai->ai_protocol = IPPROTO_TCP;
+		/* A dequeued job is running and can't be cancelled */
+		job = nwrap_gai_a.head;
+		nwrap_gai_a.head = job->next;
+		if (nwrap_gai_a.head == NULL) {
+			nwrap_gai_a.tail = NULL;
 		}
-	}
+		NWRAP_UNLOCK(nwrap_gai_a_global);
 
-	ai->ai_addrlen = socklen;
+		rc = nwrap_getaddrinfo(job->req->ar_name,
+				       job->req->ar_service,
+				       job->req->ar_request,
+				       &res,
+				       true);
 
-#ifdef HAVE_STRUCT_SOCKADDR_SA_LEN
-	ai->ai_addr->sa_len = socklen;
-#endif
-	ai->ai_addr->sa_family = he->h_addrtype;
+		NWRAP_LOCK(nwrap_gai_a_global);
+		job->req->ar_result = res;
+		nwrap_gai_a_complete(job, rc);
+	}
 
-	switch (he->h_addrtype) {
-		case AF_INET:
-		{
-			struct sockaddr_in *sinp =
-				(struct sockaddr_in *) ai->ai_addr;
+	return NULL;
+}
 
-			memset(sinp, 0, sizeof(struct sockaddr_in));
+/* The caller has to hold the lock */
+static bool nwrap_gai_a_spawn_workers(void)
+{
+	int wanted = 0;
+	struct nwrap_gai_a_job *job;
 
-			sinp->sin_port = htons(port);
-			sinp->sin_family = AF_INET;
+	for (job = nwrap_gai_a.head; job != NULL; job = job->next) {
+		wanted++;
+	}
+	wanted -= nwrap_gai_a.idle_workers;
 
-			memset (sinp->sin_zero, '\0', sizeof (sinp->sin_zero));
-			memcpy(&sinp->sin_addr, he->h_addr_list[0], he->h_length);
+	while (wanted > 0 &&
+	       nwrap_gai_a.num_workers < NWRAP_GAI_A_MAX_WORKERS) {
+		pthread_attr_t attr;
+		pthread_t thread;
+		int rc;
 
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		rc = pthread_create(&thread, &attr, nwrap_gai_a_worker, NULL);
+		pthread_attr_destroy(&attr);
+		if (rc != 0) {
+			NWRAP_LOG(NWRAP_LOG_ERROR,
+				  "Failed to create worker thread: %s",
+				  strerror(rc));
+			break;
 		}
-		break;
-#ifdef HAVE_IPV6
-		case AF_INET6:
-		{
-			struct sockaddr_in6 *sin6p =
-				(struct sockaddr_in6 *) ai->ai_addr;
+		nwrap_gai_a.num_workers++;
+		wanted--;
+	}
 
-			memset(sin6p, 0, sizeof(struct sockaddr_in6));
+	pthread_cond_broadcast(&nwrap_gai_a.work_cond);
 
-			sin6p->sin6_port = htons(port);
-			sin6p->sin6_family = AF_INET6;
+	return nwrap_gai_a.num_workers > 0;
+}
 
-			memcpy(&sin6p->sin6_addr,
-			       he->h_addr_list[0],
-			       he->h_length);
-		}
-		break;
-#endif
-	}
+/*
+ * The workers don't exist in the child. The requests of the parent which
+ * were queued or running fail with EAI_SYSTEM, without a notification.
+ */
+static void nwrap_gai_a_thread_child(void)
+{
+	size_t b;
 
-	ai->ai_next = NULL;
+	for (b = 0; b < NWRAP_GAI_A_BUCKETS; b++) {
+		struct nwrap_gai_a_job *job = nwrap_gai_a.jobs[b];
 
-	if (he->h_name && !skip_canonname) {
-		ai->ai_canonname = strdup(he->h_name);
-		if (ai->ai_canonname == NULL) {
-			freeaddrinfo(ai);
-			return EAI_MEMORY;
+		while (job != NULL) {
+			struct nwrap_gai_a_job *next = job->hnext;
+			struct nwrap_gai_a_batch *batch = job->batch;
+
+			job->req->__return = EAI_SYSTEM;
+			if (batch != NULL && --batch->pending == 0) {
+				free(batch);
+			}
+			free(job);
+
+			job = next;
 		}
+		nwrap_gai_a.jobs[b] = NULL;
 	}
 
-	*pai = ai;
-	return 0;
+	nwrap_gai_a.head = NULL;
+	nwrap_gai_a.tail = NULL;
+	nwrap_gai_a.num_workers = 0;
+	nwrap_gai_a.idle_workers = 0;
 }
 
-static int nwrap_getaddrinfo(const char *node,
-			     const char *service,
-			     const struct addrinfo *hints,
-			     struct addrinfo **res)
+static int nwrap_getaddrinfo_a(int mode,
+			       struct gaicb *list[],
+			       int nitems,
+			       struct sigevent *sevp)
 {
-	struct addrinfo *ai = NULL;
-	unsigned short port = 0;
-	struct {
-		int family;
-		union {
-			struct in_addr v4;
-#ifdef HAVE_IPV6
-			struct in6_addr v6;
-		} in;
-#endif
-	} addr = {
-		.family = AF_UNSPEC,
-	};
-	int rc;
+	struct nwrap_gai_a_batch *batch = NULL;
+	struct nwrap_gai_a_job **jobs = NULL;
+	int *status = NULL;
+	int rc = 0;
+	int i;
 
-	if (node == NULL && service == NULL) {
-		return EAI_NONAME;
+	if ((mode != GAI_WAIT && mode != GAI_NOWAIT) || nitems < 0) {
+		errno = EINVAL;
+		return EAI_SYSTEM;
 	}
 
-	if (hints == NULL) {
-		hints = &default_hints;
-	}
+	/* Waiting callers can just resolve the names one after the other */
+	if (mode == GAI_WAIT) {
+		for (i = 0; i < nitems; i++) {
+			struct nwrap_gai_a_job *job;
+			struct addrinfo *res = NULL;
+			int ret;
 
-        /* EAI_BADFLAGS
-              hints.ai_flags   contains   invalid  flags;  or,  hints.ai_flags
-              included AI_CANONNAME and name was NULL.
-	*/
-	if ((hints->ai_flags & AI_CANONNAME) && (node == NULL)) {
-		return EAI_BADFLAGS;
-	}
+			if (list[i] == NULL) {
+				continue;
+			}
 
-	/* If no node has been specified, let glibc deal with it */
-	if (node == NULL) {
-		int ret;
-		struct addrinfo *p = NULL;
+			NWRAP_LOCK(nwrap_gai_a_global);
+			job = nwrap_gai_a_job_get(list[i], &rc);
+			NWRAP_UNLOCK(nwrap_gai_a_global);
+			if (job == NULL) {
+				continue;
+			}
 
-		ret = libc_getaddrinfo(node, service, hints, &p);
+			ret = nwrap_getaddrinfo(list[i]->ar_name,
+						list[i]->ar_service,
+						list[i]->ar_request,
+						&res,
+						true);
 
-		if (ret == 0) {
-			*res = p;
+			NWRAP_LOCK(nwrap_gai_a_global);
+			list[i]->ar_result = res;
+			nwrap_gai_a_complete(job, ret);
+			NWRAP_UNLOCK(nwrap_gai_a_global);
+
+			/* Like glibc, gai_error() tells which one failed */
+			if (ret != 0 && rc == 0) {
+				rc = EAI_SYSTEM;
+			}
 		}
-		return ret;
-	}
 
-	if (service != NULL && service[0] != '\0') {
-		const char *proto = NULL;
-		struct servent *s;
-		char *end_ptr;
-		long sl;
+		return rc;
+	}
 
-		errno = 0;
-		sl = strtol(service, &end_ptr, 10);
+	batch = (struct nwrap_gai_a_batch *)
+		calloc(1, sizeof(struct nwrap_gai_a_batch));
+	jobs = (struct nwrap_gai_a_job **)
+		calloc(nitems + 1, sizeof(struct nwrap_gai_a_job *));
+	status = (int *)malloc((nitems + 1) * sizeof(int));
+	if (batch == NULL || jobs == NULL || status == NULL) {
+		free(batch);
+		free(jobs);
+		free(status);
+		return EAI_MEMORY;
+	}
+	if (sevp != NULL) {
+		batch->sev = *sevp;
+	} else {
+		batch->sev.sigev_notify = SIGEV_NONE;
+	}
 
-		if (*end_ptr == '\0') {
-			port = sl;
-			goto valid_port;
-		} else if (hints->ai_flags & AI_NUMERICSERV) {
-			return EAI_NONAME;
+	/* Claim the requests, the ones still in progress are left alone */
+	NWRAP_LOCK(nwrap_gai_a_global);
+	for (i = 0; i < nitems; i++) {
+		if (list[i] != NULL) {
+			jobs[i] = nwrap_gai_a_job_get(list[i], &rc);
 		}
+	}
+	NWRAP_UNLOCK(nwrap_gai_a_global);
 
-		if (hints->ai_protocol != 0) {
-			struct protoent *pent;
+	/* Answer everything possible without holding the lock */
+	for (i = 0; i < nitems; i++) {
+		struct addrinfo *res = NULL;
 
-			pent = getprotobynumber(hints->ai_protocol);
-			if (pent != NULL) {
-				proto = pent->p_name;
-			}
+		if (jobs[i] == NULL) {
+			continue;
 		}
 
-		s = getservbyname(service, proto);
-		if (s == NULL) {
-			return EAI_NONAME;
-		}
-		port = ntohs(s->s_port);
+		status[i] = nwrap_getaddrinfo(list[i]->ar_name,
+					      list[i]->ar_service,
+					      list[i]->ar_request,
+					      &res,
+					      false);
+		list[i]->ar_result = res;
 	}
 
-valid_port:
+	NWRAP_LOCK(nwrap_gai_a_global);
 
-	rc = inet_pton(AF_INET, node, &addr.in.v4);
-	if (rc == 1) {
-		addr.family = AF_INET;
-	}
-#ifdef HAVE_IPV6
-	if (addr.family == AF_UNSPEC) {
-		rc = inet_pton(AF_INET6, node, &addr.in.v6);
-		if (rc == 1) {
-			addr.family = AF_INET6;
+	/* Count the whole batch first, so the workers can't complete it early */
+	batch->pending = 1;
+
+	for (i = 0; i < nitems; i++) {
+		struct nwrap_gai_a_job *job = jobs[i];
+
+		if (job == NULL) {
+			continue;
+		}
+		if (status[i] != EAI_INPROGRESS) {
+			nwrap_gai_a_complete(job, status[i]);
+			continue;
 		}
-	}
-#endif
 
-	if (addr.family == AF_UNSPEC) {
-	       if (hints->ai_flags & AI_NUMERICHOST) {
-			return EAI_NONAME;
+		job->batch = batch;
+		if (nwrap_gai_a.tail != NULL) {
+			nwrap_gai_a.tail->next = job;
+		} else {
+			nwrap_gai_a.head = job;
 		}
-	} else if ((hints->ai_family != AF_UNSPEC) &&
-		   (hints->ai_family != addr.family))
-	{
-		return EAI_ADDRFAMILY;
+		nwrap_gai_a.tail = job;
+		batch->pending++;
 	}
+	free(jobs);
+	free(status);
 
-	rc = nwrap_files_getaddrinfo(node, port, hints, &ai);
-	if (rc != 0) {
-		int ret;
-		struct addrinfo *p = NULL;
+	if (batch->pending > 1 && !nwrap_gai_a_spawn_workers()) {
+		struct nwrap_gai_a_job *job = nwrap_gai_a.head;
 
-		ret = libc_getaddrinfo(node, service, hints, &p);
+		/* Without any worker nobody would ever run the jobs */
+		while (job != NULL) {
+			struct nwrap_gai_a_job *next = job->next;
 
-		if (ret == 0) {
-			/*
-			 * nwrap_files_getaddrinfo failed, but libc was
-			 * successful -- use the result from libc.
-			 */
-			*res = p;
-			return 0;
+			job->next = NULL;
+			nwrap_gai_a_complete(job, EAI_AGAIN);
+			job = next;
 		}
+		nwrap_gai_a.head = nwrap_gai_a.tail = NULL;
+		rc = EAI_AGAIN;
+	}
 
-		return rc;
+	if (--batch->pending == 0) {
+		nwrap_gai_a_notify(&batch->sev);
+		free(batch);
 	}
 
-	/*
-	 * If the socktype was not specified, duplicate
-	 * each ai returned, so that we have variants for
-	 * both UDP and TCP.
-	 */
-	if (hints->ai_socktype == 0) {
-		struct addrinfo *ai_cur;
+	NWRAP_UNLOCK(nwrap_gai_a_global);
 
-		/* freeaddrinfo() frees ai_canonname and ai so allocate them */
-		for (ai_cur = ai; ai_cur != NULL; ai_cur = ai_cur->ai_next) {
-			struct addrinfo *ai_new;
+	return rc;
+}
 
-			/* duplicate the current entry */
+int getaddrinfo_a(int mode,
+		  struct gaicb *list[],
+		  int nitems,
+		  struct sigevent *sevp)
+{
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_getaddrinfo_a(mode, list, nitems, sevp);
+	}
 
-			ai_new = malloc(sizeof(struct addrinfo));
-			if (ai_new == NULL) {
-				freeaddrinfo(ai);
-				return EAI_MEMORY;
-			}
+	return nwrap_getaddrinfo_a(mode, list, nitems, sevp);
+}
 
-			memcpy(ai_new, ai_cur, sizeof(struct addrinfo));
-			ai_new->ai_next = NULL;
+static int nwrap_gai_suspend(const struct gaicb * const list[],
+			     int nitems,
+			     const struct timespec *timeout)
+{
+	struct timespec deadline;
+	int rc = 0;
 
-			/* We need a deep copy or freeaddrinfo() will blow up */
-#ifdef OSX
-			ai_new->ai_addr = malloc(ai->ai_addrlen);
-			if (ai_new->ai_addr == NULL) {
-				freeaddrinfo(ai);
-				return EAI_MEMORY;
-			}
+	if (timeout != NULL) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout->tv_sec;
+		deadline.tv_nsec += timeout->tv_nsec;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+	}
 
-			memcpy(ai_new->ai_addr, ai->ai_addr, ai->ai_addrlen);
-#endif /* OSX */
-			if (ai_cur->ai_canonname != NULL) {
-				ai_new->ai_canonname =
-					strdup(ai_cur->ai_canonname);
-			}
+	NWRAP_LOCK(nwrap_gai_a_global);
+	for (;;) {
+		bool in_progress = false;
+		bool done = false;
+		int i;
 
-			if (ai_cur->ai_socktype == SOCK_DGRAM) {
-				ai_new->ai_socktype = SOCK_STREAM;
-			} else if (ai_cur->ai_socktype == SOCK_STREAM) {
-				ai_new->ai_socktype = SOCK_DGRAM;
+		for (i = 0; i < nitems; i++) {
+			if (list[i] == NULL) {
+				continue;
 			}
-			if (ai_cur->ai_protocol == IPPROTO_TCP) {
-				ai_new->ai_protocol = IPPROTO_UDP;
-			} else if (ai_cur->ai_protocol == IPPROTO_UDP) {
-				ai_new->ai_protocol = IPPROTO_TCP;
+			if (nwrap_gai_a_status(list[i]) == EAI_INPROGRESS) {
+				in_progress = true;
+			} else {
+				done = true;
 			}
+		}
+		if (done || !in_progress) {
+			break;
+		}
 
-			/* now insert the new entry */
+		if (timeout == NULL) {
+			pthread_cond_wait(&nwrap_gai_a.done_cond,
+					  &nwrap_gai_a_global_mutex);
+		} else if (pthread_cond_timedwait(&nwrap_gai_a.done_cond,
+						  &nwrap_gai_a_global_mutex,
+						  &deadline) == ETIMEDOUT) {
+			rc = EAI_AGAIN;
+			break;
+		}
+	}
+	NWRAP_UNLOCK(nwrap_gai_a_global);
 
-			ai_new->ai_next = ai_cur->ai_next;
-			ai_cur->ai_next = ai_new;
+	return rc;
+}
 
-			/* and move on (don't duplicate the new entry) */
+int gai_suspend(const struct gaicb * const list[],
+		int nitems,
+		const struct timespec *timeout)
+{
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gai_suspend(list, nitems, timeout);
+	}
 
-			ai_cur = ai_new;
+	return nwrap_gai_suspend(list, nitems, timeout);
+}
+
+int gai_error(struct gaicb *req)
+{
+	int rc;
+
+	if (!nss_wrapper_hosts_enabled()) {
+		return libc_gai_error(req);
+	}
+
+	NWRAP_LOCK(nwrap_gai_a_global);
+	rc = nwrap_gai_a_status(req);
+	NWRAP_UNLOCK(nwrap_gai_a_global);
+
+	return rc;
+}
+
+/* Only the queued requests can be cancelled, NULL cancels all of them */
+static int nwrap_gai_cancel(struct gaicb *req)
+{
+	struct nwrap_gai_a_job **pjob;
+	struct nwrap_gai_a_job *prev = NULL;
+	int rc = EAI_ALLDONE;
+
+	NWRAP_LOCK(nwrap_gai_a_global);
+
+	pjob = &nwrap_gai_a.head;
+	while (*pjob != NULL) {
+		struct nwrap_gai_a_job *job = *pjob;
+
+		if (req != NULL && job->req != req) {
+			prev = job;
+			pjob = &job->next;
+			continue;
 		}
+
+		*pjob = job->next;
+		if (nwrap_gai_a.tail == job) {
+			nwrap_gai_a.tail = prev;
+		}
+		job->next = NULL;
+		nwrap_gai_a_complete(job, EAI_CANCELED);
+		rc = EAI_CANCELED;
 	}
 
-	*res = ai;
+	if (rc == EAI_ALLDONE && req != NULL &&
+	    nwrap_gai_a_status(req) == EAI_INPROGRESS) {
+		rc = EAI_NOTCANCELED;
+	}
 
-	return 0;
+	NWRAP_UNLOCK(nwrap_gai_a_global);
+
+	return rc;
 }
 
-int getaddrinfo(const char *node, const char *service,
-		const struct addrinfo *hints,
-		struct addrinfo **res)
+int gai_cancel(struct gaicb *req)
 {
 	if (!nss_wrapper_hosts_enabled()) {
-		return libc_getaddrinfo(node, service, hints, res);
+		return libc_gai_cancel(req);
 	}
 
-	return nwrap_getaddrinfo(node, service, hints, res);
+	return nwrap_gai_cancel(req);
+}
+#else /* HAVE_GETADDRINFO_A */
+static void nwrap_gai_a_thread_child(void)
+{
 }
+#endif /* HAVE_GETADDRINFO_A */
 
 static int nwrap_getnameinfo(const struct sockaddr *sa, socklen_t salen,
 			     char *host, size_t hostlen,
@@ -5515,18 +14183,26 @@ static int nwrap_getnameinfo(const struct sockaddr *sa, socklen_t salen,
 
 	if (host != NULL) {
 		he = NULL;
+		/* The name is copied before a reload can free it */
+		NWRAP_WRLOCK(nwrap_he_global);
 		if ((flags & NI_NUMERICHOST) == 0) {
 			he = nwrap_files_gethostbyaddr(addr, addrlen, type);
-			if ((flags & NI_NAMEREQD) && (he == NULL || he->h_name == NULL))
+			if ((flags & NI_NAMEREQD) && (he == NULL || he->h_name == NULL)) {
+				NWRAP_RWUNLOCK(nwrap_he_global);
 				return EAI_NONAME;
+			}
 		}
 		if (he != NULL && he->h_name != NULL) {
-			if (strlen(he->h_name) >= hostlen)
+			if (strlen(he->h_name) >= hostlen) {
+				NWRAP_RWUNLOCK(nwrap_he_global);
 				return EAI_OVERFLOW;
+			}
 			strcpy(host, he->h_name);
+			NWRAP_RWUNLOCK(nwrap_he_global);
 			if (flags & NI_NOFQDN)
 				host[strcspn(host, ".")] = '\0';
 		} else {
+			NWRAP_RWUNLOCK(nwrap_he_global);
 			if (inet_ntop(type, addr, host, hostlen) == NULL)
 				return (errno == ENOSPC) ? EAI_OVERFLOW : EAI_FAIL;
 		}
@@ -5568,11 +14244,19 @@ int getnameinfo(const struct sockaddr *sa, socklen_t salen,
 		int flags)
 #endif
 {
+	uint64_t start;
+	int rc;
+
 	if (!nss_wrapper_hosts_enabled()) {
 		return libc_getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
 	}
 
-	return nwrap_getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
+	start = nwrap_trace_begin();
+	rc = nwrap_getnameinfo(sa, salen, host, hostlen, serv, servlen, flags);
+	nwrap_trace_end(start, NWRAP_TRACE_GETNAMEINFO, sa, salen,
+			(int32_t)flags, rc);
+
+	return rc;
 }
 
 static int nwrap_gethostname(char *name, size_t len)
@@ -5594,17 +14278,40 @@ int gethostname(char *name, int len)
 int gethostname(char *name, size_t len)
 #endif /* HAVE_SOLARIS_GETHOSTNAME */
 {
+	uint64_t start;
+	int rc;
+
 	if (!nwrap_hostname_enabled()) {
 		return libc_gethostname(name, len);
 	}
 
-	return nwrap_gethostname(name, len);
+	start = nwrap_trace_begin();
+	rc = nwrap_gethostname(name, len);
+	nwrap_trace_end(start, NWRAP_TRACE_GETHOSTNAME, NULL, 0,
+			(int32_t)len, rc);
+
+	return rc;
 }
 
 /****************************
  * DESTRUCTOR
  ***************************/
 
+static void nwrap_dlclose(void *handle)
+{
+	if (handle == NULL) {
+		return;
+	}
+#ifdef RTLD_NEXT
+	/* Not a handle we opened ourselves */
+	if (handle == RTLD_NEXT) {
+		return;
+	}
+#endif
+
+	dlclose(handle);
+}
+
 /*
  * This function is called when the library is unloaded and makes sure that
  * sockets get closed and the unix file for the socket are unlinked.
@@ -5619,15 +14326,9 @@ void nwrap_destructor(void)
 		struct nwrap_main *m = nwrap_main_global;
 
 		/* libc */
-		if (m->libc.handle != NULL) {
-			dlclose(m->libc.handle);
-		}
-		if (m->libc.nsl_handle != NULL) {
-			dlclose(m->libc.nsl_handle);
-		}
-		if (m->libc.sock_handle != NULL) {
-			dlclose(m->libc.sock_handle);
-		}
+		nwrap_dlclose(m->libc.handle);
+		nwrap_dlclose(m->libc.nsl_handle);
+		nwrap_dlclose(m->libc.sock_handle);
 
 		/* backends */
 		for (i = 0; i < m->num_backends; i++) {
@@ -5637,34 +14338,26 @@ void nwrap_destructor(void)
 				dlclose(b->so_handle);
 			}
 			SAFE_FREE(b->fns);
+			nwrap_module_enum_free(&b->pw_enum);
+			nwrap_module_enum_free(&b->gr_enum);
 		}
 		SAFE_FREE(m->backends);
 	}
 
+	nwrap_reload_free();
+
 	if (nwrap_pw_global.cache != NULL) {
 		struct nwrap_cache *c = nwrap_pw_global.cache;
 
 		nwrap_files_cache_unload(c);
-		if (c->fd >= 0) {
-			fclose(c->fp);
-			c->fd = -1;
-		}
-
-		SAFE_FREE(nwrap_pw_global.list);
-		nwrap_pw_global.num = 0;
+		nwrap_layers_free(c);
 	}
 
 	if (nwrap_gr_global.cache != NULL) {
 		struct nwrap_cache *c = nwrap_gr_global.cache;
 
 		nwrap_files_cache_unload(c);
-		if (c->fd >= 0) {
-			fclose(c->fp);
-			c->fd = -1;
-		}
-
-		SAFE_FREE(nwrap_gr_global.list);
-		nwrap_pw_global.num = 0;
+		nwrap_layers_free(c);
 	}
 
 #if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
@@ -5672,32 +14365,61 @@ void nwrap_destructor(void)
 		struct nwrap_cache *c = nwrap_sp_global.cache;
 
 		nwrap_files_cache_unload(c);
-		if (c->fd >= 0) {
-			fclose(c->fp);
-			c->fd = -1;
-		}
+		nwrap_layers_free(c);
 
 		nwrap_sp_global.num = 0;
 	}
 #endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
 
+#ifdef HAVE_INNETGR
+	if (nwrap_ng_global.cache != NULL) {
+		struct nwrap_cache *c = nwrap_ng_global.cache;
+
+		nwrap_files_cache_unload(c);
+		nwrap_layers_free(c);
+	}
+#endif /* HAVE_INNETGR */
+
 	if (nwrap_he_global.cache != NULL) {
 		struct nwrap_cache *c = nwrap_he_global.cache;
 
 		nwrap_files_cache_unload(c);
-		if (c->fd >= 0) {
-			fclose(c->fp);
-			c->fd = -1;
-		}
+		nwrap_layers_free(c);
 
 		nwrap_he_global.num = 0;
 	}
 
-	free(user_addrlist.items);
-#ifdef HAVE_GETHOSTBYNAME2
-	free(user_addrlist2.items);
-#endif
+	SAFE_FREE(nwrap_he_global.slots);
+	nwrap_he_global.num_slots = 0;
+
+	/* The other threads free their results when they exit */
+	nwrap_he_tls_free(&nwrap_he_tls);
+	nwrap_ent_tls_free(&nwrap_ent_tls);
+
+	/* The other threads write their records when they exit */
+	nwrap_trace_tls_free(&nwrap_trace_tls);
+
+	nwrap_profile_report();
+
+	for (i = 0; i < NWRAP_GAI_CACHE_SIZE; i++) {
+		nwrap_gai_cache_entry_free(&nwrap_gai_cache.entries[i]);
+	}
+
+	if (nwrap_main_global != NULL &&
+	    nwrap_main_global->erange_retries > 0) {
+		NWRAP_LOG(NWRAP_LOG_DEBUG,
+			  "%lu lookups failed with ERANGE, size the buffers "
+			  "with sysconf(_SC_GETPW_R_SIZE_MAX) and "
+			  "sysconf(_SC_GETGR_R_SIZE_MAX)",
+			  nwrap_main_global->erange_retries);
+	}
+
+	if (nwrap_he_global.fallbacks > 0) {
+		NWRAP_LOG(NWRAP_LOG_WARN,
+			  "%lu hosts lookups fell back to libc, set "
+			  "NSS_WRAPPER_HOSTS_STRICT to avoid them",
+			  nwrap_he_global.fallbacks);
+	}
 
-	hdestroy();
 	NWRAP_UNLOCK_ALL;
 }
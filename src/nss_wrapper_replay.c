@@ -0,0 +1,776 @@
+#include "config.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef _POSIX_PTHREAD_SEMANTICS
+#define _POSIX_PTHREAD_SEMANTICS
+#endif
+
+#include <pwd.h>
+#include <grp.h>
+#ifdef HAVE_SHADOW_H
+#include <shadow.h>
+#endif /* HAVE_SHADOW_H */
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "nss_wrapper_trace.h"
+
+/*
+ * Replay a trace written with NSS_WRAPPER_TRACE_FILE. The calls are issued
+ * again in the order they were started, either with the original pauses
+ * between them or as fast as possible. The calls go to nss_wrapper, which
+ * this tool is linked against, so the files of the replay are set with the
+ * NSS_WRAPPER_* variables or the options.
+ */
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#endif
+
+#define NWRAP_REPLAY_HASH_SIZE 65536
+#define NWRAP_REPLAY_HOST_BUFLEN 65536
+
+struct nwrap_replay_record {
+	struct nwrap_trace_record rec;
+	const char *key;
+	size_t idx;
+};
+
+struct nwrap_replay_stats {
+	unsigned long calls;
+	unsigned long redundant;
+	unsigned long mismatches;
+	uint64_t recorded_ns;
+	uint64_t replayed_ns;
+};
+
+struct nwrap_replay {
+	struct nwrap_trace_header hdr;
+	struct nwrap_replay_record *records;
+	size_t num;
+
+	/* The first record of every lookup key, to find repeated lookups */
+	struct nwrap_replay_record **seen;
+	size_t num_seen;
+
+	char *buf;
+	size_t buflen;
+
+	struct nwrap_replay_stats stats[NWRAP_TRACE_FN_MAX];
+};
+
+static uint64_t nwrap_replay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void nwrap_replay_sleep(uint64_t ns)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ns / 1000000000;
+	ts.tv_nsec = ns % 1000000000;
+
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+		continue;
+	}
+}
+
+static char *nwrap_replay_read_file(const char *path, size_t *psize)
+{
+	char *data = NULL;
+	size_t size = 0;
+	size_t used = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "Unable to open %s: %s\n",
+			path, strerror(errno));
+		return NULL;
+	}
+
+	for (;;) {
+		size_t n;
+
+		if (used == size) {
+			char *tmp;
+
+			size = size > 0 ? size * 2 : 65536;
+			tmp = (char *)realloc(data, size);
+			if (tmp == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				free(data);
+				fclose(fp);
+				return NULL;
+			}
+			data = tmp;
+		}
+
+		n = fread(data + used, 1, size - used, fp);
+		if (n == 0) {
+			break;
+		}
+		used += n;
+	}
+	fclose(fp);
+
+	*psize = used;
+	return data;
+}
+
+static int nwrap_replay_cmp(const void *p1, const void *p2)
+{
+	const struct nwrap_replay_record *r1 = p1;
+	const struct nwrap_replay_record *r2 = p2;
+
+	if (r1->rec.time_ns != r2->rec.time_ns) {
+		return r1->rec.time_ns < r2->rec.time_ns ? -1 : 1;
+	}
+	if (r1->idx != r2->idx) {
+		return r1->idx < r2->idx ? -1 : 1;
+	}
+
+	return 0;
+}
+
+/* The records are sorted by the time the calls started */
+static bool nwrap_replay_parse(struct nwrap_replay *r,
+			       const char *data, size_t size)
+{
+	struct nwrap_trace_header hdr;
+	size_t ofs;
+	size_t num = 0;
+
+	if (size < sizeof(hdr)) {
+		fprintf(stderr, "The trace is too short\n");
+		return false;
+	}
+	memcpy(&hdr, data, sizeof(hdr));
+	if (memcmp(hdr.magic, NWRAP_TRACE_MAGIC, sizeof(hdr.magic)) != 0 ||
+	    hdr.version != NWRAP_TRACE_VERSION ||
+	    hdr.record_size != sizeof(struct nwrap_trace_record)) {
+		fprintf(stderr, "Not a trace of this nss_wrapper version\n");
+		return false;
+	}
+
+	/* Count the records first */
+	for (ofs = sizeof(hdr); ofs < size; num++) {
+		struct nwrap_trace_record rec;
+
+		if (size - ofs < sizeof(rec)) {
+			fprintf(stderr, "The trace is truncated\n");
+			return false;
+		}
+		memcpy(&rec, data + ofs, sizeof(rec));
+		ofs += sizeof(rec);
+		if (size - ofs < rec.key_len) {
+			fprintf(stderr, "The trace is truncated\n");
+			return false;
+		}
+		ofs += rec.key_len;
+	}
+
+	r->hdr = hdr;
+
+	r->records = calloc(num + 1, sizeof(struct nwrap_replay_record));
+	if (r->records == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return false;
+	}
+
+	for (ofs = sizeof(hdr); ofs < size; r->num++) {
+		struct nwrap_replay_record *rr = &r->records[r->num];
+
+		memcpy(&rr->rec, data + ofs, sizeof(rr->rec));
+		ofs += sizeof(rr->rec);
+		rr->key = data + ofs;
+		rr->idx = r->num;
+		ofs += rr->rec.key_len;
+	}
+
+	qsort(r->records, r->num, sizeof(struct nwrap_replay_record),
+	      nwrap_replay_cmp);
+
+	return true;
+}
+
+static const char *nwrap_replay_fn_name(uint16_t fn)
+{
+	if (fn >= NWRAP_TRACE_FN_MAX || nwrap_trace_fn_names[fn] == NULL) {
+		return "unknown";
+	}
+
+	return nwrap_trace_fn_names[fn];
+}
+
+/* Enumeration and gethostname() have no key */
+static bool nwrap_replay_is_lookup(uint16_t fn)
+{
+	switch (fn) {
+	case NWRAP_TRACE_SETPWENT:
+	case NWRAP_TRACE_GETPWENT:
+	case NWRAP_TRACE_GETPWENT_R:
+	case NWRAP_TRACE_ENDPWENT:
+	case NWRAP_TRACE_SETGRENT:
+	case NWRAP_TRACE_GETGRENT:
+	case NWRAP_TRACE_GETGRENT_R:
+	case NWRAP_TRACE_ENDGRENT:
+	case NWRAP_TRACE_SETHOSTENT:
+	case NWRAP_TRACE_GETHOSTENT:
+	case NWRAP_TRACE_ENDHOSTENT:
+	case NWRAP_TRACE_GETHOSTNAME:
+		return false;
+	}
+
+	return true;
+}
+
+static uint32_t nwrap_replay_hash(const struct nwrap_replay_record *rr)
+{
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	h = (h ^ rr->rec.fn) * 16777619U;
+	for (i = 0; i < rr->rec.key_len; i++) {
+		h = (h ^ (uint8_t)rr->key[i]) * 16777619U;
+	}
+
+	return h;
+}
+
+/*
+ * A lookup is redundant if the same function was asked for the same key
+ * before and got the same answer. The buffer sizes of the _r functions
+ * don't matter.
+ */
+static bool nwrap_replay_redundant(struct nwrap_replay *r,
+				   struct nwrap_replay_record *rr)
+{
+	uint32_t h;
+
+	if (!nwrap_replay_is_lookup(rr->rec.fn)) {
+		return false;
+	}
+
+	h = nwrap_replay_hash(rr) % NWRAP_REPLAY_HASH_SIZE;
+	for (;;) {
+		struct nwrap_replay_record *s = r->seen[h];
+
+		if (s == NULL) {
+			/* Keep the table sparse, later keys aren't tracked */
+			if (r->num_seen < NWRAP_REPLAY_HASH_SIZE / 2) {
+				r->seen[h] = rr;
+				r->num_seen++;
+			}
+			return false;
+		}
+		if (s->rec.fn == rr->rec.fn &&
+		    s->rec.key_len == rr->rec.key_len &&
+		    memcmp(s->key, rr->key, rr->rec.key_len) == 0) {
+			if (s->rec.result == rr->rec.result) {
+				return true;
+			}
+			/* Compare the following ones with the new answer */
+			r->seen[h] = rr;
+			return false;
+		}
+		h = (h + 1) % NWRAP_REPLAY_HASH_SIZE;
+	}
+}
+
+static char *nwrap_replay_buf(struct nwrap_replay *r, int32_t arg)
+{
+	size_t len = arg > 0 ? (size_t)arg : 1;
+
+	if (len > r->buflen) {
+		char *buf = (char *)realloc(r->buf, len);
+
+		if (buf == NULL) {
+			return NULL;
+		}
+		r->buf = buf;
+		r->buflen = len;
+	}
+
+	return r->buf;
+}
+
+/* Copies the key, so it can be used as a string */
+static void nwrap_replay_key(const struct nwrap_replay_record *rr,
+			     char *key, size_t len)
+{
+	size_t n = rr->rec.key_len < len ? rr->rec.key_len : len - 1;
+
+	memcpy(key, rr->key, n);
+	key[n] = '\0';
+}
+
+static uint32_t nwrap_replay_id(const struct nwrap_replay_record *rr)
+{
+	uint32_t id = 0;
+
+	if (rr->rec.key_len == sizeof(id)) {
+		memcpy(&id, rr->key, sizeof(id));
+	}
+
+	return id;
+}
+
+static int nwrap_replay_getgrouplist(const char *user, gid_t group)
+{
+	gid_t groups[4096];
+	int ngroups = ARRAY_SIZE(groups);
+
+	getgrouplist(user, group, groups, &ngroups);
+
+	return ngroups;
+}
+
+#ifdef HAVE_INNETGR
+static int nwrap_replay_innetgr(const struct nwrap_replay_record *rr)
+{
+	char key[1025];
+	const char *fields[3] = { NULL, NULL, NULL };
+	const char *p;
+	const char *end;
+	size_t i;
+
+	nwrap_replay_key(rr, key, sizeof(key));
+	end = key + (rr->rec.key_len < sizeof(key) ?
+		     rr->rec.key_len : sizeof(key) - 1);
+
+	p = key + strlen(key) + 1;
+	for (i = 0; i < ARRAY_SIZE(fields) && p <= end; i++) {
+		if (rr->rec.arg & (1 << i)) {
+			fields[i] = p;
+		}
+		p += strlen(p) + 1;
+	}
+
+	return innetgr(key, fields[0], fields[1], fields[2]);
+}
+#endif /* HAVE_INNETGR */
+
+/*
+ * Issue the call of the record again. Returns the result in the encoding of
+ * the trace, compare is set to false if it can't be compared.
+ */
+static int32_t nwrap_replay_call(struct nwrap_replay *r,
+				 const struct nwrap_replay_record *rr,
+				 bool *compare)
+{
+	const struct nwrap_trace_record *rec = &rr->rec;
+	char key[1025];
+	char *buf = NULL;
+	struct passwd pwd;
+	struct passwd *pwdp = NULL;
+	struct group grp;
+	struct group *grpp = NULL;
+	struct hostent *he;
+	struct addrinfo hints;
+	struct addrinfo *ai = NULL;
+	char host[NI_MAXHOST];
+	int rc;
+
+	*compare = true;
+	nwrap_replay_key(rr, key, sizeof(key));
+
+	switch (rec->fn) {
+	case NWRAP_TRACE_GETPWENT_R:
+	case NWRAP_TRACE_GETGRENT_R:
+	case NWRAP_TRACE_GETPWNAM_R:
+	case NWRAP_TRACE_GETPWUID_R:
+	case NWRAP_TRACE_GETGRNAM_R:
+	case NWRAP_TRACE_GETGRGID_R:
+	case NWRAP_TRACE_GETSPNAM_R:
+	case NWRAP_TRACE_GETHOSTBYNAME_R:
+		buf = nwrap_replay_buf(r, rec->arg);
+		if (buf == NULL) {
+			*compare = false;
+			return ENOMEM;
+		}
+		break;
+	}
+
+	switch (rec->fn) {
+	case NWRAP_TRACE_GETPWNAM:
+		return getpwnam(key) != NULL ? 0 : ENOENT;
+	case NWRAP_TRACE_GETPWNAM_R:
+		return getpwnam_r(key, &pwd, buf, rec->arg, &pwdp);
+	case NWRAP_TRACE_GETPWUID:
+		return getpwuid(nwrap_replay_id(rr)) != NULL ? 0 : ENOENT;
+	case NWRAP_TRACE_GETPWUID_R:
+		return getpwuid_r(nwrap_replay_id(rr), &pwd,
+				  buf, rec->arg, &pwdp);
+	case NWRAP_TRACE_SETPWENT:
+		setpwent();
+		return 0;
+	case NWRAP_TRACE_GETPWENT:
+		return getpwent() != NULL ? 0 : ENOENT;
+#ifdef HAVE_GETPWENT_R
+	case NWRAP_TRACE_GETPWENT_R:
+		return getpwent_r(&pwd, buf, rec->arg, &pwdp);
+#endif
+	case NWRAP_TRACE_ENDPWENT:
+		endpwent();
+		return 0;
+	case NWRAP_TRACE_INITGROUPS:
+		/* setgroups() needs privileges, only do the lookup */
+		*compare = false;
+		return nwrap_replay_getgrouplist(key, rec->arg);
+	case NWRAP_TRACE_GETGRNAM:
+		return getgrnam(key) != NULL ? 0 : ENOENT;
+	case NWRAP_TRACE_GETGRNAM_R:
+		return getgrnam_r(key, &grp, buf, rec->arg, &grpp);
+	case NWRAP_TRACE_GETGRGID:
+		return getgrgid(nwrap_replay_id(rr)) != NULL ? 0 : ENOENT;
+	case NWRAP_TRACE_GETGRGID_R:
+		return getgrgid_r(nwrap_replay_id(rr), &grp,
+				  buf, rec->arg, &grpp);
+	case NWRAP_TRACE_SETGRENT:
+		setgrent();
+		return 0;
+	case NWRAP_TRACE_GETGRENT:
+		return getgrent() != NULL ? 0 : ENOENT;
+#ifdef HAVE_GETGRENT_R
+	case NWRAP_TRACE_GETGRENT_R:
+		return getgrent_r(&grp, buf, rec->arg, &grpp);
+#endif
+	case NWRAP_TRACE_ENDGRENT:
+		endgrent();
+		return 0;
+	case NWRAP_TRACE_GETGROUPLIST:
+		return nwrap_replay_getgrouplist(key, rec->arg);
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+	case NWRAP_TRACE_GETSPNAM:
+		return getspnam(key) != NULL ? 0 : ENOENT;
+#endif
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+	case NWRAP_TRACE_GETSPNAM_R: {
+		struct spwd spwd;
+		struct spwd *spwdp = NULL;
+
+		return getspnam_r(key, &spwd, buf, rec->arg, &spwdp);
+	}
+#endif
+#ifdef HAVE_INNETGR
+	case NWRAP_TRACE_INNETGR:
+		return nwrap_replay_innetgr(rr);
+#endif
+	case NWRAP_TRACE_GETHOSTBYNAME:
+		return gethostbyname(key) != NULL ? 0 : h_errno;
+#ifdef HAVE_GETHOSTBYNAME2
+	case NWRAP_TRACE_GETHOSTBYNAME2:
+		return gethostbyname2(key, rec->arg) != NULL ? 0 : h_errno;
+#endif
+#ifdef HAVE_GETHOSTBYNAME_R
+	case NWRAP_TRACE_GETHOSTBYNAME_R: {
+		struct hostent he_r;
+		int h_err;
+
+		return gethostbyname_r(key, &he_r, buf, rec->arg,
+				       &he, &h_err);
+	}
+#endif
+	case NWRAP_TRACE_GETHOSTBYADDR:
+		he = gethostbyaddr(rr->key, rec->key_len, rec->arg);
+		return he != NULL ? 0 : h_errno;
+#ifdef HAVE_GETHOSTBYADDR_R
+	case NWRAP_TRACE_GETHOSTBYADDR_R: {
+		struct hostent he_r;
+		int h_err;
+
+		/* The buffer size isn't recorded, arg is the family */
+		buf = nwrap_replay_buf(r, NWRAP_REPLAY_HOST_BUFLEN);
+		if (buf == NULL) {
+			*compare = false;
+			return ENOMEM;
+		}
+
+		return gethostbyaddr_r(rr->key, rec->key_len, rec->arg,
+				       &he_r, buf, NWRAP_REPLAY_HOST_BUFLEN,
+				       &he, &h_err);
+	}
+#endif
+	case NWRAP_TRACE_SETHOSTENT:
+		sethostent(rec->arg);
+		return 0;
+	case NWRAP_TRACE_GETHOSTENT:
+		return gethostent() != NULL ? 0 : ENOENT;
+	case NWRAP_TRACE_ENDHOSTENT:
+		endhostent();
+		return 0;
+	case NWRAP_TRACE_GETADDRINFO:
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = rec->arg;
+		rc = getaddrinfo(rec->key_len > 0 ? key : NULL, NULL,
+				 &hints, &ai);
+		if (ai != NULL) {
+			freeaddrinfo(ai);
+		}
+		return rc;
+	case NWRAP_TRACE_GETNAMEINFO: {
+		struct sockaddr_storage ss;
+
+		if (rec->key_len > sizeof(ss)) {
+			break;
+		}
+		memcpy(&ss, rr->key, rec->key_len);
+
+		return getnameinfo((struct sockaddr *)&ss, rec->key_len,
+				   host, sizeof(host), NULL, 0, rec->arg);
+	}
+	case NWRAP_TRACE_GETHOSTNAME:
+		return gethostname(host,
+				   rec->arg > 0 && rec->arg < (int)sizeof(host) ?
+				   (size_t)rec->arg : sizeof(host));
+	}
+
+	*compare = false;
+	return 0;
+}
+
+static void nwrap_replay_dump(const struct nwrap_replay *r)
+{
+	size_t i;
+
+	for (i = 0; i < r->num; i++) {
+		const struct nwrap_replay_record *rr = &r->records[i];
+		/* The wall clock time of the call */
+		uint64_t t = r->hdr.realtime_ns +
+			     (rr->rec.time_ns - r->hdr.monotonic_ns);
+		char key[1025];
+		size_t j;
+
+		nwrap_replay_key(rr, key, sizeof(key));
+
+		switch (rr->rec.fn) {
+		case NWRAP_TRACE_GETPWUID:
+		case NWRAP_TRACE_GETPWUID_R:
+		case NWRAP_TRACE_GETGRGID:
+		case NWRAP_TRACE_GETGRGID_R:
+			snprintf(key, sizeof(key), "%u",
+				 (unsigned int)nwrap_replay_id(rr));
+			break;
+		case NWRAP_TRACE_GETHOSTBYADDR:
+		case NWRAP_TRACE_GETHOSTBYADDR_R:
+			if (inet_ntop(rr->rec.arg, rr->key,
+				      key, sizeof(key)) == NULL) {
+				snprintf(key, sizeof(key), "?");
+			}
+			break;
+		case NWRAP_TRACE_GETNAMEINFO:
+			snprintf(key, sizeof(key), "sockaddr");
+			break;
+		case NWRAP_TRACE_INNETGR:
+			for (j = 0; j < rr->rec.key_len && j < sizeof(key) - 1;
+			     j++) {
+				if (key[j] == '\0') {
+					key[j] = ',';
+				}
+			}
+			break;
+		}
+
+		printf("%llu.%09llu %u/%u %s(%s) arg=%d result=%d %uns\n",
+		       (unsigned long long)(t / 1000000000),
+		       (unsigned long long)(t % 1000000000),
+		       rr->rec.pid, rr->rec.thread,
+		       nwrap_replay_fn_name(rr->rec.fn), key,
+		       rr->rec.arg, rr->rec.result, rr->rec.latency_ns);
+	}
+}
+
+static void nwrap_replay_run(struct nwrap_replay *r, bool max_speed)
+{
+	uint64_t first = 0;
+	uint64_t begin;
+	size_t i;
+
+	if (r->num > 0) {
+		first = r->records[0].rec.time_ns;
+	}
+
+	begin = nwrap_replay_now();
+	for (i = 0; i < r->num; i++) {
+		struct nwrap_replay_record *rr = &r->records[i];
+		struct nwrap_replay_stats *st;
+		uint64_t start;
+		uint64_t end;
+		bool compare;
+		int32_t result;
+
+		if (rr->rec.fn == 0 || rr->rec.fn >= NWRAP_TRACE_FN_MAX) {
+			continue;
+		}
+		st = &r->stats[rr->rec.fn];
+
+		if (!max_speed) {
+			uint64_t due = begin + (rr->rec.time_ns - first);
+
+			start = nwrap_replay_now();
+			if (due > start) {
+				nwrap_replay_sleep(due - start);
+			}
+		}
+
+		start = nwrap_replay_now();
+		result = nwrap_replay_call(r, rr, &compare);
+		end = nwrap_replay_now();
+
+		st->calls++;
+		st->recorded_ns += rr->rec.latency_ns;
+		st->replayed_ns += end - start;
+		if (compare && result != rr->rec.result) {
+			st->mismatches++;
+		}
+		if (nwrap_replay_redundant(r, rr)) {
+			st->redundant++;
+		}
+	}
+}
+
+static unsigned long nwrap_replay_report(const struct nwrap_replay *r)
+{
+	unsigned long mismatches = 0;
+	size_t i;
+
+	printf("%-16s %10s %10s %10s %12s %12s\n",
+	       "function", "calls", "redundant", "mismatch",
+	       "recorded_ns", "replayed_ns");
+
+	for (i = 0; i < NWRAP_TRACE_FN_MAX; i++) {
+		const struct nwrap_replay_stats *st = &r->stats[i];
+
+		if (st->calls == 0) {
+			continue;
+		}
+		printf("%-16s %10lu %10lu %10lu %12llu %12llu\n",
+		       nwrap_replay_fn_name(i),
+		       st->calls, st->redundant, st->mismatches,
+		       (unsigned long long)(st->recorded_ns / st->calls),
+		       (unsigned long long)(st->replayed_ns / st->calls));
+		mismatches += st->mismatches;
+	}
+
+	return mismatches;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-m] [-c] [-d] [-p passwd] [-g group] "
+		"[-s shadow] [-H hosts] [-n netgroup] TRACE\n"
+		"  -m  replay at maximum speed instead of the original one\n"
+		"  -c  fail if a result differs from the recorded one\n"
+		"  -d  print the records instead of replaying them\n",
+		prog);
+}
+
+int main(int argc, char *argv[])
+{
+	struct nwrap_replay r;
+	bool max_speed = false;
+	bool check = false;
+	bool dump = false;
+	unsigned long mismatches;
+	size_t size = 0;
+	char *data;
+	int opt;
+
+	memset(&r, 0, sizeof(r));
+
+	while ((opt = getopt(argc, argv, "mcdp:g:s:H:n:")) != -1) {
+		switch (opt) {
+		case 'm':
+			max_speed = true;
+			break;
+		case 'c':
+			check = true;
+			break;
+		case 'd':
+			dump = true;
+			break;
+		case 'p':
+			setenv("NSS_WRAPPER_PASSWD", optarg, 1);
+			break;
+		case 'g':
+			setenv("NSS_WRAPPER_GROUP", optarg, 1);
+			break;
+		case 's':
+			setenv("NSS_WRAPPER_SHADOW", optarg, 1);
+			break;
+		case 'H':
+			setenv("NSS_WRAPPER_HOSTS", optarg, 1);
+			break;
+		case 'n':
+			setenv("NSS_WRAPPER_NETGROUP", optarg, 1);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	/* Don't append the replay to a trace */
+	unsetenv("NSS_WRAPPER_TRACE_FILE");
+
+	data = nwrap_replay_read_file(argv[optind], &size);
+	if (data == NULL) {
+		return 1;
+	}
+	if (!nwrap_replay_parse(&r, data, size)) {
+		free(data);
+		return 1;
+	}
+
+	if (dump) {
+		nwrap_replay_dump(&r);
+		free(r.records);
+		free(data);
+		return 0;
+	}
+
+	r.seen = calloc(NWRAP_REPLAY_HASH_SIZE,
+			sizeof(struct nwrap_replay_record *));
+	if (r.seen == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(r.records);
+		free(data);
+		return 1;
+	}
+
+	nwrap_replay_run(&r, max_speed);
+	mismatches = nwrap_replay_report(&r);
+
+	free(r.seen);
+	free(r.buf);
+	free(r.records);
+	free(data);
+
+	if (check && mismatches > 0) {
+		return 2;
+	}
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+#ifndef NSS_WRAPPER_TRACE_H
+#define NSS_WRAPPER_TRACE_H
+
+#include <stdint.h>
+
+/*
+ * The format of NSS_WRAPPER_TRACE_FILE, which is written by nss_wrapper and
+ * read by nss_wrapper_replay.
+ *
+ * The file starts with a struct nwrap_trace_header, followed by the records.
+ * Every record is a struct nwrap_trace_record followed by key_len bytes of
+ * key. The records are not aligned and use the byte order of the machine.
+ * The records of a thread are in order, the threads and processes which
+ * share a file are interleaved in blocks.
+ */
+
+#define NWRAP_TRACE_MAGIC "NWTRACE\n"
+#define NWRAP_TRACE_VERSION 2
+
+/*
+ * The clocks when the file was created. The time of a record is
+ * realtime_ns + (time_ns - monotonic_ns) on the wall clock.
+ */
+struct nwrap_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	uint64_t realtime_ns;
+	uint64_t monotonic_ns;
+};
+
+/*
+ * The key and arg of the functions:
+ *
+ * - names: the name, arg is the buffer size of the _r functions
+ * - ids: the uid or gid as uint32_t, arg is the buffer size
+ * - enumeration: no key, arg is the buffer size of the _r functions
+ * - initgroups, getgrouplist: the user, arg is the group
+ * - innetgr: netgroup, host, user and domain separated by '\0', bit n of
+ *   arg is set if the n-th of host, user and domain isn't NULL
+ * - gethostbyname2, getaddrinfo: the name, arg is the address family
+ * - gethostbyaddr: the address, arg is the address family
+ * - getnameinfo: the struct sockaddr, arg is the flags
+ * - gethostname: no key, arg is the buffer size
+ *
+ * The result is the return value of the _r functions, getaddrinfo() and
+ * getnameinfo(). It is 0 or ENOENT for the functions returning a pointer,
+ * 0 or h_errno for the hosts functions, the number of groups of the user
+ * for getgrouplist() and -1 or 0 for the others.
+ */
+enum nwrap_trace_fn {
+	NWRAP_TRACE_GETPWNAM = 1,
+	NWRAP_TRACE_GETPWNAM_R,
+	NWRAP_TRACE_GETPWUID,
+	NWRAP_TRACE_GETPWUID_R,
+	NWRAP_TRACE_SETPWENT,
+	NWRAP_TRACE_GETPWENT,
+	NWRAP_TRACE_GETPWENT_R,
+	NWRAP_TRACE_ENDPWENT,
+	NWRAP_TRACE_INITGROUPS,
+	NWRAP_TRACE_GETGRNAM,
+	NWRAP_TRACE_GETGRNAM_R,
+	NWRAP_TRACE_GETGRGID,
+	NWRAP_TRACE_GETGRGID_R,
+	NWRAP_TRACE_SETGRENT,
+	NWRAP_TRACE_GETGRENT,
+	NWRAP_TRACE_GETGRENT_R,
+	NWRAP_TRACE_ENDGRENT,
+	NWRAP_TRACE_GETGROUPLIST,
+	NWRAP_TRACE_GETSPNAM,
+	NWRAP_TRACE_GETSPNAM_R,
+	NWRAP_TRACE_INNETGR,
+	NWRAP_TRACE_GETHOSTBYNAME,
+	NWRAP_TRACE_GETHOSTBYNAME2,
+	NWRAP_TRACE_GETHOSTBYNAME_R,
+	NWRAP_TRACE_GETHOSTBYADDR,
+	NWRAP_TRACE_GETHOSTBYADDR_R,
+	NWRAP_TRACE_SETHOSTENT,
+	NWRAP_TRACE_GETHOSTENT,
+	NWRAP_TRACE_ENDHOSTENT,
+	NWRAP_TRACE_GETADDRINFO,
+	NWRAP_TRACE_GETNAMEINFO,
+	NWRAP_TRACE_GETHOSTNAME,
+
+	NWRAP_TRACE_FN_MAX
+};
+
+/* The names of the functions, indexed by enum nwrap_trace_fn */
+static const char * const nwrap_trace_fn_names[NWRAP_TRACE_FN_MAX] = {
+	[NWRAP_TRACE_GETPWNAM] = "getpwnam",
+	[NWRAP_TRACE_GETPWNAM_R] = "getpwnam_r",
+	[NWRAP_TRACE_GETPWUID] = "getpwuid",
+	[NWRAP_TRACE_GETPWUID_R] = "getpwuid_r",
+	[NWRAP_TRACE_SETPWENT] = "setpwent",
+	[NWRAP_TRACE_GETPWENT] = "getpwent",
+	[NWRAP_TRACE_GETPWENT_R] = "getpwent_r",
+	[NWRAP_TRACE_ENDPWENT] = "endpwent",
+	[NWRAP_TRACE_INITGROUPS] = "initgroups",
+	[NWRAP_TRACE_GETGRNAM] = "getgrnam",
+	[NWRAP_TRACE_GETGRNAM_R] = "getgrnam_r",
+	[NWRAP_TRACE_GETGRGID] = "getgrgid",
+	[NWRAP_TRACE_GETGRGID_R] = "getgrgid_r",
+	[NWRAP_TRACE_SETGRENT] = "setgrent",
+	[NWRAP_TRACE_GETGRENT] = "getgrent",
+	[NWRAP_TRACE_GETGRENT_R] = "getgrent_r",
+	[NWRAP_TRACE_ENDGRENT] = "endgrent",
+	[NWRAP_TRACE_GETGROUPLIST] = "getgrouplist",
+	[NWRAP_TRACE_GETSPNAM] = "getspnam",
+	[NWRAP_TRACE_GETSPNAM_R] = "getspnam_r",
+	[NWRAP_TRACE_INNETGR] = "innetgr",
+	[NWRAP_TRACE_GETHOSTBYNAME] = "gethostbyname",
+	[NWRAP_TRACE_GETHOSTBYNAME2] = "gethostbyname2",
+	[NWRAP_TRACE_GETHOSTBYNAME_R] = "gethostbyname_r",
+	[NWRAP_TRACE_GETHOSTBYADDR] = "gethostbyaddr",
+	[NWRAP_TRACE_GETHOSTBYADDR_R] = "gethostbyaddr_r",
+	[NWRAP_TRACE_SETHOSTENT] = "sethostent",
+	[NWRAP_TRACE_GETHOSTENT] = "gethostent",
+	[NWRAP_TRACE_ENDHOSTENT] = "endhostent",
+	[NWRAP_TRACE_GETADDRINFO] = "getaddrinfo",
+	[NWRAP_TRACE_GETNAMEINFO] = "getnameinfo",
+	[NWRAP_TRACE_GETHOSTNAME] = "gethostname",
+};
+
+struct nwrap_trace_record {
+	uint64_t time_ns;	/* CLOCK_MONOTONIC when the call started */
+	uint32_t latency_ns;
+	uint32_t pid;
+	uint32_t thread;	/* numbered per process in order of the calls */
+	int32_t result;
+	int32_t arg;
+	uint16_t fn;		/* enum nwrap_trace_fn */
+	uint16_t key_len;
+};
+
+#endif /* NSS_WRAPPER_TRACE_H */
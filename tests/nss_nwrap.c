@@ -1,7 +1,15 @@
 #include "config.h"
 
+#include <errno.h>
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #if defined(HAVE_NSS_H)
 /* Linux and BSD */
@@ -44,108 +52,707 @@ NSS_STATUS _nss_nwrap_initgroups_dyn(char *user, gid_t group, long int *start,
 				     long int *size, gid_t **groups,
 				     long int limit, int *errnop);
 
+/*
+ * A module backed by its own passwd and group files, so the module backend of
+ * nss_wrapper can be tested and benchmarked without winbind or sssd. Without
+ * NSS_NWRAP_PASSWD and NSS_NWRAP_GROUP every call returns NSS_STATUS_UNAVAIL.
+ *
+ * NSS_NWRAP_LATENCY_US     delay every call by this many microseconds
+ * NSS_NWRAP_JITTER_US      add a random delay of up to this many microseconds
+ * NSS_NWRAP_TRYAGAIN_RATE  percentage of calls which fail with EAGAIN
+ * NSS_NWRAP_ERANGE_RATE    percentage of calls which fail with ERANGE
+ * NSS_NWRAP_SEED           seed of the random numbers, 1 by default
+ * NSS_NWRAP_LARGE_GROUP    "name:gid:count", adds a group with count members
+ *                          called name0, name1, ...
+ *
+ * A failing call doesn't change the enumeration position, so the caller can
+ * retry it.
+ */
+
+struct nwrap_mod_config {
+	unsigned latency_us;
+	unsigned jitter_us;
+	unsigned tryagain_rate;
+	unsigned erange_rate;
+	unsigned seed;
+};
+
+struct nwrap_mod_data {
+	pthread_mutex_t mutex;
+	bool loaded;
+	bool enabled;
+	struct nwrap_mod_config config;
+
+	struct passwd *pw;
+	size_t num_pw;
+	size_t pw_idx;
+
+	struct group *gr;
+	size_t num_gr;
+	size_t gr_idx;
+};
+
+static struct nwrap_mod_data nwrap_mod = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static __thread unsigned nwrap_mod_rand_state;
+static __thread bool nwrap_mod_rand_seeded;
+
+static unsigned nwrap_mod_env_uint(const char *name, unsigned dflt)
+{
+	const char *env = getenv(name);
+
+	if (env == NULL || env[0] == '\0') {
+		return dflt;
+	}
+
+	return (unsigned)strtoul(env, NULL, 10);
+}
+
+static char *nwrap_mod_read_file(const char *path)
+{
+	char *buf = NULL;
+	size_t size = 0;
+	size_t n;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return NULL;
+	}
+
+	do {
+		char *tmp = realloc(buf, size + 4096 + 1);
+
+		if (tmp == NULL) {
+			free(buf);
+			fclose(fp);
+			return NULL;
+		}
+		buf = tmp;
+		n = fread(buf + size, 1, 4096, fp);
+		size += n;
+	} while (n == 4096);
+	fclose(fp);
+
+	buf[size] = '\0';
+	return buf;
+}
+
+/* Split s at sep into at most num fields, returns the number of fields */
+static size_t nwrap_mod_split(char *s, char sep, char **fields, size_t num)
+{
+	size_t n = 0;
+
+	while (n < num) {
+		char *p;
+
+		fields[n++] = s;
+		p = strchr(s, sep);
+		if (p == NULL || n == num) {
+			break;
+		}
+		*p = '\0';
+		s = p + 1;
+	}
+
+	return n;
+}
+
+/* The lines of the file, the buffer is kept for the lifetime of the module */
+static char **nwrap_mod_lines(const char *path, size_t *pnum)
+{
+	char **lines = NULL;
+	size_t num = 0;
+	char *buf;
+	char *line;
+	char *nl;
+
+	buf = nwrap_mod_read_file(path);
+	if (buf == NULL) {
+		return NULL;
+	}
+
+	for (line = buf; line[0] != '\0'; line = nl + 1) {
+		char **tmp;
+
+		nl = strchr(line, '\n');
+		if (nl == NULL) {
+			nl = line + strlen(line) - 1;
+		} else {
+			*nl = '\0';
+		}
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
+		}
+
+		tmp = realloc(lines, (num + 1) * sizeof(char *));
+		if (tmp == NULL) {
+			free(lines);
+			return NULL;
+		}
+		lines = tmp;
+		lines[num++] = line;
+	}
+
+	*pnum = num;
+	return lines;
+}
+
+static bool nwrap_mod_load_passwd(const char *path)
+{
+	char **lines;
+	size_t num = 0;
+	size_t i;
+
+	lines = nwrap_mod_lines(path, &num);
+	if (lines == NULL) {
+		return false;
+	}
+
+	nwrap_mod.pw = calloc(num + 1, sizeof(struct passwd));
+	if (nwrap_mod.pw == NULL) {
+		free(lines);
+		return false;
+	}
+
+	for (i = 0; i < num; i++) {
+		struct passwd *pw = &nwrap_mod.pw[nwrap_mod.num_pw];
+		char *f[7];
+
+		if (nwrap_mod_split(lines[i], ':', f, 7) != 7) {
+			continue;
+		}
+		pw->pw_name = f[0];
+		pw->pw_passwd = f[1];
+		pw->pw_uid = (uid_t)strtoul(f[2], NULL, 10);
+		pw->pw_gid = (gid_t)strtoul(f[3], NULL, 10);
+		pw->pw_gecos = f[4];
+		pw->pw_dir = f[5];
+		pw->pw_shell = f[6];
+		nwrap_mod.num_pw++;
+	}
+
+	free(lines);
+	return true;
+}
+
+static bool nwrap_mod_add_group(char *name, char *passwd, gid_t gid,
+				char **mem)
+{
+	struct group *tmp;
+
+	tmp = realloc(nwrap_mod.gr, (nwrap_mod.num_gr + 1) * sizeof(struct group));
+	if (tmp == NULL) {
+		return false;
+	}
+	nwrap_mod.gr = tmp;
+
+	tmp = &nwrap_mod.gr[nwrap_mod.num_gr++];
+	tmp->gr_name = name;
+	tmp->gr_passwd = passwd;
+	tmp->gr_gid = gid;
+	tmp->gr_mem = mem;
+
+	return true;
+}
+
+static bool nwrap_mod_load_group(const char *path)
+{
+	char **lines;
+	size_t num = 0;
+	size_t i;
+
+	lines = nwrap_mod_lines(path, &num);
+	if (lines == NULL) {
+		return false;
+	}
+
+	for (i = 0; i < num; i++) {
+		char *f[4];
+		char **mem;
+		size_t num_mem = 1;
+		const char *p;
+
+		if (nwrap_mod_split(lines[i], ':', f, 4) != 4) {
+			continue;
+		}
+
+		for (p = f[3]; *p != '\0'; p++) {
+			num_mem += (*p == ',');
+		}
+		mem = calloc(num_mem + 1, sizeof(char *));
+		if (mem == NULL) {
+			free(lines);
+			return false;
+		}
+		if (f[3][0] != '\0') {
+			nwrap_mod_split(f[3], ',', mem, num_mem);
+		}
+
+		if (!nwrap_mod_add_group(f[0], f[1],
+					 (gid_t)strtoul(f[2], NULL, 10), mem)) {
+			free(mem);
+			free(lines);
+			return false;
+		}
+	}
+
+	free(lines);
+	return true;
+}
+
+/* NSS_NWRAP_LARGE_GROUP=name:gid:count */
+static bool nwrap_mod_load_large_group(const char *spec)
+{
+	char *f[3];
+	char **mem;
+	char *copy;
+	size_t count;
+	size_t i;
+
+	copy = strdup(spec);
+	if (copy == NULL) {
+		return false;
+	}
+	if (nwrap_mod_split(copy, ':', f, 3) != 3) {
+		free(copy);
+		return false;
+	}
+	count = strtoul(f[2], NULL, 10);
+
+	mem = calloc(count + 1, sizeof(char *));
+	if (mem == NULL) {
+		free(copy);
+		return false;
+	}
+	for (i = 0; i < count; i++) {
+		size_t len = strlen(f[0]) + 24;
+
+		mem[i] = malloc(len);
+		if (mem[i] == NULL) {
+			return false;
+		}
+		snprintf(mem[i], len, "%s%zu", f[0], i);
+	}
+
+	return nwrap_mod_add_group(f[0], (char *)"x",
+				   (gid_t)strtoul(f[1], NULL, 10), mem);
+}
+
+/* Load the files with the first call, returns if the module is enabled */
+static bool nwrap_mod_init(void)
+{
+	const char *passwd;
+	const char *group;
+	const char *large;
+	bool ok = true;
+
+	pthread_mutex_lock(&nwrap_mod.mutex);
+	if (nwrap_mod.loaded) {
+		pthread_mutex_unlock(&nwrap_mod.mutex);
+		return nwrap_mod.enabled;
+	}
+	nwrap_mod.loaded = true;
+
+	passwd = getenv("NSS_NWRAP_PASSWD");
+	group = getenv("NSS_NWRAP_GROUP");
+	if (passwd == NULL || group == NULL) {
+		pthread_mutex_unlock(&nwrap_mod.mutex);
+		return false;
+	}
+
+	nwrap_mod.config.latency_us = nwrap_mod_env_uint("NSS_NWRAP_LATENCY_US", 0);
+	nwrap_mod.config.jitter_us = nwrap_mod_env_uint("NSS_NWRAP_JITTER_US", 0);
+	nwrap_mod.config.tryagain_rate =
+		nwrap_mod_env_uint("NSS_NWRAP_TRYAGAIN_RATE", 0);
+	nwrap_mod.config.erange_rate =
+		nwrap_mod_env_uint("NSS_NWRAP_ERANGE_RATE", 0);
+	nwrap_mod.config.seed = nwrap_mod_env_uint("NSS_NWRAP_SEED", 1);
+
+	ok = nwrap_mod_load_passwd(passwd) && nwrap_mod_load_group(group);
+
+	large = getenv("NSS_NWRAP_LARGE_GROUP");
+	if (ok && large != NULL && large[0] != '\0') {
+		ok = nwrap_mod_load_large_group(large);
+	}
+
+	nwrap_mod.enabled = ok;
+	pthread_mutex_unlock(&nwrap_mod.mutex);
+
+	return ok;
+}
+
+static unsigned nwrap_mod_rand(void)
+{
+	if (!nwrap_mod_rand_seeded) {
+		nwrap_mod_rand_state = nwrap_mod.config.seed;
+		nwrap_mod_rand_seeded = true;
+	}
+
+	return (unsigned)rand_r(&nwrap_mod_rand_state);
+}
+
+/*
+ * Every call starts here. It waits for the configured latency and returns
+ * false with *errnop set if a failure is injected.
+ */
+static bool nwrap_mod_call(int *errnop)
+{
+	const struct nwrap_mod_config *c = &nwrap_mod.config;
+	unsigned delay = c->latency_us;
+
+	if (c->jitter_us > 0) {
+		delay += nwrap_mod_rand() % (c->jitter_us + 1);
+	}
+	if (delay > 0) {
+		struct timespec ts = {
+			.tv_sec = delay / 1000000,
+			.tv_nsec = (long)(delay % 1000000) * 1000,
+		};
+
+		while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+			continue;
+		}
+	}
+
+	if (c->tryagain_rate > 0 && nwrap_mod_rand() % 100 < c->tryagain_rate) {
+		*errnop = EAGAIN;
+		return false;
+	}
+	if (c->erange_rate > 0 && nwrap_mod_rand() % 100 < c->erange_rate) {
+		*errnop = ERANGE;
+		return false;
+	}
+
+	return true;
+}
+
+/* Reserve len bytes of the buffer */
+static char *nwrap_mod_alloc(char **buf, size_t *buflen, size_t len)
+{
+	char *p = *buf;
+
+	if (len > *buflen) {
+		return NULL;
+	}
+	*buf += len;
+	*buflen -= len;
+
+	return p;
+}
+
+static char *nwrap_mod_strdup(char **buf, size_t *buflen, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p = nwrap_mod_alloc(buf, buflen, len);
+
+	if (p != NULL) {
+		memcpy(p, s, len);
+	}
+
+	return p;
+}
+
+static NSS_STATUS nwrap_mod_copy_pw(const struct passwd *src,
+				    struct passwd *dst,
+				    char *buf, size_t buflen, int *errnop)
+{
+	dst->pw_uid = src->pw_uid;
+	dst->pw_gid = src->pw_gid;
+	dst->pw_name = nwrap_mod_strdup(&buf, &buflen, src->pw_name);
+	dst->pw_passwd = nwrap_mod_strdup(&buf, &buflen, src->pw_passwd);
+	dst->pw_gecos = nwrap_mod_strdup(&buf, &buflen, src->pw_gecos);
+	dst->pw_dir = nwrap_mod_strdup(&buf, &buflen, src->pw_dir);
+	dst->pw_shell = nwrap_mod_strdup(&buf, &buflen, src->pw_shell);
+	if (dst->pw_name == NULL || dst->pw_passwd == NULL ||
+	    dst->pw_gecos == NULL || dst->pw_dir == NULL ||
+	    dst->pw_shell == NULL) {
+		*errnop = ERANGE;
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	return NSS_STATUS_SUCCESS;
+}
+
+static NSS_STATUS nwrap_mod_copy_gr(const struct group *src,
+				    struct group *dst,
+				    char *buf, size_t buflen, int *errnop)
+{
+	size_t pad = (sizeof(char *) - (uintptr_t)buf % sizeof(char *)) %
+		     sizeof(char *);
+	size_t num = 0;
+	size_t i;
+
+	while (src->gr_mem[num] != NULL) {
+		num++;
+	}
+
+	if (nwrap_mod_alloc(&buf, &buflen, pad) == NULL) {
+		goto erange;
+	}
+	dst->gr_mem = (char **)(void *)nwrap_mod_alloc(&buf, &buflen,
+						(num + 1) * sizeof(char *));
+	if (dst->gr_mem == NULL) {
+		goto erange;
+	}
+	for (i = 0; i < num; i++) {
+		dst->gr_mem[i] = nwrap_mod_strdup(&buf, &buflen,
+						  src->gr_mem[i]);
+		if (dst->gr_mem[i] == NULL) {
+			goto erange;
+		}
+	}
+	dst->gr_mem[num] = NULL;
+
+	dst->gr_gid = src->gr_gid;
+	dst->gr_name = nwrap_mod_strdup(&buf, &buflen, src->gr_name);
+	dst->gr_passwd = nwrap_mod_strdup(&buf, &buflen, src->gr_passwd);
+	if (dst->gr_name == NULL || dst->gr_passwd == NULL) {
+		goto erange;
+	}
+
+	return NSS_STATUS_SUCCESS;
+
+erange:
+	*errnop = ERANGE;
+	return NSS_STATUS_TRYAGAIN;
+}
+
 NSS_STATUS _nss_nwrap_setpwent(void)
 {
-	return NSS_STATUS_UNAVAIL;
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+
+	pthread_mutex_lock(&nwrap_mod.mutex);
+	nwrap_mod.pw_idx = 0;
+	pthread_mutex_unlock(&nwrap_mod.mutex);
+
+	return NSS_STATUS_SUCCESS;
 }
 
 NSS_STATUS _nss_nwrap_endpwent(void)
 {
-	return NSS_STATUS_UNAVAIL;
+	return _nss_nwrap_setpwent();
 }
 
 NSS_STATUS _nss_nwrap_getpwent_r(struct passwd *result, char *buffer,
 				 size_t buflen, int *errnop)
 {
-	(void) result;
-	(void) buffer;
-	(void) buflen;
-	(void) errnop;
+	NSS_STATUS status;
 
-	return NSS_STATUS_UNAVAIL;
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	pthread_mutex_lock(&nwrap_mod.mutex);
+	if (nwrap_mod.pw_idx >= nwrap_mod.num_pw) {
+		pthread_mutex_unlock(&nwrap_mod.mutex);
+		*errnop = ENOENT;
+		return NSS_STATUS_NOTFOUND;
+	}
+	status = nwrap_mod_copy_pw(&nwrap_mod.pw[nwrap_mod.pw_idx],
+				   result, buffer, buflen, errnop);
+	if (status == NSS_STATUS_SUCCESS) {
+		nwrap_mod.pw_idx++;
+	}
+	pthread_mutex_unlock(&nwrap_mod.mutex);
+
+	return status;
 }
 
 NSS_STATUS _nss_nwrap_getpwuid_r(uid_t uid, struct passwd *result,
 				 char *buffer, size_t buflen, int *errnop)
 {
-	(void) uid;
-	(void) result;
-	(void) buffer;
-	(void) buflen;
-	(void) errnop;
+	size_t i;
+
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	for (i = 0; i < nwrap_mod.num_pw; i++) {
+		if (nwrap_mod.pw[i].pw_uid == uid) {
+			return nwrap_mod_copy_pw(&nwrap_mod.pw[i], result,
+						 buffer, buflen, errnop);
+		}
+	}
 
-	return NSS_STATUS_UNAVAIL;
+	*errnop = ENOENT;
+	return NSS_STATUS_NOTFOUND;
 }
 
 NSS_STATUS _nss_nwrap_getpwnam_r(const char *name, struct passwd *result,
 				 char *buffer, size_t buflen, int *errnop)
 {
-	(void) name;
-	(void) result;
-	(void) buffer;
-	(void) buflen;
-	(void) errnop;
+	size_t i;
 
-	return NSS_STATUS_UNAVAIL;
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	for (i = 0; i < nwrap_mod.num_pw; i++) {
+		if (strcmp(nwrap_mod.pw[i].pw_name, name) == 0) {
+			return nwrap_mod_copy_pw(&nwrap_mod.pw[i], result,
+						 buffer, buflen, errnop);
+		}
+	}
+
+	*errnop = ENOENT;
+	return NSS_STATUS_NOTFOUND;
 }
 
 NSS_STATUS _nss_nwrap_setgrent(void)
 {
-	return NSS_STATUS_UNAVAIL;
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+
+	pthread_mutex_lock(&nwrap_mod.mutex);
+	nwrap_mod.gr_idx = 0;
+	pthread_mutex_unlock(&nwrap_mod.mutex);
+
+	return NSS_STATUS_SUCCESS;
 }
 
 NSS_STATUS _nss_nwrap_endgrent(void)
 {
-	return NSS_STATUS_UNAVAIL;
+	return _nss_nwrap_setgrent();
 }
 
 NSS_STATUS _nss_nwrap_getgrent_r(struct group *result, char *buffer,
 				 size_t buflen, int *errnop)
 {
-	(void) result;
-	(void) buffer;
-	(void) buflen;
-	(void) errnop;
+	NSS_STATUS status;
 
-	return NSS_STATUS_UNAVAIL;
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	pthread_mutex_lock(&nwrap_mod.mutex);
+	if (nwrap_mod.gr_idx >= nwrap_mod.num_gr) {
+		pthread_mutex_unlock(&nwrap_mod.mutex);
+		*errnop = ENOENT;
+		return NSS_STATUS_NOTFOUND;
+	}
+	status = nwrap_mod_copy_gr(&nwrap_mod.gr[nwrap_mod.gr_idx],
+				   result, buffer, buflen, errnop);
+	if (status == NSS_STATUS_SUCCESS) {
+		nwrap_mod.gr_idx++;
+	}
+	pthread_mutex_unlock(&nwrap_mod.mutex);
+
+	return status;
 }
 
 NSS_STATUS _nss_nwrap_getgrnam_r(const char *name, struct group *result,
 				 char *buffer, size_t buflen, int *errnop)
 {
-	(void) name;
-	(void) result;
-	(void) buffer;
-	(void) buflen;
-	(void) errnop;
+	size_t i;
+
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	for (i = 0; i < nwrap_mod.num_gr; i++) {
+		if (strcmp(nwrap_mod.gr[i].gr_name, name) == 0) {
+			return nwrap_mod_copy_gr(&nwrap_mod.gr[i], result,
+						 buffer, buflen, errnop);
+		}
+	}
 
-	return NSS_STATUS_UNAVAIL;
+	*errnop = ENOENT;
+	return NSS_STATUS_NOTFOUND;
 }
 
 NSS_STATUS _nss_nwrap_getgrgid_r(gid_t gid, struct group *result, char *buffer,
 				 size_t buflen, int *errnop)
 {
-	(void) gid;
-	(void) result;
-	(void) buffer;
-	(void) buflen;
-	(void) errnop;
+	size_t i;
 
-	return NSS_STATUS_UNAVAIL;
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	for (i = 0; i < nwrap_mod.num_gr; i++) {
+		if (nwrap_mod.gr[i].gr_gid == gid) {
+			return nwrap_mod_copy_gr(&nwrap_mod.gr[i], result,
+						 buffer, buflen, errnop);
+		}
+	}
+
+	*errnop = ENOENT;
+	return NSS_STATUS_NOTFOUND;
 }
 
 NSS_STATUS _nss_nwrap_initgroups_dyn(char *user, gid_t group, long int *start,
 				     long int *size, gid_t **groups,
 				     long int limit, int *errnop)
 {
-	(void) user;
-	(void) group;
-	(void) start;
-	(void) size;
-	(void) groups;
-	(void) limit;
-	(void) errnop;
+	size_t i;
+	size_t j;
 
-	return NSS_STATUS_UNAVAIL;
-}
+	if (!nwrap_mod_init()) {
+		return NSS_STATUS_UNAVAIL;
+	}
+	if (!nwrap_mod_call(errnop)) {
+		return NSS_STATUS_TRYAGAIN;
+	}
+
+	for (i = 0; i < nwrap_mod.num_gr; i++) {
+		const struct group *gr = &nwrap_mod.gr[i];
 
+		if (gr->gr_gid == group) {
+			continue;
+		}
+		for (j = 0; gr->gr_mem[j] != NULL; j++) {
+			if (strcmp(gr->gr_mem[j], user) == 0) {
+				break;
+			}
+		}
+		if (gr->gr_mem[j] == NULL) {
+			continue;
+		}
+
+		if (*start == *size) {
+			long int new_size = *size * 2;
+			gid_t *tmp;
+
+			if (limit > 0 && new_size > limit) {
+				new_size = limit;
+			}
+			if (new_size <= *size) {
+				break;
+			}
+			tmp = realloc(*groups, new_size * sizeof(gid_t));
+			if (tmp == NULL) {
+				*errnop = ENOMEM;
+				return NSS_STATUS_TRYAGAIN;
+			}
+			*groups = tmp;
+			*size = new_size;
+		}
+		(*groups)[(*start)++] = gr->gr_gid;
+	}
+
+	return NSS_STATUS_SUCCESS;
+}
@@ -232,6 +232,65 @@ static void test_nwrap_getaddrinfo_local(void **state)
 	freeaddrinfo(res);
 }
 
+static void test_nwrap_getaddrinfo_numeric(void **state)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct sockaddr_in *sinp;
+	struct sockaddr_in6 *sin6p;
+	char ip6[INET6_ADDRSTRLEN];
+	int rc;
+
+	(void) state; /* unused */
+
+	/* Not in the hosts file */
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_CANONNAME;
+
+	rc = getaddrinfo("10.1.2.3", "4711", &hints, &res);
+	assert_int_equal(rc, 0);
+	assert_non_null(res);
+
+	assert_int_equal(res->ai_family, AF_INET);
+	assert_int_equal(res->ai_protocol, IPPROTO_TCP);
+	assert_non_null(res->ai_canonname);
+	assert_string_equal(res->ai_canonname, "10.1.2.3");
+
+	sinp = (struct sockaddr_in *)res->ai_addr;
+	assert_int_equal(ntohs(sinp->sin_port), 4711);
+	assert_string_equal(inet_ntoa(sinp->sin_addr), "10.1.2.3");
+	assert_null(res->ai_next);
+
+	freeaddrinfo(res);
+	res = NULL;
+
+	/* Wildcard addresses, IPv6 first */
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	rc = getaddrinfo(NULL, "4711", &hints, &res);
+	assert_int_equal(rc, 0);
+	assert_non_null(res);
+
+	assert_int_equal(res->ai_family, AF_INET6);
+	sin6p = (struct sockaddr_in6 *)res->ai_addr;
+	assert_int_equal(ntohs(sin6p->sin6_port), 4711);
+	inet_ntop(AF_INET6, (void *)&sin6p->sin6_addr, ip6, sizeof(ip6));
+	assert_string_equal(ip6, "::");
+
+	assert_non_null(res->ai_next);
+	assert_int_equal(res->ai_next->ai_family, AF_INET);
+	sinp = (struct sockaddr_in *)res->ai_next->ai_addr;
+	assert_string_equal(inet_ntoa(sinp->sin_addr), "0.0.0.0");
+	assert_null(res->ai_next->ai_next);
+
+	freeaddrinfo(res);
+}
+
 static void test_nwrap_getaddrinfo_name(void **state)
 {
 	struct addrinfo hints;
@@ -537,8 +596,7 @@ static void test_nwrap_getaddrinfo_flags_ai_numericserv(void **state)
 	hints.ai_canonname = NULL;
 
 	/*
-	 * Calls with NULL name are handled by libc,
-	 * even if nss_wrapper is enabled
+	 * Calls with NULL name return the wildcard address
 	 */
 
 	rc = getaddrinfo(NULL, "echo", &hints, &res);
@@ -674,6 +732,7 @@ int main(void) {
 		cmocka_unit_test(test_nwrap_getaddrinfo),
 		cmocka_unit_test(test_nwrap_getaddrinfo_any),
 		cmocka_unit_test(test_nwrap_getaddrinfo_local),
+		cmocka_unit_test(test_nwrap_getaddrinfo_numeric),
 		cmocka_unit_test(test_nwrap_getaddrinfo_name),
 		cmocka_unit_test(test_nwrap_getaddrinfo_service),
 		cmocka_unit_test(test_nwrap_getaddrinfo_null),
@@ -1,6 +1,7 @@
 #include "config.h"
 
 #include <pthread.h>
+#include <sched.h>
 
 #include <stdarg.h>
 #include <stddef.h>
@@ -79,21 +80,67 @@ static void test_nwrap_gethostbyname_thread(void **state)
 	pthread_create(&th, NULL, &thread_test_gethostbyname, NULL);
 	pthread_join(th, NULL);
 
+	/* Every thread has its own result */
 	assert_non_null(he);
 	assert_non_null(he->h_name);
-#ifdef BSD
-	/*
-	 * On *BSD (and Mac OS X) systems,
-	 * data is stored in thread local storage.
-	 */
 	assert_string_equal(he->h_name, "maximegalon.galaxy.site");
-#else
-	/*
-	 * Glibc doesn't store data in thread local storage, so calling
-	 * gethostbyname from a thread overwrites the parent thread's data.
-	 */
-	assert_string_equal(he->h_name, "magrathea.galaxy.site");
-#endif
+}
+
+#define NWRAP_HE_THREADS 4
+#define NWRAP_HE_LOOKUPS 1000
+
+static const char * const thread_names[NWRAP_HE_THREADS][2] = {
+	{ "magrathea.galaxy.site", "127.0.0.11" },
+	{ "maximegalon.galaxy.site", "127.0.0.12" },
+	{ "krikkit.galaxy.site", "127.0.0.14" },
+	{ "pumpkin.bunny.net", "127.1.1.1" },
+};
+
+static void *thread_test_gethostbyname_concurrent(void *u)
+{
+	const char * const *names = (const char * const *)u;
+	struct hostent *he;
+	char ip[INET_ADDRSTRLEN];
+	int i;
+
+	for (i = 0; i < NWRAP_HE_LOOKUPS; i++) {
+		he = gethostbyname(names[0]);
+		if (he == NULL) {
+			return (void *)1;
+		}
+		/* Yield, so the other threads look up their names meanwhile */
+		sched_yield();
+		inet_ntop(AF_INET, he->h_addr_list[0], ip, sizeof(ip));
+		if (strcmp(he->h_name, names[0]) != 0 ||
+		    strcmp(ip, names[1]) != 0) {
+			return (void *)1;
+		}
+	}
+
+	return NULL;
+}
+
+static void test_nwrap_gethostbyname_concurrent(void **state)
+{
+	pthread_t th[NWRAP_HE_THREADS];
+	void *ret;
+	int rc;
+	int i;
+
+	(void) state; /* unused */
+
+	for (i = 0; i < NWRAP_HE_THREADS; i++) {
+		rc = pthread_create(&th[i], NULL,
+				    &thread_test_gethostbyname_concurrent,
+				    (void *)thread_names[i]);
+		assert_int_equal(rc, 0);
+	}
+
+	for (i = 0; i < NWRAP_HE_THREADS; i++) {
+		rc = pthread_join(th[i], &ret);
+		assert_int_equal(rc, 0);
+		assert_null(ret);
+	}
 }
 
 static void test_nwrap_gethostbyname(void **state)
@@ -118,6 +165,31 @@ static void test_nwrap_gethostbyname(void **state)
 	assert_string_equal(ip, "127.0.0.11");
 }
 
+static void test_nwrap_gethostbyname_case(void **state)
+{
+	char ip[INET_ADDRSTRLEN];
+	struct hostent *he;
+	const char *a;
+
+	(void) state; /* unused */
+
+	/* Longer than 16 bytes, mixed case and with a trailing dot */
+	he = gethostbyname("LocalNT4Member3.SAMBA.example.Com.");
+	assert_non_null(he);
+	assert_non_null(he->h_name);
+
+	assert_string_equal(he->h_name, "localnt4member3.samba.example.com");
+	assert_int_equal(he->h_addrtype, AF_INET);
+
+	a = inet_ntop(AF_INET, he->h_addr_list[0], ip, sizeof(ip));
+	assert_non_null(a);
+
+	assert_string_equal(ip, "127.0.0.4");
+
+	he = gethostbyname("LocalNT4Member3.SAMBA.example.Co");
+	assert_null(he);
+}
+
 static void test_nwrap_gethostbyname_multiple(void **state)
 {
 	struct hostent *he;
@@ -197,6 +269,30 @@ static void test_nwrap_gethostbyname2(void **state)
 	assert_non_null(a);
 
 	assert_string_equal(ip, "127.0.0.14");
+
+	/* All addresses of a family are returned in file order */
+	he = gethostbyname2("pumpkin.bunny.net", AF_INET6);
+	assert_non_null(he);
+	assert_non_null(he->h_addr_list);
+	assert_int_equal(he->h_addrtype, AF_INET6);
+
+	a = inet_ntop(AF_INET6, he->h_addr_list[0], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "2666::22");
+	a = inet_ntop(AF_INET6, he->h_addr_list[2], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "b00b:5::4");
+	assert_null(he->h_addr_list[3]);
+
+	he = gethostbyname2("pumpkin.bunny.net", AF_INET);
+	assert_non_null(he);
+	assert_non_null(he->h_addr_list);
+	assert_int_equal(he->h_addrtype, AF_INET);
+
+	a = inet_ntop(AF_INET, he->h_addr_list[1], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "127.0.0.66");
+	assert_null(he->h_addr_list[2]);
 }
 #endif /* HAVE_GETHOSTBYNAME2 */
 
@@ -250,6 +346,24 @@ static void test_nwrap_gethostbyname_r(void **state)
 	assert_non_null(a);
 
 	assert_string_equal(ip, "127.0.0.11");
+
+	/* Everything is copied to the buffer */
+	assert_true(he->h_name >= buf && he->h_name < buf + sizeof(buf));
+	assert_true(he->h_addr_list[0] >= buf &&
+		    he->h_addr_list[0] < buf + sizeof(buf));
+	assert_non_null(he->h_addr_list[1]);
+	assert_null(he->h_addr_list[2]);
+	assert_non_null(he->h_aliases[0]);
+	assert_string_equal(he->h_aliases[0], "magrathea");
+	assert_true(he->h_aliases[0] >= buf &&
+		    he->h_aliases[0] < buf + sizeof(buf));
+
+	rc = gethostbyname_r("magrathea.galaxy.site",
+			     &hb,
+			     buf, 16,
+			     &he,
+			     &herr);
+	assert_int_equal(rc, ERANGE);
 }
 #endif
 
@@ -290,7 +404,9 @@ int main(void) {
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_nwrap_gethostname),
 		cmocka_unit_test(test_nwrap_gethostbyname),
+		cmocka_unit_test(test_nwrap_gethostbyname_case),
 		cmocka_unit_test(test_nwrap_gethostbyname_thread),
+		cmocka_unit_test(test_nwrap_gethostbyname_concurrent),
 #ifdef HAVE_GETHOSTBYNAME2
 		cmocka_unit_test(test_nwrap_gethostbyname2),
 #endif
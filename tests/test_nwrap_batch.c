@@ -0,0 +1,180 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <string.h>
+#include <sys/types.h>
+
+int nss_wrapper_getpwnam_batch(const char * const *names, size_t num,
+			       struct passwd *pwds, int *errors,
+			       char *buf, size_t buflen);
+int nss_wrapper_getpwuid_batch(const uid_t *uids, size_t num,
+			       struct passwd *pwds, int *errors,
+			       char *buf, size_t buflen);
+int nss_wrapper_getgrnam_batch(const char * const *names, size_t num,
+			       struct group *grps, int *errors,
+			       char *buf, size_t buflen);
+int nss_wrapper_getgrgid_batch(const gid_t *gids, size_t num,
+			       struct group *grps, int *errors,
+			       char *buf, size_t buflen);
+
+static void test_nwrap_getpwnam_batch(void **state)
+{
+	const char * const names[] = { "bob", "nonexisting", "alice", "root" };
+	struct passwd pwds[4];
+	int errors[4];
+	char buf[1024];
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_getpwnam_batch(names, 4, pwds, errors,
+					buf, sizeof(buf));
+	assert_int_equal(rc, 3);
+
+	assert_int_equal(errors[0], 0);
+	assert_string_equal(pwds[0].pw_name, "bob");
+	assert_int_equal(pwds[0].pw_uid, 1000);
+	assert_string_equal(pwds[0].pw_gecos, "bob gecos");
+	assert_string_equal(pwds[0].pw_shell, "/bin/false");
+
+	assert_int_equal(errors[1], ENOENT);
+
+	assert_int_equal(errors[2], 0);
+	assert_string_equal(pwds[2].pw_name, "alice");
+
+	assert_int_equal(errors[3], 0);
+	assert_string_equal(pwds[3].pw_name, "root");
+	assert_int_equal(pwds[3].pw_uid, 65534);
+
+	/* The entries must not overlap in the buffer */
+	assert_string_equal(pwds[0].pw_name, "bob");
+	assert_string_equal(pwds[0].pw_shell, "/bin/false");
+	assert_true(pwds[2].pw_name > pwds[0].pw_shell);
+	assert_true(pwds[3].pw_name > pwds[2].pw_shell);
+}
+
+static void test_nwrap_getpwuid_batch(void **state)
+{
+	const uid_t uids[] = { 65534, 1000, 4711 };
+	struct passwd pwds[3];
+	int errors[3];
+	char buf[1024];
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_getpwuid_batch(uids, 3, pwds, errors,
+					buf, sizeof(buf));
+	assert_int_equal(rc, 2);
+
+	assert_int_equal(errors[0], 0);
+	assert_string_equal(pwds[0].pw_name, "root");
+	assert_int_equal(errors[1], 0);
+	assert_string_equal(pwds[1].pw_name, "bob");
+	assert_int_equal(errors[2], ENOENT);
+}
+
+static void test_nwrap_getgrnam_batch(void **state)
+{
+	const char * const names[] = { "biggroup", "users", "nogroup" };
+	struct group grps[3];
+	int errors[3];
+	char buf[1024];
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_getgrnam_batch(names, 3, grps, errors,
+					buf, sizeof(buf));
+	assert_int_equal(rc, 3);
+
+	assert_int_equal(errors[0], 0);
+	assert_string_equal(grps[0].gr_name, "biggroup");
+	assert_int_equal(grps[0].gr_gid, 2000);
+	assert_string_equal(grps[0].gr_mem[0], "root");
+	assert_string_equal(grps[0].gr_mem[10], "member8");
+	assert_null(grps[0].gr_mem[11]);
+
+	assert_int_equal(errors[1], 0);
+	assert_string_equal(grps[1].gr_name, "users");
+	assert_null(grps[1].gr_mem[0]);
+
+	assert_int_equal(errors[2], 0);
+	assert_string_equal(grps[2].gr_name, "nogroup");
+	assert_string_equal(grps[2].gr_mem[0], "nobody");
+	assert_null(grps[2].gr_mem[1]);
+
+	/* Still intact after the following entries have been copied */
+	assert_string_equal(grps[0].gr_mem[10], "member8");
+}
+
+static void test_nwrap_getgrgid_batch(void **state)
+{
+	const gid_t gids[] = { 4711, 65532, 1000 };
+	struct group grps[3];
+	int errors[3];
+	char buf[1024];
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_getgrgid_batch(gids, 3, grps, errors,
+					buf, sizeof(buf));
+	assert_int_equal(rc, 2);
+
+	assert_int_equal(errors[0], ENOENT);
+	assert_int_equal(errors[1], 0);
+	assert_string_equal(grps[1].gr_name, "root");
+	assert_int_equal(errors[2], 0);
+	assert_string_equal(grps[2].gr_name, "users");
+}
+
+static void test_nwrap_batch_erange(void **state)
+{
+	const char * const names[] = { "bob", "biggroup" };
+	struct passwd pwds[2];
+	struct group grps[2];
+	int errors[2];
+	char buf[64];
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_getpwnam_batch(names, 1, pwds, errors, buf, 8);
+	assert_int_equal(rc, 0);
+	assert_int_equal(errors[0], ERANGE);
+
+	rc = nss_wrapper_getgrnam_batch(names, 2, grps, errors,
+					buf, sizeof(buf));
+	assert_int_equal(rc, 0);
+	assert_int_equal(errors[0], ENOENT);
+	assert_int_equal(errors[1], ERANGE);
+
+	rc = nss_wrapper_getpwnam_batch(NULL, 1, pwds, errors,
+					buf, sizeof(buf));
+	assert_int_equal(rc, -1);
+	assert_int_equal(errno, EINVAL);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_getpwnam_batch),
+		cmocka_unit_test(test_nwrap_getpwuid_batch),
+		cmocka_unit_test(test_nwrap_getgrnam_batch),
+		cmocka_unit_test(test_nwrap_getgrgid_batch),
+		cmocka_unit_test(test_nwrap_batch_erange),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
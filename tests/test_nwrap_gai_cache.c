@@ -0,0 +1,128 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <string.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+unsigned long nss_wrapper_gai_cache_hits(void);
+unsigned long nss_wrapper_hosts_fallbacks(void);
+
+/*
+ * A label of more than 63 characters can't be put into a DNS query, so libc
+ * fails with EAI_NONAME without asking a name server.
+ */
+#define NWRAP_GAI_LONG_NAME \
+	"nonexisting-nonexisting-nonexisting-" \
+	"nonexisting-nonexisting-nonexisting.invalid"
+
+static void test_nwrap_gai_cache_negative(void **state)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	unsigned long hits;
+	unsigned long fallbacks;
+	int i;
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	hits = nss_wrapper_gai_cache_hits();
+	fallbacks = nss_wrapper_hosts_fallbacks();
+
+	rc = getaddrinfo(NWRAP_GAI_LONG_NAME, "80", &hints, &res);
+	assert_int_equal(rc, EAI_NONAME);
+	assert_null(res);
+	assert_int_equal(nss_wrapper_gai_cache_hits(), hits);
+	assert_int_equal(nss_wrapper_hosts_fallbacks(), fallbacks + 1);
+
+	/* The retries are answered from the cache */
+	for (i = 1; i <= 3; i++) {
+		rc = getaddrinfo(NWRAP_GAI_LONG_NAME, "80", &hints, &res);
+		assert_int_equal(rc, EAI_NONAME);
+		assert_null(res);
+		assert_int_equal(nss_wrapper_gai_cache_hits(), hits + i);
+	}
+	assert_int_equal(nss_wrapper_hosts_fallbacks(), fallbacks + 1);
+
+	/* Other hints are a different entry */
+	hints.ai_family = AF_INET;
+	rc = getaddrinfo(NWRAP_GAI_LONG_NAME, "80", &hints, &res);
+	assert_int_equal(rc, EAI_NONAME);
+	assert_int_equal(nss_wrapper_gai_cache_hits(), hits + 3);
+}
+
+static void test_nwrap_gai_cache_positive(void **state)
+{
+	struct addrinfo hints;
+	struct addrinfo *res1 = NULL;
+	struct addrinfo *res2 = NULL;
+	struct addrinfo *a;
+	struct addrinfo *b;
+	unsigned long hits;
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_CANONNAME;
+
+	/* Not in the hosts file of nss_wrapper, so libc gets asked */
+	rc = getaddrinfo("localhost", "80", &hints, &res1);
+	if (rc != 0) {
+		/* No localhost entry on this system, nothing to cache */
+		skip();
+	}
+
+	/* This one is served from the cache */
+	hits = nss_wrapper_gai_cache_hits();
+	rc = getaddrinfo("localhost", "80", &hints, &res2);
+	assert_int_equal(rc, 0);
+	assert_non_null(res2);
+	assert_int_equal(nss_wrapper_gai_cache_hits(), hits + 1);
+	assert_true(res1 != res2);
+
+	for (a = res1, b = res2;
+	     a != NULL && b != NULL;
+	     a = a->ai_next, b = b->ai_next) {
+		assert_int_equal(a->ai_family, b->ai_family);
+		assert_int_equal(a->ai_socktype, b->ai_socktype);
+		assert_int_equal(a->ai_addrlen, b->ai_addrlen);
+		assert_memory_equal(a->ai_addr, b->ai_addr, a->ai_addrlen);
+		assert_true(a->ai_addr != b->ai_addr);
+		if (a->ai_canonname != NULL) {
+			assert_string_equal(a->ai_canonname, b->ai_canonname);
+		}
+	}
+	assert_null(a);
+	assert_null(b);
+
+	freeaddrinfo(res1);
+	freeaddrinfo(res2);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_gai_cache_negative),
+		cmocka_unit_test(test_nwrap_gai_cache_positive),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
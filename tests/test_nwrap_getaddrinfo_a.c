@@ -0,0 +1,314 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+static void assert_ai_ipv4(const struct addrinfo *ai, const char *expected)
+{
+	char ip[INET_ADDRSTRLEN];
+	const struct sockaddr_in *sinp;
+	const char *a;
+
+	assert_non_null(ai);
+	assert_int_equal(ai->ai_family, AF_INET);
+
+	sinp = (const struct sockaddr_in *)ai->ai_addr;
+	a = inet_ntop(AF_INET, &sinp->sin_addr, ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, expected);
+}
+
+static void test_nwrap_getaddrinfo_a_nowait(void **state)
+{
+	struct addrinfo hints;
+	struct gaicb req;
+	struct gaicb *list[1] = { &req };
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	memset(&req, 0, sizeof(req));
+	req.ar_name = "magrathea.galaxy.site";
+	req.ar_request = &hints;
+
+	rc = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL);
+	assert_int_equal(rc, 0);
+
+	/* The hosts file answers it without a worker */
+	rc = gai_error(&req);
+	assert_int_equal(rc, 0);
+	assert_ai_ipv4(req.ar_result, "127.0.0.11");
+
+	rc = gai_cancel(&req);
+	assert_int_equal(rc, EAI_ALLDONE);
+
+	freeaddrinfo(req.ar_result);
+}
+
+static void test_nwrap_getaddrinfo_a_wait(void **state)
+{
+	struct addrinfo hints;
+	struct gaicb req[3];
+	struct gaicb *list[4] = { &req[0], NULL, &req[1], &req[2] };
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	memset(req, 0, sizeof(req));
+	req[0].ar_name = "127.0.0.12";
+	req[0].ar_request = &hints;
+	req[1].ar_name = "192.0.2.7";
+	req[1].ar_request = &hints;
+	req[2].ar_name = "not-a-number";
+	req[2].ar_request = &hints;
+
+	/* One of them failed */
+	rc = getaddrinfo_a(GAI_WAIT, list, 4, NULL);
+	assert_int_equal(rc, EAI_SYSTEM);
+
+	assert_int_equal(gai_error(&req[0]), 0);
+	assert_ai_ipv4(req[0].ar_result, "127.0.0.12");
+	assert_int_equal(gai_error(&req[1]), 0);
+	assert_ai_ipv4(req[1].ar_result, "192.0.2.7");
+	assert_int_equal(gai_error(&req[2]), EAI_NONAME);
+	assert_null(req[2].ar_result);
+
+	freeaddrinfo(req[0].ar_result);
+	freeaddrinfo(req[1].ar_result);
+}
+
+/* The status is kept no matter how many requests were completed since */
+static void test_nwrap_getaddrinfo_a_old_status(void **state)
+{
+	struct addrinfo hints;
+	struct gaicb old_req;
+	struct gaicb req;
+	struct gaicb *list[1];
+	int i;
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+
+	memset(&old_req, 0, sizeof(old_req));
+	old_req.ar_name = "not-a-number";
+	old_req.ar_request = &hints;
+	list[0] = &old_req;
+
+	rc = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL);
+	assert_int_equal(rc, 0);
+	assert_int_equal(gai_error(&old_req), EAI_NONAME);
+
+	memset(&req, 0, sizeof(req));
+	req.ar_name = "127.0.0.12";
+	req.ar_request = &hints;
+	list[0] = &req;
+
+	for (i = 0; i < 5000; i++) {
+		rc = getaddrinfo_a(GAI_NOWAIT, list, 1, NULL);
+		assert_int_equal(rc, 0);
+		assert_int_equal(gai_error(&req), 0);
+		freeaddrinfo(req.ar_result);
+	}
+
+	assert_int_equal(gai_error(&old_req), EAI_NONAME);
+}
+
+static pthread_mutex_t notify_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t notify_cond = PTHREAD_COND_INITIALIZER;
+static bool notified;
+
+static void notify_fn(union sigval value)
+{
+	pthread_mutex_lock(&notify_mutex);
+	notified = (value.sival_int == 42);
+	pthread_cond_signal(&notify_cond);
+	pthread_mutex_unlock(&notify_mutex);
+}
+
+static void test_nwrap_getaddrinfo_a_notify(void **state)
+{
+	struct addrinfo hints;
+	struct gaicb req;
+	struct gaicb *list[1] = { &req };
+	struct sigevent sev;
+	struct timespec deadline;
+	int rc = 0;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	memset(&req, 0, sizeof(req));
+	req.ar_name = "krikkit.galaxy.site";
+	req.ar_request = &hints;
+
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD;
+	sev.sigev_notify_function = notify_fn;
+	sev.sigev_value.sival_int = 42;
+
+	rc = getaddrinfo_a(GAI_NOWAIT, list, 1, &sev);
+	assert_int_equal(rc, 0);
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += 10;
+
+	pthread_mutex_lock(&notify_mutex);
+	while (!notified && rc == 0) {
+		rc = pthread_cond_timedwait(&notify_cond,
+					    &notify_mutex,
+					    &deadline);
+	}
+	pthread_mutex_unlock(&notify_mutex);
+
+	assert_true(notified);
+	assert_int_equal(gai_error(&req), 0);
+	assert_ai_ipv4(req.ar_result, "127.0.0.14");
+
+	freeaddrinfo(req.ar_result);
+}
+
+static void test_nwrap_getaddrinfo_a_fallback(void **state)
+{
+	struct addrinfo hints;
+	struct gaicb req;
+	const struct gaicb *list[1] = { &req };
+	struct timespec timeout = {
+		.tv_sec = 10,
+	};
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	memset(&req, 0, sizeof(req));
+	/* Not in the hosts file, so a worker asks libc */
+	req.ar_name = "localhost";
+	req.ar_request = &hints;
+
+	rc = getaddrinfo_a(GAI_NOWAIT, (struct gaicb **)list, 1, NULL);
+	assert_int_equal(rc, 0);
+
+	rc = gai_suspend(list, 1, &timeout);
+	assert_int_equal(rc, 0);
+
+	rc = gai_error(&req);
+	assert_int_not_equal(rc, EAI_INPROGRESS);
+	if (rc == 0) {
+		freeaddrinfo(req.ar_result);
+	}
+}
+
+#define NWRAP_GAI_A_FORK_REQS 32
+
+static void test_nwrap_getaddrinfo_a_fork(void **state)
+{
+	struct addrinfo hints;
+	struct gaicb req[NWRAP_GAI_A_FORK_REQS];
+	struct gaicb *list[NWRAP_GAI_A_FORK_REQS];
+	struct timespec timeout = {
+		.tv_sec = 10,
+	};
+	pid_t pid;
+	int status;
+	int i;
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+
+	memset(req, 0, sizeof(req));
+	for (i = 0; i < NWRAP_GAI_A_FORK_REQS; i++) {
+		/* Not in the hosts file, so they are queued for the workers */
+		req[i].ar_name = "localhost";
+		req[i].ar_request = &hints;
+		list[i] = &req[i];
+	}
+
+	rc = getaddrinfo_a(GAI_NOWAIT, list, NWRAP_GAI_A_FORK_REQS, NULL);
+	assert_int_equal(rc, 0);
+
+	pid = fork();
+	assert_true(pid >= 0);
+	if (pid == 0) {
+		/* Nobody runs the requests of the parent in the child */
+		for (i = 0; i < NWRAP_GAI_A_FORK_REQS; i++) {
+			if (gai_error(&req[i]) == EAI_INPROGRESS) {
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+
+	/* The parent still gets all of them */
+	for (i = 0; i < NWRAP_GAI_A_FORK_REQS; i++) {
+		const struct gaicb *one[1] = { &req[i] };
+
+		rc = gai_suspend(one, 1, &timeout);
+		assert_int_equal(rc, 0);
+
+		rc = gai_error(&req[i]);
+		assert_int_not_equal(rc, EAI_INPROGRESS);
+		if (rc == 0) {
+			freeaddrinfo(req[i].ar_result);
+		}
+	}
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_getaddrinfo_a_nowait),
+		cmocka_unit_test(test_nwrap_getaddrinfo_a_wait),
+		cmocka_unit_test(test_nwrap_getaddrinfo_a_old_status),
+		cmocka_unit_test(test_nwrap_getaddrinfo_a_notify),
+		cmocka_unit_test(test_nwrap_getaddrinfo_a_fallback),
+		cmocka_unit_test(test_nwrap_getaddrinfo_a_fork),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
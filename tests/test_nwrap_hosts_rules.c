@@ -0,0 +1,220 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+/* tests/hosts.in maps 10.10.0.0/16 and fd00:10::/112 to node%d.cluster.test */
+
+static void test_nwrap_rule_gethostbyname(void **state)
+{
+	char ip[INET_ADDRSTRLEN];
+	struct hostent *he;
+	const char *a;
+
+	(void) state; /* unused */
+
+	he = gethostbyname("node258.cluster.test");
+	assert_non_null(he);
+	assert_string_equal(he->h_name, "node258.cluster.test");
+	assert_int_equal(he->h_addrtype, AF_INET);
+	assert_non_null(he->h_aliases);
+	assert_null(he->h_aliases[0]);
+	assert_non_null(he->h_addr_list[0]);
+	assert_null(he->h_addr_list[1]);
+
+	a = inet_ntop(AF_INET, he->h_addr_list[0], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "10.10.1.2");
+
+	/* Case and a trailing dot don't matter */
+	he = gethostbyname("NODE65535.Cluster.Test.");
+	assert_non_null(he);
+	a = inet_ntop(AF_INET, he->h_addr_list[0], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "10.10.255.255");
+
+	/* Outside of the block */
+	he = gethostbyname("node65536.cluster.test");
+	assert_null(he);
+
+	/* Every address has exactly one name */
+	he = gethostbyname("node01.cluster.test");
+	assert_null(he);
+
+	he = gethostbyname("node.cluster.test");
+	assert_null(he);
+
+	he = gethostbyname("node1x.cluster.test");
+	assert_null(he);
+}
+
+#ifdef HAVE_GETHOSTBYNAME2
+static void test_nwrap_rule_gethostbyname2(void **state)
+{
+	char ip[INET6_ADDRSTRLEN];
+	struct hostent *he;
+	const char *a;
+
+	(void) state; /* unused */
+
+	he = gethostbyname2("node258.cluster.test", AF_INET6);
+	assert_non_null(he);
+	assert_string_equal(he->h_name, "node258.cluster.test");
+	assert_int_equal(he->h_addrtype, AF_INET6);
+
+	a = inet_ntop(AF_INET6, he->h_addr_list[0], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "fd00:10::102");
+}
+#endif
+
+static void test_nwrap_rule_gethostbyaddr(void **state)
+{
+	struct in_addr in;
+	struct in6_addr in6;
+	struct hostent *he;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = inet_pton(AF_INET, "10.10.1.2", &in);
+	assert_int_equal(rc, 1);
+
+	he = gethostbyaddr(&in, sizeof(in), AF_INET);
+	assert_non_null(he);
+	assert_string_equal(he->h_name, "node258.cluster.test");
+	assert_memory_equal(&in, he->h_addr_list[0], he->h_length);
+
+	rc = inet_pton(AF_INET6, "fd00:10::ffff", &in6);
+	assert_int_equal(rc, 1);
+
+	he = gethostbyaddr(&in6, sizeof(in6), AF_INET6);
+	assert_non_null(he);
+	assert_string_equal(he->h_name, "node65535.cluster.test");
+
+	rc = inet_pton(AF_INET, "10.11.0.1", &in);
+	assert_int_equal(rc, 1);
+
+	he = gethostbyaddr(&in, sizeof(in), AF_INET);
+	assert_null(he);
+}
+
+#ifdef HAVE_GETHOSTBYNAME_R
+static void test_nwrap_rule_gethostbyname_r(void **state)
+{
+	char buf[1024] = {0};
+	char small[8] = {0};
+	char ip[INET_ADDRSTRLEN];
+	struct hostent hb, *he;
+	struct hostent *he2;
+	const char *a;
+	int herr = 0;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = gethostbyname_r("node7.cluster.test",
+			     &hb,
+			     buf, sizeof(buf),
+			     &he,
+			     &herr);
+	assert_int_equal(rc, 0);
+	assert_non_null(he);
+
+	/* The result lives in buf, so another lookup doesn't change it */
+	he2 = gethostbyname("node8.cluster.test");
+	assert_non_null(he2);
+
+	assert_string_equal(he->h_name, "node7.cluster.test");
+	a = inet_ntop(AF_INET, he->h_addr_list[0], ip, sizeof(ip));
+	assert_non_null(a);
+	assert_string_equal(ip, "10.10.0.7");
+
+	rc = gethostbyname_r("node7.cluster.test",
+			     &hb,
+			     small, sizeof(small),
+			     &he,
+			     &herr);
+	assert_int_equal(rc, ERANGE);
+}
+#endif
+
+static void test_nwrap_rule_getaddrinfo(void **state)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct addrinfo *ai;
+	char ip[INET6_ADDRSTRLEN];
+	bool inet = false;
+	bool inet6 = false;
+	const char *a;
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_CANONNAME;
+
+	rc = getaddrinfo("node3.cluster.test", "80", &hints, &res);
+	assert_int_equal(rc, 0);
+	assert_non_null(res);
+	assert_string_equal(res->ai_canonname, "node3.cluster.test");
+
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		if (ai->ai_family == AF_INET) {
+			struct sockaddr_in *sinp =
+				(struct sockaddr_in *)ai->ai_addr;
+
+			a = inet_ntop(AF_INET, &sinp->sin_addr, ip, sizeof(ip));
+			assert_non_null(a);
+			assert_string_equal(ip, "10.10.0.3");
+			assert_int_equal(ntohs(sinp->sin_port), 80);
+			inet = true;
+		} else if (ai->ai_family == AF_INET6) {
+			struct sockaddr_in6 *sin6p =
+				(struct sockaddr_in6 *)ai->ai_addr;
+
+			a = inet_ntop(AF_INET6, &sin6p->sin6_addr, ip, sizeof(ip));
+			assert_non_null(a);
+			assert_string_equal(ip, "fd00:10::3");
+			inet6 = true;
+		}
+	}
+	assert_true(inet);
+	assert_true(inet6);
+
+	freeaddrinfo(res);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_rule_gethostbyname),
+#ifdef HAVE_GETHOSTBYNAME2
+		cmocka_unit_test(test_nwrap_rule_gethostbyname2),
+#endif
+		cmocka_unit_test(test_nwrap_rule_gethostbyaddr),
+#ifdef HAVE_GETHOSTBYNAME_R
+		cmocka_unit_test(test_nwrap_rule_gethostbyname_r),
+#endif
+		cmocka_unit_test(test_nwrap_rule_getaddrinfo),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -0,0 +1,73 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <string.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+unsigned long nss_wrapper_hosts_fallbacks(void);
+
+static void test_nwrap_hosts_strict_getaddrinfo(void **state)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	int rc;
+
+	(void) state; /* unused */
+
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	rc = getaddrinfo("nonexisting.galaxy.site", "80", &hints, &res);
+	assert_int_equal(rc, EAI_NONAME);
+	assert_null(res);
+
+	rc = getaddrinfo("localhost", "80", &hints, &res);
+	assert_int_equal(rc, EAI_NONAME);
+	assert_null(res);
+
+	/* The resolver must not have been asked */
+	assert_int_equal(nss_wrapper_hosts_fallbacks(), 0);
+
+	/* Names from the hosts file still work */
+	rc = getaddrinfo("magrathea.galaxy.site", "80", &hints, &res);
+	assert_int_equal(rc, 0);
+	assert_non_null(res);
+	freeaddrinfo(res);
+}
+
+static void test_nwrap_hosts_strict_gethostbyname(void **state)
+{
+	struct hostent *he;
+
+	(void) state; /* unused */
+
+	he = gethostbyname("nonexisting.galaxy.site");
+	assert_null(he);
+
+	he = gethostbyname("magrathea.galaxy.site");
+	assert_non_null(he);
+
+	assert_int_equal(nss_wrapper_hosts_fallbacks(), 0);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_hosts_strict_getaddrinfo),
+		cmocka_unit_test(test_nwrap_hosts_strict_gethostbyname),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -0,0 +1,305 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/*
+ * NSS_WRAPPER_PASSWD and NSS_WRAPPER_GROUP are the files of the testsuite
+ * followed by a drop-in directory, which is filled by the tests.
+ */
+static char passwd_dir[1024];
+static char group_dir[1024];
+
+static int get_dir(const char *env, char *dir, size_t len)
+{
+	const char *path = getenv(env);
+	const char *p;
+
+	if (path == NULL) {
+		return -1;
+	}
+	p = strrchr(path, ':');
+	if (p == NULL) {
+		return -1;
+	}
+
+	snprintf(dir, len, "%s", p + 1);
+
+	return 0;
+}
+
+static void clean_dir(const char *dir)
+{
+	struct dirent *de;
+	DIR *d;
+
+	d = opendir(dir);
+	if (d == NULL) {
+		return;
+	}
+	while ((de = readdir(d)) != NULL) {
+		char path[1280];
+
+		if (de->d_name[0] == '.') {
+			continue;
+		}
+		snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+		unlink(path);
+	}
+	closedir(d);
+}
+
+/* Replace the file like an editor would, so it gets a new inode */
+static void write_layer(const char *dir, const char *name, const char *data)
+{
+	char path[1280];
+	char tmp[1280];
+	FILE *fp;
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", dir, name);
+
+	fp = fopen(tmp, "w");
+	assert_non_null(fp);
+	fputs(data, fp);
+	fclose(fp);
+
+	rc = rename(tmp, path);
+	assert_int_equal(rc, 0);
+}
+
+static void remove_layer(const char *dir, const char *name)
+{
+	char path[1280];
+	int rc;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	rc = unlink(path);
+	assert_int_equal(rc, 0);
+}
+
+static int count_users(const char *name)
+{
+	struct passwd *pwd;
+	int num = 0;
+
+	setpwent();
+	while ((pwd = getpwent()) != NULL) {
+		if (strcmp(pwd->pw_name, name) == 0) {
+			num++;
+		}
+	}
+	endpwent();
+
+	return num;
+}
+
+static int count_groups(const char *name)
+{
+	struct group *grp;
+	int num = 0;
+
+	setgrent();
+	while ((grp = getgrent()) != NULL) {
+		if (strcmp(grp->gr_name, name) == 0) {
+			num++;
+		}
+	}
+	endgrent();
+
+	return num;
+}
+
+static void test_nwrap_layers_missing_dir(void **state)
+{
+	struct passwd *pwd;
+	int rc;
+
+	(void) state; /* unused */
+
+	/* The drop-in directory doesn't exist yet */
+	pwd = getpwnam("bob");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 1000);
+
+	rc = mkdir(passwd_dir, 0755);
+	assert_int_equal(rc, 0);
+	write_layer(passwd_dir, "05-late",
+		    "late:x:4000:4000:late:/tmp:/bin/sh\n");
+
+	pwd = getpwnam("late");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 4000);
+
+	remove_layer(passwd_dir, "05-late");
+	assert_null(getpwnam("late"));
+}
+
+static void test_nwrap_layers_passwd(void **state)
+{
+	struct passwd *pwd;
+
+	(void) state; /* unused */
+
+	pwd = getpwnam("bob");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 1000);
+	assert_null(getpwnam("carol"));
+
+	/* An overlay overrides bob and adds carol */
+	write_layer(passwd_dir, "10-test",
+		    "bob:x:3000:1000:overlay bob:/tmp:/bin/sh\n"
+		    "carol:x:3001:1000:carol:/tmp:/bin/sh\n");
+
+	pwd = getpwnam("bob");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3000);
+	assert_string_equal(pwd->pw_gecos, "overlay bob");
+
+	/* The uid of the overridden entry is gone */
+	assert_null(getpwuid(1000));
+
+	pwd = getpwuid(3001);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "carol");
+
+	pwd = getpwnam("alice");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 1001);
+
+	assert_int_equal(count_users("bob"), 1);
+	assert_int_equal(count_users("carol"), 1);
+
+	/* A later layer overrides an earlier one */
+	write_layer(passwd_dir, "20-test",
+		    "carol:x:3002:1000:carol again:/tmp:/bin/sh\n");
+
+	pwd = getpwnam("carol");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3002);
+	assert_null(getpwuid(3001));
+	assert_int_equal(count_users("carol"), 1);
+
+	/* Changing the first overlay reparses it and the later ones */
+	write_layer(passwd_dir, "10-test",
+		    "dave:x:3003:1000:dave:/tmp:/bin/sh\n");
+
+	pwd = getpwnam("bob");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 1000);
+
+	pwd = getpwnam("carol");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3002);
+
+	pwd = getpwnam("dave");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3003);
+
+	/* A "-name" line removes the user of the earlier layers */
+	write_layer(passwd_dir, "30-test", "-alice\n");
+
+	assert_null(getpwnam("alice"));
+	assert_null(getpwuid(1001));
+	assert_int_equal(count_users("alice"), 0);
+
+	remove_layer(passwd_dir, "30-test");
+
+	pwd = getpwnam("alice");
+	assert_non_null(pwd);
+
+	/* Dropping the last layer truncates the database */
+	remove_layer(passwd_dir, "20-test");
+
+	assert_null(getpwnam("carol"));
+	pwd = getpwnam("dave");
+	assert_non_null(pwd);
+
+	remove_layer(passwd_dir, "10-test");
+
+	assert_null(getpwnam("dave"));
+	pwd = getpwuid(1000);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "bob");
+	assert_int_equal(count_users("bob"), 1);
+}
+
+static void test_nwrap_layers_group(void **state)
+{
+	struct group *grp;
+
+	(void) state; /* unused */
+
+	grp = getgrnam("biggroup");
+	assert_non_null(grp);
+	assert_non_null(grp->gr_mem[10]);
+
+	write_layer(group_dir, "10-test",
+		    "biggroup:x:2000:carol\n"
+		    "testers:x:3000:alice,bob\n");
+
+	grp = getgrnam("biggroup");
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_mem[0], "carol");
+	assert_null(grp->gr_mem[1]);
+
+	grp = getgrgid(2000);
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_mem[0], "carol");
+
+	grp = getgrnam("testers");
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_mem[1], "bob");
+
+	assert_int_equal(count_groups("biggroup"), 1);
+
+	remove_layer(group_dir, "10-test");
+
+	assert_null(getgrnam("testers"));
+	grp = getgrgid(2000);
+	assert_non_null(grp);
+	assert_non_null(grp->gr_mem[10]);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_layers_missing_dir),
+		cmocka_unit_test(test_nwrap_layers_passwd),
+		cmocka_unit_test(test_nwrap_layers_group),
+	};
+
+	rc = get_dir("NSS_WRAPPER_PASSWD", passwd_dir, sizeof(passwd_dir));
+	if (rc != 0) {
+		return 1;
+	}
+	rc = get_dir("NSS_WRAPPER_GROUP", group_dir, sizeof(group_dir));
+	if (rc != 0) {
+		return 1;
+	}
+
+	/* The passwd directory is created by the first test */
+	clean_dir(passwd_dir);
+	rmdir(passwd_dir);
+	mkdir(group_dir, 0755);
+	clean_dir(group_dir);
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -0,0 +1,434 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+
+/*
+ * Test the module backend with libnss_nwrap.so, which serves the users and
+ * groups of module_passwd and module_group. The test runs a second time with
+ * injected latency and failures, then only the lookups which retry like a
+ * real caller are checked.
+ */
+
+#define NWRAP_MODULE_LOOKUPS 2000
+#define NWRAP_MODULE_LARGE_MEMBERS 5000
+#define NWRAP_MODULE_MAX_BUFLEN (1024 * 1024)
+
+static double nwrap_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static bool nwrap_faults_enabled(void)
+{
+	const char *env = getenv("NSS_NWRAP_ERANGE_RATE");
+
+	return env != NULL && atoi(env) > 0;
+}
+
+/* Retry like a real caller, grow the buffer on ERANGE */
+static int getpwnam_retry(const char *name, struct passwd *pwd,
+			  char **buf, size_t *buflen, int *retries)
+{
+	struct passwd *res = NULL;
+	int rc;
+
+	for (;;) {
+		rc = getpwnam_r(name, pwd, *buf, *buflen, &res);
+		if (rc == ERANGE) {
+			/* Injected failures must not grow it forever */
+			if (*buflen < NWRAP_MODULE_MAX_BUFLEN) {
+				*buflen *= 2;
+				*buf = realloc(*buf, *buflen);
+				assert_non_null(*buf);
+			}
+		} else if (rc != EAGAIN) {
+			break;
+		}
+		(*retries)++;
+	}
+	if (rc == 0) {
+		assert_true(res == pwd);
+	}
+
+	return rc;
+}
+
+static int getgrnam_retry(const char *name, struct group *grp,
+			  char **buf, size_t *buflen, int *retries)
+{
+	struct group *res = NULL;
+	int rc;
+
+	for (;;) {
+		rc = getgrnam_r(name, grp, *buf, *buflen, &res);
+		if (rc == ERANGE) {
+			/* Injected failures must not grow it forever */
+			if (*buflen < NWRAP_MODULE_MAX_BUFLEN) {
+				*buflen *= 2;
+				*buf = realloc(*buf, *buflen);
+				assert_non_null(*buf);
+			}
+		} else if (rc != EAGAIN) {
+			break;
+		}
+		(*retries)++;
+	}
+	if (rc == 0) {
+		assert_true(res == grp);
+	}
+
+	return rc;
+}
+
+static void test_nwrap_module_getpwnam(void **state)
+{
+	struct passwd *pwd;
+
+	(void) state; /* unused */
+
+	pwd = getpwnam("modalice");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 5001);
+	assert_string_equal(pwd->pw_gecos, "Module Alice");
+
+	pwd = getpwuid(5002);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "modbob");
+
+	/* The files are asked first */
+	pwd = getpwnam("bob");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 1000);
+
+	assert_null(getpwnam("nomodule"));
+}
+
+static void test_nwrap_module_getpwnam_r(void **state)
+{
+	struct passwd pwd;
+	struct passwd *res = NULL;
+	char buf[16];
+	char *big;
+	size_t buflen = sizeof(buf);
+	int retries = 0;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = getpwnam_r("modbob", &pwd, buf, sizeof(buf), &res);
+	assert_int_equal(rc, ERANGE);
+	assert_null(res);
+
+	big = malloc(buflen);
+	assert_non_null(big);
+	rc = getpwnam_retry("modbob", &pwd, &big, &buflen, &retries);
+	assert_int_equal(rc, 0);
+	assert_int_equal(pwd.pw_uid, 5002);
+	assert_string_equal(pwd.pw_name, "modbob");
+	free(big);
+
+	rc = getpwuid_r(5001, &pwd, buf, sizeof(buf), &res);
+	assert_int_equal(rc, ERANGE);
+
+	rc = getpwnam_r("nomodule", &pwd, buf, sizeof(buf), &res);
+	assert_int_equal(rc, ENOENT);
+	assert_null(res);
+}
+
+static void test_nwrap_module_getgrnam(void **state)
+{
+	struct group *grp;
+	int i;
+
+	(void) state; /* unused */
+
+	grp = getgrnam("modusers");
+	assert_non_null(grp);
+	assert_int_equal(grp->gr_gid, 5001);
+	assert_string_equal(grp->gr_mem[0], "modalice");
+	assert_string_equal(grp->gr_mem[1], "modbob");
+	assert_null(grp->gr_mem[2]);
+
+	grp = getgrgid(5002);
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_name, "modadmins");
+
+	/* getgrnam() grows its buffer for the large group */
+	grp = getgrnam("large");
+	assert_non_null(grp);
+	i = 0;
+	while (grp->gr_mem[i] != NULL) {
+		i++;
+	}
+	assert_int_equal(i, NWRAP_MODULE_LARGE_MEMBERS);
+	assert_string_equal(grp->gr_mem[NWRAP_MODULE_LARGE_MEMBERS - 1],
+			    "large4999");
+}
+
+static void test_nwrap_module_large_group(void **state)
+{
+	struct group grp;
+	struct group *res = NULL;
+	char *buf;
+	size_t buflen = 1024;
+	int retries = 0;
+	int rc;
+
+	(void) state; /* unused */
+
+	buf = malloc(buflen);
+	assert_non_null(buf);
+
+	rc = getgrnam_r("large", &grp, buf, buflen, &res);
+	assert_int_equal(rc, ERANGE);
+	assert_null(res);
+
+	rc = getgrnam_retry("large", &grp, &buf, &buflen, &retries);
+	assert_int_equal(rc, 0);
+	assert_int_equal(grp.gr_gid, 70000);
+	assert_string_equal(grp.gr_mem[0], "large0");
+	assert_true(retries > 0);
+
+	free(buf);
+}
+
+static void test_nwrap_module_enum(void **state)
+{
+	struct passwd *pwd;
+	struct group *grp;
+	bool found_files = false;
+	int found_module = 0;
+	bool found_large = false;
+
+	(void) state; /* unused */
+
+	setpwent();
+	while ((pwd = getpwent()) != NULL) {
+		if (strcmp(pwd->pw_name, "alice") == 0) {
+			found_files = true;
+		}
+		if (strncmp(pwd->pw_name, "mod", 3) == 0) {
+			found_module++;
+		}
+	}
+	endpwent();
+
+	assert_true(found_files);
+	assert_int_equal(found_module, 2);
+
+	setgrent();
+	while ((grp = getgrent()) != NULL) {
+		if (strcmp(grp->gr_name, "large") == 0) {
+			found_large = true;
+		}
+	}
+	endgrent();
+
+	assert_true(found_large);
+}
+
+/*
+ * Walk the enumeration with getpwent_r() and getgrent_r() like a caller which
+ * grows its buffer and retries, no entry may get lost.
+ */
+static void test_nwrap_module_enum_r(void **state)
+{
+	struct passwd pwd;
+	struct passwd *pwdp;
+	struct group grp;
+	struct group *grpp;
+	size_t buflen = 16;
+	char *buf;
+	int found_module = 0;
+	int found_groups = 0;
+	int retries = 0;
+	int rc;
+	int i;
+
+	(void) state; /* unused */
+
+	buf = malloc(buflen);
+	assert_non_null(buf);
+
+	setpwent();
+	for (;;) {
+		rc = getpwent_r(&pwd, buf, buflen, &pwdp);
+		if (rc == ERANGE) {
+			buflen *= 2;
+			buf = realloc(buf, buflen);
+			assert_non_null(buf);
+			retries++;
+			continue;
+		}
+		if (rc == EAGAIN) {
+			retries++;
+			continue;
+		}
+		if (rc != 0) {
+			break;
+		}
+		assert_true(pwdp == &pwd);
+		if (strncmp(pwd.pw_name, "mod", 3) == 0) {
+			found_module++;
+		}
+	}
+	endpwent();
+
+	assert_int_equal(rc, ENOENT);
+	assert_int_equal(found_module, 2);
+
+	setgrent();
+	for (;;) {
+		rc = getgrent_r(&grp, buf, buflen, &grpp);
+		if (rc == ERANGE) {
+			buflen *= 2;
+			buf = realloc(buf, buflen);
+			assert_non_null(buf);
+			retries++;
+			continue;
+		}
+		if (rc == EAGAIN) {
+			retries++;
+			continue;
+		}
+		if (rc != 0) {
+			break;
+		}
+		assert_true(grpp == &grp);
+
+		if (strcmp(grp.gr_name, "modusers") == 0) {
+			assert_string_equal(grp.gr_mem[1], "modbob");
+			found_groups++;
+		} else if (strcmp(grp.gr_name, "modadmins") == 0) {
+			found_groups++;
+		} else if (strcmp(grp.gr_name, "large") == 0) {
+			for (i = 0; grp.gr_mem[i] != NULL; i++) {
+				continue;
+			}
+			assert_int_equal(i, NWRAP_MODULE_LARGE_MEMBERS);
+			found_groups++;
+		}
+	}
+	endgrent();
+
+	assert_int_equal(rc, ENOENT);
+	assert_int_equal(found_groups, 3);
+	assert_true(retries > 0);
+
+	free(buf);
+}
+
+/* Every lookup has to succeed for a caller which retries */
+static void test_nwrap_module_retry(void **state)
+{
+	struct passwd pwd;
+	struct group grp;
+	size_t pw_buflen = 64;
+	size_t gr_buflen = 64;
+	char *pw_buf;
+	char *gr_buf;
+	int retries = 0;
+	int rc;
+	int i;
+
+	(void) state; /* unused */
+
+	pw_buf = malloc(pw_buflen);
+	assert_non_null(pw_buf);
+	gr_buf = malloc(gr_buflen);
+	assert_non_null(gr_buf);
+
+	for (i = 0; i < 200; i++) {
+		const char *name = (i % 2) ? "modalice" : "modbob";
+
+		rc = getpwnam_retry(name, &pwd, &pw_buf, &pw_buflen, &retries);
+		assert_int_equal(rc, 0);
+		assert_string_equal(pwd.pw_name, name);
+
+		rc = getgrnam_retry("modusers", &grp, &gr_buf, &gr_buflen,
+				    &retries);
+		assert_int_equal(rc, 0);
+		assert_int_equal(grp.gr_gid, 5001);
+	}
+
+	if (nwrap_faults_enabled()) {
+		assert_true(retries > 0);
+	}
+
+	free(pw_buf);
+	free(gr_buf);
+}
+
+static void test_nwrap_module_speed(void **state)
+{
+	struct passwd pwd;
+	size_t buflen = 1024;
+	char *buf;
+	double start;
+	double elapsed;
+	int retries = 0;
+	int rc;
+	int i;
+
+	(void) state; /* unused */
+
+	buf = malloc(buflen);
+	assert_non_null(buf);
+
+	start = nwrap_now_us();
+	for (i = 0; i < NWRAP_MODULE_LOOKUPS; i++) {
+		rc = getpwnam_retry("modbob", &pwd, &buf, &buflen, &retries);
+		assert_int_equal(rc, 0);
+	}
+	elapsed = nwrap_now_us() - start;
+
+	printf("module getpwnam_r: %.2f us (%d lookups, %d retries)\n",
+	       elapsed / NWRAP_MODULE_LOOKUPS, NWRAP_MODULE_LOOKUPS, retries);
+
+	free(buf);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_module_getpwnam),
+		cmocka_unit_test(test_nwrap_module_getpwnam_r),
+		cmocka_unit_test(test_nwrap_module_getgrnam),
+		cmocka_unit_test(test_nwrap_module_large_group),
+		cmocka_unit_test(test_nwrap_module_enum),
+		cmocka_unit_test(test_nwrap_module_enum_r),
+		cmocka_unit_test(test_nwrap_module_retry),
+		cmocka_unit_test(test_nwrap_module_speed),
+	};
+	const struct CMUnitTest fault_tests[] = {
+		cmocka_unit_test(test_nwrap_module_enum_r),
+		cmocka_unit_test(test_nwrap_module_retry),
+		cmocka_unit_test(test_nwrap_module_speed),
+	};
+
+	if (nwrap_faults_enabled()) {
+		rc = cmocka_run_group_tests(fault_tests, NULL, NULL);
+	} else {
+		rc = cmocka_run_group_tests(tests, NULL, NULL);
+	}
+
+	return rc;
+}
@@ -0,0 +1,400 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+int nss_wrapper_add_user(const struct passwd *pwd);
+int nss_wrapper_del_user(const char *name);
+int nss_wrapper_add_group(const struct group *grp);
+int nss_wrapper_del_group(const char *name);
+int nss_wrapper_add_host(const char *name, const char *addr);
+int nss_wrapper_del_host(const char *name);
+
+#define NWRAP_MUTATE_ITERATIONS 2000
+
+/*
+ * The tests write back to the files, so they work on copies of the files of
+ * the testsuite.
+ */
+static char passwd_path[1024];
+static char group_path[1024];
+static char hosts_path[1024];
+
+static int copy_file(const char *env, char *path, size_t len)
+{
+	const char *src = getenv(env);
+	char buf[4096];
+	FILE *in;
+	FILE *out;
+	size_t n;
+
+	if (src == NULL) {
+		return -1;
+	}
+	snprintf(path, len, "%s.mutate", src);
+
+	in = fopen(src, "r");
+	if (in == NULL) {
+		return -1;
+	}
+	out = fopen(path, "w");
+	if (out == NULL) {
+		fclose(in);
+		return -1;
+	}
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		fwrite(buf, 1, n, out);
+	}
+	fclose(in);
+	fclose(out);
+
+	return setenv(env, path, 1);
+}
+
+static bool file_has_line(const char *path, const char *prefix)
+{
+	char line[1024];
+	bool found = false;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	assert_non_null(fp);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, prefix, strlen(prefix)) == 0) {
+			found = true;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return found;
+}
+
+static int count_users(const char *name)
+{
+	struct passwd *pwd;
+	int num = 0;
+
+	setpwent();
+	while ((pwd = getpwent()) != NULL) {
+		if (strcmp(pwd->pw_name, name) == 0) {
+			num++;
+		}
+	}
+	endpwent();
+
+	return num;
+}
+
+static void fill_passwd(struct passwd *pwd, char *name, uid_t uid,
+			char *gecos)
+{
+	static char passwd[] = "x";
+	static char dir[] = "/tmp";
+	static char shell[] = "/bin/sh";
+
+	pwd->pw_name = name;
+	pwd->pw_passwd = passwd;
+	pwd->pw_uid = uid;
+	pwd->pw_gid = 1000;
+	pwd->pw_gecos = gecos;
+	pwd->pw_dir = dir;
+	pwd->pw_shell = shell;
+}
+
+static void test_nwrap_mutate_user(void **state)
+{
+	char name[] = "mutant";
+	char bad_name[] = "mu:tant";
+	char gecos[] = "mutant";
+	char gecos2[] = "mutant again";
+	char bob[] = "bob";
+	struct passwd new_pwd;
+	struct passwd *pwd;
+	int rc;
+
+	(void) state; /* unused */
+
+	assert_null(getpwnam("mutant"));
+
+	fill_passwd(&new_pwd, bad_name, 4000, gecos);
+	rc = nss_wrapper_add_user(&new_pwd);
+	assert_int_equal(rc, EINVAL);
+
+	fill_passwd(&new_pwd, name, 4000, gecos);
+	rc = nss_wrapper_add_user(&new_pwd);
+	assert_int_equal(rc, 0);
+
+	pwd = getpwnam("mutant");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 4000);
+	pwd = getpwuid(4000);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "mutant");
+
+	/* Adding it again replaces it */
+	fill_passwd(&new_pwd, name, 4001, gecos2);
+	rc = nss_wrapper_add_user(&new_pwd);
+	assert_int_equal(rc, 0);
+
+	pwd = getpwnam("mutant");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 4001);
+	assert_string_equal(pwd->pw_gecos, "mutant again");
+	assert_null(getpwuid(4000));
+	assert_int_equal(count_users("mutant"), 1);
+
+	rc = nss_wrapper_del_user("mutant");
+	assert_int_equal(rc, 0);
+	assert_null(getpwnam("mutant"));
+	assert_null(getpwuid(4001));
+	rc = nss_wrapper_del_user("mutant");
+	assert_int_equal(rc, ENOENT);
+
+	/* Users of the file can be removed and added again */
+	rc = nss_wrapper_del_user("bob");
+	assert_int_equal(rc, 0);
+	assert_null(getpwnam("bob"));
+	assert_null(getpwuid(1000));
+	assert_int_equal(count_users("bob"), 0);
+
+	pwd = getpwnam("alice");
+	assert_non_null(pwd);
+
+	fill_passwd(&new_pwd, bob, 1000, bob);
+	rc = nss_wrapper_add_user(&new_pwd);
+	assert_int_equal(rc, 0);
+	pwd = getpwuid(1000);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "bob");
+	assert_int_equal(count_users("bob"), 1);
+}
+
+static void test_nwrap_mutate_group(void **state)
+{
+	char name[] = "mutants";
+	char passwd[] = "x";
+	char alice[] = "alice";
+	char bob[] = "bob";
+	char *members[] = { alice, bob, NULL };
+	struct group new_grp;
+	struct group *grp;
+	int rc;
+
+	(void) state; /* unused */
+
+	new_grp.gr_name = name;
+	new_grp.gr_passwd = passwd;
+	new_grp.gr_gid = 4000;
+	new_grp.gr_mem = members;
+
+	rc = nss_wrapper_add_group(&new_grp);
+	assert_int_equal(rc, 0);
+
+	grp = getgrnam("mutants");
+	assert_non_null(grp);
+	assert_int_equal(grp->gr_gid, 4000);
+	assert_string_equal(grp->gr_mem[0], "alice");
+	assert_string_equal(grp->gr_mem[1], "bob");
+	assert_null(grp->gr_mem[2]);
+
+	grp = getgrgid(4000);
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_name, "mutants");
+
+	rc = nss_wrapper_del_group("mutants");
+	assert_int_equal(rc, 0);
+	assert_null(getgrnam("mutants"));
+	assert_null(getgrgid(4000));
+
+	rc = nss_wrapper_del_group("users");
+	assert_int_equal(rc, 0);
+	assert_null(getgrnam("users"));
+	assert_null(getgrgid(1000));
+	rc = nss_wrapper_del_group("users");
+	assert_int_equal(rc, ENOENT);
+}
+
+static void test_nwrap_mutate_host(void **state)
+{
+	struct addrinfo hints;
+	struct addrinfo *res = NULL;
+	struct hostent *he;
+	char ip[INET6_ADDRSTRLEN];
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_add_host("mutant.example.org", "not an address");
+	assert_int_equal(rc, EINVAL);
+
+	rc = nss_wrapper_add_host("mutant.example.org", "10.9.8.7");
+	assert_int_equal(rc, 0);
+	rc = nss_wrapper_add_host("mutant.example.org", "fd00::87");
+	assert_int_equal(rc, 0);
+
+	he = gethostbyname("mutant.example.org");
+	assert_non_null(he);
+	assert_int_equal(he->h_addrtype, AF_INET);
+	inet_ntop(AF_INET, he->h_addr_list[0], ip, sizeof(ip));
+	assert_string_equal(ip, "10.9.8.7");
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET6;
+	rc = getaddrinfo("mutant.example.org", NULL, &hints, &res);
+	assert_int_equal(rc, 0);
+	assert_non_null(res);
+	freeaddrinfo(res);
+
+	/* The hosts of the file are still there */
+	he = gethostbyname("magrathea.galaxy.site");
+	assert_non_null(he);
+
+	rc = nss_wrapper_del_host("mutant.example.org");
+	assert_int_equal(rc, 0);
+	assert_null(gethostbyname("mutant.example.org"));
+
+	rc = nss_wrapper_del_host("mutant.example.org");
+	assert_int_equal(rc, ENOENT);
+	/* Only added hosts can be removed */
+	rc = nss_wrapper_del_host("magrathea.galaxy.site");
+	assert_int_equal(rc, ENOENT);
+}
+
+static void test_nwrap_mutate_write_back(void **state)
+{
+	char name[] = "written";
+	char gecos[] = "written";
+	struct passwd new_pwd;
+	struct passwd *pwd;
+	struct hostent *he;
+	FILE *fp;
+	int rc;
+
+	(void) state; /* unused */
+
+	setenv("NSS_WRAPPER_WRITE_BACK", "1", 1);
+
+	fill_passwd(&new_pwd, name, 4100, gecos);
+	rc = nss_wrapper_add_user(&new_pwd);
+	assert_int_equal(rc, 0);
+	assert_true(file_has_line(passwd_path, "written:x:4100:"));
+
+	rc = nss_wrapper_del_user("alice");
+	assert_int_equal(rc, 0);
+	assert_false(file_has_line(passwd_path, "alice:"));
+
+	rc = nss_wrapper_del_group("nogroup");
+	assert_int_equal(rc, 0);
+	assert_false(file_has_line(group_path, "nogroup:"));
+
+	rc = nss_wrapper_add_host("written.example.org", "10.9.8.9");
+	assert_int_equal(rc, 0);
+	assert_true(file_has_line(hosts_path, "10.9.8.9 written.example.org"));
+
+	unsetenv("NSS_WRAPPER_WRITE_BACK");
+
+	/* Parse the hosts file again, the address is only listed once */
+	fp = fopen(hosts_path, "a");
+	assert_non_null(fp);
+	fprintf(fp, "10.9.8.10 changed.example.org\n");
+	fclose(fp);
+
+	he = gethostbyname("written.example.org");
+	assert_non_null(he);
+	assert_non_null(he->h_addr_list[0]);
+	assert_null(he->h_addr_list[1]);
+
+	pwd = getpwnam("written");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 4100);
+	assert_null(getpwnam("alice"));
+	assert_null(getgrnam("nogroup"));
+}
+
+static double nwrap_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static void test_nwrap_mutate_speed(void **state)
+{
+	char name[64];
+	char gecos[] = "many";
+	struct passwd new_pwd;
+	struct passwd *pwd;
+	double start;
+	double elapsed;
+	int i;
+	int rc;
+
+	(void) state; /* unused */
+
+	start = nwrap_now_us();
+	for (i = 0; i < NWRAP_MUTATE_ITERATIONS; i++) {
+		snprintf(name, sizeof(name), "many%d", i);
+		fill_passwd(&new_pwd, name, 10000 + i, gecos);
+		rc = nss_wrapper_add_user(&new_pwd);
+		assert_int_equal(rc, 0);
+	}
+	elapsed = nwrap_now_us() - start;
+
+	printf("add_user: %.2f us (%d users)\n",
+	       elapsed / NWRAP_MUTATE_ITERATIONS, NWRAP_MUTATE_ITERATIONS);
+
+	pwd = getpwuid(10000 + NWRAP_MUTATE_ITERATIONS - 1);
+	assert_non_null(pwd);
+	snprintf(name, sizeof(name), "many%d", NWRAP_MUTATE_ITERATIONS - 1);
+	assert_string_equal(pwd->pw_name, name);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_mutate_user),
+		cmocka_unit_test(test_nwrap_mutate_group),
+		cmocka_unit_test(test_nwrap_mutate_host),
+		cmocka_unit_test(test_nwrap_mutate_write_back),
+		cmocka_unit_test(test_nwrap_mutate_speed),
+	};
+
+	/* nss_wrapper reads the variables with the first lookup */
+	rc = copy_file("NSS_WRAPPER_PASSWD", passwd_path, sizeof(passwd_path));
+	if (rc != 0) {
+		return 1;
+	}
+	rc = copy_file("NSS_WRAPPER_GROUP", group_path, sizeof(group_path));
+	if (rc != 0) {
+		return 1;
+	}
+	rc = copy_file("NSS_WRAPPER_HOSTS", hosts_path, sizeof(hosts_path));
+	if (rc != 0) {
+		return 1;
+	}
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
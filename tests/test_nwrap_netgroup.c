@@ -0,0 +1,157 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <netdb.h>
+
+static void test_nwrap_innetgr(void **state)
+{
+	(void) state; /* unused */
+
+	/* Host and domain names are case insensitive */
+	assert_int_equal(innetgr("hosts", "ALPHA.example.com", NULL, NULL), 1);
+	assert_int_equal(innetgr("hosts", "beta.example.com", NULL, "Example.Com"), 1);
+	assert_int_equal(innetgr("hosts", "gamma.example.com", NULL, NULL), 0);
+	assert_int_equal(innetgr("hosts", "alpha.example.com", NULL, "other.com"), 0);
+
+	/* An empty field matches everything */
+	assert_int_equal(innetgr("hosts", "alpha.example.com", "anyone", NULL), 1);
+	assert_int_equal(innetgr("admins", "any.host", "alice", "any.domain"), 1);
+	assert_int_equal(innetgr("admins", NULL, "bob", "example.com"), 1);
+	assert_int_equal(innetgr("admins", NULL, "bob", "other.com"), 0);
+
+	/* But the user is case sensitive */
+	assert_int_equal(innetgr("admins", NULL, "Alice", NULL), 0);
+
+	/* "-" doesn't match anything else */
+	assert_int_equal(innetgr("staff", NULL, "carol", "example.com"), 0);
+	assert_int_equal(innetgr("staff", NULL, "carol", "-"), 1);
+
+	/* Nested and continued on the next line */
+	assert_int_equal(innetgr("staff", NULL, "alice", NULL), 1);
+	assert_int_equal(innetgr("staff", "gamma.example.com", "dave", NULL), 1);
+	assert_int_equal(innetgr("all", "h", "dave", "d"), 0);
+	assert_int_equal(innetgr("all", "gamma.example.com", "dave", "d"), 1);
+	assert_int_equal(innetgr("all", "beta.example.com", NULL, NULL), 1);
+	assert_int_equal(innetgr("all", NULL, "bob", NULL), 1);
+
+	assert_int_equal(innetgr("loop1", "h2", "u2", NULL), 1);
+	assert_int_equal(innetgr("loop2", "h1", "u1", NULL), 1);
+	assert_int_equal(innetgr("loop1", "h1", "u2", NULL), 0);
+
+	assert_int_equal(innetgr("nonexistent", NULL, NULL, NULL), 0);
+	assert_int_equal(innetgr("admins", NULL, NULL, NULL), 1);
+}
+
+static void test_nwrap_getnetgrent(void **state)
+{
+	char *host;
+	char *user;
+	char *domain;
+	bool found_carol = false;
+	bool found_alice = false;
+	int num = 0;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = setnetgrent("staff");
+	assert_int_equal(rc, 1);
+
+	while (getnetgrent(&host, &user, &domain) == 1) {
+		assert_non_null(user);
+
+		if (strcmp(user, "carol") == 0) {
+			assert_null(host);
+			assert_string_equal(domain, "-");
+			found_carol = true;
+		}
+		if (strcmp(user, "alice") == 0) {
+			assert_null(host);
+			assert_null(domain);
+			found_alice = true;
+		}
+		num++;
+	}
+	endnetgrent();
+
+	assert_true(found_carol);
+	assert_true(found_alice);
+	assert_int_equal(num, 4);
+
+	/* Triples reached twice are only returned once */
+	rc = setnetgrent("all");
+	assert_int_equal(rc, 1);
+	num = 0;
+	while (getnetgrent(&host, &user, &domain) == 1) {
+		num++;
+	}
+	endnetgrent();
+	assert_int_equal(num, 6);
+
+	rc = setnetgrent("loop1");
+	assert_int_equal(rc, 1);
+	num = 0;
+	while (getnetgrent(&host, &user, &domain) == 1) {
+		num++;
+	}
+	endnetgrent();
+	assert_int_equal(num, 2);
+
+	rc = setnetgrent("nonexistent");
+	assert_int_equal(rc, 0);
+	rc = getnetgrent(&host, &user, &domain);
+	assert_int_equal(rc, 0);
+	endnetgrent();
+}
+
+#ifdef HAVE_GETNETGRENT_R
+static void test_nwrap_getnetgrent_r(void **state)
+{
+	char buf[64];
+	char *host;
+	char *user;
+	char *domain;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = setnetgrent("hosts");
+	assert_int_equal(rc, 1);
+
+	rc = getnetgrent_r(&host, &user, &domain, buf, 8);
+	assert_int_equal(rc, 0);
+	assert_int_equal(errno, ERANGE);
+
+	rc = getnetgrent_r(&host, &user, &domain, buf, sizeof(buf));
+	assert_int_equal(rc, 1);
+	assert_string_equal(host, "alpha.example.com");
+	assert_null(user);
+	assert_string_equal(domain, "example.com");
+
+	endnetgrent();
+}
+#endif /* HAVE_GETNETGRENT_R */
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_innetgr),
+		cmocka_unit_test(test_nwrap_getnetgrent),
+#ifdef HAVE_GETNETGRENT_R
+		cmocka_unit_test(test_nwrap_getnetgrent_r),
+#endif
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -0,0 +1,282 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <time.h>
+
+#include "../src/nss_wrapper.c"
+
+/*
+ * Measure the parse throughput of the databases. Every database gets
+ * generated lines, which are parsed NWRAP_PARSE_ROUNDS times. The formats
+ * get the number of the line and its two low bytes.
+ */
+
+#define NWRAP_PARSE_ENTRIES 20000
+#define NWRAP_PARSE_ROUNDS 10
+
+static void test_nwrap_split_line(void **state)
+{
+	char line[128];
+	char *fields[8];
+	size_t num;
+	size_t i;
+
+	(void) state; /* unused */
+
+	/* Separators on both sides of the block boundaries */
+	for (i = 1; i < 70; i++) {
+		memset(line, 'a', sizeof(line));
+		line[i - 1] = ':';
+		line[i] = ':';
+		line[100] = ':';
+		line[101] = '\0';
+
+		num = nwrap_split_line(line, ':', fields, ARRAY_SIZE(fields));
+		assert_int_equal(num, 4);
+		assert_int_equal(strlen(fields[0]), i - 1);
+		assert_string_equal(fields[1], "");
+		assert_int_equal(strlen(fields[2]), 99 - i);
+		assert_string_equal(fields[3], "");
+	}
+
+	/* The last field keeps the rest */
+	snprintf(line, sizeof(line), "a:b:c:d");
+	num = nwrap_split_line(line, ':', fields, 2);
+	assert_int_equal(num, 2);
+	assert_string_equal(fields[0], "a");
+	assert_string_equal(fields[1], "b:c:d");
+
+	snprintf(line, sizeof(line), "no separator");
+	num = nwrap_split_line(line, ':', fields, ARRAY_SIZE(fields));
+	assert_int_equal(num, 1);
+	assert_string_equal(fields[0], "no separator");
+
+	snprintf(line, sizeof(line),
+		 "alice,bob,carol,dave,eve,frank,grace,heidi,ivan,judy");
+	assert_int_equal(nwrap_count_char(line, ','), 9);
+}
+
+static void test_nwrap_find_space(void **state)
+{
+	char line[128];
+	const char *end;
+	size_t i;
+
+	(void) state; /* unused */
+
+	for (i = 0; i < 70; i++) {
+		memset(line, 'a', sizeof(line));
+		line[i] = (i % 2) ? '\t' : ' ';
+		line[100] = '\0';
+		end = line + strlen(line);
+
+		assert_true(nwrap_find_space(line, end) == line + i);
+	}
+
+	/* Bytes >= 0x80 are no whitespace */
+	memset(line, 0x85, 80);
+	line[80] = '\0';
+	end = line + 80;
+	assert_true(nwrap_find_space(line, end) == end);
+}
+
+static void test_nwrap_parse_uint32(void **state)
+{
+	const char *e = NULL;
+	uint32_t id = 0;
+	bool ok;
+
+	(void) state; /* unused */
+
+	ok = nwrap_parse_uint32("1000:", &e, &id);
+	assert_true(ok);
+	assert_int_equal(id, 1000);
+	assert_int_equal(e[0], ':');
+
+	ok = nwrap_parse_uint32("4294967295", &e, &id);
+	assert_true(ok);
+	assert_true(id == UINT32_MAX);
+
+	assert_false(nwrap_parse_uint32("4294967296", &e, &id));
+	assert_false(nwrap_parse_uint32("10000000000", &e, &id));
+	assert_false(nwrap_parse_uint32("", &e, &id));
+	assert_false(nwrap_parse_uint32(" 1", &e, &id));
+	assert_false(nwrap_parse_uint32("-1", &e, &id));
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+	{
+		long v = 0;
+
+		assert_true(nwrap_parse_long("99999", &v));
+		assert_int_equal(v, 99999);
+		assert_true(nwrap_parse_long("-1", &v));
+		assert_int_equal(v, -1);
+		assert_false(nwrap_parse_long("1x", &v));
+		assert_false(nwrap_parse_long("-", &v));
+	}
+#endif
+}
+
+static double nwrap_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static char *nwrap_gen_data(const char *fmt, size_t *psize)
+{
+	size_t size = (size_t)NWRAP_PARSE_ENTRIES * 256;
+	size_t used = 0;
+	char *data;
+	int i;
+
+	data = malloc(size);
+	assert_non_null(data);
+
+	for (i = 0; i < NWRAP_PARSE_ENTRIES; i++) {
+		int n;
+
+		n = snprintf(data + used, size - used, fmt,
+			     i, (i >> 8) & 0xff, i & 0xff);
+		assert_true(n > 0 && (size_t)n < size - used);
+		used += n;
+	}
+
+	*psize = used;
+	return data;
+}
+
+/* Returns the number of parsed lines */
+static int nwrap_parse_buf(struct nwrap_cache *c, char *buf, size_t size)
+{
+	char *line = buf;
+	char *end = buf + size;
+	int num = 0;
+	bool ok;
+
+	while (line < end) {
+		char *nl = memchr(line, '\n', end - line);
+
+		assert_non_null(nl);
+		*nl = '\0';
+
+		ok = c->parse_line(c, line);
+		assert_true(ok);
+		num++;
+
+		line = nl + 1;
+	}
+
+	return num;
+}
+
+static void nwrap_parse_bench(const char *db,
+			      struct nwrap_cache *c,
+			      const char *fmt,
+			      int *pnum)
+{
+	double start;
+	double elapsed = 0;
+	size_t size;
+	char *data;
+	char *buf;
+	int i;
+
+	data = nwrap_gen_data(fmt, &size);
+	buf = malloc(size);
+	assert_non_null(buf);
+
+	for (i = 0; i < NWRAP_PARSE_ROUNDS; i++) {
+		int num;
+
+		/* The parsers modify the lines */
+		memcpy(buf, data, size);
+
+		start = nwrap_now_us();
+		num = nwrap_parse_buf(c, buf, size);
+		elapsed += nwrap_now_us() - start;
+
+		assert_int_equal(num, NWRAP_PARSE_ENTRIES);
+		assert_int_equal(*pnum, NWRAP_PARSE_ENTRIES);
+
+		c->unload(c);
+	}
+
+	printf("%s: %.1f MB/s (%zu bytes, %d lines)\n",
+	       db, (double)size * NWRAP_PARSE_ROUNDS / elapsed, size,
+	       NWRAP_PARSE_ENTRIES);
+
+	free(buf);
+	free(data);
+}
+
+static void test_nwrap_parse_passwd(void **state)
+{
+	(void) state; /* unused */
+
+	nwrap_parse_bench("passwd", nwrap_pw_global.cache,
+			  "user%1$d:x:%1$d:100:User %1$d,,,:/home/user%1$d:"
+			  "/bin/bash\n",
+			  &nwrap_pw_global.num);
+}
+
+static void test_nwrap_parse_group(void **state)
+{
+	(void) state; /* unused */
+
+	nwrap_parse_bench("group", nwrap_gr_global.cache,
+			  "group%1$d:x:%1$d:user%1$d,admin%1$d,guest%1$d,"
+			  "test%1$d\n",
+			  &nwrap_gr_global.num);
+}
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+static void test_nwrap_parse_shadow(void **state)
+{
+	(void) state; /* unused */
+
+	nwrap_parse_bench("shadow", nwrap_sp_global.cache,
+			  "user%1$d:$6$salt%1$d$0123456789abcdef0123456789abcdef:"
+			  "17%2$d:0:99999:7:::\n",
+			  &nwrap_sp_global.num);
+}
+#endif /* defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM) */
+
+static void test_nwrap_parse_hosts(void **state)
+{
+	(void) state; /* unused */
+
+	nwrap_parse_bench("hosts", nwrap_he_global.cache,
+			  "10.1.%2$d.%3$d\thost%1$d.example.test host%1$d "
+			  "alias%1$d\n",
+			  &nwrap_he_global.num);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_split_line),
+		cmocka_unit_test(test_nwrap_find_space),
+		cmocka_unit_test(test_nwrap_parse_uint32),
+		cmocka_unit_test(test_nwrap_parse_passwd),
+		cmocka_unit_test(test_nwrap_parse_group),
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM)
+		cmocka_unit_test(test_nwrap_parse_shadow),
+#endif
+		cmocka_unit_test(test_nwrap_parse_hosts),
+	};
+
+	nwrap_init();
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
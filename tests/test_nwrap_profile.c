@@ -0,0 +1,147 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ * A child process does the lookups from different call sites, the profile is
+ * written when it exits. Every call is sampled, so the counts are exact.
+ */
+static char profile_path[1024];
+
+static __attribute__((noinline)) void lookup_often(void)
+{
+	int i;
+
+	for (i = 0; i < 30; i++) {
+		getpwuid(1000);
+	}
+}
+
+static __attribute__((noinline)) void lookup_sometimes(void)
+{
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		getpwuid(1001);
+	}
+}
+
+static void profile_child(void)
+{
+	int i;
+
+	lookup_often();
+	lookup_sometimes();
+
+	for (i = 0; i < 10; i++) {
+		getpwnam("bob");
+	}
+
+	/* The report is written by the destructor */
+	exit(0);
+}
+
+static void test_nwrap_profile_report(void **state)
+{
+	char line[1024];
+	unsigned long pwuid_calls = 0;
+	unsigned long pwnam_calls = 0;
+	unsigned long max_calls = 0;
+	int pwuid_sites = 0;
+	int pwnam_sites = 0;
+	bool header = false;
+	pid_t pid;
+	int status;
+	FILE *fp;
+
+	(void) state; /* unused */
+
+	pid = fork();
+	assert_true(pid >= 0);
+	if (pid == 0) {
+		profile_child();
+	}
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+
+	fp = fopen(profile_path, "r");
+	assert_non_null(fp);
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		unsigned long calls;
+		double total_us;
+		double avg_us;
+		char fn[64];
+		int n;
+
+		if (strncmp(line, "nss_wrapper profile", 19) == 0) {
+			header = true;
+			continue;
+		}
+
+		/* The frames of a site are indented lines without numbers */
+		n = sscanf(line, "%lu %lf %lf %63s",
+			   &calls, &total_us, &avg_us, fn);
+		if (n != 4) {
+			continue;
+		}
+
+		/* The sites are sorted by the number of calls */
+		if (max_calls > 0) {
+			assert_true(calls <= max_calls);
+		}
+		max_calls = calls;
+
+		assert_true(total_us >= 0);
+
+		if (strcmp(fn, "getpwuid") == 0) {
+			pwuid_calls += calls;
+			pwuid_sites++;
+		} else if (strcmp(fn, "getpwnam") == 0) {
+			pwnam_calls += calls;
+			pwnam_sites++;
+			assert_int_equal(calls, 10);
+		}
+	}
+	fclose(fp);
+
+	assert_true(header);
+	assert_int_equal(pwuid_calls, 50);
+	assert_int_equal(pwuid_sites, 2);
+	assert_int_equal(pwnam_calls, 10);
+	assert_int_equal(pwnam_sites, 1);
+	assert_int_equal(max_calls, 10);
+}
+
+int main(void) {
+	const char *env;
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_profile_report),
+	};
+
+	env = getenv("NSS_WRAPPER_PROFILE_FILE");
+	if (env == NULL) {
+		return 1;
+	}
+	snprintf(profile_path, sizeof(profile_path), "%s", env);
+	unlink(profile_path);
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
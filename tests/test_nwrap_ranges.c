@@ -0,0 +1,277 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <pwd.h>
+#include <grp.h>
+
+int nss_wrapper_add_user(const struct passwd *pwd);
+int nss_wrapper_del_user(const char *name);
+int nss_wrapper_del_group(const char *name);
+
+/*
+ * tests/passwd_ranges.in and tests/group_ranges.in describe 100000 users
+ * with their private groups using a single line each.
+ */
+
+static void test_nwrap_range_getpwnam(void **state)
+{
+	struct passwd *pwd;
+
+	(void) state; /* unused */
+
+	pwd = getpwnam("user42");
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "user42");
+	assert_string_equal(pwd->pw_passwd, "x");
+	assert_int_equal(pwd->pw_uid, 100042);
+	assert_int_equal(pwd->pw_gid, 100042);
+	assert_string_equal(pwd->pw_gecos, "User 42");
+	assert_string_equal(pwd->pw_dir, "/home/user42");
+	assert_string_equal(pwd->pw_shell, "/bin/sh");
+
+	pwd = getpwnam("user99999");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 199999);
+
+	pwd = getpwnam("bob");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 1000);
+
+	/* Outside of the range or not the canonical name */
+	pwd = getpwnam("user100000");
+	assert_null(pwd);
+	pwd = getpwnam("user042");
+	assert_null(pwd);
+	pwd = getpwnam("user");
+	assert_null(pwd);
+	pwd = getpwnam("user4x");
+	assert_null(pwd);
+}
+
+static void test_nwrap_range_getpwuid(void **state)
+{
+	struct passwd *pwd;
+
+	(void) state; /* unused */
+
+	pwd = getpwuid(100000);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "user0");
+
+	pwd = getpwuid(150123);
+	assert_non_null(pwd);
+	assert_string_equal(pwd->pw_name, "user50123");
+	assert_string_equal(pwd->pw_dir, "/home/user50123");
+
+	pwd = getpwuid(200000);
+	assert_null(pwd);
+}
+
+static void test_nwrap_range_getpwnam_r(void **state)
+{
+	char buf[256];
+	struct passwd pwd;
+	struct passwd *pwdp = NULL;
+	struct passwd *other;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = getpwnam_r("user7", &pwd, buf, sizeof(buf), &pwdp);
+	assert_int_equal(rc, 0);
+	assert_non_null(pwdp);
+
+	/* The result is a copy */
+	other = getpwnam("user8");
+	assert_non_null(other);
+
+	assert_string_equal(pwd.pw_name, "user7");
+	assert_int_equal(pwd.pw_uid, 100007);
+	assert_string_equal(pwd.pw_gecos, "User 7");
+
+	rc = getpwnam_r("user7", &pwd, buf, 4, &pwdp);
+	assert_int_equal(rc, ERANGE);
+}
+
+static void test_nwrap_range_getgr(void **state)
+{
+	struct group *grp;
+
+	(void) state; /* unused */
+
+	grp = getgrnam("team7");
+	assert_non_null(grp);
+	assert_int_equal(grp->gr_gid, 200007);
+	assert_non_null(grp->gr_mem);
+	assert_string_equal(grp->gr_mem[0], "user7");
+	assert_null(grp->gr_mem[1]);
+
+	grp = getgrgid(100001);
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_name, "upg1");
+	assert_null(grp->gr_mem[0]);
+
+	grp = getgrgid(300001);
+	assert_non_null(grp);
+	assert_string_equal(grp->gr_name, "everyone1");
+	assert_string_equal(grp->gr_mem[0], "bob");
+
+	grp = getgrnam("team1000");
+	assert_null(grp);
+	grp = getgrgid(201000);
+	assert_null(grp);
+}
+
+static void test_nwrap_range_enum(void **state)
+{
+	struct passwd *pwd;
+	struct group *grp;
+	unsigned long num = 0;
+	bool bob = false;
+
+	(void) state; /* unused */
+
+	setpwent();
+	while ((pwd = getpwent()) != NULL) {
+		if (strcmp(pwd->pw_name, "bob") == 0) {
+			bob = true;
+		} else {
+			assert_int_equal(pwd->pw_uid, 100000 + num);
+			num++;
+		}
+	}
+	endpwent();
+
+	assert_true(bob);
+	assert_int_equal(num, 100000);
+
+	num = 0;
+	setgrent();
+	while ((grp = getgrent()) != NULL) {
+		num++;
+	}
+	endgrent();
+
+	assert_int_equal(num, 1 + 100000 + 1000 + 2);
+
+	/* getgrouplist() doesn't move the position of getgrent() */
+	num = 0;
+	setgrent();
+	while ((grp = getgrent()) != NULL) {
+		if (num == 10) {
+			gid_t groups[16];
+			int ngroups = 16;
+
+			assert_int_equal(getgrouplist("bob", 1000,
+						      groups, &ngroups), 3);
+		}
+		num++;
+	}
+	endgrent();
+
+	assert_int_equal(num, 1 + 100000 + 1000 + 2);
+}
+
+static int nwrap_gid_cmp(const void *a, const void *b)
+{
+	gid_t ga = *(const gid_t *)a;
+	gid_t gb = *(const gid_t *)b;
+
+	return (ga > gb) - (ga < gb);
+}
+
+static void test_nwrap_range_getgrouplist(void **state)
+{
+	gid_t groups[16];
+	int ngroups;
+	int rc;
+
+	(void) state; /* unused */
+
+	ngroups = 16;
+	rc = getgrouplist("user5", 100005, groups, &ngroups);
+	assert_int_equal(rc, 2);
+	assert_int_equal(ngroups, 2);
+	qsort(groups, ngroups, sizeof(gid_t), nwrap_gid_cmp);
+	assert_int_equal(groups[0], 100005);
+	assert_int_equal(groups[1], 200005);
+
+	/* Not a member of a team */
+	ngroups = 16;
+	rc = getgrouplist("user5000", 105000, groups, &ngroups);
+	assert_int_equal(rc, 1);
+	assert_int_equal(groups[0], 105000);
+
+	/* A plain member is in every group of the range */
+	ngroups = 16;
+	rc = getgrouplist("bob", 1000, groups, &ngroups);
+	assert_int_equal(rc, 3);
+	qsort(groups, ngroups, sizeof(gid_t), nwrap_gid_cmp);
+	assert_int_equal(groups[0], 1000);
+	assert_int_equal(groups[1], 300000);
+	assert_int_equal(groups[2], 300001);
+}
+
+static void test_nwrap_range_del(void **state)
+{
+	char name[] = "user7";
+	char passwd[] = "x";
+	char gecos[] = "Added";
+	char dir[] = "/tmp";
+	char shell[] = "/bin/false";
+	struct passwd add = {
+		.pw_name = name,
+		.pw_passwd = passwd,
+		.pw_uid = 4242,
+		.pw_gid = 4242,
+		.pw_gecos = gecos,
+		.pw_dir = dir,
+		.pw_shell = shell,
+	};
+	struct passwd *pwd;
+	int rc;
+
+	(void) state; /* unused */
+
+	rc = nss_wrapper_del_user("user5");
+	assert_int_equal(rc, ENOTSUP);
+	rc = nss_wrapper_del_group("upg5");
+	assert_int_equal(rc, ENOTSUP);
+
+	/* A failed call doesn't remove the entry which overrides the range */
+	rc = nss_wrapper_add_user(&add);
+	assert_int_equal(rc, 0);
+	rc = nss_wrapper_del_user("user7");
+	assert_int_equal(rc, ENOTSUP);
+
+	pwd = getpwnam("user7");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 4242);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_range_getpwnam),
+		cmocka_unit_test(test_nwrap_range_getpwuid),
+		cmocka_unit_test(test_nwrap_range_getpwnam_r),
+		cmocka_unit_test(test_nwrap_range_getgr),
+		cmocka_unit_test(test_nwrap_range_enum),
+		cmocka_unit_test(test_nwrap_range_getgrouplist),
+		cmocka_unit_test(test_nwrap_range_del),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -0,0 +1,222 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+int nss_wrapper_add_user(const struct passwd *pwd);
+unsigned long nss_wrapper_reload_swaps(void);
+
+/*
+ * The test runs with NSS_WRAPPER_RELOAD_INTERVAL, so the passwd file is
+ * reloaded by the reloader thread. Every version has the user "reload" with
+ * a different uid and a lot of other users, so parsing takes a while.
+ */
+
+#define NWRAP_RELOAD_FILLER 20000
+#define NWRAP_RELOAD_TIMEOUT_MS 5000
+
+static const char *passwd_path;
+
+static double nwrap_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static bool write_passwd(uid_t uid)
+{
+	char tmp[1024];
+	FILE *fp;
+	int i;
+	int rc;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", passwd_path);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		return false;
+	}
+	fprintf(fp, "reload:x:%u:%u:Reload:/home/reload:/bin/false\n",
+		(unsigned)uid, (unsigned)uid);
+	for (i = 0; i < NWRAP_RELOAD_FILLER; i++) {
+		fprintf(fp, "filler%d:x:%d:%d:Filler:/:/bin/false\n",
+			i, 100000 + i, 100000 + i);
+	}
+	rc = fclose(fp);
+	if (rc != 0) {
+		return false;
+	}
+
+	return rename(tmp, passwd_path) == 0;
+}
+
+/*
+ * Look up the user until the new version shows up. The old version is
+ * served meanwhile, the user never goes missing.
+ */
+static bool wait_for_uid(uid_t old_uid, uid_t new_uid)
+{
+	double deadline = nwrap_now_us() + NWRAP_RELOAD_TIMEOUT_MS * 1000.0;
+
+	while (nwrap_now_us() < deadline) {
+		struct passwd *pwd;
+
+		pwd = getpwnam("reload");
+		if (pwd == NULL) {
+			return false;
+		}
+		if (pwd->pw_uid == new_uid) {
+			return true;
+		}
+		if (pwd->pw_uid != old_uid) {
+			return false;
+		}
+		usleep(1000);
+	}
+
+	return false;
+}
+
+static void test_nwrap_reload_rename(void **state)
+{
+	struct passwd *pwd;
+	unsigned long swaps;
+	bool ok;
+
+	(void) state; /* unused */
+
+	/* The first lookup loads the file itself and starts the thread */
+	pwd = getpwnam("reload");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3001);
+
+	swaps = nss_wrapper_reload_swaps();
+
+	ok = write_passwd(3002);
+	assert_true(ok);
+
+	ok = wait_for_uid(3001, 3002);
+	assert_true(ok);
+
+	/* The new version was swapped in by the thread, not by the lookup */
+	assert_true(nss_wrapper_reload_swaps() > swaps);
+
+	pwd = getpwnam("filler19999");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 119999);
+}
+
+static void test_nwrap_reload_add_user(void **state)
+{
+	char name[] = "added";
+	char passwd[] = "x";
+	char gecos[] = "Added";
+	char dir[] = "/home/added";
+	char shell[] = "/bin/false";
+	struct passwd add = {
+		.pw_name = name,
+		.pw_passwd = passwd,
+		.pw_uid = 3100,
+		.pw_gid = 3100,
+		.pw_gecos = gecos,
+		.pw_dir = dir,
+		.pw_shell = shell,
+	};
+	struct passwd *pwd;
+	unsigned long swaps;
+	bool ok;
+	int rc;
+
+	(void) state; /* unused */
+
+	/* The change applies at once, it doesn't wait for the thread */
+	rc = nss_wrapper_add_user(&add);
+	assert_int_equal(rc, 0);
+
+	pwd = getpwnam("added");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3100);
+
+	/* It is kept when the thread swaps in a new version of the file */
+	swaps = nss_wrapper_reload_swaps();
+
+	ok = write_passwd(3003);
+	assert_true(ok);
+
+	ok = wait_for_uid(3002, 3003);
+	assert_true(ok);
+	assert_true(nss_wrapper_reload_swaps() > swaps);
+
+	pwd = getpwnam("added");
+	assert_non_null(pwd);
+	assert_int_equal(pwd->pw_uid, 3100);
+}
+
+static void test_nwrap_reload_fork(void **state)
+{
+	pid_t pid;
+	int status;
+	bool ok;
+
+	(void) state; /* unused */
+
+	pid = fork();
+	assert_true(pid >= 0);
+	if (pid == 0) {
+		/* The child needs a thread of its own */
+		unsigned long swaps = nss_wrapper_reload_swaps();
+
+		ok = write_passwd(3004);
+		if (!ok) {
+			_exit(1);
+		}
+		ok = wait_for_uid(3003, 3004);
+		if (!ok) {
+			_exit(2);
+		}
+		_exit(nss_wrapper_reload_swaps() > swaps ? 0 : 3);
+	}
+
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+
+	ok = wait_for_uid(3003, 3004);
+	assert_true(ok);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_reload_rename),
+		cmocka_unit_test(test_nwrap_reload_add_user),
+		cmocka_unit_test(test_nwrap_reload_fork),
+	};
+
+	passwd_path = getenv("NSS_WRAPPER_PASSWD");
+	if (passwd_path == NULL || !write_passwd(3001)) {
+		return 1;
+	}
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
@@ -0,0 +1,122 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/*
+ * Measure the time from exec() to the first lookup of a wrapped process. The
+ * test runs itself with --lookup a number of times and prints the average.
+ * Set NSS_WRAPPER_STARTUP_ITERATIONS to change the number of runs.
+ */
+
+#define NWRAP_STARTUP_ITERATIONS 200
+
+static char *self_path;
+static char lookup_arg[] = "--lookup";
+
+static double nwrap_now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+
+static int nwrap_lookup(void)
+{
+	struct passwd *pwd;
+
+	pwd = getpwnam("bob");
+	if (pwd == NULL || pwd->pw_uid != 1000) {
+		return 1;
+	}
+
+	return 0;
+}
+
+static int nwrap_run_child(void)
+{
+	char *argv[] = { NULL, NULL, NULL };
+	pid_t pid;
+	int status;
+	int rc;
+
+	argv[0] = self_path;
+	argv[1] = lookup_arg;
+
+	pid = fork();
+	if (pid == -1) {
+		return -1;
+	}
+	if (pid == 0) {
+		execv(self_path, argv);
+		_exit(127);
+	}
+
+	do {
+		rc = waitpid(pid, &status, 0);
+	} while (rc == -1 && errno == EINTR);
+	if (rc == -1 || !WIFEXITED(status)) {
+		return -1;
+	}
+
+	return WEXITSTATUS(status);
+}
+
+static void test_nwrap_startup(void **state)
+{
+	const char *env = getenv("NSS_WRAPPER_STARTUP_ITERATIONS");
+	int iterations = NWRAP_STARTUP_ITERATIONS;
+	double start;
+	double elapsed;
+	int i;
+	int rc;
+
+	(void) state; /* unused */
+
+	if (env != NULL && env[0] != '\0') {
+		iterations = atoi(env);
+		assert_true(iterations > 0);
+	}
+
+	start = nwrap_now_us();
+	for (i = 0; i < iterations; i++) {
+		rc = nwrap_run_child();
+		assert_int_equal(rc, 0);
+	}
+	elapsed = nwrap_now_us() - start;
+
+	printf("exec to first lookup: %.1f us (%d runs)\n",
+	       elapsed / iterations, iterations);
+}
+
+int main(int argc, char *argv[]) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_startup),
+	};
+
+	if (argc == 2 && strcmp(argv[1], lookup_arg) == 0) {
+		return nwrap_lookup();
+	}
+
+	self_path = argv[0];
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
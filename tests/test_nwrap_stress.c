@@ -0,0 +1,553 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#ifdef HAVE_SHADOW_H
+#include <shadow.h>
+#endif
+
+/*
+ * Lookups in many threads while another thread replaces the files. Every
+ * version of the files describes the user, group, host and shadow entry
+ * "stress" with the version number k in all of its fields, so a result which
+ * mixes two versions or points into a freed cache is detected. The files are
+ * replaced with rename() like an administrator or a config management tool
+ * would do it, so a lookup must never fail.
+ */
+
+#define NWRAP_STRESS_MAX_THREADS 64
+#define NWRAP_STRESS_STEP_MS 150
+#define NWRAP_STRESS_VERSIONS 200
+#define NWRAP_STRESS_FILLER 64
+#define NWRAP_STRESS_UID 10000
+#define NWRAP_STRESS_GID 20000
+
+struct stress_files {
+	const char *passwd;
+	const char *group;
+	const char *hosts;
+	const char *shadow;
+};
+
+struct stress_thread;
+
+typedef void (*stress_lookup_fn)(struct stress_thread *t, unsigned n);
+
+struct stress_thread {
+	pthread_t thread;
+	stress_lookup_fn lookup;
+	unsigned seed;
+	unsigned long lookups;
+	unsigned long errors;
+	char error[256];
+};
+
+static struct stress_files files;
+static bool stress_stop;
+static bool writer_stop;
+static unsigned long writer_versions;
+
+/* The flags are atomic so a thread sanitizer only reports nss_wrapper */
+#define STRESS_LOAD(v) __atomic_load_n(&(v), __ATOMIC_RELAXED)
+#define STRESS_STORE(v, x) __atomic_store_n(&(v), (x), __ATOMIC_RELAXED)
+
+static double nwrap_now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static bool write_file(const char *path, const char *data)
+{
+	char tmp[1024];
+	FILE *fp;
+	int rc;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		return false;
+	}
+	fputs(data, fp);
+	rc = fclose(fp);
+	if (rc != 0) {
+		return false;
+	}
+
+	/* Readers see the old or the new file, never a part of it */
+	rc = rename(tmp, path);
+
+	return rc == 0;
+}
+
+static bool write_version(unsigned k)
+{
+	char data[16384];
+	size_t len;
+	unsigned i;
+	bool ok;
+
+	len = snprintf(data, sizeof(data),
+		       "stress:x:%u:%u:v%u:/v%u:/bin/false\n",
+		       NWRAP_STRESS_UID + k, NWRAP_STRESS_GID + k, k, k);
+	for (i = 0; i < NWRAP_STRESS_FILLER; i++) {
+		len += snprintf(data + len, sizeof(data) - len,
+				"filler%u:x:%u:%u:filler:/:/bin/false\n",
+				i, 30000 + i, 30000 + i);
+	}
+	ok = write_file(files.passwd, data);
+	if (!ok) {
+		return false;
+	}
+
+	len = snprintf(data, sizeof(data),
+		       "stress:x:%u:v%u,stress\n", NWRAP_STRESS_GID + k, k);
+	for (i = 0; i < NWRAP_STRESS_FILLER; i++) {
+		len += snprintf(data + len, sizeof(data) - len,
+				"filler%u:x:%u:filler%u\n", i, 30000 + i, i);
+	}
+	ok = write_file(files.group, data);
+	if (!ok) {
+		return false;
+	}
+
+	len = snprintf(data, sizeof(data),
+		       "127.0.%u.%u stress.example v%u.example\n",
+		       k / 250, k % 250 + 1, k);
+	for (i = 0; i < NWRAP_STRESS_FILLER; i++) {
+		len += snprintf(data + len, sizeof(data) - len,
+				"127.1.%u.%u filler%u.example\n",
+				i / 250, i % 250 + 1, i);
+	}
+	ok = write_file(files.hosts, data);
+	if (!ok) {
+		return false;
+	}
+
+	snprintf(data, sizeof(data), "stress:v%u:%u:0:99999:7:::\n", k, k);
+
+	return write_file(files.shadow, data);
+}
+
+static void *writer_thread(void *arg)
+{
+	unsigned k = 1;
+
+	(void) arg; /* unused */
+
+	while (!STRESS_LOAD(writer_stop)) {
+		k = k % NWRAP_STRESS_VERSIONS + 1;
+		if (!write_version(k)) {
+			break;
+		}
+		writer_versions++;
+		/* Give the readers some time with every version */
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static void stress_error(struct stress_thread *t, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static void stress_error(struct stress_thread *t, const char *fmt, ...)
+{
+	va_list ap;
+
+	if (t->errors++ > 0) {
+		return;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(t->error, sizeof(t->error), fmt, ap);
+	va_end(ap);
+}
+
+static void check_passwd(struct stress_thread *t, const struct passwd *pwd)
+{
+	unsigned k = pwd->pw_uid - NWRAP_STRESS_UID;
+	char expect[32];
+
+	snprintf(expect, sizeof(expect), "v%u", k);
+	if (k < 1 || k > NWRAP_STRESS_VERSIONS ||
+	    pwd->pw_gid != NWRAP_STRESS_GID + k ||
+	    strcmp(pwd->pw_name, "stress") != 0 ||
+	    strcmp(pwd->pw_gecos, expect) != 0 ||
+	    pwd->pw_dir[0] != '/' ||
+	    strcmp(pwd->pw_dir + 1, expect) != 0) {
+		stress_error(t, "passwd: uid %u gid %u gecos %s dir %s",
+			     (unsigned)pwd->pw_uid, (unsigned)pwd->pw_gid,
+			     pwd->pw_gecos, pwd->pw_dir);
+	}
+}
+
+static void check_group(struct stress_thread *t, const struct group *grp)
+{
+	unsigned k = grp->gr_gid - NWRAP_STRESS_GID;
+	char expect[32];
+
+	snprintf(expect, sizeof(expect), "v%u", k);
+	if (k < 1 || k > NWRAP_STRESS_VERSIONS ||
+	    strcmp(grp->gr_name, "stress") != 0 ||
+	    grp->gr_mem[0] == NULL ||
+	    strcmp(grp->gr_mem[0], expect) != 0 ||
+	    grp->gr_mem[1] == NULL ||
+	    strcmp(grp->gr_mem[1], "stress") != 0 ||
+	    grp->gr_mem[2] != NULL) {
+		stress_error(t, "group: gid %u mem %s",
+			     (unsigned)grp->gr_gid,
+			     grp->gr_mem[0] != NULL ? grp->gr_mem[0] : "NULL");
+	}
+}
+
+static void check_host(struct stress_thread *t, const struct hostent *he)
+{
+	const unsigned char *a;
+	unsigned k;
+	char expect[64];
+
+	if (he->h_addrtype != AF_INET || he->h_addr_list[0] == NULL ||
+	    he->h_aliases[0] == NULL) {
+		stress_error(t, "hosts: incomplete entry for %s", he->h_name);
+		return;
+	}
+
+	a = (const unsigned char *)he->h_addr_list[0];
+	k = a[2] * 250 + a[3] - 1;
+	snprintf(expect, sizeof(expect), "v%u.example", k);
+	if (a[0] != 127 || a[1] != 0 ||
+	    strcmp(he->h_name, "stress.example") != 0 ||
+	    strcmp(he->h_aliases[0], expect) != 0 ||
+	    he->h_addr_list[1] != NULL) {
+		stress_error(t, "hosts: %u.%u.%u.%u alias %s",
+			     a[0], a[1], a[2], a[3], he->h_aliases[0]);
+	}
+}
+
+static void check_addrinfo(struct stress_thread *t, const struct addrinfo *ai)
+{
+	const struct sockaddr_in *sin;
+	const unsigned char *a;
+
+	if (ai->ai_family != AF_INET) {
+		stress_error(t, "getaddrinfo: family %d", ai->ai_family);
+		return;
+	}
+
+	sin = (const struct sockaddr_in *)(const void *)ai->ai_addr;
+	a = (const unsigned char *)&sin->sin_addr;
+	if (a[0] != 127 || a[1] != 0 ||
+	    a[2] * 250 + a[3] - 1 > NWRAP_STRESS_VERSIONS) {
+		stress_error(t, "getaddrinfo: %u.%u.%u.%u",
+			     a[0], a[1], a[2], a[3]);
+	}
+}
+
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+static void check_shadow(struct stress_thread *t, const struct spwd *sp)
+{
+	char expect[32];
+
+	snprintf(expect, sizeof(expect), "v%ld", sp->sp_lstchg);
+	if (sp->sp_lstchg < 1 || sp->sp_lstchg > NWRAP_STRESS_VERSIONS ||
+	    strcmp(sp->sp_namp, "stress") != 0 ||
+	    strcmp(sp->sp_pwdp, expect) != 0) {
+		stress_error(t, "shadow: lstchg %ld pwdp %s",
+			     sp->sp_lstchg, sp->sp_pwdp);
+	}
+}
+#endif
+
+static void stress_lookup(struct stress_thread *t, unsigned n)
+{
+	struct addrinfo hints;
+	struct addrinfo *ai;
+	struct passwd pwd;
+	struct passwd *pwdp;
+	struct group grp;
+	struct group *grpp;
+	struct hostent he;
+	struct hostent *hep;
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+	struct spwd spwd;
+	struct spwd *spwdp;
+#endif
+	char buf[4096];
+	int h_err;
+	int rc;
+
+	switch (n % 7) {
+	case 0:
+		rc = getpwnam_r("stress", &pwd, buf, sizeof(buf), &pwdp);
+		if (rc != 0 || pwdp == NULL) {
+			stress_error(t, "getpwnam_r: %d", rc);
+			break;
+		}
+		check_passwd(t, pwdp);
+		break;
+	case 1:
+		/* The uid of the last version which was seen may be gone */
+		rc = getpwuid_r(30000 + n % NWRAP_STRESS_FILLER,
+				&pwd, buf, sizeof(buf), &pwdp);
+		if (rc != 0 || pwdp == NULL ||
+		    pwd.pw_uid != 30000 + n % NWRAP_STRESS_FILLER) {
+			stress_error(t, "getpwuid_r: %d", rc);
+		}
+		break;
+	case 2:
+		rc = getgrnam_r("stress", &grp, buf, sizeof(buf), &grpp);
+		if (rc != 0 || grpp == NULL) {
+			stress_error(t, "getgrnam_r: %d", rc);
+			break;
+		}
+		check_group(t, grpp);
+		break;
+	case 3:
+		rc = getgrgid_r(30000 + n % NWRAP_STRESS_FILLER,
+				&grp, buf, sizeof(buf), &grpp);
+		if (rc != 0 || grpp == NULL ||
+		    grp.gr_gid != 30000 + n % NWRAP_STRESS_FILLER) {
+			stress_error(t, "getgrgid_r: %d", rc);
+		}
+		break;
+	case 4:
+		rc = gethostbyname_r("stress.example", &he, buf, sizeof(buf),
+				     &hep, &h_err);
+		if (rc != 0 || hep == NULL) {
+			stress_error(t, "gethostbyname_r: %d/%d", rc, h_err);
+			break;
+		}
+		check_host(t, hep);
+		break;
+	case 5:
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+		rc = getaddrinfo("stress.example", NULL, &hints, &ai);
+		if (rc != 0) {
+			stress_error(t, "getaddrinfo: %s", gai_strerror(rc));
+			break;
+		}
+		check_addrinfo(t, ai);
+		freeaddrinfo(ai);
+		break;
+	case 6:
+#if defined(HAVE_SHADOW_H) && defined(HAVE_GETSPNAM_R)
+		rc = getspnam_r("stress", &spwd, buf, sizeof(buf), &spwdp);
+		if (rc != 0 || spwdp == NULL) {
+			stress_error(t, "getspnam_r: %d", rc);
+			break;
+		}
+		check_shadow(t, spwdp);
+#endif
+		break;
+	}
+}
+
+/* Only the hosts lookups, they share the hosts database like the others */
+static void stress_lookup_hosts(struct stress_thread *t, unsigned n)
+{
+	struct hostent he;
+	struct hostent *hep;
+	char name[64];
+	char buf[4096];
+	unsigned i = n % NWRAP_STRESS_FILLER;
+	int h_err;
+	int rc;
+
+	switch (n % 4) {
+	case 0:
+		hep = gethostbyname("stress.example");
+		if (hep == NULL) {
+			stress_error(t, "gethostbyname: %d", h_errno);
+			break;
+		}
+		check_host(t, hep);
+		break;
+	case 1:
+		hep = gethostbyname2("stress.example", AF_INET);
+		if (hep == NULL) {
+			stress_error(t, "gethostbyname2: %d", h_errno);
+			break;
+		}
+		check_host(t, hep);
+		break;
+	case 2:
+		rc = gethostbyname_r("stress.example", &he, buf, sizeof(buf),
+				     &hep, &h_err);
+		if (rc != 0 || hep == NULL) {
+			stress_error(t, "gethostbyname_r: %d/%d", rc, h_err);
+			break;
+		}
+		check_host(t, hep);
+		break;
+	case 3:
+		/* The filler entries are the same in every version */
+		snprintf(name, sizeof(name), "filler%u.example", i);
+		rc = gethostbyname_r(name, &he, buf, sizeof(buf),
+				     &hep, &h_err);
+		if (rc != 0 || hep == NULL) {
+			stress_error(t, "gethostbyname_r %s: %d/%d",
+				     name, rc, h_err);
+			break;
+		}
+		if (strcmp(hep->h_name, name) != 0 ||
+		    hep->h_addr_list[0] == NULL ||
+		    (unsigned char)hep->h_addr_list[0][1] != 1 ||
+		    (unsigned char)hep->h_addr_list[0][3] != i % 250 + 1 ||
+		    hep->h_addr_list[1] != NULL) {
+			stress_error(t, "gethostbyname_r: %s for %s",
+				     hep->h_name, name);
+		}
+		break;
+	}
+}
+
+static void *stress_thread(void *arg)
+{
+	struct stress_thread *t = (struct stress_thread *)arg;
+	unsigned n = t->seed;
+
+	while (!STRESS_LOAD(stress_stop)) {
+		t->lookup(t, n++);
+		t->lookups++;
+	}
+
+	return NULL;
+}
+
+static unsigned long stress_run(struct stress_thread *threads, int num,
+				stress_lookup_fn lookup)
+{
+	unsigned long lookups = 0;
+	int i;
+	int rc;
+
+	STRESS_STORE(stress_stop, false);
+	for (i = 0; i < num; i++) {
+		memset(&threads[i], 0, sizeof(threads[i]));
+		threads[i].lookup = lookup;
+		threads[i].seed = i;
+		rc = pthread_create(&threads[i].thread, NULL,
+				    stress_thread, &threads[i]);
+		assert_int_equal(rc, 0);
+	}
+
+	usleep(NWRAP_STRESS_STEP_MS * 1000);
+	STRESS_STORE(stress_stop, true);
+
+	for (i = 0; i < num; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].errors > 0) {
+			fprintf(stderr, "thread %d: %lu errors, first: %s\n",
+				i, threads[i].errors, threads[i].error);
+		}
+		assert_int_equal(threads[i].errors, 0);
+		lookups += threads[i].lookups;
+	}
+
+	return lookups;
+}
+
+/* Doubles the number of threads while the writer replaces the files */
+static void stress_scale(stress_lookup_fn lookup)
+{
+	struct stress_thread threads[NWRAP_STRESS_MAX_THREADS];
+	unsigned long single = 0;
+	pthread_t writer;
+	int num;
+	int rc;
+
+	writer_versions = 0;
+	STRESS_STORE(writer_stop, false);
+	rc = pthread_create(&writer, NULL, writer_thread, NULL);
+	assert_int_equal(rc, 0);
+
+	printf("threads   lookups/s   speedup\n");
+	for (num = 1; num <= NWRAP_STRESS_MAX_THREADS; num *= 2) {
+		double start = nwrap_now_ms();
+		unsigned long lookups;
+		double rate;
+
+		lookups = stress_run(threads, num, lookup);
+		rate = lookups * 1000.0 / (nwrap_now_ms() - start);
+		if (num == 1) {
+			single = lookups;
+		}
+
+		printf("%7d %11.0f %9.2f\n",
+		       num, rate, single > 0 ? (double)lookups / single : 0.0);
+		assert_true(lookups > 0);
+	}
+
+	STRESS_STORE(writer_stop, true);
+	pthread_join(writer, NULL);
+
+	printf("%lu versions of the files were written\n", writer_versions);
+	assert_true(writer_versions > 1);
+}
+
+static void test_nwrap_stress_reload(void **state)
+{
+	(void) state; /* unused */
+
+	stress_scale(stress_lookup);
+}
+
+static void test_nwrap_stress_hosts(void **state)
+{
+	(void) state; /* unused */
+
+	stress_scale(stress_lookup_hosts);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_stress_reload),
+		cmocka_unit_test(test_nwrap_stress_hosts),
+	};
+
+	files.passwd = getenv("NSS_WRAPPER_PASSWD");
+	files.group = getenv("NSS_WRAPPER_GROUP");
+	files.hosts = getenv("NSS_WRAPPER_HOSTS");
+	files.shadow = getenv("NSS_WRAPPER_SHADOW");
+	if (files.passwd == NULL || files.group == NULL ||
+	    files.hosts == NULL || files.shadow == NULL) {
+		return 1;
+	}
+
+	/* The files have to exist before the first lookup */
+	if (!write_version(1)) {
+		return 1;
+	}
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
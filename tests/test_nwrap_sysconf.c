@@ -0,0 +1,138 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+unsigned long nss_wrapper_erange_retries(void);
+
+static void test_nwrap_sysconf_getpw_r_size_max(void **state)
+{
+	const char * const names[] = {
+		"bob", "alice", "nobody", "root", "member1", "member8",
+	};
+	unsigned long retries;
+	struct passwd pwd;
+	struct passwd *pwdp;
+	char *buf;
+	long size;
+	size_t i;
+	int rc;
+
+	(void) state; /* unused */
+
+	size = sysconf(_SC_GETPW_R_SIZE_MAX);
+	assert_true(size > 0);
+
+	/* Misalign the buffer on purpose */
+	buf = malloc(size + 1);
+	assert_non_null(buf);
+
+	retries = nss_wrapper_erange_retries();
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		rc = getpwnam_r(names[i], &pwd, buf + 1, size, &pwdp);
+		assert_int_equal(rc, 0);
+		assert_non_null(pwdp);
+		assert_string_equal(pwd.pw_name, names[i]);
+	}
+
+	assert_int_equal(nss_wrapper_erange_retries(), retries);
+
+	free(buf);
+}
+
+static void test_nwrap_sysconf_getgr_r_size_max(void **state)
+{
+	unsigned long retries;
+	struct group grp;
+	struct group *grpp;
+	char *buf;
+	long size;
+	int num = 0;
+	int rc;
+
+	(void) state; /* unused */
+
+	size = sysconf(_SC_GETGR_R_SIZE_MAX);
+	assert_true(size > 0);
+
+	buf = malloc(size + 1);
+	assert_non_null(buf);
+
+	retries = nss_wrapper_erange_retries();
+
+	rc = getgrnam_r("biggroup", &grp, buf + 1, size, &grpp);
+	assert_int_equal(rc, 0);
+	assert_non_null(grpp);
+	assert_string_equal(grp.gr_mem[10], "member8");
+	assert_null(grp.gr_mem[11]);
+
+	/* Every entry fits at the first try */
+	setgrent();
+	for (;;) {
+		rc = getgrent_r(&grp, buf + 1, size, &grpp);
+		if (rc != 0) {
+			break;
+		}
+		num++;
+	}
+	endgrent();
+	assert_int_equal(rc, ENOENT);
+	assert_true(num >= 5);
+
+	assert_int_equal(nss_wrapper_erange_retries(), retries);
+
+	free(buf);
+}
+
+static void test_nwrap_erange_retries(void **state)
+{
+	unsigned long retries;
+	struct passwd pwd;
+	struct passwd *pwdp;
+	struct group grp;
+	struct group *grpp;
+	char buf[4];
+	int rc;
+
+	(void) state; /* unused */
+
+	retries = nss_wrapper_erange_retries();
+
+	rc = getpwnam_r("bob", &pwd, buf, sizeof(buf), &pwdp);
+	assert_int_equal(rc, ERANGE);
+	assert_int_equal(nss_wrapper_erange_retries(), retries + 1);
+
+	rc = getgrgid_r(2000, &grp, buf, sizeof(buf), &grpp);
+	assert_int_equal(rc, ERANGE);
+	assert_int_equal(nss_wrapper_erange_retries(), retries + 2);
+
+	/* Unknown entries are no retries */
+	rc = getpwnam_r("nonexisting", &pwd, buf, sizeof(buf), &pwdp);
+	assert_int_not_equal(rc, ERANGE);
+	assert_int_equal(nss_wrapper_erange_retries(), retries + 2);
+}
+
+int main(void) {
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_sysconf_getpw_r_size_max),
+		cmocka_unit_test(test_nwrap_sysconf_getgr_r_size_max),
+		cmocka_unit_test(test_nwrap_erange_retries),
+	};
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
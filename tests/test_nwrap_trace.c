@@ -0,0 +1,242 @@
+#include "config.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include <errno.h>
+#include <pwd.h>
+#include <grp.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "../src/nss_wrapper_trace.h"
+
+/*
+ * A child process does the lookups, so the records are written when it
+ * exits. The parent checks them and replays them with nss_wrapper_replay.
+ */
+static char trace_path[1024];
+
+struct trace_record {
+	struct nwrap_trace_record rec;
+	char key[256];
+};
+
+static void *lookup_thread(void *arg)
+{
+	(void) arg; /* unused */
+
+	getpwnam("alice");
+
+	return NULL;
+}
+
+static void trace_child(void)
+{
+	struct group grp;
+	struct group *grpp = NULL;
+	pthread_t thread;
+	char buf[8];
+	int rc;
+
+	getpwnam("bob");
+	getpwnam("bob");
+	getpwuid(1001);
+
+	rc = getgrnam_r("users", &grp, buf, sizeof(buf), &grpp);
+	if (rc != ERANGE) {
+		_exit(1);
+	}
+
+	if (getpwnam("nonexisting") != NULL) {
+		_exit(1);
+	}
+
+	gethostbyname("magrathea.galaxy.site");
+
+	rc = pthread_create(&thread, NULL, lookup_thread, NULL);
+	if (rc != 0) {
+		_exit(1);
+	}
+	pthread_join(thread, NULL);
+
+	/* The records of the main thread are written by the destructor */
+	exit(0);
+}
+
+static size_t read_trace(struct trace_record *records, size_t max)
+{
+	struct nwrap_trace_header hdr;
+	size_t num = 0;
+	size_t n;
+	FILE *fp;
+
+	fp = fopen(trace_path, "r");
+	assert_non_null(fp);
+
+	n = fread(&hdr, sizeof(hdr), 1, fp);
+	assert_int_equal(n, 1);
+	assert_memory_equal(hdr.magic, NWRAP_TRACE_MAGIC, sizeof(hdr.magic));
+	assert_int_equal(hdr.version, NWRAP_TRACE_VERSION);
+	assert_int_equal(hdr.record_size, sizeof(struct nwrap_trace_record));
+	assert_true(hdr.realtime_ns > 0);
+
+	while (num < max &&
+	       fread(&records[num].rec, sizeof(records[num].rec), 1, fp) == 1) {
+		struct trace_record *r = &records[num];
+
+		assert_true(r->rec.key_len < sizeof(r->key));
+		n = fread(r->key, 1, r->rec.key_len, fp);
+		assert_int_equal(n, r->rec.key_len);
+		r->key[r->rec.key_len] = '\0';
+
+		/* The calls are timed on the same clock as the header */
+		assert_true(r->rec.time_ns >= hdr.monotonic_ns);
+		num++;
+	}
+	fclose(fp);
+
+	return num;
+}
+
+static const struct trace_record *find_record(const struct trace_record *records,
+					      size_t num,
+					      uint16_t fn,
+					      const char *key,
+					      size_t *count)
+{
+	const struct trace_record *found = NULL;
+	size_t i;
+
+	*count = 0;
+	for (i = 0; i < num; i++) {
+		if (records[i].rec.fn == fn &&
+		    strcmp(records[i].key, key) == 0) {
+			if (found == NULL) {
+				found = &records[i];
+			}
+			(*count)++;
+		}
+	}
+
+	return found;
+}
+
+static void test_nwrap_trace_record(void **state)
+{
+	struct trace_record records[64];
+	const struct trace_record *r;
+	uint32_t uid = 1001;
+	size_t count;
+	size_t num;
+	size_t i;
+	pid_t pid;
+	int status;
+
+	(void) state; /* unused */
+
+	pid = fork();
+	assert_true(pid >= 0);
+	if (pid == 0) {
+		trace_child();
+	}
+	assert_int_equal(waitpid(pid, &status, 0), pid);
+	assert_true(WIFEXITED(status));
+	assert_int_equal(WEXITSTATUS(status), 0);
+
+	num = read_trace(records, 64);
+	assert_int_equal(num, 7);
+
+	r = find_record(records, num, NWRAP_TRACE_GETPWNAM, "bob", &count);
+	assert_non_null(r);
+	assert_int_equal(count, 2);
+	assert_int_equal(r->rec.result, 0);
+	assert_int_equal(r->rec.pid, pid);
+	assert_int_equal(r->rec.thread, 1);
+
+	r = find_record(records, num, NWRAP_TRACE_GETPWNAM, "nonexisting",
+			&count);
+	assert_non_null(r);
+	assert_int_equal(r->rec.result, ENOENT);
+
+	r = find_record(records, num, NWRAP_TRACE_GETGRNAM_R, "users", &count);
+	assert_non_null(r);
+	assert_int_equal(r->rec.result, ERANGE);
+	assert_int_equal(r->rec.arg, 8);
+
+	r = find_record(records, num, NWRAP_TRACE_GETHOSTBYNAME,
+			"magrathea.galaxy.site", &count);
+	assert_non_null(r);
+	assert_int_equal(r->rec.result, 0);
+
+	/* The thread wrote its record when it exited, before the main one */
+	r = find_record(records, num, NWRAP_TRACE_GETPWNAM, "alice", &count);
+	assert_non_null(r);
+	assert_int_equal(r->rec.thread, 2);
+	assert_true(r == &records[0]);
+
+	for (i = 0; i < num; i++) {
+		if (records[i].rec.fn == NWRAP_TRACE_GETPWUID) {
+			assert_int_equal(records[i].rec.key_len, sizeof(uid));
+			assert_memory_equal(records[i].key, &uid, sizeof(uid));
+		}
+		assert_true(records[i].rec.time_ns > 0);
+	}
+}
+
+static void test_nwrap_trace_replay(void **state)
+{
+	const char *replay = getenv("NSS_WRAPPER_REPLAY");
+	char cmd[4096];
+	int rc;
+
+	(void) state; /* unused */
+
+	assert_non_null(replay);
+
+	/* Don't trace the shell */
+	unsetenv("NSS_WRAPPER_TRACE_FILE");
+
+	/* The replay gets the same results from the same files */
+	snprintf(cmd, sizeof(cmd), "%s -m -c %s >/dev/null", replay, trace_path);
+	rc = system(cmd);
+	assert_int_equal(rc, 0);
+
+	/* Nobody is found in an empty passwd file */
+	snprintf(cmd, sizeof(cmd), "%s -m -c -p /dev/null %s >/dev/null",
+		 replay, trace_path);
+	rc = system(cmd);
+	assert_true(WIFEXITED(rc));
+	assert_int_equal(WEXITSTATUS(rc), 2);
+}
+
+int main(void) {
+	const char *env;
+	int rc;
+
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_nwrap_trace_record),
+		cmocka_unit_test(test_nwrap_trace_replay),
+	};
+
+	env = getenv("NSS_WRAPPER_TRACE_FILE");
+	if (env == NULL) {
+		return 1;
+	}
+	snprintf(trace_path, sizeof(trace_path), "%s", env);
+	unlink(trace_path);
+
+	rc = cmocka_run_group_tests(tests, NULL, NULL);
+
+	return rc;
+}
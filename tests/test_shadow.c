@@ -5,6 +5,7 @@
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include <errno.h>
 #include <shadow.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -59,12 +60,81 @@ static void test_nwrap_getspnam(void **state)
 	assert_string_equal(encrypted_password, sp->sp_pwdp);
 }
 
+#ifdef HAVE_GETSPNAM_R
+static void test_nwrap_getspnam_r(void **state)
+{
+	struct spwd spwd;
+	struct spwd *sp;
+	char buf[256];
+	int rc;
+
+	(void)state; /* unused */
+
+	rc = getspnam_r("bob", &spwd, buf, sizeof(buf), &sp);
+	assert_int_equal(rc, 0);
+	assert_true(sp == &spwd);
+	assert_string_equal(sp->sp_namp, "bob");
+	assert_int_equal(sp->sp_lstchg, 2);
+	assert_int_equal(sp->sp_max, 99999);
+
+	/* The strings are stored in the buffer */
+	assert_true(sp->sp_namp >= buf && sp->sp_namp < buf + sizeof(buf));
+	assert_true(sp->sp_pwdp >= buf && sp->sp_pwdp < buf + sizeof(buf));
+
+	rc = getspnam_r("bob", &spwd, buf, 8, &sp);
+	assert_int_equal(rc, ERANGE);
+	assert_null(sp);
+
+	rc = getspnam_r("nobody", &spwd, buf, sizeof(buf), &sp);
+	assert_int_equal(rc, ENOENT);
+	assert_null(sp);
+}
+#endif /* HAVE_GETSPNAM_R */
+
+#if defined(HAVE_SETSPENT) && defined(HAVE_GETSPENT_R)
+static void test_nwrap_getspent_r(void **state)
+{
+	struct spwd spwd;
+	struct spwd *sp;
+	char buf[256];
+	int rc;
+
+	(void)state; /* unused */
+
+	setspent();
+
+	/* A too small buffer doesn't skip the entry */
+	rc = getspent_r(&spwd, buf, 8, &sp);
+	assert_int_equal(rc, ERANGE);
+
+	rc = getspent_r(&spwd, buf, sizeof(buf), &sp);
+	assert_int_equal(rc, 0);
+	assert_string_equal(sp->sp_namp, "alice");
+
+	rc = getspent_r(&spwd, buf, sizeof(buf), &sp);
+	assert_int_equal(rc, 0);
+	assert_string_equal(sp->sp_namp, "bob");
+
+	rc = getspent_r(&spwd, buf, sizeof(buf), &sp);
+	assert_int_equal(rc, ENOENT);
+	assert_null(sp);
+
+	endspent();
+}
+#endif /* HAVE_SETSPENT && HAVE_GETSPENT_R */
+
 int main(void) {
 	int rc;
 
 	const struct CMUnitTest tests[] = {
 		cmocka_unit_test(test_nwrap_getspent),
 		cmocka_unit_test(test_nwrap_getspnam),
+#ifdef HAVE_GETSPNAM_R
+		cmocka_unit_test(test_nwrap_getspnam_r),
+#endif
+#if defined(HAVE_SETSPENT) && defined(HAVE_GETSPENT_R)
+		cmocka_unit_test(test_nwrap_getspent_r),
+#endif
 	};
 
 	rc = cmocka_run_group_tests(tests, NULL, NULL);
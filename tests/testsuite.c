@@ -1012,6 +1012,49 @@ static void test_nwrap_duplicates(void **state)
 	test_nwrap_group_duplicates();
 }
 
+/* A result of getpwnam() survives the other lookups of the thread */
+static void test_nwrap_stable_results(void **state)
+{
+	struct passwd pwd, *pwdp;
+	struct passwd *alice;
+	struct passwd *bob;
+	struct group *users;
+	struct group *grp;
+	char buffer[1024];
+	int ret;
+
+	(void) state; /* unused */
+
+	alice = getpwnam("alice");
+	assert_non_null(alice);
+
+	bob = getpwuid(1000);
+	assert_non_null(bob);
+	assert_true(bob != alice);
+	assert_string_equal(bob->pw_name, "bob");
+
+	ret = getpwnam_r("bob", &pwd, buffer, sizeof(buffer), &pwdp);
+	assert_int_equal(ret, 0);
+	assert_non_null(pwdp);
+
+	users = getgrgid(1000);
+	assert_non_null(users);
+	assert_string_equal(users->gr_name, "users");
+
+	grp = getgrnam("biggroup");
+	assert_non_null(grp);
+	assert_true(grp != users);
+
+	assert_string_equal(alice->pw_name, "alice");
+	assert_int_equal(alice->pw_uid, 1001);
+	assert_string_equal(alice->pw_gecos, "alice gecos");
+	assert_string_equal(bob->pw_name, "bob");
+	assert_int_equal(bob->pw_uid, 1000);
+	assert_string_equal(users->gr_name, "users");
+	assert_int_equal(users->gr_gid, 1000);
+	assert_null(users->gr_mem[0]);
+}
+
 #ifndef OSX
 static void test_nwrap_small_buffer(void **state)
 {
@@ -1047,14 +1090,14 @@ static void test_nwrap_group_many_members_r(void **state)
 	assert_non_null(grpp);
 
 	for(int i=0; grp.gr_mem[i]; ++i) {
-		const char *val = members[0];
-                for (; val != NULL; ++val) {
-                        if (strcasecmp(val, grp.gr_mem[i]) == 0) {
+		const char **val = members;
+		for (; *val != NULL; ++val) {
+			if (strcasecmp(*val, grp.gr_mem[i]) == 0) {
 				++count;
-                                break;
-                        }
-                }
-		assert_non_null(val);
+				break;
+			}
+		}
+		assert_non_null(*val);
 	}
 	assert_int_equal(count, 11);
 }
@@ -1073,6 +1116,7 @@ int main(void) {
 		cmocka_unit_test(test_nwrap_membership),
 #endif
 		cmocka_unit_test(test_nwrap_duplicates),
+		cmocka_unit_test(test_nwrap_stable_results),
 #ifndef OSX
 		cmocka_unit_test(test_nwrap_small_buffer),
 		cmocka_unit_test(test_nwrap_group_many_members_r),